@@ -0,0 +1,269 @@
+#include "async_frame_source.hpp"
+#include "bench_stats.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s [--streams N] [--workers N] [--frames N] [--mode both|thread|coroutine]\n"
+            "                [--cancel-ms MS] [--backend NAME] input...\n"
+            "  --streams    concurrent streams, taking the inputs in turn (default 100)\n"
+            "  --workers    pool threads the coroutines share (default: one per hardware thread)\n"
+            "  --frames     frames decoded per stream, 0 for all (default 250)\n"
+            "  --mode       thread per stream, coroutines on the pool, or both (default)\n"
+            "  --cancel-ms  cancel every stream after MS and time how long they take to stop\n"
+            "  --backend    software (default), auto, or a hw device type\n",
+            argv0);
+}
+
+struct StreamResult
+{
+    int64_t     nFrames         = 0;
+    double      dFirstFrameMs   = 0.0;
+    int         ret             = 0;
+};
+
+struct ModeResult
+{
+    const char*     pszMode     = "";
+    unsigned        nThreads    = 0;
+    double          dWall       = 0.0;
+    double          dCpu        = 0.0;
+    double          dCancelMs   = 0.0;      // from cancel until every stream stopped
+    std::vector<StreamResult>   streams;
+};
+
+// Returns once nRemaining reaches zero. After nCancelMs, cancels first and
+// measures how long the streams take to stop.
+static void WaitOrCancel(const std::atomic<int>& nRemaining, int nCancelMs,
+                         const std::function<void()>& cancel, ModeResult* pResult)
+{
+    BenchClock::time_point tStart = BenchClock::now();
+    BenchClock::time_point tCancel;
+    bool bCancelled = false;
+
+    while (nRemaining.load(std::memory_order_acquire) > 0)
+    {
+        if (!bCancelled && nCancelMs > 0 && ElapsedSeconds(tStart, BenchClock::now()) * 1e3 >= nCancelMs)
+        {
+            tCancel = BenchClock::now();
+            cancel();
+            bCancelled = true;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    if (bCancelled)
+        pResult->dCancelMs = ElapsedSeconds(tCancel, BenchClock::now()) * 1e3;
+}
+
+static void DecodeOnThread(const std::string& strUrl, const DecoderOptions& options, int64_t nMaxFrames,
+                           BenchClock::time_point tStart, const std::atomic<bool>& bRun, StreamResult* pResult)
+{
+    VideoStream stream;
+    int ret = OpenStream(strUrl, &stream, options);
+    AVPacket* pPacket = ret >= 0 ? av_packet_alloc() : nullptr;
+    if (ret >= 0 && !pPacket)
+        ret = AVERROR(ENOMEM);
+
+    FrameCallback onFrame = [&](AVCodecContext*, AVFrame*)
+    {
+        if (pResult->nFrames++ == 0)
+            pResult->dFirstFrameMs = ElapsedSeconds(tStart, BenchClock::now()) * 1e3;
+        return (nMaxFrames > 0 && pResult->nFrames >= nMaxFrames) ? AVERROR_EOF : 0;
+    };
+
+    while (ret >= 0)
+    {
+        if (!bRun.load(std::memory_order_acquire))
+        {
+            ret = AVERROR_EXIT;
+            break;
+        }
+        if ((ret = av_read_frame(stream.pFormatContext, pPacket)) < 0)
+            break;
+        if (pPacket->stream_index == stream.iVideo)
+            ret = DecodeFrame(stream.pCodecCtx, pPacket, onFrame, nullptr, stream.pBackend.get());
+        av_packet_unref(pPacket);
+    }
+    if (ret == AVERROR_EOF && (nMaxFrames <= 0 || pResult->nFrames < nMaxFrames))
+        DecodeFrame(stream.pCodecCtx, NULL, onFrame, nullptr, stream.pBackend.get());
+
+    pResult->ret = ret;
+    av_packet_free(&pPacket);
+    CloseStream(&stream);
+}
+
+static void RunThreadPerStream(const std::vector<std::string>& urls, const DecoderOptions& options,
+                               int64_t nMaxFrames, int nCancelMs, ModeResult* pResult)
+{
+    std::atomic<bool> bRun{true};
+    std::atomic<int> nRemaining{static_cast<int>(urls.size())};
+    std::vector<std::thread> threads;
+    pResult->pszMode = "thread";
+    pResult->streams.assign(urls.size(), StreamResult());
+    pResult->nThreads = static_cast<unsigned>(urls.size());
+
+    double dCpuStart = ProcessCpuSeconds();
+    BenchClock::time_point tStart = BenchClock::now();
+    for (size_t i = 0; i < urls.size(); i++)
+    {
+        threads.emplace_back([&, i]()
+        {
+            DecodeOnThread(urls[i], options, nMaxFrames, tStart, bRun, &pResult->streams[i]);
+            nRemaining.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    WaitOrCancel(nRemaining, nCancelMs, [&]() { bRun.store(false, std::memory_order_release); }, pResult);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    pResult->dWall = ElapsedSeconds(tStart, BenchClock::now());
+    pResult->dCpu = ProcessCpuSeconds() - dCpuStart;
+}
+
+// Arguments are taken by value: they live in the coroutine frame.
+static AsyncTask ConsumeStream(AsyncFrameSource* pSource, std::string strUrl, DecoderOptions options,
+                               int64_t nMaxFrames, BenchClock::time_point tStart, StreamResult* pResult)
+{
+    int ret = co_await pSource->Open(strUrl, options);
+    while (ret >= 0)
+    {
+        if ((ret = co_await pSource->NextFrame()) < 0)
+            break;
+        if (pResult->nFrames++ == 0)
+            pResult->dFirstFrameMs = ElapsedSeconds(tStart, BenchClock::now()) * 1e3;
+        if (nMaxFrames > 0 && pResult->nFrames >= nMaxFrames)
+            ret = AVERROR_EOF;
+    }
+    pResult->ret = ret;
+    pSource->Close();
+}
+
+static void RunCoroutines(const std::vector<std::string>& urls, const DecoderOptions& options,
+                          int64_t nMaxFrames, int nCancelMs, unsigned nWorkers, ModeResult* pResult)
+{
+    WorkerPool pool(nWorkers);
+    CancellationSource cancel;
+    std::atomic<int> nRemaining{static_cast<int>(urls.size())};
+    std::vector<std::unique_ptr<AsyncFrameSource>> sources;
+    std::vector<AsyncTask> tasks;
+    pResult->pszMode = "coroutine";
+    pResult->streams.assign(urls.size(), StreamResult());
+    pResult->nThreads = pool.Size();
+
+    double dCpuStart = ProcessCpuSeconds();
+    BenchClock::time_point tStart = BenchClock::now();
+    for (size_t i = 0; i < urls.size(); i++)
+    {
+        sources.emplace_back(new AsyncFrameSource(&pool, cancel.Token()));
+        tasks.push_back(ConsumeStream(sources.back().get(), urls[i], options, nMaxFrames, tStart,
+                                      &pResult->streams[i]));
+        tasks.back().Start(&pool, [&]() { nRemaining.fetch_sub(1, std::memory_order_release); });
+    }
+
+    WaitOrCancel(nRemaining, nCancelMs, [&]() { cancel.Cancel(); }, pResult);
+    // The last resume of each task is still on its way out of the worker.
+    pool.Wait();
+
+    pResult->dWall = ElapsedSeconds(tStart, BenchClock::now());
+    pResult->dCpu = ProcessCpuSeconds() - dCpuStart;
+}
+
+static void PrintResult(ModeResult& result)
+{
+    int64_t nFrames = 0;
+    int nFailed = 0;
+    std::vector<double> firstFrame;
+    for (const StreamResult& stream : result.streams)
+    {
+        nFrames += stream.nFrames;
+        if (stream.nFrames > 0)
+            firstFrame.push_back(stream.dFirstFrameMs);
+        if (stream.ret < 0 && stream.ret != AVERROR_EOF && stream.ret != AVERROR_EXIT)
+            nFailed++;
+    }
+
+    printf("%-10s %8zu %8u %9lld %10.1f %9.2f %9.2f %8.2f %10.2f %7d\n",
+           result.pszMode, result.streams.size(), result.nThreads, (long long)nFrames,
+           result.dWall > 0 ? nFrames / result.dWall : 0.0,
+           Percentile(firstFrame, 50), Percentile(firstFrame, 99), result.dCpu, result.dCancelMs, nFailed);
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> inputs;
+    int nStreams = 100;
+    unsigned nWorkers = 0;
+    int64_t nMaxFrames = 250;
+    std::string strMode = "both";
+    int nCancelMs = 0;
+    DecoderOptions options;
+    // Hundreds of streams already oversubscribe the cores; decoder threads
+    // would only add to it, in both modes alike.
+    options.threading.mode = ThreadMode::None;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--streams") == 0 && i + 1 < argc)
+            nStreams = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+            nWorkers = static_cast<unsigned>(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            nMaxFrames = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+            strMode = argv[++i];
+        else if (strcmp(argv[i], "--cancel-ms") == 0 && i + 1 < argc)
+            nCancelMs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            options.strBackend = argv[++i];
+        else if (argv[i][0] != '-')
+            inputs.push_back(argv[i]);
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (inputs.empty() || nStreams < 1 || (strMode != "both" && strMode != "thread" && strMode != "coroutine"))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    std::vector<std::string> urls;
+    for (int i = 0; i < nStreams; i++)
+        urls.push_back(inputs[i % inputs.size()]);
+
+    std::vector<ModeResult> results;
+    if (strMode != "thread")
+    {
+        results.emplace_back();
+        RunCoroutines(urls, options, nMaxFrames, nCancelMs, nWorkers, &results.back());
+    }
+    if (strMode != "coroutine")
+    {
+        results.emplace_back();
+        RunThreadPerStream(urls, options, nMaxFrames, nCancelMs, &results.back());
+    }
+
+    printf("%-10s %8s %8s %9s %10s %9s %9s %8s %10s %7s\n", "mode", "streams", "threads", "frames",
+           "frames/s", "first p50", "first p99", "cpu s", "cancel ms", "failed");
+    for (ModeResult& result : results)
+        PrintResult(result);
+    printf("\n");
+    printf("peak rss:     %.1f MiB\n", PeakRssBytes() / (1024.0 * 1024.0));
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include "async_frame_source.hpp"
+#include "av_err2string.hpp"
+#include "stage_trace.hpp"
+
+#include <cstdio>
+
+AsyncTask& AsyncTask::operator=(AsyncTask&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (m_handle)
+            m_handle.destroy();
+        m_handle = other.m_handle;
+        other.m_handle = nullptr;
+    }
+    return *this;
+}
+
+AsyncTask::~AsyncTask()
+{
+    if (m_handle)
+        m_handle.destroy();
+}
+
+void AsyncTask::Start(WorkerPool* pPool, std::function<void()> onDone)
+{
+    m_handle.promise().onDone = std::move(onDone);
+    Handle handle = m_handle;
+    pPool->Submit([handle]() { handle.resume(); });
+}
+
+AsyncFrameSource::AsyncFrameSource(WorkerPool* pPool, CancellationToken token)
+    : m_pPool(pPool)
+    , m_token(std::move(token))
+{
+}
+
+AsyncFrameSource::~AsyncFrameSource()
+{
+    Close();
+}
+
+PoolAwaiter AsyncFrameSource::Open(const std::string& strUrl, const DecoderOptions& options)
+{
+    return PoolAwaiter(m_pPool, [this, strUrl, options]() { return DoOpen(strUrl, options); });
+}
+
+PoolAwaiter AsyncFrameSource::NextFrame()
+{
+    return PoolAwaiter(m_pPool, [this]() { return DecodeNext(); });
+}
+
+int AsyncFrameSource::InterruptCallback(void* opaque)
+{
+    return static_cast<const CancellationToken*>(opaque)->IsCancelled() ? 1 : 0;
+}
+
+int AsyncFrameSource::DoOpen(const std::string& strUrl, const DecoderOptions& options)
+{
+    int ret = 0;
+    if (m_token.IsCancelled())
+        return AVERROR_EXIT;
+
+    // libavformat polls the token while it waits on I/O, so cancelling
+    // also abandons a stalled open or read.
+    DecoderOptions opened = options;
+    opened.interrupt = { InterruptCallback, &m_token };
+    if ((ret = OpenStream(strUrl, &m_stream, opened)) < 0)
+        return ret;
+
+    if (!(m_pPacket = av_packet_alloc()) || !(m_pFrame = av_frame_alloc()))
+    {
+        Close();
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+int AsyncFrameSource::DecodeNext()
+{
+    int ret = 0;
+    m_pOut = nullptr;
+    if (!m_pFrame)
+        return AVERROR(EINVAL);
+    av_frame_unref(m_pFrame);
+
+    while (true)
+    {
+        if (m_token.IsCancelled())
+            return AVERROR_EXIT;
+
+        {
+            ScopedStage stage(TraceStage::ReceiveFrame);
+            ret = avcodec_receive_frame(m_stream.pCodecCtx, m_pFrame);
+        }
+        if (ret >= 0)
+            break;
+        if (ret != AVERROR(EAGAIN))
+            return ret;
+
+        // The decoder wants input: read only now, one packet at a time.
+        if ((ret = TracedReadFrame(m_stream.pFormatContext, m_pPacket)) < 0)
+        {
+            if (ret != AVERROR_EOF || m_bDraining)
+                return ret;
+            m_bDraining = true;
+            ret = avcodec_send_packet(m_stream.pCodecCtx, nullptr);
+        }
+        else
+        {
+            m_nPackets++;
+            if (m_pPacket->stream_index == m_stream.iVideo)
+            {
+                ScopedStage stage(TraceStage::SendPacket);
+                ret = avcodec_send_packet(m_stream.pCodecCtx, m_pPacket);
+            }
+            av_packet_unref(m_pPacket);
+        }
+        if (ret < 0)
+        {
+            fprintf(stderr, "Error during decoding: %s\n", av_err2str(ret));
+            return ret;
+        }
+    }
+
+    AVFrame* pOut = m_pFrame;
+    if (m_stream.pBackend && (ret = m_stream.pBackend->Deliver(m_pFrame, &pOut)) < 0)
+        return ret;
+    m_pOut = pOut;
+    return 0;
+}
+
+void AsyncFrameSource::Close()
+{
+    m_pOut = nullptr;
+    av_frame_free(&m_pFrame);
+    av_packet_free(&m_pPacket);
+    CloseStream(&m_stream);
+}
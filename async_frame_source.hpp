@@ -0,0 +1,174 @@
+#pragma once
+
+// C++20: only targets built with CXX_STANDARD 20 can include this header.
+
+#include "decoder.hpp"
+#include "worker_pool.hpp"
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+// Observes a CancellationSource. A default-constructed token is never
+// cancelled.
+class CancellationToken
+{
+public:
+    CancellationToken() = default;
+
+    bool    IsCancelled() const     { return m_pFlag && m_pFlag->load(std::memory_order_acquire); }
+
+private:
+    friend class CancellationSource;
+    explicit CancellationToken(std::shared_ptr<std::atomic<bool>> pFlag) : m_pFlag(std::move(pFlag)) {}
+
+    std::shared_ptr<std::atomic<bool>>  m_pFlag;
+};
+
+class CancellationSource
+{
+public:
+    CancellationSource() : m_pFlag(std::make_shared<std::atomic<bool>>(false)) {}
+
+    CancellationToken   Token() const   { return CancellationToken(m_pFlag); }
+    void                Cancel()        { m_pFlag->store(true, std::memory_order_release); }
+    bool                IsCancelled() const { return m_pFlag->load(std::memory_order_acquire); }
+
+private:
+    std::shared_ptr<std::atomic<bool>>  m_pFlag;
+};
+
+// co_await runs work as a WorkerPool task and resumes the awaiting
+// coroutine on that worker with its result, so a coroutine waiting for the
+// work holds no thread.
+class PoolAwaiter
+{
+public:
+    PoolAwaiter(WorkerPool* pPool, std::function<int()> work)
+        : m_pPool(pPool)
+        , m_work(std::move(work))
+    {
+    }
+
+    bool    await_ready() const noexcept    { return false; }
+    void    await_suspend(std::coroutine_handle<> handle)
+    {
+        // The awaiter lives in the coroutine frame, which the resumed
+        // coroutine may destroy, so nothing touches this after resume.
+        m_pPool->Submit([this, handle]()
+        {
+            m_ret = m_work();
+            handle.resume();
+        });
+    }
+    int     await_resume() const noexcept   { return m_ret; }
+
+private:
+    WorkerPool*             m_pPool;
+    std::function<int()>    m_work;
+    int                     m_ret = 0;
+};
+
+// Coroutine returning nothing that starts suspended. Start resumes it on a
+// pool worker; onDone runs on the worker that finishes it. The task must
+// outlive the coroutine.
+class AsyncTask
+{
+public:
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    struct FinalAwaiter
+    {
+        bool    await_ready() const noexcept    { return false; }
+        void    await_suspend(Handle handle) noexcept
+        {
+            if (handle.promise().onDone)
+                handle.promise().onDone();
+        }
+        void    await_resume() const noexcept   {}
+    };
+
+    struct promise_type
+    {
+        std::function<void()>   onDone;
+
+        AsyncTask               get_return_object()         { return AsyncTask(Handle::from_promise(*this)); }
+        std::suspend_always     initial_suspend() noexcept  { return {}; }
+        FinalAwaiter            final_suspend() noexcept    { return {}; }
+        void                    return_void()               {}
+        void                    unhandled_exception()       { std::terminate(); }
+    };
+
+    AsyncTask() = default;
+    AsyncTask(AsyncTask&& other) noexcept : m_handle(other.m_handle) { other.m_handle = nullptr; }
+    AsyncTask& operator=(AsyncTask&& other) noexcept;
+    ~AsyncTask();
+
+    AsyncTask(const AsyncTask&) = delete;
+    AsyncTask& operator=(const AsyncTask&) = delete;
+
+    void    Start(WorkerPool* pPool, std::function<void()> onDone);
+
+private:
+    explicit AsyncTask(Handle handle) : m_handle(handle) {}
+
+    Handle  m_handle;
+};
+
+// Pull-based decode of one video stream. Open and NextFrame are awaitable
+// and run as pool tasks, so many sources share a few threads. Demux follows
+// demand: packets are read only while NextFrame looks for a frame, so each
+// source holds at most one decoded frame and nothing piles up behind a slow
+// consumer. Once the token is cancelled, the current and later calls return
+// AVERROR_EXIT at the next packet.
+//
+// Both calls occupy a worker while they run. Open blocks on avformat_open_input
+// and the probe, NextFrame on av_read_frame and the decoder; a slow network
+// input holds its worker for as long as it stalls. The token is installed as
+// the format context's interrupt callback, so cancelling makes blocked I/O
+// return AVERROR_EXIT too. Decoding itself cannot be interrupted, only
+// stopped between packets. options.interrupt is replaced by the token's.
+class AsyncFrameSource
+{
+public:
+    AsyncFrameSource(WorkerPool* pPool, CancellationToken token = CancellationToken());
+    ~AsyncFrameSource();
+
+    AsyncFrameSource(const AsyncFrameSource&) = delete;
+    AsyncFrameSource& operator=(const AsyncFrameSource&) = delete;
+
+    PoolAwaiter         Open(const std::string& strUrl, const DecoderOptions& options = DecoderOptions());
+    // Resolves to 0 with Frame() set, AVERROR_EOF after the last frame, or
+    // another AVERROR. Frame() stays valid until the next call.
+    PoolAwaiter         NextFrame();
+    AVFrame*            Frame() const       { return m_pOut; }
+    void                Close();
+
+    const VideoStream&  Stream() const      { return m_stream; }
+    int64_t             PacketsRead() const { return m_nPackets; }
+
+private:
+    static int          InterruptCallback(void* opaque);
+    int                 DoOpen(const std::string& strUrl, const DecoderOptions& options);
+    int                 DecodeNext();
+
+    WorkerPool*         m_pPool;
+    CancellationToken   m_token;
+    VideoStream         m_stream;
+    AVPacket*           m_pPacket   = nullptr;
+    AVFrame*            m_pFrame    = nullptr;
+    AVFrame*            m_pOut      = nullptr;
+    bool                m_bDraining = false;
+    int64_t             m_nPackets  = 0;
+};
@@ -0,0 +1,97 @@
+#include "audio_output.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+extern "C"
+{
+#include <libavutil/avutil.h>
+}
+
+WavFileAudioOutput::~WavFileAudioOutput()
+{
+    Close();
+}
+
+static void PutLE16(uint8_t* p, uint16_t v)
+{
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+}
+
+static void PutLE32(uint8_t* p, uint32_t v)
+{
+    PutLE16(p, static_cast<uint16_t>(v));
+    PutLE16(p + 2, static_cast<uint16_t>(v >> 16));
+}
+
+int WavFileAudioOutput::WriteHeader(uint32_t nDataBytes)
+{
+    const bool bFloat = m_format.sampleFormat == AV_SAMPLE_FMT_FLT;
+    const int nBytesPerSample = av_get_bytes_per_sample(m_format.sampleFormat);
+
+    uint8_t header[44];
+    memcpy(header, "RIFF", 4);
+    PutLE32(header + 4, 36 + nDataBytes);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    PutLE32(header + 16, 16);
+    PutLE16(header + 20, bFloat ? 3 : 1);
+    PutLE16(header + 22, static_cast<uint16_t>(m_format.nChannels));
+    PutLE32(header + 24, static_cast<uint32_t>(m_format.nSampleRate));
+    PutLE32(header + 28, static_cast<uint32_t>(m_format.nSampleRate * m_format.BytesPerFrame()));
+    PutLE16(header + 32, static_cast<uint16_t>(m_format.BytesPerFrame()));
+    PutLE16(header + 34, static_cast<uint16_t>(nBytesPerSample * 8));
+    memcpy(header + 36, "data", 4);
+    PutLE32(header + 40, nDataBytes);
+
+    return fwrite(header, sizeof(header), 1, m_fp) == 1 ? 0 : AVERROR(EIO);
+}
+
+int WavFileAudioOutput::Open(const AudioFormat& format)
+{
+    // WAV only carries packed integer or float PCM.
+    if (format.sampleFormat != AV_SAMPLE_FMT_U8 && format.sampleFormat != AV_SAMPLE_FMT_S16 &&
+        format.sampleFormat != AV_SAMPLE_FMT_S32 && format.sampleFormat != AV_SAMPLE_FMT_FLT)
+        return AVERROR(EINVAL);
+
+    m_format = format;
+    m_nDataBytes = 0;
+    if (!(m_fp = fopen(m_strPath.c_str(), "wb")))
+        return AVERROR(errno);
+    return WriteHeader(0);
+}
+
+int WavFileAudioOutput::Write(const uint8_t* pData, size_t nFrames)
+{
+    const size_t nBytes = nFrames * m_format.BytesPerFrame();
+    if (!m_fp || fwrite(pData, 1, nBytes, m_fp) != nBytes)
+        return AVERROR(EIO);
+    m_nDataBytes += nBytes;
+    return 0;
+}
+
+void WavFileAudioOutput::Close()
+{
+    if (!m_fp)
+        return;
+
+    if (fseek(m_fp, 0, SEEK_SET) == 0)
+        WriteHeader(static_cast<uint32_t>(std::min<uint64_t>(m_nDataBytes, UINT32_MAX - 36)));
+    fclose(m_fp);
+    m_fp = nullptr;
+}
+
+int CreateAudioOutput(const std::string& strSpec, std::unique_ptr<AudioOutput>* ppOutput)
+{
+    if (strSpec == "null")
+        ppOutput->reset(new NullAudioOutput());
+    else if (strSpec.compare(0, 4, "wav:") == 0 && strSpec.size() > 4)
+        ppOutput->reset(new WavFileAudioOutput(strSpec.substr(4)));
+    else
+    {
+        fprintf(stderr, "unknown audio output %s\n", strSpec.c_str());
+        return AVERROR(EINVAL);
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+extern "C"
+{
+#include <libavutil/samplefmt.h>
+}
+
+// Interleaved format everything after swresample runs in.
+struct AudioFormat
+{
+    int             nSampleRate     = 48000;
+    int             nChannels       = 2;
+    AVSampleFormat  sampleFormat    = AV_SAMPLE_FMT_S16;
+
+    int             BytesPerFrame() const { return nChannels * av_get_bytes_per_sample(sampleFormat); }
+};
+
+// Where the audio output thread sends what it drains from the ring, one
+// period at a time.
+class AudioOutput
+{
+public:
+    virtual ~AudioOutput() = default;
+
+    virtual const char*     Name() const = 0;
+    virtual int             Open(const AudioFormat& format) = 0;
+    virtual int             Write(const uint8_t* pData, size_t nFrames) = 0;
+    virtual void            Close() {}
+};
+
+class NullAudioOutput : public AudioOutput
+{
+public:
+    const char*     Name() const override   { return "null"; }
+    int             Open(const AudioFormat&) override { return 0; }
+    int             Write(const uint8_t*, size_t) override { return 0; }
+};
+
+// PCM WAV file; the sizes in the header are filled in on Close.
+class WavFileAudioOutput : public AudioOutput
+{
+public:
+    explicit WavFileAudioOutput(const std::string& strPath) : m_strPath(strPath) {}
+    ~WavFileAudioOutput() override;
+
+    const char*     Name() const override   { return "wav"; }
+    int             Open(const AudioFormat& format) override;
+    int             Write(const uint8_t* pData, size_t nFrames) override;
+    void            Close() override;
+
+private:
+    int             WriteHeader(uint32_t nDataBytes);
+
+    std::string     m_strPath;
+    AudioFormat     m_format;
+    FILE*           m_fp            = nullptr;
+    uint64_t        m_nDataBytes    = 0;
+};
+
+// "null" or "wav:PATH".
+int     CreateAudioOutput(const std::string& strSpec, std::unique_ptr<AudioOutput>* ppOutput);
@@ -0,0 +1,405 @@
+#include "audio_pipeline.hpp"
+#include "av_err2string.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+extern "C"
+{
+#include <libswresample/swresample.h>
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t kMarks = 256;
+
+static int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+AudioPipeline::~AudioPipeline()
+{
+    Stop();
+    Close();
+}
+
+int AudioPipeline::Open(AVFormatContext* pFormatContext, int iStream, AudioOutput* pOutput,
+                        const AudioPipelineOptions& options)
+{
+    int ret = 0;
+    AVStream* pStream = pFormatContext->streams[iStream];
+
+    const AVCodec* pCodec = avcodec_find_decoder(pStream->codecpar->codec_id);
+    if (!pCodec)
+    {
+        fprintf(stderr, "avcodec_find_decoder: no decoder for %s\n", avcodec_get_name(pStream->codecpar->codec_id));
+        return AVERROR_DECODER_NOT_FOUND;
+    }
+    if (!(m_pCodecCtx = avcodec_alloc_context3(pCodec)))
+        return AVERROR(ENOMEM);
+    if ((ret = avcodec_parameters_to_context(m_pCodecCtx, pStream->codecpar)) < 0 ||
+        (ret = avcodec_open2(m_pCodecCtx, pCodec, nullptr)) < 0)
+    {
+        fprintf(stderr, "audio decoder: %s\n", av_err2str(ret));
+        Close();
+        return ret;
+    }
+    m_pCodecCtx->pkt_timebase = pStream->time_base;
+    m_timeBase = pStream->time_base;
+
+    m_options = options;
+    m_pOutput = pOutput;
+
+    const AudioFormat& format = options.format;
+    const size_t nRingFrames = static_cast<size_t>(format.nSampleRate) * options.nRingMs / 1000;
+    if ((ret = m_ring.Init(std::max<size_t>(nRingFrames, 1), format.BytesPerFrame())) < 0 ||
+        (ret = m_pOutput->Open(format)) < 0)
+    {
+        fprintf(stderr, "audio output %s: %s\n", m_pOutput->Name(), av_err2str(ret));
+        Close();
+        return ret;
+    }
+
+    m_marks.assign(kMarks, LatencyMark());
+    return 0;
+}
+
+void AudioPipeline::Close()
+{
+    swr_free(&m_pSwr);
+    av_channel_layout_uninit(&m_inLayout);
+    avcodec_free_context(&m_pCodecCtx);
+    if (m_pOutput)
+        m_pOutput->Close();
+    m_pOutput = nullptr;
+}
+
+int AudioPipeline::Start(PacketQueue* pQueue)
+{
+    if (!m_pCodecCtx || m_decodeThread.joinable())
+        return AVERROR(EINVAL);
+
+    m_pQueue = pQueue;
+    m_bAbort.store(false, std::memory_order_relaxed);
+    m_bFinished.store(false, std::memory_order_relaxed);
+    m_decodeThread = std::thread(&AudioPipeline::DecodeLoop, this);
+    m_outputThread = std::thread(&AudioPipeline::OutputLoop, this);
+    return 0;
+}
+
+void AudioPipeline::Join()
+{
+    if (m_decodeThread.joinable())
+        m_decodeThread.join();
+    if (m_outputThread.joinable())
+        m_outputThread.join();
+    m_pQueue = nullptr;
+}
+
+void AudioPipeline::Stop()
+{
+    m_bAbort.store(true, std::memory_order_release);
+    if (m_pQueue)
+        m_pQueue->Abort();
+    Join();
+}
+
+void AudioPipeline::Fail(int ret)
+{
+    int expected = 0;
+    m_ret.compare_exchange_strong(expected, ret, std::memory_order_acq_rel);
+    m_bAbort.store(true, std::memory_order_release);
+    // As in Stop: the demuxer must not block on a queue nobody drains, or
+    // it never gets to close the other streams' queues.
+    if (m_pQueue)
+        m_pQueue->Abort();
+    m_ring.Close();
+}
+
+double AudioPipeline::ClockSeconds() const
+{
+    if (!m_bHaveStartPts.load(std::memory_order_acquire))
+        return 0.0;
+    return m_dStartPts.load(std::memory_order_relaxed) +
+           double(m_nPlayed.load(std::memory_order_acquire)) / m_options.format.nSampleRate;
+}
+
+double AudioPipeline::BufferedMs() const
+{
+    return m_ring.Available() * 1e3 / m_options.format.nSampleRate;
+}
+
+AudioStats AudioPipeline::Stats() const
+{
+    AudioStats stats;
+    stats.nFramesDecoded    = m_ring.TotalWritten();
+    stats.nFramesPlayed     = m_nPlayed.load(std::memory_order_acquire);
+    stats.nUnderruns        = m_nUnderruns;
+    stats.nUnderrunFrames   = m_nUnderrunFrames;
+    stats.nOverruns         = m_nOverruns;
+    stats.dOverrunSeconds   = m_nOverrunNs * 1e-9;
+    stats.latency           = m_latency;
+    return stats;
+}
+
+int AudioPipeline::ConfigureResampler(const AVFrame* frame)
+{
+    if (m_pSwr && frame->format == m_inFormat && frame->sample_rate == m_inRate &&
+        av_channel_layout_compare(&frame->ch_layout, &m_inLayout) == 0)
+        return 0;
+
+    // Streams that do not say which channels they carry get the default
+    // layout for their channel count.
+    AVChannelLayout inLayout = {};
+    int ret = 0;
+    if (frame->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC)
+        av_channel_layout_default(&inLayout, frame->ch_layout.nb_channels);
+    else if ((ret = av_channel_layout_copy(&inLayout, &frame->ch_layout)) < 0)
+        return ret;
+
+    AVChannelLayout outLayout = {};
+    av_channel_layout_default(&outLayout, m_options.format.nChannels);
+
+    swr_free(&m_pSwr);
+    ret = swr_alloc_set_opts2(&m_pSwr, &outLayout, m_options.format.sampleFormat, m_options.format.nSampleRate,
+                              &inLayout, static_cast<AVSampleFormat>(frame->format), frame->sample_rate, 0, nullptr);
+    if (ret >= 0)
+        ret = swr_init(m_pSwr);
+    av_channel_layout_uninit(&inLayout);
+    av_channel_layout_uninit(&outLayout);
+    if (ret < 0)
+    {
+        fprintf(stderr, "swr_init: %s\n", av_err2str(ret));
+        swr_free(&m_pSwr);
+        return ret;
+    }
+
+    av_channel_layout_uninit(&m_inLayout);
+    av_channel_layout_copy(&m_inLayout, &frame->ch_layout);
+    m_inRate = frame->sample_rate;
+    m_inFormat = frame->format;
+    return 0;
+}
+
+int AudioPipeline::WriteRing(const uint8_t* pData, size_t nFrames, int64_t tNs)
+{
+    const int nBytesPerFrame = m_options.format.BytesPerFrame();
+    int64_t tStall = 0;
+
+    while (nFrames > 0)
+    {
+        size_t n = m_ring.Write(pData, nFrames);
+        pData += n * nBytesPerFrame;
+        nFrames -= n;
+        if (nFrames == 0)
+            break;
+
+        if (m_bAbort.load(std::memory_order_acquire))
+            return AVERROR_EXIT;
+        if (tStall == 0)
+        {
+            m_nOverruns++;
+            tStall = NowNs();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (tStall != 0)
+        m_nOverrunNs += NowNs() - tStall;
+
+    // Latency is sampled; a full mark ring just skips this chunk.
+    const size_t nTail = m_nMarkTail.load(std::memory_order_relaxed);
+    if (nTail - m_nMarkHead.load(std::memory_order_acquire) < m_marks.size())
+    {
+        m_marks[nTail % m_marks.size()] = { m_ring.TotalWritten(), tNs };
+        m_nMarkTail.store(nTail + 1, std::memory_order_release);
+    }
+    return 0;
+}
+
+int AudioPipeline::Convert(const AVFrame* frame, int64_t tNs)
+{
+    int ret = 0;
+    if (frame && (ret = ConfigureResampler(frame)) < 0)
+        return ret;
+    if (!m_pSwr)
+        return 0;
+
+    // A null frame flushes what the resampler still holds.
+    const int nOut = swr_get_out_samples(m_pSwr, frame ? frame->nb_samples : 0);
+    if (nOut <= 0)
+        return nOut;
+    m_converted.resize(static_cast<size_t>(nOut) * m_options.format.BytesPerFrame());
+
+    uint8_t* out[1] = { m_converted.data() };
+    int n = swr_convert(m_pSwr, out, nOut,
+                        frame ? const_cast<const uint8_t**>(frame->extended_data) : nullptr,
+                        frame ? frame->nb_samples : 0);
+    if (n < 0)
+    {
+        fprintf(stderr, "swr_convert: %s\n", av_err2str(n));
+        return n;
+    }
+    return WriteRing(m_converted.data(), static_cast<size_t>(n), tNs);
+}
+
+int AudioPipeline::ReceiveFrames(int64_t tNs)
+{
+    AVFrame* frame = av_frame_alloc();
+    if (!frame)
+        return AVERROR(ENOMEM);
+
+    int ret = 0;
+    while ((ret = avcodec_receive_frame(m_pCodecCtx, frame)) >= 0)
+    {
+        if (!m_bHaveStartPts.load(std::memory_order_relaxed) && frame->best_effort_timestamp != AV_NOPTS_VALUE)
+        {
+            m_dStartPts.store(frame->best_effort_timestamp * av_q2d(m_timeBase), std::memory_order_relaxed);
+            m_bHaveStartPts.store(true, std::memory_order_release);
+        }
+        ret = Convert(frame, tNs);
+        av_frame_unref(frame);
+        if (ret < 0)
+            break;
+    }
+    av_frame_free(&frame);
+
+    return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+
+void AudioPipeline::DecodeLoop()
+{
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+    {
+        Fail(AVERROR(ENOMEM));
+        m_ring.Close();
+        return;
+    }
+
+    int ret = 0;
+    while ((ret = m_pQueue->Pop(pPacket)) >= 0)
+    {
+        const int64_t tNs = NowNs();
+        ret = avcodec_send_packet(m_pCodecCtx, pPacket);
+        av_packet_unref(pPacket);
+        // A damaged packet costs a gap, not the stream.
+        if (ret < 0 && ret != AVERROR_INVALIDDATA)
+            break;
+        if ((ret = ReceiveFrames(tNs)) < 0)
+            break;
+    }
+
+    if (ret == AVERROR_EOF)
+    {
+        const int64_t tNs = NowNs();
+        avcodec_send_packet(m_pCodecCtx, nullptr);
+        if ((ret = ReceiveFrames(tNs)) >= 0)
+            ret = Convert(nullptr, tNs);
+    }
+    if (ret < 0 && ret != AVERROR_EOF && ret != AVERROR_EXIT)
+    {
+        fprintf(stderr, "audio decode: %s\n", av_err2str(ret));
+        Fail(ret);
+    }
+
+    av_packet_free(&pPacket);
+    m_ring.Close();
+}
+
+void AudioPipeline::OutputLoop()
+{
+    const AudioFormat& format = m_options.format;
+    const size_t nPeriod = std::max<size_t>(1, static_cast<size_t>(format.nSampleRate) * m_options.nPeriodMs / 1000);
+    const size_t nPrebuffer = std::min(m_ring.Capacity(),
+                                       static_cast<size_t>(format.nSampleRate) * m_options.nPrebufferMs / 1000);
+    const int nBytesPerFrame = format.BytesPerFrame();
+    const uint8_t silence = format.sampleFormat == AV_SAMPLE_FMT_U8 ? 0x80 : 0;
+    std::vector<uint8_t> buffer(nPeriod * nBytesPerFrame);
+
+    while (m_ring.Available() < nPrebuffer && !m_ring.Closed() && !m_bAbort.load(std::memory_order_acquire))
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    const Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(double(nPeriod) / format.nSampleRate));
+    Clock::time_point tNext = Clock::now();
+
+    while (!m_bAbort.load(std::memory_order_acquire))
+    {
+        if (m_options.bRealtime)
+        {
+            tNext += period;
+            std::this_thread::sleep_until(tNext);
+        }
+
+        // Closed is read before draining so a final write is not missed.
+        const bool bClosed = m_ring.Closed();
+        size_t n = m_ring.Read(buffer.data(), nPeriod);
+        size_t nWrite = n;
+
+        if (n < nPeriod && !bClosed)
+        {
+            if (!m_options.bRealtime)
+            {
+                if (n == 0)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    continue;
+                }
+            }
+            else
+            {
+                // A device would play silence; so does the output.
+                m_nUnderruns++;
+                m_nUnderrunFrames += nPeriod - n;
+                memset(buffer.data() + n * nBytesPerFrame, silence, (nPeriod - n) * nBytesPerFrame);
+                nWrite = nPeriod;
+            }
+        }
+
+        if (nWrite > 0)
+        {
+            int ret = m_pOutput->Write(buffer.data(), nWrite);
+            if (ret < 0)
+            {
+                fprintf(stderr, "audio output %s: %s\n", m_pOutput->Name(), av_err2str(ret));
+                Fail(ret);
+                break;
+            }
+        }
+        m_nPlayed.fetch_add(n, std::memory_order_release);
+
+        const uint64_t nRead = m_ring.TotalRead();
+        const int64_t tNow = NowNs();
+        size_t nHead = m_nMarkHead.load(std::memory_order_relaxed);
+        while (nHead != m_nMarkTail.load(std::memory_order_acquire) && m_marks[nHead % m_marks.size()].nFrameEnd <= nRead)
+        {
+            m_latency.Add((tNow - m_marks[nHead % m_marks.size()].tNs) * 1e-9);
+            nHead++;
+        }
+        m_nMarkHead.store(nHead, std::memory_order_release);
+
+        if (bClosed && m_ring.Available() == 0)
+            break;
+    }
+
+    m_bFinished.store(true, std::memory_order_release);
+}
+
+double AudioMasterClock::Now() const
+{
+    return m_pAudio->ClockSeconds();
+}
+
+void AudioMasterClock::SleepUntil(double dTime)
+{
+    while (!m_pAudio->Finished())
+    {
+        double dWait = dTime - m_pAudio->ClockSeconds();
+        if (dWait <= 0)
+            break;
+        std::this_thread::sleep_for(std::chrono::duration<double>(std::min(dWait, 0.005)));
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "audio_output.hpp"
+#include "bench_stats.hpp"
+#include "packet_queue.hpp"
+#include "presentation_clock.hpp"
+#include "sample_ring.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+struct SwrContext;
+
+struct AudioPipelineOptions
+{
+    AudioFormat     format;
+    int             nRingMs         = 200;      // SampleRing capacity
+    int             nPeriodMs       = 10;       // frames the output takes at a time
+    int             nPrebufferMs    = 100;      // queued before the output starts
+    // Drain at the sample rate like a device would. Without it the output
+    // takes whatever is there, so file dumps run as fast as decoding.
+    bool            bRealtime       = true;
+};
+
+struct AudioStats
+{
+    uint64_t            nFramesDecoded      = 0;    // after resampling
+    uint64_t            nFramesPlayed       = 0;
+    uint64_t            nUnderruns          = 0;    // periods the ring could not fill
+    uint64_t            nUnderrunFrames     = 0;    // silence inserted for them
+    uint64_t            nOverruns           = 0;    // writes that found the ring full
+    double              dOverrunSeconds     = 0.0;  // the decoder spent waiting for room
+    LatencyHistogram    latency;                    // packet decoded -> played
+};
+
+// Decodes one audio stream on its own thread, converts it with swresample
+// to a fixed interleaved format and writes it into a SampleRing; a second
+// thread drains the ring into an AudioOutput one period at a time. Frames
+// the output has taken are the audio clock.
+class AudioPipeline
+{
+public:
+    AudioPipeline() = default;
+    ~AudioPipeline();
+
+    AudioPipeline(const AudioPipeline&) = delete;
+    AudioPipeline& operator=(const AudioPipeline&) = delete;
+
+    int         Open(AVFormatContext* pFormatContext, int iStream, AudioOutput* pOutput,
+                     const AudioPipelineOptions& options = AudioPipelineOptions());
+    // Starts decoding packets from pQueue, which the demuxer fills.
+    int         Start(PacketQueue* pQueue);
+    // Waits for the queue to end and the ring to drain.
+    void        Join();
+    // Aborts the queue and both threads.
+    void        Stop();
+    void        Close();
+
+    // Media time of the last frame the output took, in seconds.
+    double      ClockSeconds() const;
+    bool        Finished() const    { return m_bFinished.load(std::memory_order_acquire); }
+    int         Result() const      { return m_ret.load(std::memory_order_acquire); }
+    // Ring fill level in milliseconds.
+    double      BufferedMs() const;
+
+    // Complete once Join or Stop returned.
+    AudioStats  Stats() const;
+
+private:
+    struct LatencyMark
+    {
+        uint64_t    nFrameEnd;      // ring write position after the chunk
+        int64_t     tNs;            // when its packet was taken off the queue
+    };
+
+    void        DecodeLoop();
+    void        OutputLoop();
+    int         ReceiveFrames(int64_t tNs);
+    int         ConfigureResampler(const AVFrame* frame);
+    int         Convert(const AVFrame* frame, int64_t tNs);
+    int         WriteRing(const uint8_t* pData, size_t nFrames, int64_t tNs);
+    void        Fail(int ret);
+
+    AVCodecContext*             m_pCodecCtx     = nullptr;
+    SwrContext*                 m_pSwr          = nullptr;
+    AVChannelLayout             m_inLayout      = {};
+    int                         m_inRate        = 0;
+    int                         m_inFormat      = -1;
+    AVRational                  m_timeBase      = { 0, 1 };
+    AudioPipelineOptions        m_options;
+    AudioOutput*                m_pOutput       = nullptr;
+    PacketQueue*                m_pQueue        = nullptr;
+    SampleRing                  m_ring;
+    std::vector<uint8_t>        m_converted;
+
+    std::thread                 m_decodeThread;
+    std::thread                 m_outputThread;
+    std::atomic<bool>           m_bAbort{false};
+    std::atomic<bool>           m_bFinished{false};
+    std::atomic<int>            m_ret{0};
+    std::atomic<double>         m_dStartPts{0.0};
+    std::atomic<bool>           m_bHaveStartPts{false};
+    std::atomic<uint64_t>       m_nPlayed{0};
+
+    std::vector<LatencyMark>    m_marks;
+    std::atomic<size_t>         m_nMarkHead{0};     // consumer
+    std::atomic<size_t>         m_nMarkTail{0};     // producer
+
+    uint64_t                    m_nOverruns         = 0;
+    int64_t                     m_nOverrunNs        = 0;
+    uint64_t                    m_nUnderruns        = 0;
+    uint64_t                    m_nUnderrunFrames   = 0;
+    LatencyHistogram            m_latency;
+};
+
+// Audio master clock for FrameScheduler: now is the media time being played.
+// It stands still while audio underruns; once audio has finished it stops
+// holding anything back.
+class AudioMasterClock : public PresentationClock
+{
+public:
+    explicit AudioMasterClock(const AudioPipeline* pAudio) : m_pAudio(pAudio) {}
+
+    double  Now() const override;
+    void    SleepUntil(double dTime) override;
+
+private:
+    const AudioPipeline*    m_pAudio;
+};
@@ -0,0 +1,273 @@
+#include "decoder.hpp"
+#include "audio_pipeline.hpp"
+#include "bench_stats.hpp"
+#include "demux_thread.hpp"
+#include "frame_scheduler.hpp"
+#include "packet_fanout.hpp"
+#include "packet_queue.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <input> [--audio-out null|wav:PATH] [--no-video] [--no-realtime] [--rate HZ]\n"
+            "                [--channels N] [--float] [--ring-ms MS] [--period-ms MS] [--prebuffer-ms MS]\n"
+            "                [--threads MODE[:N]] [--backend NAME] [--record PATH]... [--record-format NAME]\n"
+            "                [--segment-seconds S]\n"
+            "  --audio-out     where resampled audio goes (default null)\n"
+            "  --no-video      play the audio stream only\n"
+            "  --no-realtime   drain audio as fast as it decodes instead of at the sample rate\n"
+            "  --rate          output sample rate (default 48000)\n"
+            "  --channels      output channels (default 2)\n"
+            "  --float         output 32-bit float instead of 16-bit samples\n"
+            "  --ring-ms       sample ring capacity (default 200)\n"
+            "  --period-ms     frames the output takes at a time (default 10)\n"
+            "  --prebuffer-ms  audio queued before playback starts (default 100)\n"
+            "  --record        also stream-copy the input to PATH while it plays; may be repeated\n"
+            "  --record-format muxer for the recordings (default: from the path)\n"
+            "  --segment-seconds  split recordings into segments, PATH being a pattern like rec%%03d.ts\n",
+            argv0);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strUrl;
+    std::string strAudioOut = "null";
+    bool bVideo = true;
+    AudioPipelineOptions audioOptions;
+    DecoderOptions options;
+    std::vector<std::string> recordings;
+    RemuxSinkOptions recordOptions;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--audio-out") == 0 && i + 1 < argc)
+            strAudioOut = argv[++i];
+        else if (strcmp(argv[i], "--no-video") == 0)
+            bVideo = false;
+        else if (strcmp(argv[i], "--no-realtime") == 0)
+            audioOptions.bRealtime = false;
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+            audioOptions.format.nSampleRate = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--channels") == 0 && i + 1 < argc)
+            audioOptions.format.nChannels = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--float") == 0)
+            audioOptions.format.sampleFormat = AV_SAMPLE_FMT_FLT;
+        else if (strcmp(argv[i], "--ring-ms") == 0 && i + 1 < argc)
+            audioOptions.nRingMs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--period-ms") == 0 && i + 1 < argc)
+            audioOptions.nPeriodMs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--prebuffer-ms") == 0 && i + 1 < argc)
+            audioOptions.nPrebufferMs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (ParseThreadingConfig(argv[++i], &options.threading) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            options.strBackend = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            recordings.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--record-format") == 0 && i + 1 < argc)
+            recordOptions.strFormat = argv[++i];
+        else if (strcmp(argv[i], "--segment-seconds") == 0 && i + 1 < argc)
+            recordOptions.dSegmentSeconds = atof(argv[++i]);
+        else if (argv[i][0] != '-' && strUrl.empty())
+            strUrl = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (strUrl.empty() || audioOptions.format.nSampleRate <= 0 || audioOptions.format.nChannels <= 0 ||
+        audioOptions.nRingMs <= 0 || audioOptions.nPeriodMs <= 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    std::unique_ptr<AudioOutput> pAudioOutput;
+    if (CreateAudioOutput(strAudioOut, &pAudioOutput) < 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // Audio-only playback does not need a video decoder, or a video stream.
+    VideoStream stream;
+    int ret = 0;
+    if (bVideo)
+    {
+        if (OpenStream(strUrl, &stream, options) < 0)
+            return 1;
+    }
+    else if ((ret = avformat_open_input(&stream.pFormatContext, strUrl.c_str(), nullptr, nullptr)) < 0 ||
+             (ret = avformat_find_stream_info(stream.pFormatContext, nullptr)) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", strUrl.c_str(), av_err2str(ret));
+        CloseStream(&stream);
+        return 1;
+    }
+
+    int iAudio = av_find_best_stream(stream.pFormatContext, AVMEDIA_TYPE_AUDIO, -1, stream.iVideo, nullptr, 0);
+    if (iAudio < 0)
+    {
+        fprintf(stderr, "no audio stream in %s\n", strUrl.c_str());
+        CloseStream(&stream);
+        return 1;
+    }
+
+    AudioPipeline audio;
+    if (audio.Open(stream.pFormatContext, iAudio, pAudioOutput.get(), audioOptions) < 0)
+    {
+        CloseStream(&stream);
+        return 1;
+    }
+
+    // Recordings take the packets the demux thread reads for playback.
+    std::vector<std::unique_ptr<RemuxSink>> sinks;
+    PacketFanout fanout;
+    for (const std::string& strPath : recordings)
+    {
+        sinks.emplace_back(new RemuxSink());
+        if (sinks.back()->Open(stream.pFormatContext, strPath, recordOptions) < 0)
+        {
+            audio.Close();
+            CloseStream(&stream);
+            return 1;
+        }
+        fanout.AddSink(sinks.back().get());
+    }
+
+    // The audio queue is deep enough that a video decoder behind schedule
+    // blocks the demuxer on the video queue, never on this one.
+    PacketQueue videoQueue;
+    PacketQueue audioQueue;
+    DemuxThread demuxThread;
+    demuxThread.SetFanout(&fanout);
+    if ((ret = videoQueue.Init(64, 256LL << 20)) < 0 ||
+        (ret = audioQueue.Init(1024, 64LL << 20)) < 0 ||
+        (bVideo && (ret = demuxThread.AddStream(iAudio, &audioQueue)) < 0) ||
+        (ret = demuxThread.Start(stream.pFormatContext, bVideo ? stream.iVideo : iAudio,
+                                 bVideo ? &videoQueue : &audioQueue)) < 0 ||
+        (ret = audio.Start(&audioQueue)) < 0)
+    {
+        fprintf(stderr, "start: %s\n", av_err2str(ret));
+        demuxThread.Stop();
+        audio.Stop();
+        CloseStream(&stream);
+        return 1;
+    }
+
+    BenchClock::time_point tStart = BenchClock::now();
+
+    // Video follows the audio clock.
+    AudioMasterClock masterClock(&audio);
+    SchedulerOptions scheduling;
+    scheduling.bMediaClock = true;
+    FrameScheduler scheduler(&masterClock, scheduling);
+    LatencyHistogram avOffset;
+    int64_t nVideoFrames = 0;
+    int nVideoRet = 0;
+
+    if (bVideo)
+    {
+        const AVRational timeBase = stream.pFormatContext->streams[stream.iVideo]->time_base;
+        FrameCallback onFrame = [&](AVCodecContext*, AVFrame* frame)
+        {
+            nVideoFrames++;
+            const int64_t pts = frame->best_effort_timestamp;
+            if (scheduler.Schedule(pts, timeBase, masterClock.Now()) == ScheduleAction::Present)
+            {
+                scheduler.Presented();
+                if (pts != AV_NOPTS_VALUE)
+                    avOffset.Add(std::fabs(pts * av_q2d(timeBase) - masterClock.Now()));
+            }
+            return 0;
+        };
+
+        AVPacket* pPacket = av_packet_alloc();
+        if (!pPacket)
+            ret = AVERROR(ENOMEM);
+        while (pPacket && (ret = videoQueue.Pop(pPacket)) >= 0)
+        {
+            scheduler.UpdateDiscard(stream.pCodecCtx);
+            ret = DecodeFrame(stream.pCodecCtx, pPacket, onFrame, nullptr, stream.pBackend.get());
+            av_packet_unref(pPacket);
+            if (ret < 0)
+                break;
+        }
+        if (ret == AVERROR_EOF)
+            DecodeFrame(stream.pCodecCtx, NULL, onFrame, nullptr, stream.pBackend.get());
+        av_packet_free(&pPacket);
+
+        // Nothing drains the video queue any more: stop the demuxer before
+        // it blocks on it, and audio with it, or Join never returns.
+        // AVERROR_EXIT means audio failed and aborted the queues itself.
+        if (ret < 0 && ret != AVERROR_EOF && ret != AVERROR_EXIT)
+        {
+            fprintf(stderr, "video decode: %s\n", av_err2str(ret));
+            nVideoRet = ret;
+            demuxThread.Stop();
+            audio.Stop();
+        }
+    }
+
+    audio.Join();
+    demuxThread.Stop();
+    audio.Close();
+    int nRecordRet = fanout.Close();
+
+    double dElapsed = ElapsedSeconds(tStart, BenchClock::now());
+    AudioStats as = audio.Stats();
+    const AudioFormat& format = audioOptions.format;
+
+    printf("input:        %s\n", strUrl.c_str());
+    printf("audio:        %s -> %d Hz, %d ch, %s, output %s%s\n",
+           avcodec_get_name(stream.pFormatContext->streams[iAudio]->codecpar->codec_id),
+           format.nSampleRate, format.nChannels, av_get_sample_fmt_name(format.sampleFormat),
+           pAudioOutput->Name(), audioOptions.bRealtime ? "" : " (not paced)");
+    printf("played:       %.3f s of audio in %.3f s, clock at %.3f s\n",
+           double(as.nFramesPlayed) / format.nSampleRate, dElapsed, audio.ClockSeconds());
+    printf("ring:         %d ms, period %d ms, prebuffer %d ms\n",
+           audioOptions.nRingMs, audioOptions.nPeriodMs, audioOptions.nPrebufferMs);
+    printf("underruns:    %llu (%.1f ms of silence)\n", (unsigned long long)as.nUnderruns,
+           as.nUnderrunFrames * 1e3 / format.nSampleRate);
+    printf("overruns:     %llu (decoder waited %.3f s for room)\n", (unsigned long long)as.nOverruns,
+           as.dOverrunSeconds);
+    printf("latency:      mean %.3f ms, max %.3f ms (decoded -> played)\n", as.latency.MeanMs(), as.latency.MaxMs());
+    as.latency.Print(stdout, "              ");
+    if (bVideo)
+    {
+        const SchedulerStats& vs = scheduler.Stats();
+        printf("video:        %lld decoded, %llu presented, %llu dropped late, %llu/%llu packets skip nonref/nonkey\n",
+               (long long)nVideoFrames, (unsigned long long)vs.nPresented, (unsigned long long)vs.nDroppedLate,
+               (unsigned long long)vs.nPacketsSkipNonRef, (unsigned long long)vs.nPacketsSkipNonKey);
+        printf("a/v offset:   mean %.3f ms, max %.3f ms at present\n", avOffset.MeanMs(), avOffset.MaxMs());
+        avOffset.Print(stdout, "              ");
+    }
+    for (const std::unique_ptr<RemuxSink>& pSink : sinks)
+    {
+        RemuxSinkStats rs = pSink->Stats();
+        printf("record:       %s, %llu packets, %.1f MiB written, %llu dropped (%.1f MiB), queue peak %zu packets%s\n",
+               pSink->Path().c_str(), (unsigned long long)rs.nPackets, rs.nBytes / (1024.0 * 1024.0),
+               (unsigned long long)rs.nDropped, rs.nDroppedBytes / (1024.0 * 1024.0), rs.nPeakPackets,
+               rs.ret < 0 ? " (failed)" : "");
+    }
+
+    CloseStream(&stream);
+    return (nVideoRet < 0 || audio.Result() < 0 || nRecordRet < 0) ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+typedef std::chrono::steady_clock BenchClock;
+
+inline double ElapsedSeconds(BenchClock::time_point tStart, BenchClock::time_point tEnd)
+{
+    return std::chrono::duration<double>(tEnd - tStart).count();
+}
+
+// Nearest-rank percentile, p in [0, 100]. Sorts the samples in place.
+inline double Percentile(std::vector<double>& samples, double p)
+{
+    if (samples.empty())
+        return 0.0;
+
+    std::sort(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(p / 100.0 * (samples.size() - 1) + 0.5);
+    return samples[std::min(rank, samples.size() - 1)];
+}
+
+// Power-of-two buckets from 0.125 ms up; the last one is open ended. Cheap
+// enough to update per frame without keeping the samples.
+class LatencyHistogram
+{
+public:
+    static const int kBuckets = 16;
+
+    void Add(double dSeconds)
+    {
+        double dMs = dSeconds * 1e3;
+        int i = 0;
+        while (i < kBuckets - 1 && dMs >= UpperMs(i))
+            i++;
+        m_counts[i]++;
+        m_nTotal++;
+        m_dSumMs += dMs;
+        m_dMaxMs = std::max(m_dMaxMs, dMs);
+    }
+
+    static double   UpperMs(int i)          { return 0.125 * (1 << i); }
+    uint64_t        Count(int i) const      { return m_counts[i]; }
+    uint64_t        Total() const           { return m_nTotal; }
+    double          MeanMs() const          { return m_nTotal ? m_dSumMs / m_nTotal : 0.0; }
+    double          MaxMs() const           { return m_dMaxMs; }
+
+    // Non-empty buckets, one per line.
+    void Print(FILE* fp, const char* szIndent = "  ") const
+    {
+        for (int i = 0; i < kBuckets; i++)
+        {
+            if (m_counts[i] == 0)
+                continue;
+            if (i == kBuckets - 1)
+                fprintf(fp, "%s>= %8.3f ms  %llu\n", szIndent, UpperMs(i - 1), (unsigned long long)m_counts[i]);
+            else
+                fprintf(fp, "%s<  %8.3f ms  %llu\n", szIndent, UpperMs(i), (unsigned long long)m_counts[i]);
+        }
+    }
+
+private:
+    uint64_t    m_counts[kBuckets] = {};
+    uint64_t    m_nTotal    = 0;
+    double      m_dSumMs    = 0.0;
+    double      m_dMaxMs    = 0.0;
+};
+
+// Peak resident set size of this process in bytes, 0 where unsupported.
+inline uint64_t PeakRssBytes()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(__APPLE__)
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// Current resident set size of this process in bytes, 0 where
+// unsupported. Unlike the peak, this goes down again when memory is
+// returned to the system.
+inline uint64_t CurrentRssBytes()
+{
+#if defined(__linux__)
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+        return 0;
+    unsigned long long nSize = 0, nResident = 0;
+    int n = fscanf(fp, "%llu %llu", &nSize, &nResident);
+    fclose(fp);
+    return n == 2 ? static_cast<uint64_t>(nResident) * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) : 0;
+#else
+    return 0;
+#endif
+}
+
+// User plus system CPU time of every thread of this process, 0 where
+// unsupported.
+inline double ProcessCpuSeconds()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0.0;
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+#else
+    return 0.0;
+#endif
+}
@@ -0,0 +1,252 @@
+#include "decoder.hpp"
+#include "bench_stats.hpp"
+#include "worker_pool.hpp"
+#include "yuv2bgra.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <input> [--frames N] [--repeat R] [--workers N] [--bands N]\n"
+            "  --frames   decoded frames to convert (default 60)\n"
+            "  --repeat   passes over those frames per path (default 5)\n"
+            "  --workers  pool size for the threaded pass (default: one per core)\n"
+            "  --bands    row bands per frame in the threaded pass (default: workers + 1)\n",
+            argv0);
+}
+
+struct PathResult
+{
+    std::string strName;
+    double      dSeconds    = 0.0;
+    int         nMaxDiff    = 0;
+};
+
+static int MaxDiff(const uint8_t* a, const uint8_t* b, int width, int height, int stride)
+{
+    int nMax = 0;
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t* pA = a + static_cast<ptrdiff_t>(y) * stride;
+        const uint8_t* pB = b + static_cast<ptrdiff_t>(y) * stride;
+        for (int x = 0; x < width * 4; x++)
+        {
+            // Alpha is not compared; sws_scale leaves it unset for some formats.
+            if ((x & 3) == 3)
+                continue;
+            int d = abs(pA[x] - pB[x]);
+            if (d > nMax)
+                nMax = d;
+        }
+    }
+    return nMax;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strUrl;
+    int nMaxFrames = 60;
+    int nRepeat = 5;
+    int nWorkers = 0;
+    int nBands = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            nMaxFrames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+            nRepeat = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+            nWorkers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bands") == 0 && i + 1 < argc)
+            nBands = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && strUrl.empty())
+            strUrl = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (strUrl.empty() || nMaxFrames <= 0 || nRepeat <= 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    VideoStream stream;
+    int ret = OpenStream(strUrl, &stream);
+    if (ret < 0)
+        return 1;
+
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+    {
+        fprintf(stderr, "av_packet_alloc failed\n");
+        CloseStream(&stream);
+        return 1;
+    }
+
+    // Decode up front so only conversion is timed.
+    std::vector<AVFrame*> frames;
+    FrameCallback onFrame = [&](AVCodecContext*, AVFrame* frame)
+    {
+        if (static_cast<int>(frames.size()) >= nMaxFrames)
+            return 0;
+        if (!frames.empty() && (frame->width != frames[0]->width || frame->height != frames[0]->height ||
+                                frame->format != frames[0]->format))
+            return 0;
+        AVFrame* pClone = av_frame_clone(frame);
+        if (!pClone)
+            return AVERROR(ENOMEM);
+        frames.push_back(pClone);
+        return 0;
+    };
+
+    while (ret >= 0 && static_cast<int>(frames.size()) < nMaxFrames)
+    {
+        if ((ret = av_read_frame(stream.pFormatContext, pPacket)) < 0)
+            break;
+        if (pPacket->stream_index == stream.iVideo)
+            ret = DecodeFrame(stream.pCodecCtx, pPacket, onFrame);
+        av_packet_unref(pPacket);
+    }
+    DecodeFrame(stream.pCodecCtx, NULL, onFrame);
+    av_packet_free(&pPacket);
+    CloseStream(&stream);
+
+    if (frames.empty())
+    {
+        fprintf(stderr, "no frames decoded\n");
+        return 1;
+    }
+
+    const AVFrame* pFirst = frames[0];
+    const int width = pFirst->width;
+    const int height = pFirst->height;
+
+    YuvToBgraFormat format;
+    if ((ret = GetYuvToBgraFormat(pFirst, &format)) < 0)
+    {
+        fprintf(stderr, "%s frames are not supported, need nv12 or yuv420p\n",
+                av_get_pix_fmt_name(static_cast<AVPixelFormat>(pFirst->format)));
+        for (AVFrame*& frame : frames)
+            av_frame_free(&frame);
+        return 1;
+    }
+
+    const int dstStride = FFALIGN(width * 4, 64);
+    const size_t nDstSize = static_cast<size_t>(dstStride) * height;
+    uint8_t* pReference = static_cast<uint8_t*>(av_malloc(nDstSize));
+    uint8_t* pDst = static_cast<uint8_t*>(av_malloc(nDstSize));
+    if (!pReference || !pDst)
+    {
+        fprintf(stderr, "av_malloc failed\n");
+        av_free(pReference);
+        av_free(pDst);
+        for (AVFrame*& frame : frames)
+            av_frame_free(&frame);
+        return 1;
+    }
+
+    // The scalar output of the last frame is the reference for max diff.
+    ConvertFrameToBgra(frames.back(), pReference, dstStride, ConvertPath::Scalar);
+
+    WorkerPool pool(nWorkers);
+    std::vector<PathResult> results;
+
+    auto TimePath = [&](const std::string& strName, const std::function<void(const AVFrame*)>& convert)
+    {
+        PathResult result;
+        result.strName = strName;
+        memset(pDst, 0, nDstSize);
+        BenchClock::time_point tStart = BenchClock::now();
+        for (int r = 0; r < nRepeat; r++)
+        {
+            for (const AVFrame* frame : frames)
+                convert(frame);
+        }
+        result.dSeconds = ElapsedSeconds(tStart, BenchClock::now());
+        result.nMaxDiff = MaxDiff(pReference, pDst, width, height, dstStride);
+        results.push_back(result);
+    };
+
+    const ConvertPath paths[] = { ConvertPath::Scalar, ConvertPath::SSE41, ConvertPath::AVX2 };
+    for (ConvertPath path : paths)
+    {
+        // Paths the CPU or the build cannot run would silently measure a
+        // slower one.
+        if (ResolveConvertPath(path) != path)
+            continue;
+        TimePath(ConvertPathName(path), [&](const AVFrame* frame)
+        {
+            ConvertFrameToBgra(frame, pDst, dstStride, path);
+        });
+    }
+
+    const ConvertPath best = ResolveConvertPath(ConvertPath::Auto);
+    TimePath(std::string(ConvertPathName(best)) + " x" + std::to_string(pool.Size() + 1),
+             [&](const AVFrame* frame)
+    {
+        ConvertFrameToBgra(frame, pDst, dstStride, best, &pool, nBands);
+    });
+
+    // sws_scale with the same matrix and range and nearest chroma, the
+    // closest it gets to what the kernels compute.
+    SwsContext* pSws = sws_getContext(width, height, static_cast<AVPixelFormat>(pFirst->format),
+                                      width, height, AV_PIX_FMT_BGRA, SWS_POINT, nullptr, nullptr, nullptr);
+    if (pSws)
+    {
+        const int colorspace = format.matrix == YuvMatrix::BT709 ? SWS_CS_ITU709 : SWS_CS_ITU601;
+        sws_setColorspaceDetails(pSws, sws_getCoefficients(colorspace), format.bFullRange ? 1 : 0,
+                                 sws_getCoefficients(SWS_CS_DEFAULT), 1, 0, 1 << 16, 1 << 16);
+        TimePath("sws_scale", [&](const AVFrame* frame)
+        {
+            uint8_t* dst[4] = { pDst, nullptr, nullptr, nullptr };
+            int dstStrides[4] = { dstStride, 0, 0, 0 };
+            sws_scale(pSws, frame->data, frame->linesize, 0, height, dst, dstStrides);
+        });
+        sws_freeContext(pSws);
+    }
+    else
+        fprintf(stderr, "sws_getContext failed, skipping sws_scale\n");
+
+    printf("input:        %s\n", strUrl.c_str());
+    printf("frames:       %zu x %d, %dx%d %s, %s %s range\n", frames.size(), nRepeat, width, height,
+           av_get_pix_fmt_name(static_cast<AVPixelFormat>(pFirst->format)),
+           format.matrix == YuvMatrix::BT709 ? "bt709" : "bt601", format.bFullRange ? "full" : "limited");
+    printf("%-14s %10s %10s %9s %9s\n", "path", "ms/frame", "Mpix/s", "speedup", "max diff");
+
+    const double nConverted = static_cast<double>(frames.size()) * nRepeat;
+    const double dBaseline = results[0].dSeconds;
+    for (const PathResult& result : results)
+    {
+        printf("%-14s %10.3f %10.1f %8.2fx %9d\n", result.strName.c_str(),
+               result.dSeconds * 1e3 / nConverted,
+               result.dSeconds > 0 ? nConverted * width * height / result.dSeconds * 1e-6 : 0.0,
+               result.dSeconds > 0 ? dBaseline / result.dSeconds : 0.0,
+               result.nMaxDiff);
+    }
+
+    av_free(pReference);
+    av_free(pDst);
+    for (AVFrame*& frame : frames)
+        av_frame_free(&frame);
+
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include "decode_backend.hpp"
+#include "hw_format.hpp"
+#include "av_err2string.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+
+extern "C"
+{
+#include <libavutil/imgutils.h>
+}
+
+int SoftwareBackend::Configure(AVCodecContext*)
+{
+    return 0;
+}
+
+int SoftwareBackend::Deliver(AVFrame* pFrame, AVFrame** ppOut)
+{
+    m_stats.nFrames++;
+    *ppOut = pFrame;
+    return 0;
+}
+
+HWAccelBackend::HWAccelBackend(enum AVHWDeviceType type, AVBufferRef* pDeviceCtx, bool bDownload)
+    : m_type(type)
+    , m_pDeviceCtx(pDeviceCtx)
+    , m_bDownload(bDownload)
+{
+}
+
+HWAccelBackend::~HWAccelBackend()
+{
+    if (m_pBudget && m_nSurfaceBytes)
+        m_pBudget->Release(m_nSurfaceBytes, MemoryStage::Surfaces);
+    av_frame_free(&m_pDownload);
+    av_buffer_unref(&m_pDeviceCtx);
+}
+
+int HWAccelBackend::Configure(AVCodecContext* avctx)
+{
+    if (!(avctx->hw_device_ctx = av_buffer_ref(m_pDeviceCtx)))
+        return AVERROR(ENOMEM);
+    avctx->get_format = GetHWFormat;
+    return 0;
+}
+
+int HWAccelBackend::Deliver(AVFrame* pFrame, AVFrame** ppOut)
+{
+    m_stats.nFrames++;
+
+    // The surface pool is allocated up front, so it is charged whole with
+    // the first surface. Pools that grow on demand report no initial size.
+    if (m_pBudget && !m_nSurfaceBytes && pFrame->hw_frames_ctx)
+    {
+        const AVHWFramesContext* pFrames = reinterpret_cast<const AVHWFramesContext*>(pFrame->hw_frames_ctx->data);
+        m_nSurfaceBytes = std::max(pFrames->initial_pool_size, 1) *
+                          EstimateFrameBytes(pFrames->sw_format, pFrames->width, pFrames->height);
+        m_pBudget->Charge(m_nSurfaceBytes, MemoryStage::Surfaces);
+    }
+
+    // Frames the hwaccel could not take (e.g. an unsupported profile) come
+    // back in software and need no transfer.
+    if (!m_bDownload || !pFrame->hw_frames_ctx)
+    {
+        *ppOut = pFrame;
+        return 0;
+    }
+
+    if (!m_pDownload && !(m_pDownload = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    av_frame_unref(m_pDownload);
+
+    std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+
+    int ret = av_hwframe_transfer_data(m_pDownload, pFrame, 0);
+    if (ret < 0)
+    {
+        fprintf(stderr, "av_hwframe_transfer_data: %s\n", av_err2str(ret));
+        return ret;
+    }
+    if ((ret = av_frame_copy_props(m_pDownload, pFrame)) < 0)
+        return ret;
+
+    m_stats.dTransferSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+    int nBytes = av_image_get_buffer_size(static_cast<enum AVPixelFormat>(m_pDownload->format),
+                                          m_pDownload->width, m_pDownload->height, 1);
+    if (nBytes > 0)
+        m_stats.nBytesCopied += nBytes;
+
+    *ppOut = m_pDownload;
+    return 0;
+}
+
+static int CreateHWBackend(enum AVHWDeviceType type, const AVCodec* pCodec, bool bDownload,
+                           std::unique_ptr<DecodeBackend>* ppBackend)
+{
+    if (FindHWPixelFormat(pCodec, type) == AV_PIX_FMT_NONE)
+        return AVERROR(ENOSYS);
+
+    AVBufferRef* pDeviceCtx = nullptr;
+    int ret = av_hwdevice_ctx_create(&pDeviceCtx, type, nullptr, nullptr, 0);
+    if (ret < 0)
+        return ret;
+
+    ppBackend->reset(new HWAccelBackend(type, pDeviceCtx, bDownload));
+    return 0;
+}
+
+std::vector<std::string> ListBackends(const AVCodec* pCodec)
+{
+    std::vector<std::string> backends;
+
+    for (int i = 0;; i++)
+    {
+        const AVCodecHWConfig* pConfig = avcodec_get_hw_config(pCodec, i);
+        if (!pConfig)
+            break;
+        if (!(pConfig->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX))
+            continue;
+
+        AVBufferRef* pDeviceCtx = nullptr;
+        if (av_hwdevice_ctx_create(&pDeviceCtx, pConfig->device_type, nullptr, nullptr, 0) >= 0)
+        {
+            backends.push_back(av_hwdevice_get_type_name(pConfig->device_type));
+            av_buffer_unref(&pDeviceCtx);
+        }
+    }
+
+    backends.push_back("software");
+    return backends;
+}
+
+int CreateBackend(const std::string& strPreference, const AVCodec* pCodec, bool bDownload,
+                  std::unique_ptr<DecodeBackend>* ppBackend)
+{
+    std::stringstream ss(strPreference.empty() ? std::string("software") : strPreference);
+    std::string strName;
+
+    while (std::getline(ss, strName, ','))
+    {
+        if (strName == "software")
+        {
+            ppBackend->reset(new SoftwareBackend);
+            return 0;
+        }
+
+        if (strName == "auto")
+        {
+            for (int i = 0;; i++)
+            {
+                const AVCodecHWConfig* pConfig = avcodec_get_hw_config(pCodec, i);
+                if (!pConfig)
+                    break;
+                if ((pConfig->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) &&
+                    CreateHWBackend(pConfig->device_type, pCodec, bDownload, ppBackend) >= 0)
+                    return 0;
+            }
+            ppBackend->reset(new SoftwareBackend);
+            return 0;
+        }
+
+        enum AVHWDeviceType type = av_hwdevice_find_type_by_name(strName.c_str());
+        if (type == AV_HWDEVICE_TYPE_NONE)
+        {
+            fprintf(stderr, "unknown decode backend %s\n", strName.c_str());
+            return AVERROR(EINVAL);
+        }
+
+        int ret = CreateHWBackend(type, pCodec, bDownload, ppBackend);
+        if (ret >= 0)
+            return 0;
+        fprintf(stderr, "%s backend unavailable for %s: %s\n", strName.c_str(), pCodec->name, av_err2str(ret));
+    }
+
+    return AVERROR(ENOSYS);
+}
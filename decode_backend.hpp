@@ -0,0 +1,89 @@
+#pragma once
+
+#include "memory_budget.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/hwcontext.h>
+}
+
+struct BackendStats
+{
+    int64_t     nFrames             = 0;
+    double      dDecodeSeconds      = 0.0;  // send_packet/receive_frame time
+    double      dTransferSeconds    = 0.0;  // hw -> system memory downloads
+    int64_t     nBytesCopied        = 0;    // payload copied by Deliver; 0 for software decode
+};
+
+// How decoded frames are produced and handed downstream. A backend is chosen
+// once per stream, configures the codec context before avcodec_open2 and then
+// turns every decoded frame into the frame the sinks see.
+class DecodeBackend
+{
+public:
+    virtual ~DecodeBackend() = default;
+
+    virtual const char*     Name() const = 0;
+    virtual bool            IsHardware() const = 0;
+    virtual int             Configure(AVCodecContext* avctx) = 0;
+    // Sets *ppOut to the frame to deliver. It either is pFrame itself or a
+    // frame owned by the backend that stays valid until the next call.
+    virtual int             Deliver(AVFrame* pFrame, AVFrame** ppOut) = 0;
+
+    void                    AddDecodeTime(double dSeconds)  { m_stats.dDecodeSeconds += dSeconds; }
+    const BackendStats&     Stats() const                   { return m_stats; }
+    // Hw backends charge their surface pool to it as MemoryStage::Surfaces.
+    void                    SetMemoryBudget(MemoryBudget* pBudget)  { m_pBudget = pBudget; }
+
+protected:
+    BackendStats            m_stats;
+    MemoryBudget*           m_pBudget = nullptr;
+};
+
+// Delivers the decoder's own frame: the planes downstream sees are the
+// refcounted buffers the decoder wrote, never a copy.
+class SoftwareBackend : public DecodeBackend
+{
+public:
+    const char*     Name() const override       { return "software"; }
+    bool            IsHardware() const override { return false; }
+    int             Configure(AVCodecContext* avctx) override;
+    int             Deliver(AVFrame* pFrame, AVFrame** ppOut) override;
+};
+
+class HWAccelBackend : public DecodeBackend
+{
+public:
+    // With bDownload the surfaces are transferred to system memory for CPU
+    // sinks; otherwise the hw frames are delivered as they are.
+    HWAccelBackend(enum AVHWDeviceType type, AVBufferRef* pDeviceCtx, bool bDownload);
+    ~HWAccelBackend() override;
+
+    const char*     Name() const override       { return av_hwdevice_get_type_name(m_type); }
+    bool            IsHardware() const override { return true; }
+    int             Configure(AVCodecContext* avctx) override;
+    int             Deliver(AVFrame* pFrame, AVFrame** ppOut) override;
+
+private:
+    enum AVHWDeviceType     m_type;
+    AVBufferRef*            m_pDeviceCtx;
+    bool                    m_bDownload;
+    AVFrame*                m_pDownload = nullptr;
+    int64_t                 m_nSurfaceBytes = 0;    // charged to m_pBudget
+};
+
+// Backends usable for this codec on this host: the hw device types the codec
+// has a config for and whose device could be created, then "software".
+std::vector<std::string>    ListBackends(const AVCodec* pCodec);
+
+// strPreference is "auto", "software", a hwdevice type name such as "vaapi",
+// or a comma separated list of those tried in order. "auto" tries every hw
+// config of the codec before falling back to software.
+int                         CreateBackend(const std::string& strPreference, const AVCodec* pCodec, bool bDownload,
+                                          std::unique_ptr<DecodeBackend>* ppBackend);
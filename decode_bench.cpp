@@ -0,0 +1,399 @@
+#include "decoder.hpp"
+#include "bench_stats.hpp"
+#include "decoder_threading.hpp"
+#include "demux_thread.hpp"
+#include "frame_pool.hpp"
+#include "frame_sink.hpp"
+#include "packet_pool.hpp"
+#include "packet_queue.hpp"
+#include "stage_trace.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <input> [--frames N] [--demux-queue DEPTH] [--demux-queue-mb MB] [--packet-pool]\n"
+            "                [--no-frame-pool] [--threads MODE[:N]] [--autotune-threads GOPS] [--backend NAME]\n"
+            "                [--list-backends] [--sink null|checksum|shm:NAME[:SLOTS]] [--keyframes-only]\n"
+            "                [--probe-cache PATH] [--io default|mmap|readahead] [--memory-mb N] [--stages]\n"
+            "                [--trace PATH] [--metrics PATH]\n"
+            "  --demux-queue     read packets on a separate thread through a ring of DEPTH packets\n"
+            "  --demux-queue-mb  byte budget of that ring (default 256)\n"
+            "  --packet-pool     with --demux-queue, move queued payloads into size-classed pools\n"
+            "  --no-frame-pool   allocate frames with the default allocator instead of FramePool\n"
+            "  --threads         none, frame, slice or both, with an optional count (default: libavcodec's)\n"
+            "  --autotune-threads  time every threading mode on the first GOPS GOPs and use the fastest\n"
+            "  --backend         software (default), auto, a hw device type, or a comma separated list\n"
+            "  --list-backends   print the backends available for the input's codec and exit\n"
+            "  --sink            where decoded frames go (default null)\n"
+            "  --keyframes-only  drop non-key packets in the demuxer and decoder\n"
+            "  --probe-cache     reuse stream probe results stored in PATH, and update it\n"
+            "  --io              read local files through FFmpeg's file protocol, a mapping or read-ahead\n"
+            "  --memory-mb       cap frames, hw surfaces and queued packets at N MiB; sizes decoder threads\n"
+            "                    and extra hw frames to fit\n"
+            "  --stages          time read, send, receive and sink per call and print percentiles\n"
+            "  --trace           with --stages, write a Chrome trace (chrome://tracing, Perfetto)\n"
+            "  --metrics         with --stages, write Prometheus text metrics\n",
+            argv0);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strUrl;
+    int64_t nMaxFrames = 0;
+    size_t nQueueDepth = 0;
+    int64_t nQueueBytes = 256LL << 20;
+    bool bPacketPool = false;
+    bool bFramePool = true;
+    ThreadingConfig threading;
+    int nAutoTuneGops = 0;
+    std::string strBackend = "software";
+    bool bListBackends = false;
+    std::string strSink = "null";
+    bool bKeyframesOnly = false;
+    std::string strProbeCache;
+    FileIOMode fileIO = FileIOMode::Default;
+    int64_t nMemoryBudget = 0;
+    bool bStages = false;
+    std::string strTrace;
+    std::string strMetrics;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            nMaxFrames = strtoll(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--demux-queue") == 0 && i + 1 < argc)
+            nQueueDepth = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--demux-queue-mb") == 0 && i + 1 < argc)
+            nQueueBytes = strtoll(argv[++i], nullptr, 10) << 20;
+        else if (strcmp(argv[i], "--packet-pool") == 0)
+            bPacketPool = true;
+        else if (strcmp(argv[i], "--no-frame-pool") == 0)
+            bFramePool = false;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (ParseThreadingConfig(argv[++i], &threading) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--autotune-threads") == 0 && i + 1 < argc)
+            nAutoTuneGops = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            strBackend = argv[++i];
+        else if (strcmp(argv[i], "--list-backends") == 0)
+            bListBackends = true;
+        else if (strcmp(argv[i], "--sink") == 0 && i + 1 < argc)
+            strSink = argv[++i];
+        else if (strcmp(argv[i], "--keyframes-only") == 0)
+            bKeyframesOnly = true;
+        else if (strcmp(argv[i], "--probe-cache") == 0 && i + 1 < argc)
+            strProbeCache = argv[++i];
+        else if (strcmp(argv[i], "--memory-mb") == 0 && i + 1 < argc)
+            nMemoryBudget = static_cast<int64_t>(atoi(argv[++i])) << 20;
+        else if (strcmp(argv[i], "--stages") == 0)
+            bStages = true;
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            strTrace = argv[++i];
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc)
+            strMetrics = argv[++i];
+        else if (strcmp(argv[i], "--io") == 0 && i + 1 < argc)
+        {
+            if (ParseFileIOMode(argv[++i], &fileIO) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (argv[i][0] != '-' && strUrl.empty())
+            strUrl = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (strUrl.empty())
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+    SetTracingEnabled(bStages || !strTrace.empty() || !strMetrics.empty());
+
+    std::unique_ptr<FrameSink> pSink;
+    if (CreateSink(strSink, &pSink) < 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    if (nAutoTuneGops > 0)
+    {
+        std::vector<ThreadingTrial> trials;
+        if (AutoTuneThreading(strUrl, nAutoTuneGops, &threading, &trials) < 0)
+            return 1;
+
+        printf("%-12s %-12s %8s %10s %12s %14s\n", "config", "active", "frames", "frames/s", "first frame", "added latency");
+        for (const ThreadingTrial& trial : trials)
+        {
+            printf("%-12s %-12s %8lld %10.2f %9.2f ms %11.2f ms\n",
+                   ThreadingConfigToString(trial.config).c_str(),
+                   ActiveThreadTypeToString(trial.activeThreadType).c_str(),
+                   (long long)trial.nFrames, trial.dFps, trial.dFirstFrameMs, trial.dAddedLatencyMs);
+        }
+        printf("auto-tuned:   %s\n\n", ThreadingConfigToString(threading).c_str());
+    }
+
+    ProbeCache probeCache;
+    if (!strProbeCache.empty())
+    {
+        int err = probeCache.Load(strProbeCache);
+        if (err < 0 && err != AVERROR(ENOENT))
+            fprintf(stderr, "probe cache %s: %s, starting empty\n", strProbeCache.c_str(), av_err2str(err));
+    }
+
+    FramePool framePool;
+    DecoderOptions options;
+    options.threading = threading;
+    options.strBackend = strBackend;
+    options.bKeyframesOnly = bKeyframesOnly;
+    options.fileIO = fileIO;
+    if (!strProbeCache.empty())
+        options.pProbeCache = &probeCache;
+    if (bFramePool)
+        options.pFramePool = &framePool;
+    if (nMemoryBudget > 0)
+    {
+        ProcessMemoryBudget()->SetLimit(nMemoryBudget);
+        options.pMemoryBudget = ProcessMemoryBudget();
+    }
+
+    VideoStream stream;
+    int ret = OpenStream(strUrl, &stream, options);
+    if (ret < 0)
+        return 1;
+    if (!strProbeCache.empty() && (ret = probeCache.Save(strProbeCache)) < 0)
+        fprintf(stderr, "probe cache %s: %s\n", strProbeCache.c_str(), av_err2str(ret));
+
+    if (bListBackends)
+    {
+        for (const std::string& strName : ListBackends(stream.pCodecCtx->codec))
+            printf("%s\n", strName.c_str());
+        CloseStream(&stream);
+        return 0;
+    }
+
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+    {
+        fprintf(stderr, "av_packet_alloc failed\n");
+        CloseStream(&stream);
+        return 1;
+    }
+
+    PacketPool packetPool;
+    PacketQueue packetQueue;
+    DemuxThread demuxThread;
+    if (nQueueDepth > 0)
+    {
+        if (nMemoryBudget > 0)
+        {
+            if (stream.memory.nPacketBytes > 0 && stream.memory.nPacketBytes < nQueueBytes)
+                nQueueBytes = stream.memory.nPacketBytes;
+            packetQueue.SetMemoryBudget(ProcessMemoryBudget());
+        }
+        if (bPacketPool)
+            demuxThread.SetPacketPool(&packetPool);
+        if ((ret = packetQueue.Init(nQueueDepth, nQueueBytes)) < 0 ||
+            (ret = demuxThread.Start(stream.pFormatContext, stream.iVideo, &packetQueue)) < 0)
+        {
+            fprintf(stderr, "demux thread: %s\n", av_err2str(ret));
+            av_packet_free(&pPacket);
+            CloseStream(&stream);
+            return 1;
+        }
+    }
+
+    auto ReadPacket = [&](AVPacket* pkt)
+    {
+        if (nQueueDepth > 0)
+            return packetQueue.Pop(pkt);
+        return TracedReadFrame(stream.pFormatContext, pkt);
+    };
+
+    // Decode time is accumulated across send/receive calls and charged to the
+    // next frame that comes out, so frames held back for reordering carry the
+    // cost of the packets that were needed to produce them.
+    std::vector<double> latencies;
+    int64_t nFrames = 0;
+    int64_t nBytes = 0;
+    int64_t nPacketsSent = 0;
+    int64_t nPipelineDelay = 0;
+    double dPending = 0.0;
+    BenchClock::time_point tSegment;
+
+    // Pool counters after warm-up; anything allocated past this point is a
+    // steady-state allocation.
+    const int64_t nWarmupFrames = 32;
+    FramePoolStats warmPool;
+
+    // Sink time is excluded from the decode latency but not from frames/s.
+    FrameCallback onFrame = [&](AVCodecContext* avctx, AVFrame* frame)
+    {
+        latencies.push_back(dPending + ElapsedSeconds(tSegment, BenchClock::now()));
+        dPending = 0.0;
+        if (nFrames == 0)
+            nPipelineDelay = nPacketsSent;
+        if (++nFrames == nWarmupFrames)
+            warmPool = framePool.Stats();
+
+        int ret;
+        {
+            ScopedStage stage(TraceStage::Present);
+            ret = pSink->Write(avctx, frame);
+        }
+        tSegment = BenchClock::now();
+        return ret;
+    };
+
+    BenchClock::time_point tStart = BenchClock::now();
+
+    while (ret >= 0 && (nMaxFrames <= 0 || nFrames < nMaxFrames))
+    {
+        if ((ret = ReadPacket(pPacket)) < 0)
+            break;
+
+        if (pPacket->stream_index == stream.iVideo)
+        {
+            nBytes += pPacket->size;
+            nPacketsSent++;
+            tSegment = BenchClock::now();
+            ret = DecodeFrame(stream.pCodecCtx, pPacket, onFrame, options.pFramePool, stream.pBackend.get());
+            dPending += ElapsedSeconds(tSegment, BenchClock::now());
+        }
+
+        av_packet_unref(pPacket);
+    }
+
+    tSegment = BenchClock::now();
+    DecodeFrame(stream.pCodecCtx, NULL, onFrame, options.pFramePool, stream.pBackend.get());
+
+    double dElapsed = ElapsedSeconds(tStart, BenchClock::now());
+
+    if (nQueueDepth > 0)
+    {
+        demuxThread.Stop();
+        if (ret == AVERROR_EOF && demuxThread.Result() < 0 && demuxThread.Result() != AVERROR_EOF)
+            ret = demuxThread.Result();
+    }
+
+    if (ret < 0 && ret != AVERROR_EOF)
+        fprintf(stderr, "decode stopped early: %s\n", av_err2str(ret));
+
+    const AVCodecContext* pCodecCtx = stream.pCodecCtx;
+    printf("input:        %s\n", strUrl.c_str());
+    printf("codec:        %s %dx%d\n", pCodecCtx->codec->name, pCodecCtx->width, pCodecCtx->height);
+    const BackendStats& bs = stream.pBackend->Stats();
+    printf("backend:      %s, decode %.3f ms/frame, transfer %.3f ms/frame, %lld bytes copied\n",
+           stream.pBackend->Name(),
+           bs.nFrames ? bs.dDecodeSeconds * 1e3 / bs.nFrames : 0.0,
+           bs.nFrames ? bs.dTransferSeconds * 1e3 / bs.nFrames : 0.0,
+           (long long)bs.nBytesCopied);
+    printf("sink:         %s %s\n", pSink->Name(), pSink->Summary().c_str());
+    const OpenTimings& timings = stream.timings;
+    printf("open:         %.2f ms (input %.2f ms, %s %.2f ms, decoder %.2f ms)\n",
+           ElapsedSeconds(timings.tStart, timings.tDecoderOpened) * 1e3,
+           ElapsedSeconds(timings.tStart, timings.tInputOpened) * 1e3,
+           timings.bProbeCached ? "cached probe" : "probe",
+           ElapsedSeconds(timings.tInputOpened, timings.tStreamInfo) * 1e3,
+           ElapsedSeconds(timings.tStreamInfo, timings.tDecoderOpened) * 1e3);
+    if (!strProbeCache.empty())
+    {
+        ProbeCacheStats cs = probeCache.Stats();
+        printf("probe cache:  %llu hits, %llu misses (%llu stale), %.2f ms saved, %zu entries, %lld bytes\n",
+               (unsigned long long)cs.nHits, (unsigned long long)cs.nMisses, (unsigned long long)cs.nStale,
+               cs.dSavedSeconds * 1e3, probeCache.Size(), (long long)probeCache.Bytes());
+    }
+    printf("threads:      %s, %d threads (requested %s)\n",
+           ActiveThreadTypeToString(pCodecCtx->active_thread_type).c_str(), pCodecCtx->thread_count,
+           ThreadingConfigToString(threading).c_str());
+    printf("pipeline:     %lld packets in before the first frame out\n", (long long)nPipelineDelay);
+    printf("frames:       %lld\n", (long long)nFrames);
+    printf("bytes:        %lld\n", (long long)nBytes);
+    printf("elapsed:      %.3f s\n", dElapsed);
+    printf("frames/s:     %.2f\n", dElapsed > 0 ? nFrames / dElapsed : 0.0);
+    printf("bytes/s:      %.0f\n", dElapsed > 0 ? nBytes / dElapsed : 0.0);
+    printf("latency p50:  %.3f ms\n", Percentile(latencies, 50) * 1e3);
+    printf("latency p90:  %.3f ms\n", Percentile(latencies, 90) * 1e3);
+    printf("latency p99:  %.3f ms\n", Percentile(latencies, 99) * 1e3);
+    printf("latency max:  %.3f ms\n", Percentile(latencies, 100) * 1e3);
+    if (stream.pFileIO)
+    {
+        FileIOStats io = stream.pFileIO->Stats();
+        printf("io:           %s, %llu reads, %llu advise, %llu seeks\n", FileIOModeToString(fileIO),
+               (unsigned long long)io.nReads, (unsigned long long)io.nAdvise, (unsigned long long)io.nSeeks);
+    }
+    if (nQueueDepth > 0)
+    {
+        PacketQueueStats qs = packetQueue.Stats();
+        printf("queue depth:  %zu packets, %lld MiB\n", nQueueDepth, (long long)(nQueueBytes >> 20));
+        printf("queue occ.:   mean %.1f, peak %zu packets, peak %.1f MiB\n",
+               qs.dMeanOccupancy, qs.nPeakPackets, qs.nPeakBytes / (1024.0 * 1024.0));
+        printf("demux stalls: %llu (%.3f s)\n", (unsigned long long)qs.nProducerStalls, qs.dProducerStallSeconds);
+        printf("decode stalls: %llu (%.3f s)\n", (unsigned long long)qs.nConsumerStalls, qs.dConsumerStallSeconds);
+        if (bPacketPool)
+        {
+            PacketPoolStats pp = packetPool.Stats();
+            printf("packet pool:  %llu packets, %llu buffers in %d classes, %.1f MiB, %llu oversize\n",
+                   (unsigned long long)pp.nPackets, (unsigned long long)pp.nBufferAllocs, pp.nClasses,
+                   pp.nPoolBytes / (1024.0 * 1024.0), (unsigned long long)pp.nOversize);
+            printf("pool copies:  %.3f s, %.2f us/packet\n", pp.dAdoptSeconds,
+                   pp.nPackets ? pp.dAdoptSeconds * 1e6 / pp.nPackets : 0.0);
+        }
+    }
+    if (bFramePool)
+    {
+        FramePoolStats ps = framePool.Stats();
+        printf("frame pool:   %llu shell allocs, %llu buffer allocs, %llu buffer gets, %llu resets\n",
+               (unsigned long long)ps.nShellAllocs, (unsigned long long)ps.nBufferAllocs,
+               (unsigned long long)ps.nBufferGets, (unsigned long long)ps.nPoolResets);
+        if (nFrames > nWarmupFrames)
+        {
+            uint64_t nSteady = (ps.nShellAllocs - warmPool.nShellAllocs) + (ps.nBufferAllocs - warmPool.nBufferAllocs);
+            printf("steady state: %llu allocs over %lld frames (%.4f/frame)\n",
+                   (unsigned long long)nSteady, (long long)(nFrames - nWarmupFrames),
+                   double(nSteady) / (nFrames - nWarmupFrames));
+        }
+    }
+    printf("peak rss:     %.1f MiB\n", PeakRssBytes() / (1024.0 * 1024.0));
+    if (nMemoryBudget > 0)
+    {
+        const MemoryPlan& plan = stream.memory;
+        printf("memory plan:  %.1f MiB/frame, %d slots, %d threads, %d queued frames, %d extra hw frames\n",
+               plan.nFrameBytes / (1024.0 * 1024.0), plan.nFrameSlots, plan.nMaxThreads,
+               plan.nQueueFrames, plan.nExtraHwFrames);
+        ProcessMemoryBudget()->Print(stdout);
+    }
+    if (TracingEnabled())
+    {
+        printf("\n");
+        PrintStageSummary(stdout);
+        if (!strTrace.empty() && (ret = WriteChromeTrace(strTrace)) < 0)
+            fprintf(stderr, "%s: %s\n", strTrace.c_str(), av_err2str(ret));
+        if (!strMetrics.empty() && (ret = WritePrometheusMetrics(strMetrics)) < 0)
+            fprintf(stderr, "%s: %s\n", strMetrics.c_str(), av_err2str(ret));
+    }
+
+    av_packet_free(&pPacket);
+    CloseStream(&stream);
+
+    return 0;
+}
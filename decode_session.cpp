@@ -0,0 +1,237 @@
+#include "decode_session.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+DecodeSession::DecodeSession(int nId, const std::string& strUrl, const SessionOptions& options)
+    : m_nId(nId)
+    , m_strUrl(strUrl)
+    , m_options(options)
+    , m_memory(("session " + std::to_string(nId)).c_str(), options.nMemoryBudget, ProcessMemoryBudget())
+{
+}
+
+DecodeSession::~DecodeSession()
+{
+    Close();
+}
+
+int DecodeSession::Open()
+{
+    int ret = 0;
+    Clock::time_point tStart = Clock::now();
+    m_tOpen = tStart;
+
+    DecoderOptions decoder = m_options.decoder;
+    decoder.pFramePool = &m_framePool;
+    decoder.pMemoryBudget = &m_memory;
+
+    if ((ret = OpenStream(m_strUrl, &m_stream, decoder)) < 0)
+    {
+        Finish(ret);
+        return ret;
+    }
+    m_strBackend = m_stream.pBackend->Name();
+
+    if (!(m_pPacket = av_packet_alloc()))
+    {
+        Finish(AVERROR(ENOMEM));
+        return AVERROR(ENOMEM);
+    }
+
+    m_nBusyNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - tStart).count(),
+                        std::memory_order_relaxed);
+    return 0;
+}
+
+int DecodeSession::Step(int nPackets)
+{
+    if (Finished())
+        return m_ret.load(std::memory_order_acquire);
+
+    Clock::time_point tStart = Clock::now();
+    int ret = 0;
+
+    FrameCallback onFrame = [this](AVCodecContext* avctx, AVFrame* frame)
+    {
+        m_nFrames.fetch_add(1, std::memory_order_relaxed);
+        return m_onFrame ? m_onFrame(avctx, frame) : 0;
+    };
+
+    for (int nSent = 0; nSent < nPackets && ret >= 0; )
+    {
+        if ((ret = TracedReadFrame(m_stream.pFormatContext, m_pPacket)) < 0)
+            break;
+
+        if (m_pPacket->stream_index == m_stream.iVideo)
+        {
+            m_nBytes.fetch_add(m_pPacket->size, std::memory_order_relaxed);
+            ret = DecodeFrame(m_stream.pCodecCtx, m_pPacket, onFrame, &m_framePool, m_stream.pBackend.get());
+            nSent++;
+        }
+
+        av_packet_unref(m_pPacket);
+    }
+
+    if (ret < 0)
+    {
+        DecodeFrame(m_stream.pCodecCtx, NULL, onFrame, &m_framePool, m_stream.pBackend.get());
+        if (ret != AVERROR_EOF)
+            fprintf(stderr, "[%d] %s: %s\n", m_nId, m_strUrl.c_str(), av_err2str(ret));
+    }
+
+    m_nBusyNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - tStart).count(),
+                        std::memory_order_relaxed);
+
+    if (ret < 0)
+        Finish(ret);
+
+    return ret < 0 ? ret : 0;
+}
+
+void DecodeSession::Close()
+{
+    av_packet_free(&m_pPacket);
+    CloseStream(&m_stream);
+}
+
+void DecodeSession::Finish(int ret)
+{
+    m_nWallNs.store(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_tOpen).count(),
+                    std::memory_order_relaxed);
+    m_ret.store(ret, std::memory_order_release);
+    m_bFinished.store(true, std::memory_order_release);
+}
+
+SessionStats DecodeSession::Stats() const
+{
+    SessionStats stats;
+    stats.nId           = m_nId;
+    stats.strUrl        = m_strUrl;
+    stats.strBackend    = m_strBackend;
+    stats.nFrames       = m_nFrames.load(std::memory_order_relaxed);
+    stats.nBytes        = m_nBytes.load(std::memory_order_relaxed);
+    stats.dBusySeconds  = m_nBusyNs.load(std::memory_order_relaxed) * 1e-9;
+    stats.dWallSeconds  = m_nWallNs.load(std::memory_order_relaxed) * 1e-9;
+    stats.memory        = m_memory.Stats();
+    stats.ret           = m_ret.load(std::memory_order_acquire);
+    return stats;
+}
+
+struct SessionCompletion
+{
+    std::mutex                  lock;
+    std::condition_variable     done;
+    size_t                      nRemaining = 0;
+    WorkerPool*                 pPool = nullptr;
+    int                         nPacketsPerStep = 0;
+    // Sessions waiting for memory in submission order, and the ones let in.
+    std::deque<DecodeSession*>  pending;
+    std::vector<DecodeSession*> open;
+};
+
+// Called with the lock held. Sessions already let in may still grow to
+// their own budget, so that headroom counts as taken even before they
+// have charged it; a session without a budget only needs the process to
+// be below its limit. With nothing open there is nothing to wait for.
+static bool FitsProcessBudget(const SessionCompletion& completion, const DecodeSession* pSession)
+{
+    const MemoryBudget* pProcess = ProcessMemoryBudget();
+    const int64_t nLimit = pProcess->Limit();
+    if (nLimit <= 0 || completion.open.empty())
+        return true;
+
+    int64_t nTaken = pProcess->Current();
+    for (const DecodeSession* pOpen : completion.open)
+        nTaken += std::max<int64_t>(0, pOpen->MemoryLimit() - pOpen->MemoryInUse());
+    if (pSession->MemoryLimit() > 0)
+        return nTaken + pSession->MemoryLimit() <= nLimit;
+    return nTaken < nLimit;
+}
+
+static void ScheduleOpen(DecodeSession* pSession, std::shared_ptr<SessionCompletion> pCompletion);
+
+// Lets in pending sessions, in order, for as long as they fit.
+static void AdmitPending(std::shared_ptr<SessionCompletion> pCompletion)
+{
+    std::vector<DecodeSession*> admitted;
+    {
+        std::lock_guard<std::mutex> lock(pCompletion->lock);
+        while (!pCompletion->pending.empty() && FitsProcessBudget(*pCompletion, pCompletion->pending.front()))
+        {
+            admitted.push_back(pCompletion->pending.front());
+            pCompletion->open.push_back(pCompletion->pending.front());
+            pCompletion->pending.pop_front();
+        }
+    }
+    for (DecodeSession* pSession : admitted)
+        ScheduleOpen(pSession, pCompletion);
+}
+
+static void FinishSession(DecodeSession* pSession, std::shared_ptr<SessionCompletion> pCompletion)
+{
+    // Release the decoder and demuxer as soon as the session ends rather
+    // than when every other session has finished too.
+    pSession->Close();
+
+    {
+        std::lock_guard<std::mutex> lock(pCompletion->lock);
+        pCompletion->open.erase(std::find(pCompletion->open.begin(), pCompletion->open.end(), pSession));
+        if (--pCompletion->nRemaining == 0)
+            pCompletion->done.notify_all();
+    }
+    AdmitPending(pCompletion);
+}
+
+static void ScheduleStep(DecodeSession* pSession, std::shared_ptr<SessionCompletion> pCompletion)
+{
+    pCompletion->pPool->Submit([=]()
+    {
+        if (pSession->Step(pCompletion->nPacketsPerStep) < 0)
+        {
+            FinishSession(pSession, pCompletion);
+            return;
+        }
+
+        // Frames and packets released during the step may make room.
+        bool bPending = false;
+        {
+            std::lock_guard<std::mutex> lock(pCompletion->lock);
+            bPending = !pCompletion->pending.empty();
+        }
+        if (bPending)
+            AdmitPending(pCompletion);
+        ScheduleStep(pSession, pCompletion);
+    });
+}
+
+static void ScheduleOpen(DecodeSession* pSession, std::shared_ptr<SessionCompletion> pCompletion)
+{
+    pCompletion->pPool->Submit([=]()
+    {
+        if (pSession->Open() < 0)
+        {
+            FinishSession(pSession, pCompletion);
+            return;
+        }
+        ScheduleStep(pSession, pCompletion);
+    });
+}
+
+void RunSessions(WorkerPool* pPool, const std::vector<DecodeSession*>& sessions, int nPacketsPerStep)
+{
+    std::shared_ptr<SessionCompletion> pCompletion = std::make_shared<SessionCompletion>();
+    pCompletion->nRemaining = sessions.size();
+    pCompletion->pPool = pPool;
+    pCompletion->nPacketsPerStep = nPacketsPerStep;
+    pCompletion->pending.assign(sessions.begin(), sessions.end());
+
+    AdmitPending(pCompletion);
+
+    std::unique_lock<std::mutex> lock(pCompletion->lock);
+    pCompletion->done.wait(lock, [&]() { return pCompletion->nRemaining == 0; });
+}
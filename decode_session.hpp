@@ -0,0 +1,94 @@
+#pragma once
+
+#include "decoder.hpp"
+#include "frame_pool.hpp"
+#include "worker_pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct SessionOptions
+{
+    // pFramePool is ignored; every session recycles frames through its own
+    // pool. decoder.strBackend picks software or hw decode per session.
+    DecoderOptions  decoder;
+    // Bytes of frames, surfaces and packets the session may hold, charged
+    // under ProcessMemoryBudget(); 0 leaves only the process limit.
+    int64_t         nMemoryBudget   = 0;
+};
+
+struct SessionStats
+{
+    int             nId             = 0;
+    std::string     strUrl;
+    std::string     strBackend;
+    int64_t         nFrames         = 0;
+    int64_t         nBytes          = 0;
+    double          dBusySeconds    = 0.0;  // time spent inside Open/Step on a worker
+    double          dWallSeconds    = 0.0;  // from Open to the end of the stream
+    MemoryBudgetStats memory;
+    int             ret             = 0;    // AVERROR_EOF after a clean run
+};
+
+// One decode of one input. All demux, codec and hw device state is owned by
+// the session, so any number of sessions can run in one process. Open and
+// Step may be called from different threads, but never concurrently.
+class DecodeSession
+{
+public:
+    DecodeSession(int nId, const std::string& strUrl, const SessionOptions& options);
+    ~DecodeSession();
+
+    DecodeSession(const DecodeSession&) = delete;
+    DecodeSession& operator=(const DecodeSession&) = delete;
+
+    void            SetFrameCallback(const FrameCallback& onFrame)  { m_onFrame = onFrame; }
+
+    int             Open();
+    // Feeds up to nPackets video packets to the decoder. Returns 0 while
+    // there is more input, AVERROR_EOF once the decoder has been drained.
+    int             Step(int nPackets);
+    void            Close();
+
+    bool            Finished() const    { return m_bFinished.load(std::memory_order_acquire); }
+    // The session's own budget, 0 for none, and what is charged to it now.
+    int64_t         MemoryLimit() const { return m_options.nMemoryBudget; }
+    int64_t         MemoryInUse() const { return m_memory.Current(); }
+    SessionStats    Stats() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void            Finish(int ret);
+
+    int                     m_nId;
+    std::string             m_strUrl;
+    SessionOptions          m_options;
+    FrameCallback           m_onFrame;
+
+    // Outlives the stream and pool, whose buffers it is charged for.
+    MemoryBudget            m_memory;
+    VideoStream             m_stream;
+    FramePool               m_framePool;
+    AVPacket*               m_pPacket       = nullptr;
+
+    Clock::time_point       m_tOpen;
+    std::atomic<int64_t>    m_nWallNs{0};
+    std::atomic<int64_t>    m_nBusyNs{0};
+    std::atomic<int64_t>    m_nFrames{0};
+    std::atomic<int64_t>    m_nBytes{0};
+    std::atomic<int>        m_ret{0};
+    std::atomic<bool>       m_bFinished{false};
+    std::string             m_strBackend;
+};
+
+// Opens and decodes every session to completion on the shared pool, nPacketsPerStep
+// packets per task, so sessions interleave on the workers instead of each
+// holding a thread. A session is let in only when ProcessMemoryBudget()
+// has room for its whole budget next to what the open sessions may still
+// grow to; the rest wait in order and are let in as sessions finish or
+// release memory. Returns once all sessions have finished.
+void    RunSessions(WorkerPool* pPool, const std::vector<DecodeSession*>& sessions, int nPacketsPerStep);
@@ -0,0 +1,268 @@
+#include "decoder.hpp"
+#include "stage_trace.hpp"
+
+#include <chrono>
+#include <cstdio>
+
+int OpenStream(const std::string& strUrl, VideoStream* pStream, const DecoderOptions& options)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    int ret = 0;
+    pStream->timings.tStart = Clock::now();
+
+    AVDictionary* pOptions = nullptr;
+    if (options.bLowLatency)
+        SetLowLatencyFormatOptions(&pOptions, options.lowLatency);
+
+    AVFormatContext* pFormatContext = nullptr;
+    if (options.fileIO != FileIOMode::Default && IsLocalFile(strUrl))
+    {
+        std::unique_ptr<FileIO> pFileIO(new FileIO());
+        if ((ret = pFileIO->Open(strUrl, options.fileIO, options.nReadAheadBytes)) < 0 ||
+            !(pFormatContext = avformat_alloc_context()))
+        {
+            ret = ret < 0 ? ret : AVERROR(ENOMEM);
+            fprintf(stderr, "%s I/O: %s\n", FileIOModeToString(options.fileIO), av_err2str(ret));
+            av_dict_free(&pOptions);
+            return ret;
+        }
+        pFormatContext->pb = pFileIO->Context();
+        pFormatContext->flags |= AVFMT_FLAG_CUSTOM_IO;
+        pStream->pFileIO = std::move(pFileIO);
+    }
+
+    if (options.interrupt.callback)
+    {
+        if (!pFormatContext && !(pFormatContext = avformat_alloc_context()))
+        {
+            av_dict_free(&pOptions);
+            pStream->pFileIO.reset();
+            return AVERROR(ENOMEM);
+        }
+        pFormatContext->interrupt_callback = options.interrupt;
+    }
+
+    ret = avformat_open_input(&pFormatContext, strUrl.c_str(), nullptr, &pOptions);
+    av_dict_free(&pOptions);
+    if (ret < 0)
+    {
+        fprintf(stderr, "avformat_open_input: %s\n", av_err2str(ret));
+        pStream->pFileIO.reset();
+        return ret;
+    }
+    pStream->pFormatContext = pFormatContext;
+    pStream->timings.tInputOpened = Clock::now();
+
+    pStream->timings.bProbeCached = false;
+    if (options.pProbeCache && (ret = options.pProbeCache->Apply(strUrl, pFormatContext)) > 0)
+        pStream->timings.bProbeCached = true;
+    else
+    {
+        ret = avformat_find_stream_info(pFormatContext, nullptr);
+        if (ret < 0)
+        {
+            fprintf(stderr, "avformat_find_stream_info: %s\n", av_err2str(ret));
+            CloseStream(pStream);
+            return ret;
+        }
+        if (options.pProbeCache)
+        {
+            options.pProbeCache->Store(strUrl, pFormatContext,
+                std::chrono::duration<double>(Clock::now() - pStream->timings.tInputOpened).count());
+        }
+    }
+    pStream->timings.tStreamInfo = Clock::now();
+
+    int iVideo = -1;
+    for (unsigned int i = 0; i < pFormatContext->nb_streams; i++)
+    {
+        if (pFormatContext->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+        {
+            iVideo = static_cast<int>(i);
+        }
+    }
+    if (iVideo == -1)
+    {
+        fprintf(stderr, "Can't find video stream\n");
+        CloseStream(pStream);
+        return AVERROR_STREAM_NOT_FOUND;
+    }
+    pStream->iVideo = iVideo;
+
+    const AVCodec* pCodec = avcodec_find_decoder(pFormatContext->streams[iVideo]->codecpar->codec_id);
+    if (!pCodec)
+    {
+        fprintf(stderr, "avcodec_find_decoder: no decoder for %s\n",
+                avcodec_get_name(pFormatContext->streams[iVideo]->codecpar->codec_id));
+        CloseStream(pStream);
+        return AVERROR_DECODER_NOT_FOUND;
+    }
+
+    AVCodecContext* pCodecCtx = avcodec_alloc_context3(pCodec);
+    if (!pCodecCtx)
+    {
+        fprintf(stderr, "avcodec_alloc_context3 failed\n");
+        CloseStream(pStream);
+        return AVERROR(ENOMEM);
+    }
+    pStream->pCodecCtx = pCodecCtx;
+
+    ret = avcodec_parameters_to_context(pCodecCtx, pFormatContext->streams[iVideo]->codecpar);
+    if (ret < 0)
+    {
+        fprintf(stderr, "avcodec_parameters_to_context: %s\n", av_err2str(ret));
+        CloseStream(pStream);
+        return ret;
+    }
+
+    pCodecCtx->pkt_timebase = pFormatContext->streams[iVideo]->time_base;
+
+    if (options.bKeyframesOnly)
+    {
+        pFormatContext->streams[iVideo]->discard = AVDISCARD_NONKEY;
+        pCodecCtx->skip_frame = AVDISCARD_NONKEY;
+    }
+
+    if (options.pFramePool)
+    {
+        options.pFramePool->SetMemoryBudget(options.pMemoryBudget);
+        options.pFramePool->Attach(pCodecCtx);
+    }
+
+    ApplyThreadingConfig(pCodecCtx, options.threading);
+    if (options.bLowLatency)
+        ApplyLowLatencyCodecOptions(pCodecCtx);
+
+    if ((ret = CreateBackend(options.strBackend, pCodec, options.bDownloadHWFrames, &pStream->pBackend)) < 0 ||
+        (ret = pStream->pBackend->Configure(pCodecCtx)) < 0)
+    {
+        fprintf(stderr, "decode backend %s: %s\n", options.strBackend.c_str(), av_err2str(ret));
+        CloseStream(pStream);
+        return ret;
+    }
+
+    pStream->reduced = ReducedDecode();
+    if (options.nViewportWidth > 0 && options.nViewportHeight > 0)
+    {
+        pStream->reduced = ChooseReducedDecode(pCodec, pCodecCtx->width, pCodecCtx->height,
+                                               pCodecCtx->sample_aspect_ratio, options.nViewportWidth,
+                                               options.nViewportHeight, pStream->pBackend->IsHardware());
+        ApplyReducedDecode(pCodecCtx, pStream->reduced);
+    }
+
+    pStream->memory = MemoryPlan();
+    if (options.pMemoryBudget)
+    {
+        pStream->pBackend->SetMemoryBudget(options.pMemoryBudget);
+        pStream->memory = PlanMemory(options.pMemoryBudget->EffectiveLimit(),
+                                     EstimateFrameBytes(pCodecCtx->pix_fmt,
+                                                        AV_CEIL_RSHIFT(pCodecCtx->width, pCodecCtx->lowres),
+                                                        AV_CEIL_RSHIFT(pCodecCtx->height, pCodecCtx->lowres)));
+        // Frame threading holds a frame per thread on top of the references.
+        const int nMaxThreads = pStream->memory.nMaxThreads;
+        if (nMaxThreads > 0 && (pCodecCtx->thread_count == 0 || pCodecCtx->thread_count > nMaxThreads))
+            pCodecCtx->thread_count = nMaxThreads;
+        if (pStream->pBackend->IsHardware())
+            pCodecCtx->extra_hw_frames = pStream->memory.nExtraHwFrames;
+    }
+
+    ret = avcodec_open2(pCodecCtx, pCodec, nullptr);
+    if (ret < 0)
+    {
+        fprintf(stderr, "avcodec_open2: %s\n", av_err2str(ret));
+        CloseStream(pStream);
+        return ret;
+    }
+    pStream->timings.tDecoderOpened = Clock::now();
+
+    return 0;
+}
+
+void CloseStream(VideoStream* pStream)
+{
+    avcodec_free_context(&pStream->pCodecCtx);
+    avformat_close_input(&pStream->pFormatContext);
+    pStream->pFileIO.reset();
+    pStream->pBackend.reset();
+    pStream->iVideo = -1;
+}
+
+int TracedReadFrame(AVFormatContext* pFormatContext, AVPacket* pPacket)
+{
+    ScopedStage stage(TraceStage::Read);
+    return av_read_frame(pFormatContext, pPacket);
+}
+
+int DecodeFrame(AVCodecContext* avctx, AVPacket* packet, const FrameCallback& onFrame,
+                FramePool* pFramePool, DecodeBackend* pBackend)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    AVFrame* frame = NULL;
+    int ret;
+
+    Clock::time_point tStart = Clock::now();
+    double dDecode = 0.0;
+
+    {
+        ScopedStage stage(TraceStage::SendPacket);
+        ret = avcodec_send_packet(avctx, packet);
+    }
+    if (ret < 0)
+    {
+        fprintf(stderr, "Error during decoding: %s\n", av_err2str(ret));
+        return ret;
+    }
+
+    // One frame serves every receive of this call: it is unreferenced after
+    // each delivery and only goes back to the pool (or the heap) at the end.
+    frame = pFramePool ? pFramePool->Acquire() : av_frame_alloc();
+    if (!frame)
+    {
+        fprintf(stderr, "Can not alloc frame\n");
+        return AVERROR(ENOMEM);
+    }
+
+    while (true)
+    {
+        {
+            ScopedStage stage(TraceStage::ReceiveFrame);
+            ret = avcodec_receive_frame(avctx, frame);
+        }
+
+        Clock::time_point tNow = Clock::now();
+        dDecode += std::chrono::duration<double>(tNow - tStart).count();
+
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+        {
+            ret = 0;
+            break;
+        }
+        else if (ret < 0)
+        {
+            fprintf(stderr, "Error while decoding: %s\n", av_err2str(ret));
+            break;
+        }
+
+        AVFrame* pOut = frame;
+        if (pBackend && (ret = pBackend->Deliver(frame, &pOut)) < 0)
+            break;
+
+        if (onFrame && (ret = onFrame(avctx, pOut)) < 0)
+            break;
+
+        av_frame_unref(frame);
+        tStart = Clock::now();
+    }
+
+    if (pBackend)
+        pBackend->AddDecodeTime(dDecode);
+
+    if (pFramePool)
+        pFramePool->Release(frame);
+    else
+        av_frame_free(&frame);
+
+    return ret;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "av_err2string.hpp"
+#include "decode_backend.hpp"
+#include "decoder_threading.hpp"
+#include "file_io.hpp"
+#include "frame_pool.hpp"
+#include "live_profile.hpp"
+#include "memory_budget.hpp"
+#include "probe_cache.hpp"
+#include "reduced_decode.hpp"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+// Receives every frame DecodeFrame pulls out of the decoder. The frame is
+// only valid for the duration of the call; keep it with av_frame_ref. A
+// negative return stops DecodeFrame and is passed on to its caller.
+typedef std::function<int(AVCodecContext*, AVFrame*)> FrameCallback;
+
+struct DecoderOptions
+{
+    // When set, the pool's get_buffer2 is attached to the decoder and
+    // DecodeFrame takes its frame shell from the pool.
+    FramePool*          pFramePool      = nullptr;
+    ThreadingConfig     threading;
+    // See CreateBackend: "software", "auto", a hwdevice type or a list.
+    std::string         strBackend      = "software";
+    // Download hw surfaces to system memory before delivering them.
+    bool                bDownloadHWFrames = true;
+    // Drop non-key packets in the demuxer, which for indexed containers
+    // skips reading them, and have the decoder skip any that get through.
+    bool                bKeyframesOnly  = false;
+    // Open and decode with the live profile: small probe, no demuxer
+    // buffering, low-delay decoding and no frame threading.
+    bool                bLowLatency     = false;
+    LowLatencyProfile   lowLatency;
+    // Skip avformat_find_stream_info for files the cache has seen before.
+    ProbeCache*         pProbeCache     = nullptr;
+    // I/O for local files; other URLs always use their protocol.
+    FileIOMode          fileIO          = FileIOMode::Default;
+    size_t              nReadAheadBytes = 4 << 20;
+    // Size the frames end up at. When it is a quarter of the source area or
+    // less, the decoder takes the cheaper paths of ChooseReducedDecode.
+    int                 nViewportWidth  = 0;
+    int                 nViewportHeight = 0;
+    // Charged with the frame pool's buffers and hw surfaces. Its limit (or
+    // the smallest of its parents') caps frame threads and extra hw frames,
+    // see PlanMemory; the result is VideoStream::memory. Packet queues take
+    // the budget separately (PacketQueue::SetMemoryBudget).
+    MemoryBudget*       pMemoryBudget   = nullptr;
+    // Installed on the format context before the input is opened, so a
+    // blocking open, probe or read can be abandoned (AVERROR_EXIT).
+    AVIOInterruptCB     interrupt       = { nullptr, nullptr };
+};
+
+// When each step of OpenStream finished, for time-to-first-frame reports.
+struct OpenTimings
+{
+    std::chrono::steady_clock::time_point   tStart;
+    std::chrono::steady_clock::time_point   tInputOpened;
+    std::chrono::steady_clock::time_point   tStreamInfo;
+    std::chrono::steady_clock::time_point   tDecoderOpened;
+    bool                                    bProbeCached = false;
+};
+
+struct VideoStream
+{
+    AVFormatContext*    pFormatContext  = nullptr;
+    AVCodecContext*     pCodecCtx       = nullptr;
+    int                 iVideo          = -1;
+    std::unique_ptr<DecodeBackend>  pBackend;
+    // Set when the input is read through FileIO; outlives pFormatContext.
+    std::unique_ptr<FileIO>         pFileIO;
+    OpenTimings         timings;
+    // What OpenStream chose for DecoderOptions' viewport; the caller does
+    // the early downscale, to reduced.nOutputWidth x nOutputHeight.
+    ReducedDecode       reduced;
+    MemoryPlan          memory;
+};
+
+// Portable, window-less counterparts of the functions in hw_d3d11va.cpp.
+// Everything returns an AVERROR code and reports failures on stderr.
+int     OpenStream(const std::string& strUrl, VideoStream* pStream,
+                   const DecoderOptions& options = DecoderOptions());
+void    CloseStream(VideoStream* pStream);
+// With a backend, decode time is charged to it and frames go through its
+// Deliver before reaching onFrame.
+int     DecodeFrame(AVCodecContext* avctx, AVPacket* packet, const FrameCallback& onFrame,
+                    FramePool* pFramePool = nullptr, DecodeBackend* pBackend = nullptr);
+// av_read_frame, timed as TraceStage::Read when tracing is on.
+int     TracedReadFrame(AVFormatContext* pFormatContext, AVPacket* pPacket);
@@ -0,0 +1,241 @@
+#include "decoder_threading.hpp"
+#include "decoder.hpp"
+#include "bench_stats.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+int ParseThreadingConfig(const std::string& str, ThreadingConfig* pConfig)
+{
+    ThreadingConfig config;
+    std::string strMode = str;
+    std::string strCount;
+
+    size_t colon = str.find(':');
+    if (colon != std::string::npos)
+    {
+        strMode = str.substr(0, colon);
+        strCount = str.substr(colon + 1);
+    }
+
+    if (strMode == "default")
+        config.mode = ThreadMode::Default;
+    else if (strMode == "none")
+        config.mode = ThreadMode::None;
+    else if (strMode == "frame")
+        config.mode = ThreadMode::Frame;
+    else if (strMode == "slice")
+        config.mode = ThreadMode::Slice;
+    else if (strMode == "both")
+        config.mode = ThreadMode::FrameAndSlice;
+    else
+        return AVERROR(EINVAL);
+
+    if (!strCount.empty() && strCount != "auto")
+    {
+        char* end = nullptr;
+        long n = strtol(strCount.c_str(), &end, 10);
+        if (*end != '\0' || n < 0)
+            return AVERROR(EINVAL);
+        config.nThreads = static_cast<int>(n);
+    }
+
+    *pConfig = config;
+    return 0;
+}
+
+std::string ThreadingConfigToString(const ThreadingConfig& config)
+{
+    std::string str;
+    switch (config.mode)
+    {
+        case ThreadMode::Default:       return "default";
+        case ThreadMode::None:          return "none";
+        case ThreadMode::Frame:         str = "frame"; break;
+        case ThreadMode::Slice:         str = "slice"; break;
+        case ThreadMode::FrameAndSlice: str = "both"; break;
+    }
+    return str + ":" + (config.nThreads > 0 ? std::to_string(config.nThreads) : std::string("auto"));
+}
+
+std::string ActiveThreadTypeToString(int activeThreadType)
+{
+    if ((activeThreadType & FF_THREAD_FRAME) && (activeThreadType & FF_THREAD_SLICE))
+        return "frame+slice";
+    if (activeThreadType & FF_THREAD_FRAME)
+        return "frame";
+    if (activeThreadType & FF_THREAD_SLICE)
+        return "slice";
+    return "none";
+}
+
+void ApplyThreadingConfig(AVCodecContext* avctx, const ThreadingConfig& config)
+{
+    switch (config.mode)
+    {
+        case ThreadMode::Default:
+            return;
+        case ThreadMode::None:
+            avctx->thread_count = 1;
+            avctx->thread_type = 0;
+            return;
+        case ThreadMode::Frame:
+            avctx->thread_type = FF_THREAD_FRAME;
+            break;
+        case ThreadMode::Slice:
+            avctx->thread_type = FF_THREAD_SLICE;
+            break;
+        case ThreadMode::FrameAndSlice:
+            avctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+            break;
+    }
+    avctx->thread_count = config.nThreads;
+}
+
+static int RunTrial(const std::string& strUrl, int nGops, ThreadingTrial* pTrial)
+{
+    DecoderOptions options;
+    options.threading = pTrial->config;
+
+    VideoStream stream;
+    int ret = OpenStream(strUrl, &stream, options);
+    if (ret < 0)
+        return ret;
+
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+    {
+        CloseStream(&stream);
+        return AVERROR(ENOMEM);
+    }
+
+    int64_t nFrames = 0;
+    int nPacketsSent = 0;
+    int nKeyframes = 0;
+    BenchClock::time_point tFirstSend;
+
+    FrameCallback onFrame = [&](AVCodecContext*, AVFrame*)
+    {
+        if (nFrames++ == 0)
+        {
+            pTrial->dFirstFrameMs = ElapsedSeconds(tFirstSend, BenchClock::now()) * 1e3;
+            pTrial->nPipelineDelay = nPacketsSent;
+        }
+        return 0;
+    };
+
+    BenchClock::time_point tStart = BenchClock::now();
+
+    while (ret >= 0)
+    {
+        if ((ret = av_read_frame(stream.pFormatContext, pPacket)) < 0)
+            break;
+
+        if (pPacket->stream_index == stream.iVideo)
+        {
+            // Stop at the start of GOP nGops + 1.
+            if ((pPacket->flags & AV_PKT_FLAG_KEY) && ++nKeyframes > nGops)
+            {
+                av_packet_unref(pPacket);
+                break;
+            }
+            if (nPacketsSent++ == 0)
+                tFirstSend = BenchClock::now();
+            ret = DecodeFrame(stream.pCodecCtx, pPacket, onFrame);
+        }
+
+        av_packet_unref(pPacket);
+    }
+    DecodeFrame(stream.pCodecCtx, NULL, onFrame);
+
+    double dElapsed = ElapsedSeconds(tStart, BenchClock::now());
+
+    pTrial->activeThreadType = stream.pCodecCtx->active_thread_type;
+    pTrial->nFrames = nFrames;
+    pTrial->dFps = dElapsed > 0 ? nFrames / dElapsed : 0.0;
+
+    av_packet_free(&pPacket);
+    CloseStream(&stream);
+
+    return (ret < 0 && ret != AVERROR_EOF) ? ret : 0;
+}
+
+int AutoTuneThreading(const std::string& strUrl, int nGops,
+                      ThreadingConfig* pBest, std::vector<ThreadingTrial>* pTrials)
+{
+    int ret = 0;
+
+    // Probe the codec's capabilities and, as a side effect, warm the page
+    // cache so the single-threaded baseline is not penalised for cold I/O.
+    VideoStream probe;
+    if ((ret = OpenStream(strUrl, &probe)) < 0)
+        return ret;
+    const int capabilities = probe.pCodecCtx->codec->capabilities;
+    AVRational frameRate = probe.pFormatContext->streams[probe.iVideo]->avg_frame_rate;
+    CloseStream(&probe);
+
+    std::vector<ThreadingConfig> candidates;
+    candidates.push_back({ ThreadMode::None, 1 });
+
+    int nCores = static_cast<int>(std::thread::hardware_concurrency());
+    if (nCores < 1)
+        nCores = 1;
+    std::vector<int> counts;
+    for (int n = 2; n < nCores; n *= 2)
+        counts.push_back(n);
+    if (nCores > 1)
+        counts.push_back(nCores);
+
+    for (int n : counts)
+    {
+        if (capabilities & AV_CODEC_CAP_FRAME_THREADS)
+            candidates.push_back({ ThreadMode::Frame, n });
+        if (capabilities & AV_CODEC_CAP_SLICE_THREADS)
+            candidates.push_back({ ThreadMode::Slice, n });
+        if ((capabilities & AV_CODEC_CAP_FRAME_THREADS) && (capabilities & AV_CODEC_CAP_SLICE_THREADS))
+            candidates.push_back({ ThreadMode::FrameAndSlice, n });
+    }
+
+    std::vector<ThreadingTrial> trials;
+    for (const ThreadingConfig& config : candidates)
+    {
+        ThreadingTrial trial;
+        trial.config = config;
+        if ((ret = RunTrial(strUrl, nGops, &trial)) < 0)
+        {
+            fprintf(stderr, "threading trial %s failed: %s\n",
+                    ThreadingConfigToString(config).c_str(), av_err2str(ret));
+            continue;
+        }
+        trials.push_back(trial);
+    }
+    if (trials.empty())
+        return AVERROR(EINVAL);
+
+    // Trial 0 is single-threaded; anything it already holds back for
+    // reordering is not attributable to threading.
+    double dFrameMs = (frameRate.num > 0 && frameRate.den > 0) ? 1e3 / av_q2d(frameRate) : 0.0;
+    for (ThreadingTrial& trial : trials)
+        trial.dAddedLatencyMs = FFMAX(0, trial.nPipelineDelay - trials[0].nPipelineDelay) * dFrameMs;
+
+    const ThreadingTrial* pFastest = &trials[0];
+    for (const ThreadingTrial& trial : trials)
+    {
+        if (trial.dFps > pFastest->dFps)
+            pFastest = &trial;
+    }
+
+    const ThreadingTrial* pChosen = pFastest;
+    for (const ThreadingTrial& trial : trials)
+    {
+        if (trial.dFps >= pFastest->dFps * 0.97 && trial.nPipelineDelay < pChosen->nPipelineDelay)
+            pChosen = &trial;
+    }
+
+    *pBest = pChosen->config;
+    if (pTrials)
+        *pTrials = trials;
+
+    return 0;
+}
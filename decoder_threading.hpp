@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+enum class ThreadMode
+{
+    Default,        // leave thread_count/thread_type to libavcodec
+    None,           // single-threaded decode
+    Frame,
+    Slice,
+    FrameAndSlice,
+};
+
+struct ThreadingConfig
+{
+    ThreadMode  mode        = ThreadMode::Default;
+    int         nThreads    = 0;    // 0 lets libavcodec size the pool from the core count
+};
+
+// Accepts "none", "frame", "slice" or "both", optionally followed by
+// ":N" or ":auto", e.g. "frame:8".
+int             ParseThreadingConfig(const std::string& str, ThreadingConfig* pConfig);
+std::string     ThreadingConfigToString(const ThreadingConfig& config);
+std::string     ActiveThreadTypeToString(int activeThreadType);
+
+// Sets thread_count/thread_type before avcodec_open2. Modes the codec does
+// not support are masked out by libavcodec itself; check active_thread_type
+// after opening.
+void            ApplyThreadingConfig(AVCodecContext* avctx, const ThreadingConfig& config);
+
+struct ThreadingTrial
+{
+    ThreadingConfig config;
+    int             activeThreadType    = 0;
+    int64_t         nFrames             = 0;
+    double          dFps                = 0.0;
+    double          dFirstFrameMs       = 0.0;  // wall time from the first packet sent to the first frame out
+    int             nPipelineDelay      = 0;    // packets sent before the first frame came out
+    double          dAddedLatencyMs     = 0.0;  // extra delay over single-threaded decode, in stream time
+};
+
+// Decodes the first nGops GOPs of the input once per candidate configuration
+// (single-threaded, then frame/slice/both at a few thread counts the codec
+// supports) and picks the fastest. Configurations within 3% of the best are
+// considered equal and the one adding the least latency wins.
+int             AutoTuneThreading(const std::string& strUrl, int nGops,
+                                  ThreadingConfig* pBest, std::vector<ThreadingTrial>* pTrials);
@@ -0,0 +1,109 @@
+#include "demux_thread.hpp"
+#include "av_err2string.hpp"
+#include "stage_trace.hpp"
+
+#include <chrono>
+#include <cstdio>
+
+DemuxThread::~DemuxThread()
+{
+    Stop();
+}
+
+int DemuxThread::AddStream(int iStream, PacketQueue* pQueue)
+{
+    if (m_thread.joinable())
+        return AVERROR(EBUSY);
+
+    m_routes.push_back({ iStream, pQueue });
+    return 0;
+}
+
+int DemuxThread::Start(AVFormatContext* pFormatContext, int iStream, PacketQueue* pQueue)
+{
+    if (m_thread.joinable())
+        return AVERROR(EBUSY);
+
+    m_pFormatContext = pFormatContext;
+    m_routes.insert(m_routes.begin(), { iStream, pQueue });
+    m_ret.store(0, std::memory_order_release);
+    m_nBytesRead.store(0, std::memory_order_relaxed);
+
+    m_thread = std::thread(&DemuxThread::Run, this);
+    return 0;
+}
+
+void DemuxThread::Stop()
+{
+    for (const Route& route : m_routes)
+        route.pQueue->Abort();
+    Join();
+}
+
+void DemuxThread::CloseQueues()
+{
+    for (const Route& route : m_routes)
+        route.pQueue->Close();
+}
+
+void DemuxThread::Join()
+{
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void DemuxThread::Run()
+{
+    int ret = 0;
+    SetTraceThreadName("demux");
+    std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+    m_nRunNs.store(0, std::memory_order_relaxed);
+
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+    {
+        fprintf(stderr, "av_packet_alloc failed\n");
+        m_ret.store(AVERROR(ENOMEM), std::memory_order_release);
+        CloseQueues();
+        return;
+    }
+
+    while (ret >= 0)
+    {
+        {
+            ScopedStage stage(TraceStage::Read);
+            ret = av_read_frame(m_pFormatContext, pPacket);
+        }
+        if (ret < 0)
+            break;
+
+        m_nBytesRead.fetch_add(pPacket->size, std::memory_order_relaxed);
+        if (m_pPacketPool && (ret = m_pPacketPool->Adopt(pPacket)) < 0)
+        {
+            av_packet_unref(pPacket);
+            break;
+        }
+        if (m_pFanout)
+            m_pFanout->Deliver(pPacket);
+
+        for (const Route& route : m_routes)
+        {
+            if (pPacket->stream_index == route.iStream)
+            {
+                ret = route.pQueue->Push(pPacket);
+                break;
+            }
+        }
+
+        av_packet_unref(pPacket);
+    }
+
+    if (ret < 0 && ret != AVERROR_EOF && ret != AVERROR_EXIT)
+        fprintf(stderr, "av_read_frame: %s\n", av_err2str(ret));
+
+    av_packet_free(&pPacket);
+    m_nRunNs.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - tStart).count(), std::memory_order_release);
+    m_ret.store(ret, std::memory_order_release);
+    CloseQueues();
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "packet_fanout.hpp"
+#include "packet_pool.hpp"
+#include "packet_queue.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+// Runs av_read_frame on its own thread and feeds the packets of one stream
+// into a PacketQueue, so container parsing and I/O stalls overlap decoding.
+// More streams can be routed to queues of their own with AddStream; packets
+// of other streams are dropped. The queues are closed at end of input.
+//
+// A full queue blocks every stream, so queues of streams that are consumed
+// at a fixed rate (audio) need room for the other queues' depth in time.
+// A PacketFanout sees every packet read, routed or not, and never blocks.
+class DemuxThread
+{
+public:
+    DemuxThread() = default;
+    ~DemuxThread();
+
+    DemuxThread(const DemuxThread&) = delete;
+    DemuxThread& operator=(const DemuxThread&) = delete;
+
+    // Before Start: also deliver iStream's packets, into pQueue.
+    int         AddStream(int iStream, PacketQueue* pQueue);
+    // Before Start: also hand every packet read to pFanout's sinks.
+    void        SetFanout(PacketFanout* pFanout)    { m_pFanout = pFanout; }
+    // Before Start: move every payload read into pPool's buffers before it
+    // is queued or handed to the fanout.
+    void        SetPacketPool(PacketPool* pPool)    { m_pPacketPool = pPool; }
+    int         Start(AVFormatContext* pFormatContext, int iStream, PacketQueue* pQueue);
+    // Aborts the queue and joins the thread.
+    void        Stop();
+    void        Join();
+
+    // The error that ended the read loop, AVERROR_EOF on a clean end of input.
+    int         Result() const      { return m_ret.load(std::memory_order_acquire); }
+    int64_t     BytesRead() const   { return m_nBytesRead.load(std::memory_order_relaxed); }
+    // How long the read loop ran, set when it ends.
+    double      RunSeconds() const  { return m_nRunNs.load(std::memory_order_acquire) * 1e-9; }
+
+private:
+    struct Route
+    {
+        int             iStream;
+        PacketQueue*    pQueue;
+    };
+
+    void        Run();
+    void        CloseQueues();
+
+    std::thread             m_thread;
+    AVFormatContext*        m_pFormatContext    = nullptr;
+    std::vector<Route>      m_routes;
+    PacketFanout*           m_pFanout           = nullptr;
+    PacketPool*             m_pPacketPool       = nullptr;
+    std::atomic<int>        m_ret{0};
+    std::atomic<int64_t>    m_nBytesRead{0};
+    std::atomic<int64_t>    m_nRunNs{0};
+};
@@ -0,0 +1,330 @@
+#include "file_io.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define HAVE_MMAP 1
+#endif
+
+extern "C"
+{
+#include <libavutil/mem.h>
+}
+
+// Buffer avio copies through; reads are served from the map or the window.
+static const int    kAvioBufferSize = 256 * 1024;
+static const size_t kPageSize       = 4096;
+
+int ParseFileIOMode(const std::string& str, FileIOMode* pMode)
+{
+    if (str == "default")
+        *pMode = FileIOMode::Default;
+    else if (str == "mmap")
+        *pMode = FileIOMode::Mmap;
+    else if (str == "readahead")
+        *pMode = FileIOMode::ReadAhead;
+    else
+        return AVERROR(EINVAL);
+    return 0;
+}
+
+const char* FileIOModeToString(FileIOMode mode)
+{
+    switch (mode)
+    {
+        case FileIOMode::Default:   return "default";
+        case FileIOMode::Mmap:      return "mmap";
+        case FileIOMode::ReadAhead: return "readahead";
+    }
+    return "?";
+}
+
+static std::string LocalPath(const std::string& strUrl)
+{
+    if (strUrl.compare(0, 5, "file:") == 0)
+        return strUrl.substr(5);
+    return strUrl;
+}
+
+bool IsLocalFile(const std::string& strUrl)
+{
+    if (strUrl.find("://") != std::string::npos && strUrl.compare(0, 5, "file:") != 0)
+        return false;
+    struct stat st;
+    return stat(LocalPath(strUrl).c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG;
+}
+
+struct MappedFile
+{
+    void*       pData   = nullptr;
+    int64_t     nSize   = 0;
+    int64_t     nMtime  = 0;
+
+    ~MappedFile()
+    {
+#ifdef HAVE_MMAP
+        if (pData)
+            munmap(pData, static_cast<size_t>(nSize));
+#endif
+    }
+};
+
+#ifdef HAVE_MMAP
+// Live mappings by path. An entry expires with its last FileIO; a file that
+// changed size or mtime since is mapped afresh.
+static std::mutex                                       g_mapLock;
+static std::map<std::string, std::weak_ptr<MappedFile>> g_maps;
+
+static int AcquireMapping(const std::string& strPath, int fd, const struct stat& st,
+                          std::shared_ptr<MappedFile>* ppMap)
+{
+    std::lock_guard<std::mutex> lock(g_mapLock);
+
+    std::shared_ptr<MappedFile> pMap = g_maps[strPath].lock();
+    if (pMap && pMap->nSize == st.st_size && pMap->nMtime == st.st_mtime)
+    {
+        *ppMap = pMap;
+        return 0;
+    }
+
+    pMap = std::make_shared<MappedFile>();
+    pMap->nSize = st.st_size;
+    pMap->nMtime = st.st_mtime;
+    if (pMap->nSize > 0)
+    {
+        void* pData = mmap(nullptr, static_cast<size_t>(pMap->nSize), PROT_READ, MAP_SHARED, fd, 0);
+        if (pData == MAP_FAILED)
+            return AVERROR(errno);
+        pMap->pData = pData;
+    }
+    g_maps[strPath] = pMap;
+    *ppMap = pMap;
+    return 0;
+}
+#endif
+
+FileIO::~FileIO()
+{
+    Close();
+}
+
+void FileIO::Close()
+{
+    if (m_pContext)
+    {
+        av_freep(&m_pContext->buffer);
+        avio_context_free(&m_pContext);
+    }
+    av_freep(&m_pWindow);
+    m_pMap.reset();
+#ifdef HAVE_MMAP
+    if (m_fd >= 0)
+        close(m_fd);
+#endif
+    m_fd = -1;
+    m_nSize = 0;
+    m_nPos = 0;
+    m_nWindowStart = 0;
+    m_nWindowLen = 0;
+    m_nAdvisedUntil = 0;
+    m_stats = FileIOStats();
+}
+
+int FileIO::Open(const std::string& strUrl, FileIOMode mode, size_t nWindowBytes)
+{
+    Close();
+    if (mode == FileIOMode::Default)
+        return AVERROR(EINVAL);
+
+#ifdef HAVE_MMAP
+    const std::string strPath = LocalPath(strUrl);
+    m_mode = mode;
+    m_nWindowBytes = std::max(FFALIGN(nWindowBytes, kPageSize), size_t(kAvioBufferSize));
+
+    if ((m_fd = open(strPath.c_str(), O_RDONLY)) < 0)
+        return AVERROR(errno);
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+    {
+        int ret = AVERROR(errno);
+        Close();
+        return ret;
+    }
+    m_nSize = st.st_size;
+
+    int ret = 0;
+    if (mode == FileIOMode::Mmap)
+    {
+        if ((ret = AcquireMapping(strPath, m_fd, st, &m_pMap)) < 0)
+        {
+            Close();
+            return ret;
+        }
+        // The mapping holds its own reference to the file.
+        close(m_fd);
+        m_fd = -1;
+    }
+    else
+    {
+        if (!(m_pWindow = static_cast<uint8_t*>(av_malloc(m_nWindowBytes))))
+        {
+            Close();
+            return AVERROR(ENOMEM);
+        }
+#ifdef POSIX_FADV_SEQUENTIAL
+        // Doubles the kernel's own read-ahead on this descriptor.
+        posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        m_stats.nAdvise++;
+#endif
+    }
+
+    uint8_t* pBuffer = static_cast<uint8_t*>(av_malloc(kAvioBufferSize));
+    if (!pBuffer)
+    {
+        Close();
+        return AVERROR(ENOMEM);
+    }
+    m_pContext = avio_alloc_context(pBuffer, kAvioBufferSize, 0, this, &FileIO::ReadPacket, nullptr, &FileIO::Seek);
+    if (!m_pContext)
+    {
+        av_free(pBuffer);
+        Close();
+        return AVERROR(ENOMEM);
+    }
+    m_pContext->seekable = AVIO_SEEKABLE_NORMAL;
+    return 0;
+#else
+    (void)strUrl;
+    (void)nWindowBytes;
+    return AVERROR(ENOSYS);
+#endif
+}
+
+int FileIO::ReadPacket(void* opaque, uint8_t* buf, int size)
+{
+    FileIO* pThis = static_cast<FileIO*>(opaque);
+    if (pThis->m_nPos >= pThis->m_nSize)
+        return AVERROR_EOF;
+
+    int ret = pThis->m_pMap ? pThis->ReadMapped(buf, size) : pThis->ReadWindow(buf, size);
+    if (ret > 0)
+    {
+        pThis->m_nPos += ret;
+        pThis->m_stats.nBytes += ret;
+    }
+    return ret;
+}
+
+int FileIO::ReadMapped(uint8_t* buf, int size)
+{
+#ifdef HAVE_MMAP
+    const uint8_t* pData = static_cast<const uint8_t*>(m_pMap->pData);
+    int n = static_cast<int>(std::min<int64_t>(size, m_nSize - m_nPos));
+
+    // Ask for the next window while half of the current one is left, so
+    // page faults find the pages already read in.
+    if (m_nPos + int64_t(m_nWindowBytes / 2) >= m_nAdvisedUntil)
+    {
+        int64_t nStart = std::max(m_nAdvisedUntil, m_nPos) & ~int64_t(kPageSize - 1);
+        int64_t nEnd = std::min(m_nPos + int64_t(m_nWindowBytes), m_nSize);
+        if (nEnd > nStart)
+        {
+            madvise(const_cast<uint8_t*>(pData) + nStart, static_cast<size_t>(nEnd - nStart), MADV_WILLNEED);
+            m_stats.nAdvise++;
+        }
+        m_nAdvisedUntil = nEnd;
+    }
+
+    memcpy(buf, pData + m_nPos, n);
+    return n;
+#else
+    (void)buf;
+    (void)size;
+    return AVERROR(ENOSYS);
+#endif
+}
+
+int FileIO::ReadWindow(uint8_t* buf, int size)
+{
+#ifdef HAVE_MMAP
+    if (m_nPos < m_nWindowStart || m_nPos >= m_nWindowStart + int64_t(m_nWindowLen))
+    {
+        // Windows start on page boundaries so the kernel copies whole pages.
+        m_nWindowStart = m_nPos & ~int64_t(kPageSize - 1);
+        ssize_t n;
+        do
+        {
+            n = pread(m_fd, m_pWindow, m_nWindowBytes, m_nWindowStart);
+        } while (n < 0 && errno == EINTR);
+        m_stats.nReads++;
+        if (n < 0)
+        {
+            m_nWindowLen = 0;
+            return AVERROR(errno);
+        }
+        m_nWindowLen = static_cast<size_t>(n);
+        if (m_nPos >= m_nWindowStart + int64_t(m_nWindowLen))
+            return AVERROR_EOF;
+
+#ifdef POSIX_FADV_WILLNEED
+        // Start reading the following window while this one is parsed.
+        int64_t nNext = m_nWindowStart + int64_t(m_nWindowLen);
+        if (nNext < m_nSize && nNext >= m_nAdvisedUntil)
+        {
+            posix_fadvise(m_fd, nNext, static_cast<off_t>(m_nWindowBytes), POSIX_FADV_WILLNEED);
+            m_stats.nAdvise++;
+            m_nAdvisedUntil = nNext + int64_t(m_nWindowBytes);
+        }
+#endif
+    }
+    else
+        m_stats.nWindowHits++;
+
+    size_t nOffset = static_cast<size_t>(m_nPos - m_nWindowStart);
+    int n = static_cast<int>(std::min<size_t>(size, m_nWindowLen - nOffset));
+    memcpy(buf, m_pWindow + nOffset, n);
+    return n;
+#else
+    (void)buf;
+    (void)size;
+    return AVERROR(ENOSYS);
+#endif
+}
+
+int64_t FileIO::Seek(void* opaque, int64_t offset, int whence)
+{
+    FileIO* pThis = static_cast<FileIO*>(opaque);
+
+    if (whence & AVSEEK_SIZE)
+        return pThis->m_nSize;
+
+    int64_t nPos;
+    switch (whence & ~AVSEEK_FORCE)
+    {
+        case SEEK_SET:  nPos = offset; break;
+        case SEEK_CUR:  nPos = pThis->m_nPos + offset; break;
+        case SEEK_END:  nPos = pThis->m_nSize + offset; break;
+        default:        return AVERROR(EINVAL);
+    }
+    if (nPos < 0)
+        return AVERROR(EINVAL);
+
+    pThis->m_nPos = std::min(nPos, pThis->m_nSize);
+    pThis->m_stats.nSeeks++;
+    // A seek away from the advised range restarts the hints from there.
+    if (pThis->m_nPos < pThis->m_nAdvisedUntil - int64_t(pThis->m_nWindowBytes) ||
+        pThis->m_nPos > pThis->m_nAdvisedUntil)
+        pThis->m_nAdvisedUntil = pThis->m_nPos;
+    return pThis->m_nPos;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+enum class FileIOMode
+{
+    Default,        // FFmpeg's file protocol
+    Mmap,           // the whole file mapped, served from the page cache
+    ReadAhead,      // large aligned pread windows with fadvise hints
+};
+
+int         ParseFileIOMode(const std::string& str, FileIOMode* pMode);
+const char* FileIOModeToString(FileIOMode mode);
+
+// Paths and file: URLs; other protocols keep their own I/O.
+bool        IsLocalFile(const std::string& strUrl);
+
+struct FileIOStats
+{
+    uint64_t    nBytes      = 0;    // handed to the demuxer
+    uint64_t    nReads      = 0;    // pread calls
+    uint64_t    nAdvise     = 0;    // fadvise/madvise calls
+    uint64_t    nSeeks      = 0;
+    uint64_t    nWindowHits = 0;    // reads served from the current window
+};
+
+struct MappedFile;
+
+// A read-only, seekable AVIOContext over a local file, for
+// avformat_open_input with AVFMT_FLAG_CUSTOM_IO. Sessions that map the same
+// file share one mapping, and neither mode bypasses the page cache, so
+// pages read by one session are reused by the next.
+class FileIO
+{
+public:
+    FileIO() = default;
+    ~FileIO();
+
+    FileIO(const FileIO&) = delete;
+    FileIO& operator=(const FileIO&) = delete;
+
+    // nWindowBytes is the read-ahead window, and for Mmap how far ahead
+    // pages are requested with MADV_WILLNEED.
+    int             Open(const std::string& strUrl, FileIOMode mode, size_t nWindowBytes = 4 << 20);
+    void            Close();
+
+    AVIOContext*    Context() const     { return m_pContext; }
+    int64_t         FileSize() const    { return m_nSize; }
+    FileIOStats     Stats() const       { return m_stats; }
+
+private:
+    static int      ReadPacket(void* opaque, uint8_t* buf, int size);
+    static int64_t  Seek(void* opaque, int64_t offset, int whence);
+    int             ReadMapped(uint8_t* buf, int size);
+    int             ReadWindow(uint8_t* buf, int size);
+
+    FileIOMode                  m_mode          = FileIOMode::Default;
+    AVIOContext*                m_pContext      = nullptr;
+    std::shared_ptr<MappedFile> m_pMap;
+    int                         m_fd            = -1;
+    int64_t                     m_nSize         = 0;
+    int64_t                     m_nPos          = 0;
+    size_t                      m_nWindowBytes  = 0;
+    uint8_t*                    m_pWindow       = nullptr;
+    int64_t                     m_nWindowStart  = 0;
+    size_t                      m_nWindowLen    = 0;
+    int64_t                     m_nAdvisedUntil = 0;
+    FileIOStats                 m_stats;
+};
@@ -0,0 +1,188 @@
+#include "frame_pool.hpp"
+
+extern "C"
+{
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+// Matches the stride alignment libavcodec uses for its own pools, which is
+// enough for every SIMD path in the decoders.
+static const int kStrideAlign = 64;
+
+FramePool::~FramePool()
+{
+    for (AVFrame*& frame : m_freeShells)
+        av_frame_free(&frame);
+    ResetPools();
+}
+
+void FramePool::Attach(AVCodecContext* avctx)
+{
+    avctx->opaque = this;
+    avctx->get_buffer2 = GetBuffer2;
+}
+
+AVFrame* FramePool::Acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_shellLock);
+        if (!m_freeShells.empty())
+        {
+            AVFrame* frame = m_freeShells.back();
+            m_freeShells.pop_back();
+            m_nShellReuses.fetch_add(1, std::memory_order_relaxed);
+            return frame;
+        }
+    }
+
+    m_nShellAllocs.fetch_add(1, std::memory_order_relaxed);
+    return av_frame_alloc();
+}
+
+void FramePool::Release(AVFrame* frame)
+{
+    if (!frame)
+        return;
+
+    av_frame_unref(frame);
+
+    std::lock_guard<std::mutex> lock(m_shellLock);
+    m_freeShells.push_back(frame);
+}
+
+FramePoolStats FramePool::Stats() const
+{
+    FramePoolStats stats;
+    stats.nShellAllocs  = m_nShellAllocs.load(std::memory_order_relaxed);
+    stats.nShellReuses  = m_nShellReuses.load(std::memory_order_relaxed);
+    stats.nBufferAllocs = m_nBufferAllocs.load(std::memory_order_relaxed);
+    stats.nBufferGets   = m_nBufferGets.load(std::memory_order_relaxed);
+    stats.nPoolResets   = m_nPoolResets.load(std::memory_order_relaxed);
+    return stats;
+}
+
+int FramePool::GetBuffer2(AVCodecContext* avctx, AVFrame* frame, int flags)
+{
+    FramePool* pPool = static_cast<FramePool*>(avctx->opaque);
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(static_cast<enum AVPixelFormat>(frame->format));
+
+    if (!pPool || !desc || avctx->hw_frames_ctx ||
+        avctx->codec_type != AVMEDIA_TYPE_VIDEO ||
+        !(avctx->codec->capabilities & AV_CODEC_CAP_DR1) ||
+        (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM)))
+        return avcodec_default_get_buffer2(avctx, frame, flags);
+
+    return pPool->GetPooledBuffer(avctx, frame);
+}
+
+// Budgeted buffers keep their size in front of the data, so FreeBuffer can
+// release the charge without the pool.
+static const size_t kSizeHeader = 64;
+
+AVBufferRef* FramePool::AllocBuffer(void* opaque, size_t size)
+{
+    FramePool* pPool = static_cast<FramePool*>(opaque);
+    pPool->m_nBufferAllocs.fetch_add(1, std::memory_order_relaxed);
+    if (!pPool->m_pBudget)
+        return av_buffer_alloc(size);
+
+    uint8_t* pBase = static_cast<uint8_t*>(av_malloc(size + kSizeHeader));
+    if (!pBase)
+        return nullptr;
+    *reinterpret_cast<size_t*>(pBase) = size;
+
+    AVBufferRef* pBuffer = av_buffer_create(pBase + kSizeHeader, size, FreeBuffer, pPool->m_pBudget, 0);
+    if (!pBuffer)
+    {
+        av_free(pBase);
+        return nullptr;
+    }
+    pPool->m_pBudget->Charge(static_cast<int64_t>(size), MemoryStage::Frames);
+    return pBuffer;
+}
+
+void FramePool::FreeBuffer(void* opaque, uint8_t* data)
+{
+    uint8_t* pBase = data - kSizeHeader;
+    static_cast<MemoryBudget*>(opaque)->Release(static_cast<int64_t>(*reinterpret_cast<size_t*>(pBase)),
+                                                MemoryStage::Frames);
+    av_free(pBase);
+}
+
+int FramePool::GetPooledBuffer(AVCodecContext* avctx, AVFrame* frame)
+{
+    std::lock_guard<std::mutex> lock(m_poolLock);
+
+    if (frame->format != m_poolFormat || frame->width != m_nPoolWidth || frame->height != m_nPoolHeight)
+    {
+        const enum AVPixelFormat format = static_cast<enum AVPixelFormat>(frame->format);
+        int w = frame->width;
+        int h = frame->height;
+        int linesizeAlign[AV_NUM_DATA_POINTERS];
+        avcodec_align_dimensions2(avctx, &w, &h, linesizeAlign);
+
+        int linesize[4] = {};
+        int ret = av_image_fill_linesizes(linesize, format, w);
+        if (ret < 0)
+            return ret;
+
+        ptrdiff_t linesize1[4];
+        for (int i = 0; i < 4; i++)
+        {
+            linesize[i] = FFALIGN(linesize[i], kStrideAlign);
+            linesize1[i] = linesize[i];
+        }
+
+        size_t size[4] = {};
+        if ((ret = av_image_fill_plane_sizes(size, format, h, linesize1)) < 0)
+            return ret;
+
+        ResetPools();
+        for (int i = 0; i < 4 && size[i]; i++)
+        {
+            m_pools[i] = av_buffer_pool_init2(size[i] + 16 + kStrideAlign - 1, this, AllocBuffer, nullptr);
+            if (!m_pools[i])
+            {
+                ResetPools();
+                return AVERROR(ENOMEM);
+            }
+            m_linesize[i] = linesize[i];
+        }
+
+        m_poolFormat = frame->format;
+        m_nPoolWidth = frame->width;
+        m_nPoolHeight = frame->height;
+        m_nPoolResets.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    for (int i = 0; i < 4 && m_pools[i]; i++)
+    {
+        frame->buf[i] = av_buffer_pool_get(m_pools[i]);
+        if (!frame->buf[i])
+        {
+            av_frame_unref(frame);
+            return AVERROR(ENOMEM);
+        }
+        frame->data[i] = frame->buf[i]->data;
+        frame->linesize[i] = m_linesize[i];
+        m_nBufferGets.fetch_add(1, std::memory_order_relaxed);
+    }
+    frame->extended_data = frame->data;
+
+    return 0;
+}
+
+void FramePool::ResetPools()
+{
+    // Buffers still referenced by frames downstream keep their pool alive
+    // until they are released, so this is safe at any point.
+    for (int i = 0; i < 4; i++)
+    {
+        av_buffer_pool_uninit(&m_pools[i]);
+        m_linesize[i] = 0;
+    }
+    m_poolFormat = AV_PIX_FMT_NONE;
+    m_nPoolWidth = 0;
+    m_nPoolHeight = 0;
+}
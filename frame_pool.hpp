@@ -0,0 +1,78 @@
+#pragma once
+
+#include "memory_budget.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+}
+
+struct FramePoolStats
+{
+    uint64_t    nShellAllocs    = 0;    // AVFrame structs allocated
+    uint64_t    nShellReuses    = 0;    // Acquire calls served from the free list
+    uint64_t    nBufferAllocs   = 0;    // plane buffers allocated by the AVBufferPools
+    uint64_t    nBufferGets     = 0;    // plane buffers handed to the decoder
+    uint64_t    nPoolResets     = 0;    // pools rebuilt after a format or size change
+};
+
+// Recycles decoded frames: AVFrame shells are kept on a free list, and once
+// attached to a codec context the plane buffers come from AVBufferPools that
+// are only rebuilt when the frame geometry changes. In steady state neither
+// the shells nor the pixel data touch the heap.
+class FramePool
+{
+public:
+    FramePool() = default;
+    ~FramePool();
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    // Installs the pooled get_buffer2 on the context. Must be called before
+    // avcodec_open2; uses avctx->opaque. Hardware and palette formats keep
+    // using the default allocator.
+    void            Attach(AVCodecContext* avctx);
+    // Before Attach: charge plane buffers to pBudget (MemoryStage::Frames)
+    // from allocation until the buffer is freed, which can be after the
+    // pool itself is gone.
+    void            SetMemoryBudget(MemoryBudget* pBudget)  { m_pBudget = pBudget; }
+
+    AVFrame*        Acquire();
+    // Unreferences the frame and puts the shell back on the free list.
+    void            Release(AVFrame* frame);
+
+    FramePoolStats  Stats() const;
+
+private:
+    static int          GetBuffer2(AVCodecContext* avctx, AVFrame* frame, int flags);
+    static AVBufferRef* AllocBuffer(void* opaque, size_t size);
+    static void         FreeBuffer(void* opaque, uint8_t* data);
+
+    int                 GetPooledBuffer(AVCodecContext* avctx, AVFrame* frame);
+    void                ResetPools();
+
+    std::mutex              m_shellLock;
+    std::vector<AVFrame*>   m_freeShells;
+
+    MemoryBudget*           m_pBudget       = nullptr;
+
+    std::mutex              m_poolLock;
+    AVBufferPool*           m_pools[4]      = {};
+    int                     m_linesize[4]   = {};
+    int                     m_nPoolWidth    = 0;
+    int                     m_nPoolHeight   = 0;
+    int                     m_poolFormat    = AV_PIX_FMT_NONE;
+
+    std::atomic<uint64_t>   m_nShellAllocs{0};
+    std::atomic<uint64_t>   m_nShellReuses{0};
+    std::atomic<uint64_t>   m_nBufferAllocs{0};
+    std::atomic<uint64_t>   m_nBufferGets{0};
+    std::atomic<uint64_t>   m_nPoolResets{0};
+};
@@ -0,0 +1,121 @@
+#include "frame_queue.hpp"
+#include "queue_wait.hpp"
+
+#include <chrono>
+
+extern "C"
+{
+#include <libavutil/avutil.h>
+}
+
+typedef std::chrono::steady_clock Clock;
+
+FrameQueue::~FrameQueue()
+{
+    for (AVFrame*& pSlot : m_slots)
+        av_frame_free(&pSlot);
+}
+
+int FrameQueue::Init(size_t nDepth)
+{
+    if (nDepth == 0 || !m_slots.empty())
+        return AVERROR(EINVAL);
+
+    m_slots.resize(nDepth, nullptr);
+    for (AVFrame*& pSlot : m_slots)
+    {
+        if (!(pSlot = av_frame_alloc()))
+            return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+int FrameQueue::Push(AVFrame* pFrame)
+{
+    const size_t tail = m_tail.load(std::memory_order_relaxed);
+    const size_t nDepth = m_slots.size();
+
+    if (tail - m_head.load(std::memory_order_acquire) >= nDepth)
+    {
+        Clock::time_point tStart = Clock::now();
+        unsigned nSpins = 0;
+        m_nProducerStalls.fetch_add(1, std::memory_order_relaxed);
+        while (tail - m_head.load(std::memory_order_acquire) >= nDepth)
+        {
+            if (m_bAborted.load(std::memory_order_acquire))
+                return AVERROR_EXIT;
+            QueueBackoff(nSpins);
+        }
+        m_nProducerStallNs.fetch_add(NanosecondsSince(tStart), std::memory_order_relaxed);
+    }
+
+    if (m_bAborted.load(std::memory_order_acquire))
+        return AVERROR_EXIT;
+
+    av_frame_move_ref(m_slots[tail % nDepth], pFrame);
+    m_tail.store(tail + 1, std::memory_order_release);
+
+    size_t nQueued = tail + 1 - m_head.load(std::memory_order_acquire);
+    if (nQueued > m_nPeakFrames.load(std::memory_order_relaxed))
+        m_nPeakFrames.store(nQueued, std::memory_order_relaxed);
+
+    return 0;
+}
+
+int FrameQueue::Pop(AVFrame* pFrame)
+{
+    const size_t head = m_head.load(std::memory_order_relaxed);
+
+    if (m_tail.load(std::memory_order_acquire) == head)
+    {
+        Clock::time_point tStart = Clock::now();
+        unsigned nSpins = 0;
+        m_nConsumerStalls.fetch_add(1, std::memory_order_relaxed);
+        while (m_tail.load(std::memory_order_acquire) == head)
+        {
+            if (m_bAborted.load(std::memory_order_acquire))
+                return AVERROR_EXIT;
+            if (m_bClosed.load(std::memory_order_acquire) &&
+                m_tail.load(std::memory_order_acquire) == head)
+                return AVERROR_EOF;
+            QueueBackoff(nSpins);
+        }
+        m_nConsumerStallNs.fetch_add(NanosecondsSince(tStart), std::memory_order_relaxed);
+    }
+
+    if (m_bAborted.load(std::memory_order_acquire))
+        return AVERROR_EXIT;
+
+    av_frame_move_ref(pFrame, m_slots[head % m_slots.size()]);
+    m_head.store(head + 1, std::memory_order_release);
+
+    return 0;
+}
+
+void FrameQueue::Close()
+{
+    m_bClosed.store(true, std::memory_order_release);
+}
+
+void FrameQueue::Abort()
+{
+    m_bAborted.store(true, std::memory_order_release);
+}
+
+size_t FrameQueue::Size() const
+{
+    return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+}
+
+FrameQueueStats FrameQueue::Stats() const
+{
+    FrameQueueStats stats;
+    stats.nPopped               = m_head.load(std::memory_order_acquire);
+    stats.nPushed               = m_tail.load(std::memory_order_acquire);
+    stats.nProducerStalls       = m_nProducerStalls.load(std::memory_order_relaxed);
+    stats.nConsumerStalls       = m_nConsumerStalls.load(std::memory_order_relaxed);
+    stats.dProducerStallSeconds = m_nProducerStallNs.load(std::memory_order_relaxed) * 1e-9;
+    stats.dConsumerStallSeconds = m_nConsumerStallNs.load(std::memory_order_relaxed) * 1e-9;
+    stats.nPeakFrames           = m_nPeakFrames.load(std::memory_order_relaxed);
+    return stats;
+}
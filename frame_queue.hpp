@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+extern "C"
+{
+#include <libavutil/frame.h>
+}
+
+struct FrameQueueStats
+{
+    uint64_t    nPushed                 = 0;
+    uint64_t    nPopped                 = 0;
+    uint64_t    nProducerStalls         = 0;    // Push calls that had to wait for room
+    uint64_t    nConsumerStalls         = 0;    // Pop calls that had to wait for a frame
+    double      dProducerStallSeconds   = 0.0;
+    double      dConsumerStallSeconds   = 0.0;
+    size_t      nPeakFrames             = 0;
+};
+
+// The AVFrame counterpart of PacketQueue: a bounded single-producer/
+// single-consumer ring that moves frame references between threads without
+// copying planes or taking locks.
+class FrameQueue
+{
+public:
+    FrameQueue() = default;
+    ~FrameQueue();
+
+    FrameQueue(const FrameQueue&) = delete;
+    FrameQueue& operator=(const FrameQueue&) = delete;
+
+    int                 Init(size_t nDepth);
+
+    // Takes over the reference held by pFrame. Returns AVERROR_EXIT once aborted.
+    int                 Push(AVFrame* pFrame);
+    // Returns AVERROR_EOF once closed and drained, AVERROR_EXIT once aborted.
+    int                 Pop(AVFrame* pFrame);
+
+    void                Close();
+    void                Abort();
+
+    size_t              Size() const;
+    FrameQueueStats     Stats() const;
+
+private:
+    std::vector<AVFrame*>   m_slots;
+
+    alignas(64) std::atomic<size_t>     m_head{0};      // next slot to pop, owned by the consumer
+    alignas(64) std::atomic<size_t>     m_tail{0};      // next slot to push, owned by the producer
+    std::atomic<bool>                   m_bClosed{false};
+    std::atomic<bool>                   m_bAborted{false};
+
+    std::atomic<uint64_t>   m_nProducerStalls{0};
+    std::atomic<uint64_t>   m_nConsumerStalls{0};
+    std::atomic<int64_t>    m_nProducerStallNs{0};
+    std::atomic<int64_t>    m_nConsumerStallNs{0};
+    std::atomic<size_t>     m_nPeakFrames{0};
+};
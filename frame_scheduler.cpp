@@ -0,0 +1,102 @@
+#include "frame_scheduler.hpp"
+
+#include <cmath>
+
+FrameScheduler::FrameScheduler(PresentationClock* pClock, const SchedulerOptions& options)
+    : m_pClock(pClock)
+    , m_options(options)
+{
+}
+
+void FrameScheduler::Reset()
+{
+    m_bAnchored = false;
+    m_dLateness = 0.0;
+}
+
+ScheduleAction FrameScheduler::Schedule(int64_t pts, AVRational timeBase, double dDecodedAt)
+{
+    const double dNow = m_pClock->Now();
+    m_dDecodedAt = dDecodedAt;
+
+    // Without a timestamp there is nothing to pace against.
+    if (pts == AV_NOPTS_VALUE)
+    {
+        m_dDue = dNow;
+        return ScheduleAction::Present;
+    }
+
+    const double dMedia = pts * av_q2d(timeBase);
+    if (!m_options.bMediaClock && (!m_bAnchored || dMedia < m_dLastMedia))
+    {
+        m_dAnchorClock = dNow;
+        m_dAnchorMedia = dMedia;
+        m_bAnchored = true;
+    }
+    m_dLastMedia = dMedia;
+
+    double dDue = m_options.bMediaClock ? dMedia : m_dAnchorClock + (dMedia - m_dAnchorMedia) / m_options.dRate;
+    m_dLateness = dNow - dDue;
+    if (m_dLateness > m_stats.dMaxLateness)
+        m_stats.dMaxLateness = m_dLateness;
+
+    if (m_dLateness > m_options.dResyncSeconds && !m_options.bMediaClock)
+    {
+        m_dAnchorClock = dNow;
+        m_dAnchorMedia = dMedia;
+        m_dLateness = 0.0;
+        dDue = dNow;
+        m_stats.nResyncs++;
+    }
+
+    if (m_dLateness > m_options.dDropLateSeconds)
+    {
+        m_stats.nDroppedLate++;
+        return ScheduleAction::Drop;
+    }
+
+    if (dDue > dNow)
+        m_pClock->SleepUntil(dDue);
+    m_dDue = dDue;
+    return ScheduleAction::Present;
+}
+
+void FrameScheduler::Presented()
+{
+    const double dNow = m_pClock->Now();
+    m_stats.nPresented++;
+    m_stats.latency.Add(dNow - m_dDecodedAt);
+    m_stats.jitter.Add(std::fabs(dNow - m_dDue));
+}
+
+void FrameScheduler::UpdateDiscard(AVCodecContext* avctx)
+{
+    const double dNonRef = m_options.dSkipNonRefSeconds;
+    const double dNonKey = m_options.dSkipNonKeySeconds;
+
+    switch (m_discard)
+    {
+        case AVDISCARD_NONKEY:
+            if (m_dLateness < dNonRef)
+                m_discard = AVDISCARD_NONREF;
+            break;
+        case AVDISCARD_NONREF:
+            if (m_dLateness > dNonKey)
+                m_discard = AVDISCARD_NONKEY;
+            else if (m_dLateness <= 0.0)
+                m_discard = AVDISCARD_DEFAULT;
+            break;
+        default:
+            if (m_dLateness > dNonKey)
+                m_discard = AVDISCARD_NONKEY;
+            else if (m_dLateness > dNonRef)
+                m_discard = AVDISCARD_NONREF;
+            break;
+    }
+
+    avctx->skip_frame = m_discard;
+    if (m_discard == AVDISCARD_NONREF)
+        m_stats.nPacketsSkipNonRef++;
+    else if (m_discard == AVDISCARD_NONKEY)
+        m_stats.nPacketsSkipNonKey++;
+}
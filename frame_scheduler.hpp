@@ -0,0 +1,86 @@
+#pragma once
+
+#include "bench_stats.hpp"
+#include "presentation_clock.hpp"
+
+#include <cstdint>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+struct SchedulerOptions
+{
+    double  dRate               = 1.0;      // playback speed
+    // Lateness past which a decoded frame is dropped instead of rendered.
+    double  dDropLateSeconds    = 0.025;
+    // Lateness past which the decoder skips non-reference frames, and past
+    // which it decodes keyframes only. Keyframes-only steps down to
+    // non-reference skipping under dSkipNonRefSeconds, which lasts until
+    // frames are on time again, so a decoder that is only just too slow
+    // does not oscillate around the drop threshold.
+    double  dSkipNonRefSeconds  = 0.100;
+    double  dSkipNonKeySeconds  = 0.500;
+    // Further behind than this the clock is re-anchored on the current frame
+    // rather than dropping until decode catches up.
+    double  dResyncSeconds      = 2.0;
+    // The clock already reads media time, like an audio master clock does:
+    // frames are due at their pts and the clock is never re-anchored.
+    bool    bMediaClock         = false;
+};
+
+enum class ScheduleAction
+{
+    Present,
+    Drop,
+};
+
+struct SchedulerStats
+{
+    uint64_t            nPresented          = 0;
+    uint64_t            nDroppedLate        = 0;    // decoded but not rendered
+    uint64_t            nPacketsSkipNonRef  = 0;    // sent with AVDISCARD_NONREF
+    uint64_t            nPacketsSkipNonKey  = 0;    // sent with AVDISCARD_NONKEY
+    uint64_t            nResyncs            = 0;
+    double              dMaxLateness        = 0.0;
+    LatencyHistogram    latency;                    // decoded -> presented
+    LatencyHistogram    jitter;                     // |presented - due|
+};
+
+// Paces decoded frames by pts against a PresentationClock. The first frame,
+// and any frame whose pts goes backwards, anchors media time to the clock.
+class FrameScheduler
+{
+public:
+    explicit FrameScheduler(PresentationClock* pClock, const SchedulerOptions& options = SchedulerOptions());
+
+    // Forget the anchor, e.g. after a seek.
+    void                    Reset();
+
+    // Waits until the frame is due and returns Present, or returns Drop at
+    // once when it is already too late. dDecodedAt is the clock time the
+    // decoder returned the frame.
+    ScheduleAction          Schedule(int64_t pts, AVRational timeBase, double dDecodedAt);
+    // Call after rendering a frame Schedule returned Present for.
+    void                    Presented();
+
+    // Sets avctx->skip_frame for the next packet from the current lateness.
+    void                    UpdateDiscard(AVCodecContext* avctx);
+
+    double                  Lateness() const    { return m_dLateness; }
+    const SchedulerStats&   Stats() const       { return m_stats; }
+
+private:
+    PresentationClock*  m_pClock;
+    SchedulerOptions    m_options;
+    bool                m_bAnchored     = false;
+    double              m_dAnchorClock  = 0.0;
+    double              m_dAnchorMedia  = 0.0;
+    double              m_dLastMedia    = 0.0;
+    double              m_dDue          = 0.0;
+    double              m_dDecodedAt    = 0.0;
+    double              m_dLateness     = 0.0;
+    AVDiscard           m_discard       = AVDISCARD_DEFAULT;
+    SchedulerStats      m_stats;
+};
@@ -0,0 +1,113 @@
+#include "frame_sink.hpp"
+#include "shm_ring.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+extern "C"
+{
+#include <libavutil/adler32.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+int GetPlaneGeometry(int format, int width, int height, int bytewidth[4], int rows[4])
+{
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(static_cast<enum AVPixelFormat>(format));
+    if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM)))
+        return AVERROR(EINVAL);
+
+    int ret = av_image_fill_linesizes(bytewidth, static_cast<enum AVPixelFormat>(format), width);
+    if (ret < 0)
+        return ret;
+
+    const int nPlanes = av_pix_fmt_count_planes(static_cast<enum AVPixelFormat>(format));
+    const int chromaRows = -((-height) >> desc->log2_chroma_h);
+    for (int i = 0; i < 4; i++)
+    {
+        if (i >= nPlanes)
+        {
+            bytewidth[i] = 0;
+            rows[i] = 0;
+        }
+        else
+        {
+            // Planes 1 and 2 carry chroma; plane 3 (alpha) is full height.
+            rows[i] = (i == 1 || i == 2) ? chromaRows : height;
+        }
+    }
+
+    return nPlanes;
+}
+
+int NullSink::Write(AVCodecContext*, const AVFrame*)
+{
+    m_nFrames++;
+    return 0;
+}
+
+int ChecksumSink::Write(AVCodecContext*, const AVFrame* frame)
+{
+    int bytewidth[4];
+    int rows[4];
+    int nPlanes = GetPlaneGeometry(frame->format, frame->width, frame->height, bytewidth, rows);
+    if (nPlanes < 0)
+    {
+        fprintf(stderr, "checksum sink: can't read %s frames\n",
+                av_get_pix_fmt_name(static_cast<enum AVPixelFormat>(frame->format)));
+        return nPlanes;
+    }
+
+    AVAdler sum = 1;
+    for (int i = 0; i < nPlanes; i++)
+    {
+        const uint8_t* pRow = frame->data[i];
+        for (int y = 0; y < rows[i]; y++, pRow += frame->linesize[i])
+            sum = av_adler32_update(sum, pRow, bytewidth[i]);
+    }
+
+    m_frameSums.push_back(sum);
+
+    uint8_t bytes[4] = { uint8_t(sum >> 24), uint8_t(sum >> 16), uint8_t(sum >> 8), uint8_t(sum) };
+    m_nStreamSum = av_adler32_update(m_nStreamSum, bytes, sizeof(bytes));
+
+    return 0;
+}
+
+std::string ChecksumSink::Summary() const
+{
+    char str[64];
+    snprintf(str, sizeof(str), "stream adler32 %08x over %zu frames", m_nStreamSum, m_frameSums.size());
+    return str;
+}
+
+int CreateSink(const std::string& strSpec, std::unique_ptr<FrameSink>* ppSink)
+{
+    if (strSpec == "null")
+    {
+        ppSink->reset(new NullSink);
+        return 0;
+    }
+    if (strSpec == "checksum")
+    {
+        ppSink->reset(new ChecksumSink);
+        return 0;
+    }
+    if (strSpec.compare(0, 4, "shm:") == 0)
+    {
+        std::string strName = strSpec.substr(4);
+        int nSlots = 8;
+        size_t colon = strName.find(':');
+        if (colon != std::string::npos)
+        {
+            nSlots = atoi(strName.c_str() + colon + 1);
+            strName.resize(colon);
+        }
+        if (strName.empty() || nSlots < 2)
+            return AVERROR(EINVAL);
+        return CreateShmRingSink(strName, nSlots, ppSink);
+    }
+
+    fprintf(stderr, "unknown sink %s\n", strSpec.c_str());
+    return AVERROR(EINVAL);
+}
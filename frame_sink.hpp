@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+// Row width in bytes and row count of every plane of a software frame.
+// Returns the number of planes, or a negative AVERROR for hw and bitstream
+// formats.
+int     GetPlaneGeometry(int format, int width, int height, int bytewidth[4], int rows[4]);
+
+// Where DecodeFrame delivers decoded frames. Write gets a frame that is only
+// valid for the call; sinks that keep it take their own reference.
+class FrameSink
+{
+public:
+    virtual ~FrameSink() = default;
+
+    virtual const char*     Name() const = 0;
+    virtual int             Write(AVCodecContext* avctx, const AVFrame* frame) = 0;
+    virtual int64_t         Frames() const = 0;
+    // One line of sink specific counters, for the tools' reports.
+    virtual std::string     Summary() const { return std::string(); }
+};
+
+class NullSink : public FrameSink
+{
+public:
+    const char*     Name() const override   { return "null"; }
+    int             Write(AVCodecContext* avctx, const AVFrame* frame) override;
+    int64_t         Frames() const override { return m_nFrames; }
+
+private:
+    int64_t         m_nFrames = 0;
+};
+
+// Adler-32 over the visible pixels of every plane, so padding and linesize
+// differences between decoders don't change the result.
+class ChecksumSink : public FrameSink
+{
+public:
+    const char*     Name() const override   { return "checksum"; }
+    int             Write(AVCodecContext* avctx, const AVFrame* frame) override;
+    int64_t         Frames() const override { return static_cast<int64_t>(m_frameSums.size()); }
+    std::string     Summary() const override;
+
+    const std::vector<uint32_t>&    FrameSums() const   { return m_frameSums; }
+    // Checksum of the per-frame checksums, identifying the whole stream.
+    uint32_t                        StreamSum() const   { return m_nStreamSum; }
+
+private:
+    std::vector<uint32_t>   m_frameSums;
+    uint32_t                m_nStreamSum = 1;
+};
+
+// "null", "checksum" or "shm:NAME[:SLOTS]" (POSIX only, see shm_ring.hpp).
+int     CreateSink(const std::string& strSpec, std::unique_ptr<FrameSink>* ppSink);
@@ -0,0 +1,391 @@
+#include "gop_cache.hpp"
+#include "bench_stats.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+CachedGop::~CachedGop()
+{
+    for (AVFrame*& frame : frames)
+        av_frame_free(&frame);
+}
+
+ptrdiff_t CachedGop::Find(int64_t pts) const
+{
+    if (frames.empty())
+        return -1;
+
+    std::vector<AVFrame*>::const_iterator next =
+        std::upper_bound(frames.begin(), frames.end(), pts,
+                         [](int64_t t, const AVFrame* frame) { return t < frame->pts; });
+    return next == frames.begin() ? 0 : (next - frames.begin()) - 1;
+}
+
+GopCache::GopCache(int64_t nBudget)
+    : m_nBudget(nBudget)
+{
+}
+
+std::shared_ptr<const CachedGop> GopCache::Lookup(const std::string& strStream, int64_t startPts)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    std::map<Key, std::list<Entry>::iterator>::iterator it = m_entries.find(Key(strStream, startPts));
+    if (it == m_entries.end())
+    {
+        m_stats.nMisses++;
+        return nullptr;
+    }
+
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    m_stats.nHits++;
+    if (it->second->pGop->bPrefetched)
+        m_stats.nPrefetchHits++;
+    return it->second->pGop;
+}
+
+bool GopCache::Contains(const std::string& strStream, int64_t startPts) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_entries.count(Key(strStream, startPts)) != 0;
+}
+
+void GopCache::Insert(const std::string& strStream, std::shared_ptr<const CachedGop> pGop)
+{
+    if (!pGop || m_nBudget <= 0 || pGop->nBytes > m_nBudget)
+        return;
+
+    // Evicted GOPs are freed after the lock is dropped, unless a reader
+    // still holds them.
+    std::vector<std::shared_ptr<const CachedGop>> evicted;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    const Key key(strStream, pGop->startPts);
+
+    std::map<Key, std::list<Entry>::iterator>::iterator it = m_entries.find(key);
+    if (it != m_entries.end())
+    {
+        m_stats.nBytes -= it->second->pGop->nBytes;
+        evicted.push_back(it->second->pGop);
+        m_lru.erase(it->second);
+        m_entries.erase(it);
+    }
+
+    m_stats.nBytes += pGop->nBytes;
+    m_lru.push_front({ key, std::move(pGop) });
+    m_entries[key] = m_lru.begin();
+    m_stats.nInserts++;
+
+    while (m_stats.nBytes > m_nBudget)
+    {
+        Entry& victim = m_lru.back();
+        m_stats.nBytes -= victim.pGop->nBytes;
+        m_stats.nEvictions++;
+        m_stats.nEvictedBytes += victim.pGop->nBytes;
+        evicted.push_back(std::move(victim.pGop));
+        m_entries.erase(victim.key);
+        m_lru.pop_back();
+    }
+
+    m_stats.nPeakBytes = std::max(m_stats.nPeakBytes, m_stats.nBytes);
+    m_stats.nGops = m_lru.size();
+}
+
+void GopCache::Clear()
+{
+    std::list<Entry> entries;
+    std::lock_guard<std::mutex> lock(m_lock);
+    entries.swap(m_lru);
+    m_entries.clear();
+    m_stats.nBytes = 0;
+    m_stats.nGops = 0;
+}
+
+GopCacheStats GopCache::Stats() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_stats;
+}
+
+// Keeps the frames with pts in [startPts, endPts) of GOP iGop.
+static int DecodeGop(VideoStream* pStream, AVPacket* pPacket, const KeyframeIndex& index, size_t iGop,
+                     std::shared_ptr<CachedGop>* ppGop)
+{
+    const KeyframeEntry& first = index.Entry(iGop);
+    const bool bLast = iGop + 1 >= index.Size();
+
+    std::shared_ptr<CachedGop> pGop = std::make_shared<CachedGop>();
+    pGop->startPts = first.pts;
+    pGop->endPts = bLast ? INT64_MAX : index.Entry(iGop + 1).pts;
+
+    FrameCallback onFrame = [&](AVCodecContext*, AVFrame* frame)
+    {
+        const int64_t pts = frame->best_effort_timestamp;
+        if (pts == AV_NOPTS_VALUE || pts < pGop->startPts || pts >= pGop->endPts)
+            return 0;
+
+        AVFrame* pFrame = av_frame_clone(frame);
+        if (!pFrame)
+            return AVERROR(ENOMEM);
+        pFrame->pts = pts;
+        pGop->nBytes += FrameBytes(pFrame);
+        pGop->frames.push_back(pFrame);
+        return 0;
+    };
+
+    int ret = DecodeGopRange(pStream, pPacket, index, iGop, iGop + 1, onFrame);
+    if (ret < 0)
+        return ret;
+
+    std::sort(pGop->frames.begin(), pGop->frames.end(),
+              [](const AVFrame* a, const AVFrame* b) { return a->pts < b->pts; });
+    *ppGop = std::move(pGop);
+    return 0;
+}
+
+ScrubSource::ScrubSource(GopCache* pCache, WorkerPool* pPrefetchPool)
+    : m_pCache(pCache)
+    , m_pPool(pPrefetchPool)
+{
+}
+
+ScrubSource::~ScrubSource()
+{
+    Close();
+}
+
+int ScrubSource::Open(const std::string& strUrl, const ScrubOptions& options)
+{
+    int ret = 0;
+    m_strUrl = strUrl;
+    m_options = options;
+    // Cached frames live far longer than a pool's working set.
+    m_options.decoder.pFramePool = nullptr;
+
+    if ((ret = LoadOrBuildKeyframeIndex(strUrl, &m_index)) < 0)
+    {
+        fprintf(stderr, "keyframe index %s: %s\n", strUrl.c_str(), av_err2str(ret));
+        return ret;
+    }
+    if ((ret = OpenStream(strUrl, &m_stream, m_options.decoder)) < 0)
+        return ret;
+    if (m_index.Size() == 0 || m_index.Header().iStream != m_stream.iVideo)
+    {
+        Close();
+        return AVERROR(EINVAL);
+    }
+    if (!(m_pPacket = av_packet_alloc()))
+    {
+        Close();
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+void ScrubSource::Close()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_bClosing = true;
+        m_prefetchQueue.clear();
+        m_changed.wait(lock, [&]() { return !m_bPrefetchRunning; });
+        m_bClosing = false;
+        m_bPrefetchFailed = false;
+    }
+
+    m_pCurrent.reset();
+    m_iCurrentFrame = -1;
+    av_packet_free(&m_pPacket);
+    av_packet_free(&m_pPrefetchPacket);
+    CloseStream(&m_stream);
+    CloseStream(&m_prefetchStream);
+    m_index.Reset();
+}
+
+int ScrubSource::GetGop(size_t iGop, std::shared_ptr<const CachedGop>* ppGop)
+{
+    {
+        // A prefetch of this GOP is nearly as good as a hit.
+        std::unique_lock<std::mutex> lock(m_lock);
+        if (m_inFlight.count(iGop))
+        {
+            m_nPrefetchWaits++;
+            m_changed.wait(lock, [&]() { return m_inFlight.count(iGop) == 0; });
+        }
+    }
+
+    if ((*ppGop = m_pCache->Lookup(m_strUrl, m_index.Entry(iGop).pts)))
+        return 0;
+
+    BenchClock::time_point tStart = BenchClock::now();
+    std::shared_ptr<CachedGop> pGop;
+    int ret = DecodeGop(&m_stream, m_pPacket, m_index, iGop, &pGop);
+    if (ret < 0)
+    {
+        fprintf(stderr, "%s: GOP %zu: %s\n", m_strUrl.c_str(), iGop, av_err2str(ret));
+        return ret;
+    }
+    m_nGopsDecoded++;
+    m_dDecodeSeconds += ElapsedSeconds(tStart, BenchClock::now());
+
+    m_pCache->Insert(m_strUrl, pGop);
+    *ppGop = std::move(pGop);
+    return 0;
+}
+
+int ScrubSource::SetCurrent(size_t iGop, std::shared_ptr<const CachedGop> pGop, ptrdiff_t iFrame, AVFrame* pOut)
+{
+    m_pCurrent = std::move(pGop);
+    m_iCurrentGop = iGop;
+    m_iCurrentFrame = iFrame;
+
+    av_frame_unref(pOut);
+    int ret = av_frame_ref(pOut, m_pCurrent->frames[iFrame]);
+    Prefetch(iGop);
+    return ret;
+}
+
+int ScrubSource::Seek(int64_t pts, AVFrame* pOut)
+{
+    if (m_index.Size() == 0)
+        return AVERROR(EINVAL);
+
+    const size_t iGop = static_cast<size_t>(m_index.Find(pts));
+    std::shared_ptr<const CachedGop> pGop;
+    int ret = GetGop(iGop, &pGop);
+    if (ret < 0)
+        return ret;
+
+    const ptrdiff_t iFrame = pGop->Find(pts);
+    if (iFrame < 0)
+        return AVERROR_INVALIDDATA;
+    return SetCurrent(iGop, std::move(pGop), iFrame, pOut);
+}
+
+int ScrubSource::Step(int nDelta, AVFrame* pOut)
+{
+    if (!m_pCurrent)
+        return AVERROR(EINVAL);
+
+    int ret = 0;
+    size_t iGop = m_iCurrentGop;
+    std::shared_ptr<const CachedGop> pGop = m_pCurrent;
+    ptrdiff_t iFrame = m_iCurrentFrame + nDelta;
+
+    while (iFrame < 0)
+    {
+        if (iGop == 0)
+            return AVERROR_EOF;
+        if ((ret = GetGop(--iGop, &pGop)) < 0)
+            return ret;
+        iFrame += static_cast<ptrdiff_t>(pGop->frames.size());
+    }
+    while (iFrame >= static_cast<ptrdiff_t>(pGop->frames.size()))
+    {
+        if (iGop + 1 >= m_index.Size())
+            return AVERROR_EOF;
+        iFrame -= static_cast<ptrdiff_t>(pGop->frames.size());
+        if ((ret = GetGop(++iGop, &pGop)) < 0)
+            return ret;
+    }
+
+    // Staying in the same GOP goes through the cache too: it may have been
+    // evicted, and without a cache every step decodes the GOP again.
+    if (iGop == m_iCurrentGop && (ret = GetGop(iGop, &pGop)) < 0)
+        return ret;
+    if (iFrame >= static_cast<ptrdiff_t>(pGop->frames.size()))
+        return AVERROR_INVALIDDATA;
+
+    return SetCurrent(iGop, std::move(pGop), iFrame, pOut);
+}
+
+int64_t ScrubSource::CurrentPts() const
+{
+    return m_pCurrent ? m_pCurrent->frames[m_iCurrentFrame]->pts : AV_NOPTS_VALUE;
+}
+
+void ScrubSource::Prefetch(size_t iCenter)
+{
+    if (!m_pPool || m_options.nPrefetchGops <= 0 || m_pCache->Budget() <= 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_bPrefetchFailed || m_bClosing)
+        return;
+
+    // Only the neighbours of the latest position are worth decoding; the
+    // previous GOP goes first since reverse steps are the expensive ones.
+    m_prefetchQueue.clear();
+    for (int d = 1; d <= m_options.nPrefetchGops; d++)
+    {
+        if (iCenter >= static_cast<size_t>(d))
+            m_prefetchQueue.push_back(iCenter - d);
+        if (iCenter + d < m_index.Size())
+            m_prefetchQueue.push_back(iCenter + d);
+    }
+
+    if (!m_prefetchQueue.empty() && !m_bPrefetchRunning)
+    {
+        m_bPrefetchRunning = true;
+        m_pPool->Submit([this]() { PrefetchLoop(); });
+    }
+}
+
+void ScrubSource::PrefetchLoop()
+{
+    while (true)
+    {
+        size_t iGop = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_prefetchQueue.empty() || m_bClosing)
+            {
+                m_bPrefetchRunning = false;
+                m_changed.notify_all();
+                return;
+            }
+            iGop = m_prefetchQueue.front();
+            m_prefetchQueue.pop_front();
+            if (m_inFlight.count(iGop) || m_pCache->Contains(m_strUrl, m_index.Entry(iGop).pts))
+                continue;
+            m_inFlight.insert(iGop);
+        }
+
+        int ret = 0;
+        if (!m_prefetchStream.pCodecCtx)
+        {
+            if ((ret = OpenStream(m_strUrl, &m_prefetchStream, m_options.decoder)) >= 0 &&
+                !(m_pPrefetchPacket = av_packet_alloc()))
+                ret = AVERROR(ENOMEM);
+        }
+
+        std::shared_ptr<CachedGop> pGop;
+        if (ret >= 0 && (ret = DecodeGop(&m_prefetchStream, m_pPrefetchPacket, m_index, iGop, &pGop)) >= 0)
+        {
+            pGop->bPrefetched = true;
+            m_pCache->Insert(m_strUrl, pGop);
+            m_nGopsPrefetched.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_inFlight.erase(iGop);
+        if (ret < 0)
+        {
+            // The caller decodes for itself from here on.
+            fprintf(stderr, "prefetch %s: %s\n", m_strUrl.c_str(), av_err2str(ret));
+            m_bPrefetchFailed = true;
+            m_prefetchQueue.clear();
+        }
+        m_changed.notify_all();
+    }
+}
+
+ScrubStats ScrubSource::Stats() const
+{
+    ScrubStats stats;
+    stats.nGopsDecoded      = m_nGopsDecoded;
+    stats.nGopsPrefetched   = m_nGopsPrefetched.load(std::memory_order_relaxed);
+    stats.nPrefetchWaits    = m_nPrefetchWaits;
+    stats.dDecodeSeconds    = m_dDecodeSeconds;
+    return stats;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "decoder.hpp"
+#include "keyframe_index.hpp"
+#include "worker_pool.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C"
+{
+#include <libavutil/frame.h>
+}
+
+// The decoded frames of one GOP, in pts order. The cache and its readers
+// share it by shared_ptr, and sinks take av_frame_ref of the frames, so an
+// evicted GOP stays valid for whoever still holds it.
+struct CachedGop
+{
+    CachedGop() = default;
+    ~CachedGop();
+
+    CachedGop(const CachedGop&) = delete;
+    CachedGop& operator=(const CachedGop&) = delete;
+
+    // Last frame at or before pts, the first one if pts precedes them all,
+    // or -1 when the GOP has no frames.
+    ptrdiff_t   Find(int64_t pts) const;
+
+    int64_t                 startPts    = 0;            // keyframe pts, inclusive
+    int64_t                 endPts      = INT64_MAX;    // next keyframe pts, exclusive
+    std::vector<AVFrame*>   frames;
+    int64_t                 nBytes      = 0;
+    bool                    bPrefetched = false;
+};
+
+struct GopCacheStats
+{
+    uint64_t    nHits           = 0;
+    uint64_t    nMisses         = 0;
+    uint64_t    nPrefetchHits   = 0;        // hits on GOPs a prefetch decoded
+    uint64_t    nInserts        = 0;
+    uint64_t    nEvictions      = 0;
+    int64_t     nEvictedBytes   = 0;
+    size_t      nGops           = 0;
+    int64_t     nBytes          = 0;
+    int64_t     nPeakBytes      = 0;
+};
+
+// Decoded GOPs keyed by stream and keyframe pts, evicted least recently used
+// first to stay within a byte budget. A GOP larger than the whole budget is
+// not kept; a budget of 0 keeps nothing.
+class GopCache
+{
+public:
+    explicit GopCache(int64_t nBudget);
+
+    GopCache(const GopCache&) = delete;
+    GopCache& operator=(const GopCache&) = delete;
+
+    // Counts a hit or a miss and makes the GOP the most recently used.
+    std::shared_ptr<const CachedGop>    Lookup(const std::string& strStream, int64_t startPts);
+    // Neither counts nor touches the LRU order.
+    bool            Contains(const std::string& strStream, int64_t startPts) const;
+    void            Insert(const std::string& strStream, std::shared_ptr<const CachedGop> pGop);
+    void            Clear();
+
+    int64_t         Budget() const      { return m_nBudget; }
+    GopCacheStats   Stats() const;
+
+private:
+    typedef std::pair<std::string, int64_t> Key;
+    struct Entry
+    {
+        Key                                 key;
+        std::shared_ptr<const CachedGop>    pGop;
+    };
+
+    mutable std::mutex                          m_lock;
+    const int64_t                               m_nBudget;
+    std::list<Entry>                            m_lru;      // most recently used first
+    std::map<Key, std::list<Entry>::iterator>   m_entries;
+    GopCacheStats                               m_stats;
+};
+
+struct ScrubOptions
+{
+    DecoderOptions      decoder;
+    // GOPs on each side of the current one decoded ahead on the pool.
+    int                 nPrefetchGops   = 1;
+};
+
+struct ScrubStats
+{
+    uint64_t    nGopsDecoded    = 0;        // on the caller's thread, i.e. misses
+    uint64_t    nGopsPrefetched = 0;
+    uint64_t    nPrefetchWaits  = 0;        // lookups that waited for a prefetch in flight
+    double      dDecodeSeconds  = 0.0;      // spent decoding on the caller's thread
+};
+
+// Random access to the frames of one video stream for scrubbing, a GOP at a
+// time through a GopCache. Seek and Step decode a GOP only when the cache
+// does not have it; a reverse step inside a cached GOP costs a lookup. After
+// each move the neighbouring GOPs are decoded ahead on the pool with a
+// second decoder, previous ones first. Not thread-safe: one caller.
+class ScrubSource
+{
+public:
+    ScrubSource(GopCache* pCache, WorkerPool* pPrefetchPool = nullptr);
+    ~ScrubSource();
+
+    ScrubSource(const ScrubSource&) = delete;
+    ScrubSource& operator=(const ScrubSource&) = delete;
+
+    // Loads or builds the keyframe index next to strUrl.
+    int             Open(const std::string& strUrl, const ScrubOptions& options = ScrubOptions());
+    void            Close();
+
+    // The last frame at or before pts. pOut gets a new reference to the
+    // cached planes; nothing is copied.
+    int             Seek(int64_t pts, AVFrame* pOut);
+    // nDelta frames from the current one, across GOPs. AVERROR_EOF past
+    // either end of the stream, leaving the position unchanged.
+    int             Step(int nDelta, AVFrame* pOut);
+
+    int64_t         CurrentPts() const;
+    const KeyframeIndex&    Index() const   { return m_index; }
+    const VideoStream&      Stream() const  { return m_stream; }
+    ScrubStats      Stats() const;
+
+private:
+    int             GetGop(size_t iGop, std::shared_ptr<const CachedGop>* ppGop);
+    int             SetCurrent(size_t iGop, std::shared_ptr<const CachedGop> pGop, ptrdiff_t iFrame, AVFrame* pOut);
+    void            Prefetch(size_t iCenter);
+    void            PrefetchLoop();
+
+    GopCache*           m_pCache;
+    WorkerPool*         m_pPool;
+    std::string         m_strUrl;
+    ScrubOptions        m_options;
+    KeyframeIndex       m_index;
+
+    VideoStream         m_stream;
+    AVPacket*           m_pPacket           = nullptr;
+
+    std::shared_ptr<const CachedGop>    m_pCurrent;
+    size_t              m_iCurrentGop       = 0;
+    ptrdiff_t           m_iCurrentFrame     = -1;
+
+    // Prefetch state, under m_lock. The prefetch decoder is used by one
+    // pool task at a time.
+    std::mutex              m_lock;
+    std::condition_variable m_changed;
+    std::deque<size_t>      m_prefetchQueue;
+    std::set<size_t>        m_inFlight;
+    bool                    m_bPrefetchRunning  = false;
+    bool                    m_bPrefetchFailed   = false;
+    bool                    m_bClosing          = false;
+    VideoStream             m_prefetchStream;
+    AVPacket*               m_pPrefetchPacket   = nullptr;
+
+    uint64_t                m_nGopsDecoded      = 0;
+    uint64_t                m_nPrefetchWaits    = 0;
+    double                  m_dDecodeSeconds    = 0.0;
+    std::atomic<uint64_t>   m_nGopsPrefetched{0};
+};
@@ -0,0 +1,215 @@
+#include "gop_parallel.hpp"
+#include "bench_stats.hpp"
+#include "decoder_threading.hpp"
+#include "frame_sink.hpp"
+#include "keyframe_index.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <input> [--instances N,N,...] [--segment-packets N] [--buffer-mb MB]\n"
+            "                [--threads MODE[:N]] [--backend NAME] [--no-baseline]\n"
+            "  --instances        decoder instance counts to run (default 1, 2, 4 .. one per core)\n"
+            "  --segment-packets  GOPs are merged into segments of at least N packets (default 250)\n"
+            "  --buffer-mb        reorder buffer budget (default 512)\n"
+            "  --threads          threading of each instance (default none)\n"
+            "  --backend          software (default), auto, a hw device type, or a comma separated list\n"
+            "  --no-baseline      skip the single-context run with libavcodec's default threading\n",
+            argv0);
+}
+
+static int DecodeBaseline(const std::string& strUrl, const DecoderOptions& options, ChecksumSink* pSink,
+                          double* pdSeconds)
+{
+    VideoStream stream;
+    int ret = OpenStream(strUrl, &stream, options);
+    if (ret < 0)
+        return ret;
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+    {
+        CloseStream(&stream);
+        return AVERROR(ENOMEM);
+    }
+
+    FrameCallback onFrame = [&](AVCodecContext* avctx, AVFrame* frame)
+    {
+        frame->pts = frame->best_effort_timestamp;
+        return pSink->Write(avctx, frame);
+    };
+
+    BenchClock::time_point tStart = BenchClock::now();
+    while (ret >= 0)
+    {
+        if ((ret = av_read_frame(stream.pFormatContext, pPacket)) < 0)
+            break;
+        if (pPacket->stream_index == stream.iVideo)
+            ret = DecodeFrame(stream.pCodecCtx, pPacket, onFrame, nullptr, stream.pBackend.get());
+        av_packet_unref(pPacket);
+    }
+    if (ret == AVERROR_EOF)
+        ret = DecodeFrame(stream.pCodecCtx, NULL, onFrame, nullptr, stream.pBackend.get());
+    *pdSeconds = ElapsedSeconds(tStart, BenchClock::now());
+
+    av_packet_free(&pPacket);
+    CloseStream(&stream);
+    return (ret < 0 && ret != AVERROR_EOF) ? ret : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strUrl;
+    std::vector<unsigned> instances;
+    GopParallelOptions options;
+    bool bBaseline = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+        {
+            for (char* p = argv[++i]; *p; )
+            {
+                char* end = nullptr;
+                long n = strtol(p, &end, 10);
+                if (end == p || n <= 0)
+                {
+                    PrintUsage(argv[0]);
+                    return 1;
+                }
+                instances.push_back(static_cast<unsigned>(n));
+                p = *end == ',' ? end + 1 : end;
+            }
+        }
+        else if (strcmp(argv[i], "--segment-packets") == 0 && i + 1 < argc)
+            options.nSegmentPackets = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--buffer-mb") == 0 && i + 1 < argc)
+            options.nBufferBytes = strtoll(argv[++i], nullptr, 10) << 20;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (ParseThreadingConfig(argv[++i], &options.decoder.threading) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            options.decoder.strBackend = argv[++i];
+        else if (strcmp(argv[i], "--no-baseline") == 0)
+            bBaseline = false;
+        else if (argv[i][0] != '-' && strUrl.empty())
+            strUrl = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (strUrl.empty())
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    unsigned nCores = std::max(1u, std::thread::hardware_concurrency());
+    if (instances.empty())
+    {
+        for (unsigned n = 1; n < nCores; n *= 2)
+            instances.push_back(n);
+        instances.push_back(nCores);
+    }
+
+    // Built once up front so the runs below only load it.
+    KeyframeIndex index;
+    bool bBuilt = false;
+    BenchClock::time_point tIndex = BenchClock::now();
+    int ret = LoadOrBuildKeyframeIndex(strUrl, &index, &bBuilt);
+    if (ret < 0)
+    {
+        fprintf(stderr, "keyframe index: %s\n", av_err2str(ret));
+        return 1;
+    }
+    printf("input:        %s\n", strUrl.c_str());
+    printf("index:        %s in %.3f s, %zu keyframes, %lld packets\n", bBuilt ? "built" : "loaded",
+           ElapsedSeconds(tIndex, BenchClock::now()), index.Size(), (long long)index.Header().nFrames);
+    printf("cores:        %u\n", nCores);
+
+    double dBaselineFps = 0.0;
+    uint32_t nBaselineSum = 0;
+    if (bBaseline)
+    {
+        DecoderOptions baseline;
+        baseline.strBackend = options.decoder.strBackend;
+        ChecksumSink sink;
+        double dSeconds = 0.0;
+        if ((ret = DecodeBaseline(strUrl, baseline, &sink, &dSeconds)) < 0)
+        {
+            fprintf(stderr, "baseline: %s\n", av_err2str(ret));
+            return 1;
+        }
+        dBaselineFps = dSeconds > 0 ? sink.Frames() / dSeconds : 0.0;
+        nBaselineSum = sink.StreamSum();
+        printf("baseline:     1 context, default threading, %lld frames, %.3f s, %.2f frames/s, sum %08x\n",
+               (long long)sink.Frames(), dSeconds, dBaselineFps, nBaselineSum);
+    }
+    printf("\n");
+
+    printf("%9s %8s %8s %9s %10s %8s %7s %10s %8s %9s %s\n", "instances", "segments", "frames", "seconds",
+           "frames/s", "speedup", "effic.", "peak MiB", "stalls", "overlap", "checksum");
+
+    double dSingleFps = 0.0;
+    double dBestFps = 0.0;
+    uint32_t nFirstSum = 0;
+    bool bMismatch = false;
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+        options.nThreads = instances[i];
+        ChecksumSink sink;
+        FrameCallback onFrame = [&](AVCodecContext* avctx, AVFrame* frame)
+        {
+            return sink.Write(avctx, frame);
+        };
+
+        GopParallelStats stats;
+        if ((ret = DecodeGopParallel(strUrl, options, onFrame, &stats)) < 0)
+        {
+            fprintf(stderr, "%u instances: %s\n", instances[i], av_err2str(ret));
+            return 1;
+        }
+
+        // Speed-up is against the first row, normally one instance.
+        const double dFps = stats.dWallSeconds > 0 ? stats.nFrames / stats.dWallSeconds : 0.0;
+        if (i == 0)
+        {
+            dSingleFps = dFps;
+            nFirstSum = sink.StreamSum();
+        }
+        dBestFps = std::max(dBestFps, dFps);
+        const double dSpeedup = dSingleFps > 0 ? dFps / dSingleFps : 0.0;
+        const bool bMatch = sink.StreamSum() == nFirstSum && (!bBaseline || sink.StreamSum() == nBaselineSum);
+        bMismatch |= !bMatch;
+
+        printf("%9u %8zu %8lld %9.3f %10.2f %7.2fx %6.0f%% %10.1f %8llu %8.1f%% %08x%s\n",
+               stats.nThreads, stats.nSegments, (long long)stats.nFrames, stats.dWallSeconds, dFps, dSpeedup,
+               dSpeedup * 100.0 * instances[0] / stats.nThreads, stats.nPeakBufferedBytes / (1024.0 * 1024.0),
+               (unsigned long long)stats.nBudgetStalls,
+               stats.nDecoded ? stats.nDiscarded * 100.0 / stats.nDecoded : 0.0,
+               sink.StreamSum(), bMatch ? "" : " mismatch");
+    }
+
+    if (bBaseline && dBaselineFps > 0)
+        printf("\nbest vs baseline: %.2fx\n", dBestFps / dBaselineFps);
+    if (bMismatch)
+        fprintf(stderr, "output differs between runs\n");
+
+    return bMismatch ? 1 : 0;
+}
@@ -0,0 +1,317 @@
+#include "gop_parallel.hpp"
+#include "bench_stats.hpp"
+#include "keyframe_index.hpp"
+#include "stage_trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct GopSegment
+{
+    size_t                  iFirst      = 0;            // index entries [iFirst, iEnd)
+    size_t                  iEnd        = 0;
+    int64_t                 startPts    = INT64_MIN;    // inclusive
+    int64_t                 endPts      = INT64_MAX;    // exclusive
+    std::deque<AVFrame*>    frames;                     // decoded, not yet delivered
+    bool                    bDone       = false;
+};
+
+// Holds the frames of every segment until the caller reaches it. Segments
+// are taken in order, so the head segment is always being decoded or done,
+// and its instance is exempt from the budget.
+class ReorderBuffer
+{
+public:
+    ReorderBuffer(std::vector<GopSegment>* pSegments, int64_t nBudget)
+        : m_pSegments(pSegments)
+        , m_nBudget(nBudget)
+    {
+    }
+
+    ~ReorderBuffer()
+    {
+        for (GopSegment& segment : *m_pSegments)
+        {
+            for (AVFrame* frame : segment.frames)
+                av_frame_free(&frame);
+            segment.frames.clear();
+        }
+    }
+
+    // Takes ownership of frame.
+    int Push(size_t iSegment, AVFrame* frame)
+    {
+        const int64_t nBytes = FrameBytes(frame);
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        auto HasRoom = [&]() { return m_ret < 0 || iSegment == m_iHead || m_nBytes + nBytes <= m_nBudget; };
+        if (!HasRoom())
+        {
+            BenchClock::time_point tWait = BenchClock::now();
+            m_nStalls++;
+            m_cond.wait(lock, HasRoom);
+            m_dStallSeconds += ElapsedSeconds(tWait, BenchClock::now());
+        }
+        if (m_ret < 0)
+        {
+            av_frame_free(&frame);
+            return AVERROR_EXIT;
+        }
+
+        (*m_pSegments)[iSegment].frames.push_back(frame);
+        m_nBytes += nBytes;
+        m_nPeakBytes = std::max(m_nPeakBytes, m_nBytes);
+        m_cond.notify_all();
+        return 0;
+    }
+
+    void Finish(size_t iSegment)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        (*m_pSegments)[iSegment].bDone = true;
+        m_cond.notify_all();
+    }
+
+    // Wakes everyone; Pop returns ret from now on. The first error sticks.
+    void Abort(int ret)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_ret == 0)
+            m_ret = ret;
+        m_cond.notify_all();
+    }
+
+    bool Aborted()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_ret < 0;
+    }
+
+    // The next frame in presentation order, AVERROR_EOF after the last one.
+    int Pop(AVFrame** ppFrame)
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (true)
+        {
+            if (m_ret < 0)
+                return m_ret;
+            if (m_iHead >= m_pSegments->size())
+                return AVERROR_EOF;
+
+            GopSegment& segment = (*m_pSegments)[m_iHead];
+            if (!segment.frames.empty())
+            {
+                *ppFrame = segment.frames.front();
+                segment.frames.pop_front();
+                m_nBytes -= FrameBytes(*ppFrame);
+                m_cond.notify_all();
+                return 0;
+            }
+            if (segment.bDone)
+            {
+                m_iHead++;
+                m_cond.notify_all();
+                continue;
+            }
+
+            BenchClock::time_point tWait = BenchClock::now();
+            m_cond.wait(lock);
+            m_dWaitSeconds += ElapsedSeconds(tWait, BenchClock::now());
+        }
+    }
+
+    int64_t     PeakBytes() const       { return m_nPeakBytes; }
+    uint64_t    Stalls() const          { return m_nStalls; }
+    double      StallSeconds() const    { return m_dStallSeconds; }
+    double      WaitSeconds() const     { return m_dWaitSeconds; }
+
+private:
+    std::vector<GopSegment>*    m_pSegments;
+    const int64_t               m_nBudget;
+
+    std::mutex                  m_lock;
+    std::condition_variable     m_cond;
+    size_t                      m_iHead         = 0;
+    int64_t                     m_nBytes        = 0;
+    int64_t                     m_nPeakBytes    = 0;
+    int                         m_ret           = 0;
+    uint64_t                    m_nStalls       = 0;
+    double                      m_dStallSeconds = 0.0;
+    double                      m_dWaitSeconds  = 0.0;
+};
+
+struct GopWorker
+{
+    // Declared first so it outlives the frames the stream decoded into it.
+    FramePool           framePool;
+    VideoStream         stream;
+    std::thread         thread;
+    int64_t             nPackets    = 0;
+    int64_t             nDecoded    = 0;
+    int64_t             nDiscarded  = 0;
+};
+
+static int DecodeSegment(GopWorker* pWorker, const KeyframeIndex& index, const GopSegment& segment,
+                         size_t iSegment, ReorderBuffer* pBuffer, AVPacket* pPacket)
+{
+    VideoStream& stream = pWorker->stream;
+
+    FrameCallback onDecoded = [&](AVCodecContext*, AVFrame* frame)
+    {
+        pWorker->nDecoded++;
+        const int64_t pts = frame->best_effort_timestamp;
+        if (pts != AV_NOPTS_VALUE && (pts < segment.startPts || pts >= segment.endPts))
+        {
+            pWorker->nDiscarded++;
+            return 0;
+        }
+
+        AVFrame* pOut = av_frame_alloc();
+        if (!pOut)
+            return AVERROR(ENOMEM);
+        int ret = av_frame_ref(pOut, frame);
+        if (ret < 0)
+        {
+            av_frame_free(&pOut);
+            return ret;
+        }
+        pOut->pts = pts;
+        return pBuffer->Push(iSegment, pOut);
+    };
+
+    return DecodeGopRange(&stream, pPacket, index, segment.iFirst, segment.iEnd, onDecoded, &pWorker->framePool,
+                          &pWorker->nPackets);
+}
+
+int DecodeGopParallel(const std::string& strUrl, const GopParallelOptions& options,
+                      const FrameCallback& onFrame, GopParallelStats* pStats)
+{
+    BenchClock::time_point tStart = BenchClock::now();
+    GopParallelStats stats;
+
+    KeyframeIndex index;
+    int ret = LoadOrBuildKeyframeIndex(strUrl, &index, &stats.bIndexBuilt);
+    stats.dIndexSeconds = ElapsedSeconds(tStart, BenchClock::now());
+    if (ret < 0)
+        return ret;
+    if (index.Size() == 0)
+        return AVERROR_INVALIDDATA;
+
+    DecoderOptions decoder = options.decoder;
+    decoder.pFramePool = nullptr;
+    if (decoder.threading.mode == ThreadMode::Default)
+        decoder.threading = { ThreadMode::None, 1 };
+
+    // Opened here for the index check and as the context handed to onFrame.
+    VideoStream reference;
+    if ((ret = OpenStream(strUrl, &reference, decoder)) < 0)
+        return ret;
+    if (index.Header().iStream != reference.iVideo)
+    {
+        CloseStream(&reference);
+        return AVERROR(EINVAL);
+    }
+
+    std::vector<GopSegment> segments;
+    for (size_t i = 0; i < index.Size(); )
+    {
+        GopSegment segment;
+        segment.iFirst = i;
+        int64_t nPackets = 0;
+        do
+            nPackets += index.Entry(i++).nGopFrames;
+        while (i < index.Size() && nPackets < options.nSegmentPackets);
+        segment.iEnd = i;
+        if (segment.iFirst > 0)
+            segment.startPts = index.Entry(segment.iFirst).pts;
+        if (segment.iEnd < index.Size())
+            segment.endPts = index.Entry(segment.iEnd).pts;
+        segments.push_back(segment);
+    }
+
+    unsigned nThreads = options.nThreads ? options.nThreads : std::thread::hardware_concurrency();
+    nThreads = std::max(1u, std::min<unsigned>(nThreads, static_cast<unsigned>(segments.size())));
+    stats.nThreads = nThreads;
+    stats.nSegments = segments.size();
+
+    std::vector<std::unique_ptr<GopWorker>> workers;
+    for (unsigned i = 0; i < nThreads; i++)
+        workers.emplace_back(new GopWorker());
+
+    ReorderBuffer buffer(&segments, options.nBufferBytes);
+    std::atomic<size_t> nNextSegment{0};
+
+    for (unsigned i = 0; i < nThreads; i++)
+    {
+        GopWorker* pWorker = workers[i].get();
+        pWorker->thread = std::thread([&, pWorker, i]()
+        {
+            SetTraceThreadName(("gop " + std::to_string(i)).c_str());
+
+            DecoderOptions workerOptions = decoder;
+            workerOptions.pFramePool = &pWorker->framePool;
+            int ret = OpenStream(strUrl, &pWorker->stream, workerOptions);
+            AVPacket* pPacket = ret >= 0 ? av_packet_alloc() : nullptr;
+            if (ret >= 0 && !pPacket)
+                ret = AVERROR(ENOMEM);
+
+            while (ret >= 0 && !buffer.Aborted())
+            {
+                const size_t iSegment = nNextSegment.fetch_add(1, std::memory_order_relaxed);
+                if (iSegment >= segments.size())
+                    break;
+                if ((ret = DecodeSegment(pWorker, index, segments[iSegment], iSegment, &buffer, pPacket)) < 0)
+                    break;
+                buffer.Finish(iSegment);
+            }
+            if (ret < 0)
+            {
+                if (ret != AVERROR_EXIT)
+                    fprintf(stderr, "gop decoder %u: %s\n", i, av_err2str(ret));
+                buffer.Abort(ret);
+            }
+
+            av_packet_free(&pPacket);
+            CloseStream(&pWorker->stream);
+        });
+    }
+
+    AVFrame* frame = nullptr;
+    while ((ret = buffer.Pop(&frame)) >= 0)
+    {
+        stats.nFrames++;
+        ret = onFrame(reference.pCodecCtx, frame);
+        av_frame_free(&frame);
+        if (ret < 0)
+            break;
+    }
+    if (ret == AVERROR_EOF)
+        ret = 0;
+    // Releases instances still decoding when the caller stopped early.
+    buffer.Abort(ret < 0 ? ret : AVERROR_EXIT);
+
+    for (std::unique_ptr<GopWorker>& pWorker : workers)
+    {
+        pWorker->thread.join();
+        stats.nPackets += pWorker->nPackets;
+        stats.nDecoded += pWorker->nDecoded;
+        stats.nDiscarded += pWorker->nDiscarded;
+    }
+    CloseStream(&reference);
+
+    stats.nPeakBufferedBytes = buffer.PeakBytes();
+    stats.nBudgetStalls = buffer.Stalls();
+    stats.dBudgetStallSeconds = buffer.StallSeconds();
+    stats.dDeliverWaitSeconds = buffer.WaitSeconds();
+    stats.dWallSeconds = ElapsedSeconds(tStart, BenchClock::now());
+    if (pStats)
+        *pStats = stats;
+    return ret;
+}
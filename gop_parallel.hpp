@@ -0,0 +1,51 @@
+#pragma once
+
+#include "decoder.hpp"
+
+#include <cstdint>
+#include <string>
+
+struct GopParallelOptions
+{
+    // Applied to every decoder instance. ThreadMode::Default is treated as
+    // None, since the parallelism comes from the instances; pFramePool is
+    // ignored, each instance has a pool of its own.
+    DecoderOptions  decoder;
+    unsigned        nThreads        = 0;        // decoder instances; 0: hardware threads
+    // Consecutive GOPs are merged into a segment until it holds this many
+    // packets, so short GOPs don't pay a seek and a flush each.
+    int             nSegmentPackets = 250;
+    // Frames decoded ahead of the one being delivered. The instance decoding
+    // the oldest segment never waits on it, so a small budget slows the
+    // decode down but cannot stall it.
+    int64_t         nBufferBytes    = 512LL << 20;
+};
+
+struct GopParallelStats
+{
+    unsigned    nThreads            = 0;
+    size_t      nSegments           = 0;
+    int64_t     nPackets            = 0;    // sent to the decoders, including overlap
+    int64_t     nDecoded            = 0;    // frames the decoders returned
+    int64_t     nDiscarded          = 0;    // decoded outside their segment's pts range
+    int64_t     nFrames             = 0;    // delivered to onFrame
+    int64_t     nPeakBufferedBytes  = 0;
+    uint64_t    nBudgetStalls       = 0;    // decoder instances waiting for buffer room
+    double      dBudgetStallSeconds = 0.0;
+    double      dDeliverWaitSeconds = 0.0;  // the caller waiting for the oldest segment
+    double      dIndexSeconds       = 0.0;  // loading or building the keyframe index
+    bool        bIndexBuilt         = false;
+    double      dWallSeconds        = 0.0;
+};
+
+// Offline decode of strUrl's video stream on several decoder instances at
+// once. The keyframe index (built on first use, see keyframe_index.hpp)
+// splits the stream into segments of whole GOPs; instances take segments in
+// order, each seeking to its first keyframe. A segment owns the frames with
+// pts from its first keyframe up to the next segment's, and decodes past its
+// end only for leading pictures of an open GOP. Frames reach onFrame on the
+// calling thread in presentation order, through a reorder buffer bounded by
+// nBufferBytes. avctx is a context opened on the stream for reference; it is
+// not the one that decoded the frame.
+int     DecodeGopParallel(const std::string& strUrl, const GopParallelOptions& options,
+                          const FrameCallback& onFrame, GopParallelStats* pStats = nullptr);
@@ -5,9 +5,21 @@
 #include <d3d11.h>
 #include <dxgi1_3.h>
 
+#include <atomic>
 #include <thread>
 #include <string>
 
+#include "decoder.hpp"
+#include "demux_thread.hpp"
+#include "frame_scheduler.hpp"
+#include "frame_sink.hpp"
+#include "hw_format.hpp"
+#include "live_profile.hpp"
+#include "memory_budget.hpp"
+#include "packet_fanout.hpp"
+#include "packet_queue.hpp"
+#include "stage_trace.hpp"
+
 extern "C"
 {
 #include <libavcodec/avcodec.h>
@@ -30,18 +42,37 @@ ID3D11VideoProcessor*              g_pD3D11VideoProcessor;
     }
 
 std::thread           g_thDecodeThread;
-bool                  g_bDecodeThreadCanRun = false;
+std::atomic<bool>     g_bDecodeThreadCanRun{false};
 AVBufferRef*          g_pBufferRef;
-enum AVPixelFormat    g_pixelFormat;
+
+// Paces presentation by pts; decode and render both run on the decode thread.
+SystemClock           g_clock;
+FrameScheduler        g_scheduler(&g_clock);
 
 LRESULT CALLBACK      WindowProc(HWND, UINT, WPARAM, LPARAM);
 void                  OpenStream(HWND, const std::string);
 int                   InitHWDecoder(HWND, AVCodecContext*, const enum AVHWDeviceType);
 HRESULT               InitD3D11(HWND);
 void                  CleanD3D11();
-int                   DecodeFrame(HWND, AVCodecContext*, AVPacket*);
-void                  RenderFrame(HWND, AVCodecContext*, AVFrame*);
-enum AVPixelFormat    GetHWFormat(AVCodecContext*, const enum AVPixelFormat*);
+void                  RenderFrame(HWND, AVCodecContext*, const AVFrame*);
+
+// The window is one FrameSink among the others: DecodeFrame delivers into
+// it, and it paces frames by pts before presenting them. Frames that came
+// back in software (the hwaccel rejected them) are not shown; the video
+// processor only takes D3D11 surfaces.
+class SwapChainSink : public FrameSink
+{
+public:
+    explicit SwapChainSink(HWND hWnd) : m_hWnd(hWnd) {}
+
+    const char*     Name() const override   { return "swapchain"; }
+    int             Write(AVCodecContext* avctx, const AVFrame* frame) override;
+    int64_t         Frames() const override { return m_nFrames; }
+
+private:
+    HWND            m_hWnd;
+    int64_t         m_nFrames   = 0;
+};
 
 int WINAPI WinMain(HINSTANCE hInstance,
                    HINSTANCE hPrevInstance,
@@ -103,6 +134,9 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
         case WM_CREATE:
         {
             g_bDecodeThreadCanRun = TRUE;
+            // DECODE_TRACE=path.json records stage timings, written on exit
+            // as a Chrome trace plus path.json.prom.
+            SetTracingEnabled(getenv("DECODE_TRACE") != nullptr);
             // "D:/resources/Forrest_Gump_IMAX.mp4"
             // "https://gstreamer.freedesktop.org/data/media/sintel_trailer-480p.webm"
             // "D:/resources/peru_7680x4320.mp4"
@@ -113,6 +147,11 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
             g_bDecodeThreadCanRun = FALSE;
             if (g_thDecodeThread.joinable())
                 g_thDecodeThread.join();
+            if (const char* pszTrace = getenv("DECODE_TRACE"))
+            {
+                WriteChromeTrace(pszTrace);
+                WritePrometheusMetrics(std::string(pszTrace) + ".prom");
+            }
             PostQuitMessage(0);
             return 0;
         } break;
@@ -125,8 +164,16 @@ void OpenStream(HWND hWnd, const std::string strUrl)
 {
     int ret = 0;
 
+    // Network sources start showing frames after a short probe instead of
+    // buffering seconds of input first.
+    const bool bLive = IsLiveUrl(strUrl);
+    AVDictionary* pOptions = nullptr;
+    if (bLive)
+        SetLowLatencyFormatOptions(&pOptions);
+
     AVFormatContext* pFormatContext = nullptr;
-    ret = avformat_open_input(&pFormatContext, strUrl.c_str(), nullptr, nullptr);
+    ret = avformat_open_input(&pFormatContext, strUrl.c_str(), nullptr, &pOptions);
+    av_dict_free(&pOptions);
     if (ret < 0)
     {
         MessageBox(NULL, L"avformat_open_input", L"Error", MB_ICONERROR | MB_OK);
@@ -184,24 +231,15 @@ void OpenStream(HWND hWnd, const std::string strUrl)
         return;
     }
 
-    for (int i = 0;; i++)
+    enum AVPixelFormat hwPixelFormat = FindHWPixelFormat(pCodec, type);
+    if (hwPixelFormat == AV_PIX_FMT_NONE)
     {
-        const AVCodecHWConfig* pConfig = avcodec_get_hw_config(pCodec, i);
-        if (!pConfig)
-        {
-            MessageBox(NULL, L"avcodec_get_hw_config", L"Error", MB_ICONERROR | MB_OK);
-            return;
-        }
-        if (pConfig->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX &&
-            pConfig->methods & AV_CODEC_HW_CONFIG_METHOD_HW_FRAMES_CTX &&
-            pConfig->device_type == type)
-        {
-            g_pixelFormat = pConfig->pix_fmt;
-            break;
-        }
+        MessageBox(NULL, L"avcodec_get_hw_config", L"Error", MB_ICONERROR | MB_OK);
+        return;
     }
 
     pCodecCtx->get_format = GetHWFormat;
+    pCodecCtx->pkt_timebase = pFormatContext->streams[iVideo]->time_base;
 
     if (InitHWDecoder(hWnd, pCodecCtx, type) < 0)
     {
@@ -209,7 +247,24 @@ void OpenStream(HWND hWnd, const std::string strUrl)
         return;
     }
 
-    pCodecCtx->pix_fmt = g_pixelFormat;
+    pCodecCtx->pix_fmt = hwPixelFormat;
+    if (bLive)
+        ApplyLowLatencyCodecOptions(pCodecCtx);
+
+    // DECODE_MEMORY_MB bounds the surfaces kept beyond the decoder's own and
+    // the payload the demux ring may hold.
+    int64_t nQueueBytes = 256LL << 20;
+    if (const char* pszMemory = getenv("DECODE_MEMORY_MB"))
+    {
+        ProcessMemoryBudget()->SetLimit(static_cast<int64_t>(atoi(pszMemory)) << 20);
+        MemoryPlan plan = PlanMemory(ProcessMemoryBudget()->Limit(),
+                                     EstimateFrameBytes(AV_PIX_FMT_NV12, pCodecCtx->width, pCodecCtx->height));
+        // Frames are presented as soon as they are decoded; a few spare
+        // surfaces cover the swap chain.
+        pCodecCtx->extra_hw_frames = FFMIN(plan.nExtraHwFrames, 4);
+        if (plan.nPacketBytes > 0)
+            nQueueBytes = plan.nPacketBytes;
+    }
 
     ret = avcodec_open2(pCodecCtx, pCodec, NULL);
     if (ret < 0)
@@ -225,18 +280,49 @@ void OpenStream(HWND hWnd, const std::string strUrl)
         return;
     }
 
+    // Demux on its own thread so I/O and container parsing stalls don't stall
+    // decoding; the ring holds at most 64 packets or 256 MiB of payload, less
+    // under DECODE_MEMORY_MB.
+    PacketQueue packetQueue;
+    DemuxThread demuxThread;
+
+    // DECODE_RECORD=path stream-copies the input to a file while it plays.
+    RemuxSink recording;
+    PacketFanout fanout;
+    if (const char* pszRecord = getenv("DECODE_RECORD"))
+    {
+        if (recording.Open(pFormatContext, pszRecord) >= 0)
+            fanout.AddSink(&recording);
+    }
+    demuxThread.SetFanout(&fanout);
+
+    if (ProcessMemoryBudget()->Limit() > 0)
+        packetQueue.SetMemoryBudget(ProcessMemoryBudget());
+    if (packetQueue.Init(64, nQueueBytes) < 0 ||
+        demuxThread.Start(pFormatContext, iVideo, &packetQueue) < 0)
+    {
+        MessageBox(NULL, L"DemuxThread", L"Error", MB_ICONERROR | MB_OK);
+        return;
+    }
+
+    SwapChainSink sink(hWnd);
+    FrameCallback onFrame = [&](AVCodecContext* avctx, AVFrame* frame) { return sink.Write(avctx, frame); };
+
     while (g_bDecodeThreadCanRun && ret >= 0)
     {
-        if ((ret = av_read_frame(pFormatContext, pPacket)) < 0)
+        if ((ret = packetQueue.Pop(pPacket)) < 0)
             break;
 
-        if (pPacket->stream_index == iVideo)
-            ret = DecodeFrame(hWnd, pCodecCtx, pPacket);
+        g_scheduler.UpdateDiscard(pCodecCtx);
+        ret = DecodeFrame(pCodecCtx, pPacket, onFrame);
 
         av_packet_unref(pPacket);
     }
 
-    ret = DecodeFrame(hWnd, pCodecCtx, NULL);
+    demuxThread.Stop();
+    fanout.Close();
+
+    ret = DecodeFrame(pCodecCtx, NULL, onFrame);
 
     av_packet_free(&pPacket);
     avcodec_close(pCodecCtx);
@@ -348,19 +434,6 @@ void CleanD3D11()
     SAFE_RELEASE(g_pSwapChain2);
 }
 
-enum AVPixelFormat GetHWFormat(AVCodecContext* ctx, const enum AVPixelFormat* pix_fmts)
-{
-    const enum AVPixelFormat* p;
-
-    for (p = pix_fmts; *p != -1; p++)
-    {
-        if (*p == g_pixelFormat)
-            return *p;
-    }
-
-    return AV_PIX_FMT_NONE;
-}
-
 int InitHWDecoder(HWND hWnd, AVCodecContext* pCodecContext, const enum AVHWDeviceType type)
 {
     AVDictionary* pOpts = nullptr;
@@ -405,8 +478,9 @@ int InitHWDecoder(HWND hWnd, AVCodecContext* pCodecContext, const enum AVHWDevic
     return ret;
 }
 
-void RenderFrame(HWND hWnd, AVCodecContext* avctx, AVFrame* frame)
+void RenderFrame(HWND hWnd, AVCodecContext* avctx, const AVFrame* frame)
 {
+    ScopedStage stage(TraceStage::Present);
     HRESULT hr;
     D3D11_TEXTURE2D_DESC texture_desc;
     D3D11_TEXTURE2D_DESC bktexture_desc;
@@ -587,7 +661,9 @@ void RenderFrame(HWND hWnd, AVCodecContext* avctx, AVFrame* frame)
     if (g_pSwapChain2 != NULL)
     {
         // hr = m_swapchain2->Present1(0, DXGI_PRESENT_ALLOW_TEARING, &parameters);
-        g_pSwapChain2->Present1(0, DXGI_PRESENT_DO_NOT_WAIT, &parameters);
+        // The scheduler already waited for the frame's pts; a busy queue
+        // should block rather than silently discard it.
+        g_pSwapChain2->Present1(0, 0, &parameters);
     }
 
 done:
@@ -597,44 +673,15 @@ done:
     SAFE_RELEASE(pDXGIBackBuffer);
 }
 
-int DecodeFrame(HWND hWnd, AVCodecContext* avctx, AVPacket* packet)
+int SwapChainSink::Write(AVCodecContext* avctx, const AVFrame* frame)
 {
-    AVFrame* frame = NULL;
-    int ret;
-
-    ret = avcodec_send_packet(avctx, packet);
-    if (ret < 0)
+    m_nFrames++;
+    double dDecodedAt = g_clock.Now();
+    if (frame->format == AV_PIX_FMT_D3D11 &&
+        g_scheduler.Schedule(frame->best_effort_timestamp, avctx->pkt_timebase, dDecodedAt) == ScheduleAction::Present)
     {
-        fprintf(stderr, "Error during decoding\n");
-        return ret;
-    }
-
-    while (true)
-    {
-        if (!(frame = av_frame_alloc())) {
-            fprintf(stderr, "Can not alloc frame\n");
-            ret = AVERROR(ENOMEM);
-            goto fail;
-        }
-
-        ret = avcodec_receive_frame(avctx, frame);
-        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-        {
-            av_frame_free(&frame);
-            return 0;
-        }
-        else if (ret < 0)
-        {
-            fprintf(stderr, "Error while decoding\n");
-            goto fail;
-        }
-
-        if (frame->format == AV_PIX_FMT_D3D11)
-            RenderFrame(hWnd, avctx, frame);
-
-    fail:
-        av_frame_free(&frame);
-        if (ret < 0)
-            return ret;
+        RenderFrame(m_hWnd, avctx, frame);
+        g_scheduler.Presented();
     }
+    return 0;
 }
@@ -0,0 +1,45 @@
+#include "hw_format.hpp"
+
+extern "C"
+{
+#include <libavutil/pixdesc.h>
+}
+
+enum AVPixelFormat FindHWPixelFormat(const AVCodec* pCodec, enum AVHWDeviceType type)
+{
+    for (int i = 0;; i++)
+    {
+        const AVCodecHWConfig* pConfig = avcodec_get_hw_config(pCodec, i);
+        if (!pConfig)
+            return AV_PIX_FMT_NONE;
+
+        if (pConfig->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX &&
+            pConfig->device_type == type)
+            return pConfig->pix_fmt;
+    }
+}
+
+enum AVPixelFormat GetHWFormat(AVCodecContext* ctx, const enum AVPixelFormat* pix_fmts)
+{
+    enum AVPixelFormat wanted = AV_PIX_FMT_NONE;
+    if (ctx->hw_device_ctx)
+    {
+        const AVHWDeviceContext* pDevice = reinterpret_cast<const AVHWDeviceContext*>(ctx->hw_device_ctx->data);
+        wanted = FindHWPixelFormat(ctx->codec, pDevice->type);
+    }
+
+    // The software formats come last; avcodec falls back to the last of
+    // them when the hwaccel is not offered (unsupported profile or size).
+    enum AVPixelFormat software = AV_PIX_FMT_NONE;
+    for (const enum AVPixelFormat* p = pix_fmts; *p != AV_PIX_FMT_NONE; p++)
+    {
+        if (*p == wanted)
+            return *p;
+
+        const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(*p);
+        if (desc && !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+            software = *p;
+    }
+
+    return software;
+}
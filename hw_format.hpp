@@ -0,0 +1,17 @@
+#pragma once
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/hwcontext.h>
+}
+
+// Pixel format the codec produces when decoding through a device of the
+// given type, AV_PIX_FMT_NONE if the codec has no such hw config.
+enum AVPixelFormat      FindHWPixelFormat(const AVCodec* pCodec, enum AVHWDeviceType type);
+
+// get_format callback for hw decoding. It derives the wanted format from the
+// device attached to ctx->hw_device_ctx instead of global state, so any
+// number of decoders can use it concurrently. When the device format is not
+// offered it returns the software one, so those frames decode on the CPU.
+enum AVPixelFormat      GetHWFormat(AVCodecContext* ctx, const enum AVPixelFormat* pix_fmts);
@@ -0,0 +1,225 @@
+#include "decoder.hpp"
+#include "bench_stats.hpp"
+#include "file_io.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <input> [--io default|mmap|readahead|all] [--window-mb MB] [--repeat N] [--cold]\n"
+            "  --io         how the file is read (default all, one run each)\n"
+            "  --window-mb  read-ahead window, and madvise distance for mmap (default 4)\n"
+            "  --repeat     demux passes per mode (default 1)\n"
+            "  --cold       drop the file's cached pages before every pass\n",
+            argv0);
+}
+
+struct ProcessCounters
+{
+    uint64_t    nReadSyscalls   = 0;
+    uint64_t    nReadBytes      = 0;    // bytes that hit the storage layer
+    uint64_t    nMinorFaults    = 0;
+    uint64_t    nMajorFaults    = 0;
+};
+
+// Syscall counts come from /proc/self/io, which only Linux has.
+static ProcessCounters SampleCounters()
+{
+    ProcessCounters counters;
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        counters.nMinorFaults = static_cast<uint64_t>(usage.ru_minflt);
+        counters.nMajorFaults = static_cast<uint64_t>(usage.ru_majflt);
+    }
+#endif
+    FILE* fp = fopen("/proc/self/io", "r");
+    if (fp)
+    {
+        char szLine[128];
+        unsigned long long n = 0;
+        while (fgets(szLine, sizeof(szLine), fp))
+        {
+            if (sscanf(szLine, "syscr: %llu", &n) == 1)
+                counters.nReadSyscalls = n;
+            else if (sscanf(szLine, "read_bytes: %llu", &n) == 1)
+                counters.nReadBytes = n;
+        }
+        fclose(fp);
+    }
+    return counters;
+}
+
+static void DropCachedPages(const std::string& strUrl)
+{
+#if defined(POSIX_FADV_DONTNEED)
+    int fd = open(strUrl.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+#else
+    (void)strUrl;
+#endif
+}
+
+struct PassResult
+{
+    int64_t         nPackets    = 0;
+    int64_t         nBytes      = 0;
+    double          dSeconds    = 0.0;
+    ProcessCounters counters;
+    FileIOStats     io;
+};
+
+// Opens the input and reads every packet of every stream; nothing is decoded.
+static int RunPass(const std::string& strUrl, FileIOMode mode, size_t nWindowBytes, PassResult* pResult)
+{
+    ProcessCounters before = SampleCounters();
+    BenchClock::time_point tStart = BenchClock::now();
+
+    int ret = 0;
+    FileIO io;
+    AVFormatContext* pFormatContext = nullptr;
+    if (mode != FileIOMode::Default)
+    {
+        if ((ret = io.Open(strUrl, mode, nWindowBytes)) < 0)
+            return ret;
+        if (!(pFormatContext = avformat_alloc_context()))
+            return AVERROR(ENOMEM);
+        pFormatContext->pb = io.Context();
+        pFormatContext->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    if ((ret = avformat_open_input(&pFormatContext, strUrl.c_str(), nullptr, nullptr)) < 0)
+    {
+        fprintf(stderr, "avformat_open_input: %s\n", av_err2str(ret));
+        return ret;
+    }
+
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+    {
+        avformat_close_input(&pFormatContext);
+        return AVERROR(ENOMEM);
+    }
+
+    while ((ret = av_read_frame(pFormatContext, pPacket)) >= 0)
+    {
+        pResult->nPackets++;
+        pResult->nBytes += pPacket->size;
+        av_packet_unref(pPacket);
+    }
+
+    av_packet_free(&pPacket);
+    avformat_close_input(&pFormatContext);
+
+    pResult->dSeconds = ElapsedSeconds(tStart, BenchClock::now());
+    ProcessCounters after = SampleCounters();
+    pResult->counters.nReadSyscalls = after.nReadSyscalls - before.nReadSyscalls;
+    pResult->counters.nReadBytes = after.nReadBytes - before.nReadBytes;
+    pResult->counters.nMinorFaults = after.nMinorFaults - before.nMinorFaults;
+    pResult->counters.nMajorFaults = after.nMajorFaults - before.nMajorFaults;
+    pResult->io = io.Stats();
+
+    if (ret != AVERROR_EOF)
+    {
+        fprintf(stderr, "av_read_frame: %s\n", av_err2str(ret));
+        return ret;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strUrl;
+    std::string strMode = "all";
+    size_t nWindowBytes = 4 << 20;
+    int nRepeat = 1;
+    bool bCold = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--io") == 0 && i + 1 < argc)
+            strMode = argv[++i];
+        else if (strcmp(argv[i], "--window-mb") == 0 && i + 1 < argc)
+            nWindowBytes = strtoull(argv[++i], nullptr, 10) << 20;
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+            nRepeat = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--cold") == 0)
+            bCold = true;
+        else if (argv[i][0] != '-' && strUrl.empty())
+            strUrl = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<FileIOMode> modes;
+    FileIOMode mode;
+    if (strMode == "all")
+        modes = { FileIOMode::Default, FileIOMode::Mmap, FileIOMode::ReadAhead };
+    else if (ParseFileIOMode(strMode, &mode) == 0)
+        modes.push_back(mode);
+    if (strUrl.empty() || modes.empty() || nRepeat < 1 || nWindowBytes == 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    if (!IsLocalFile(strUrl))
+    {
+        fprintf(stderr, "%s is not a local file\n", strUrl.c_str());
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    printf("input:        %s\n", strUrl.c_str());
+    printf("window:       %zu KiB, %s cache\n\n", nWindowBytes >> 10, bCold ? "cold" : "warm");
+    printf("%-10s %4s %10s %10s %12s %10s %10s %10s %10s\n",
+           "io", "pass", "MiB/s", "pkts/s", "read calls", "KiB/call", "advise", "minflt", "majflt");
+
+    int nFailed = 0;
+    for (FileIOMode m : modes)
+    {
+        for (int pass = 0; pass < nRepeat; pass++)
+        {
+            if (bCold)
+                DropCachedPages(strUrl);
+
+            PassResult result;
+            if (RunPass(strUrl, m, nWindowBytes, &result) < 0)
+            {
+                nFailed++;
+                continue;
+            }
+
+            const ProcessCounters& c = result.counters;
+            printf("%-10s %4d %10.1f %10.0f %12llu %10.1f %10llu %10llu %10llu\n",
+                   FileIOModeToString(m), pass,
+                   result.dSeconds > 0 ? result.nBytes / (1024.0 * 1024.0) / result.dSeconds : 0.0,
+                   result.dSeconds > 0 ? result.nPackets / result.dSeconds : 0.0,
+                   (unsigned long long)c.nReadSyscalls,
+                   c.nReadSyscalls ? result.nBytes / 1024.0 / c.nReadSyscalls : 0.0,
+                   (unsigned long long)result.io.nAdvise,
+                   (unsigned long long)c.nMinorFaults, (unsigned long long)c.nMajorFaults);
+        }
+    }
+    printf("peak rss:     %.1f MiB\n", PeakRssBytes() / (1024.0 * 1024.0));
+
+    return nFailed ? 1 : 0;
+}
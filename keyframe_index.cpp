@@ -0,0 +1,500 @@
+#include "keyframe_index.hpp"
+#include "bench_stats.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define HAVE_MMAP 1
+#endif
+
+static const char       kMagic[4]   = { 'K', 'I', 'D', 'X' };
+static const uint32_t   kVersion    = 1;
+
+static int StatSource(const std::string& strPath, int64_t* pnSize, int64_t* pnMtime)
+{
+    struct stat st;
+    if (stat(strPath.c_str(), &st) != 0)
+        return AVERROR(errno);
+    *pnSize = static_cast<int64_t>(st.st_size);
+    *pnMtime = static_cast<int64_t>(st.st_mtime);
+    return 0;
+}
+
+KeyframeIndex::KeyframeIndex()
+{
+    Reset();
+}
+
+KeyframeIndex::~KeyframeIndex()
+{
+    Reset();
+}
+
+void KeyframeIndex::Reset()
+{
+#ifdef HAVE_MMAP
+    if (m_pMap)
+        munmap(m_pMap, m_nMapSize);
+#endif
+    m_pMap = nullptr;
+    m_nMapSize = 0;
+    m_entries.clear();
+    m_pEntries = nullptr;
+    m_nEntries = 0;
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+int KeyframeIndex::Build(const std::string& strUrl)
+{
+    Reset();
+
+    int ret = 0;
+    AVFormatContext* pFormatContext = nullptr;
+    if ((ret = avformat_open_input(&pFormatContext, strUrl.c_str(), nullptr, nullptr)) < 0)
+    {
+        fprintf(stderr, "avformat_open_input: %s\n", av_err2str(ret));
+        return ret;
+    }
+    if ((ret = avformat_find_stream_info(pFormatContext, nullptr)) < 0)
+    {
+        fprintf(stderr, "avformat_find_stream_info: %s\n", av_err2str(ret));
+        avformat_close_input(&pFormatContext);
+        return ret;
+    }
+
+    // The same stream OpenStream picks.
+    int iStream = -1;
+    for (unsigned int i = 0; i < pFormatContext->nb_streams; i++)
+    {
+        if (pFormatContext->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+            iStream = static_cast<int>(i);
+        else
+            pFormatContext->streams[i]->discard = AVDISCARD_ALL;
+    }
+    if (iStream == -1)
+    {
+        fprintf(stderr, "Can't find video stream\n");
+        avformat_close_input(&pFormatContext);
+        return AVERROR_STREAM_NOT_FOUND;
+    }
+
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+    {
+        avformat_close_input(&pFormatContext);
+        return AVERROR(ENOMEM);
+    }
+
+    int64_t nFrames = 0;
+    int64_t lastPts = AV_NOPTS_VALUE;
+    while ((ret = av_read_frame(pFormatContext, pPacket)) >= 0)
+    {
+        if (pPacket->stream_index == iStream)
+        {
+            const int64_t pts = pPacket->pts != AV_NOPTS_VALUE ? pPacket->pts : pPacket->dts;
+            // Keyframes without a timestamp cannot be seeked to: their
+            // packets stay with the GOP before them.
+            if ((pPacket->flags & AV_PKT_FLAG_KEY) && pts != AV_NOPTS_VALUE)
+                m_entries.push_back({ pts, pPacket->dts, pPacket->pos, nFrames, 0, 0 });
+            if (!m_entries.empty())
+            {
+                m_entries.back().nGopFrames++;
+                m_entries.back().nGopBytes += pPacket->size;
+            }
+            if (pts != AV_NOPTS_VALUE && (lastPts == AV_NOPTS_VALUE || pts > lastPts))
+                lastPts = pts;
+            nFrames++;
+        }
+        av_packet_unref(pPacket);
+    }
+
+    const AVRational timeBase = pFormatContext->streams[iStream]->time_base;
+    av_packet_free(&pPacket);
+    avformat_close_input(&pFormatContext);
+
+    if (ret != AVERROR_EOF)
+    {
+        fprintf(stderr, "av_read_frame: %s\n", av_err2str(ret));
+        m_entries.clear();
+        return ret;
+    }
+
+    std::stable_sort(m_entries.begin(), m_entries.end(),
+                     [](const KeyframeEntry& a, const KeyframeEntry& b) { return a.pts < b.pts; });
+
+    memcpy(m_header.magic, kMagic, sizeof(kMagic));
+    m_header.nVersion       = kVersion;
+    m_header.nEntries       = static_cast<uint32_t>(m_entries.size());
+    m_header.iStream        = iStream;
+    m_header.timeBaseNum    = timeBase.num;
+    m_header.timeBaseDen    = timeBase.den;
+    m_header.nFrames        = nFrames;
+    m_header.lastPts        = lastPts;
+    if (StatSource(strUrl, &m_header.nSourceSize, &m_header.nSourceMtime) < 0)
+    {
+        m_header.nSourceSize = -1;
+        m_header.nSourceMtime = -1;
+    }
+
+    m_pEntries = m_entries.data();
+    m_nEntries = m_entries.size();
+    return 0;
+}
+
+int KeyframeIndex::Save(const std::string& strPath) const
+{
+    // Written beside the target and renamed over it so a reader never maps
+    // a half-written file.
+    const std::string strTemp = strPath + ".tmp";
+    FILE* fp = fopen(strTemp.c_str(), "wb");
+    if (!fp)
+        return AVERROR(errno);
+
+    bool bOk = fwrite(&m_header, sizeof(m_header), 1, fp) == 1 &&
+               (m_nEntries == 0 || fwrite(m_pEntries, sizeof(KeyframeEntry), m_nEntries, fp) == m_nEntries);
+    bOk = fclose(fp) == 0 && bOk;
+    if (!bOk)
+    {
+        remove(strTemp.c_str());
+        return AVERROR(EIO);
+    }
+
+#ifdef _WIN32
+    remove(strPath.c_str());
+#endif
+    if (rename(strTemp.c_str(), strPath.c_str()) != 0)
+    {
+        int ret = AVERROR(errno);
+        remove(strTemp.c_str());
+        return ret;
+    }
+    return 0;
+}
+
+int KeyframeIndex::Load(const std::string& strPath, const std::string& strSource)
+{
+    Reset();
+
+    const uint8_t* pData = nullptr;
+    size_t nSize = 0;
+
+#ifdef HAVE_MMAP
+    int fd = open(strPath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return AVERROR(errno);
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        int ret = AVERROR(errno);
+        close(fd);
+        return ret;
+    }
+    nSize = static_cast<size_t>(st.st_size);
+    if (nSize < sizeof(KeyframeIndexHeader))
+    {
+        close(fd);
+        return AVERROR_INVALIDDATA;
+    }
+    void* pMap = mmap(nullptr, nSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pMap == MAP_FAILED)
+        return AVERROR(errno);
+    m_pMap = pMap;
+    m_nMapSize = nSize;
+    pData = static_cast<const uint8_t*>(pMap);
+#else
+    int64_t nFileSize = 0, nFileMtime = 0;
+    int ret = StatSource(strPath, &nFileSize, &nFileMtime);
+    if (ret < 0)
+        return ret;
+    FILE* fp = fopen(strPath.c_str(), "rb");
+    if (!fp)
+        return AVERROR(errno);
+    // nEntries comes from the file: check it against the file's length
+    // before sizing anything from it.
+    KeyframeIndexHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.nVersion != kVersion ||
+        static_cast<uint64_t>(nFileSize) != sizeof(header) + uint64_t(header.nEntries) * sizeof(KeyframeEntry))
+    {
+        fclose(fp);
+        return AVERROR_INVALIDDATA;
+    }
+    m_entries.resize(header.nEntries);
+    if (header.nEntries && fread(m_entries.data(), sizeof(KeyframeEntry), header.nEntries, fp) != header.nEntries)
+    {
+        fclose(fp);
+        m_entries.clear();
+        return AVERROR_INVALIDDATA;
+    }
+    fclose(fp);
+    nSize = sizeof(header) + m_entries.size() * sizeof(KeyframeEntry);
+    memcpy(&m_header, &header, sizeof(header));
+#endif
+
+#ifdef HAVE_MMAP
+    memcpy(&m_header, pData, sizeof(m_header));
+#endif
+    if (memcmp(m_header.magic, kMagic, sizeof(kMagic)) != 0 || m_header.nVersion != kVersion ||
+        nSize != sizeof(KeyframeIndexHeader) + static_cast<size_t>(m_header.nEntries) * sizeof(KeyframeEntry))
+    {
+        Reset();
+        return AVERROR_INVALIDDATA;
+    }
+
+    int64_t nSourceSize = 0, nSourceMtime = 0;
+    if (StatSource(strSource, &nSourceSize, &nSourceMtime) < 0 ||
+        nSourceSize != m_header.nSourceSize || nSourceMtime != m_header.nSourceMtime)
+    {
+        Reset();
+        return AVERROR(ESTALE);
+    }
+
+    m_pEntries = pData ? reinterpret_cast<const KeyframeEntry*>(pData + sizeof(KeyframeIndexHeader))
+                       : m_entries.data();
+    m_nEntries = m_header.nEntries;
+    return 0;
+}
+
+ptrdiff_t KeyframeIndex::Find(int64_t pts) const
+{
+    if (m_nEntries == 0)
+        return -1;
+
+    const KeyframeEntry* pEnd = m_pEntries + m_nEntries;
+    const KeyframeEntry* pNext = std::upper_bound(m_pEntries, pEnd, pts,
+                                                  [](int64_t t, const KeyframeEntry& e) { return t < e.pts; });
+    return pNext == m_pEntries ? 0 : (pNext - m_pEntries) - 1;
+}
+
+std::string KeyframeIndexPath(const std::string& strUrl)
+{
+    return strUrl + ".kidx";
+}
+
+int LoadOrBuildKeyframeIndex(const std::string& strUrl, KeyframeIndex* pIndex, bool* pbBuilt)
+{
+    const std::string strPath = KeyframeIndexPath(strUrl);
+
+    int ret = pIndex->Load(strPath, strUrl);
+    if (pbBuilt)
+        *pbBuilt = ret < 0;
+    if (ret >= 0)
+        return 0;
+
+    if ((ret = pIndex->Build(strUrl)) < 0)
+        return ret;
+
+    // Only local files can be validated later, so only they get a sidecar.
+    if (pIndex->Header().nSourceSize >= 0 && (ret = pIndex->Save(strPath)) < 0)
+        fprintf(stderr, "keyframe index %s not saved: %s\n", strPath.c_str(), av_err2str(ret));
+
+    return 0;
+}
+
+int SeekToKeyframe(AVFormatContext* pFormatContext, int iStream, const KeyframeEntry& entry)
+{
+    // Timestamps restart at discontinuities in formats like MPEG-TS, so the
+    // byte offset is the reliable address there.
+    const int flags = pFormatContext->iformat->flags;
+    if ((flags & AVFMT_TS_DISCONT) && !(flags & AVFMT_NO_BYTE_SEEK) && entry.pos >= 0)
+        return av_seek_frame(pFormatContext, iStream, entry.pos, AVSEEK_FLAG_BYTE);
+    return av_seek_frame(pFormatContext, iStream, entry.pts, AVSEEK_FLAG_BACKWARD);
+}
+
+int DecodeGopRange(VideoStream* pStream, AVPacket* pPacket, const KeyframeIndex& index, size_t iFirst,
+                   size_t iEnd, const FrameCallback& onFrame, FramePool* pFramePool, int64_t* pnPackets)
+{
+    const KeyframeEntry& first = index.Entry(iFirst);
+    const bool bLast = iEnd >= index.Size();
+    const int64_t endPts = bLast ? INT64_MAX : index.Entry(iEnd).pts;
+
+    size_t iSeek = iFirst;
+    int ret = SeekToKeyframe(pStream->pFormatContext, pStream->iVideo, index.Entry(iSeek));
+    avcodec_flush_buffers(pStream->pCodecCtx);
+
+    bool bFirst = true;
+    bool bStarted = false;
+    bool bPastEnd = false;
+    while (ret >= 0)
+    {
+        if ((ret = TracedReadFrame(pStream->pFormatContext, pPacket)) < 0)
+            break;
+        if (pPacket->stream_index != pStream->iVideo)
+        {
+            av_packet_unref(pPacket);
+            continue;
+        }
+
+        const int64_t pts = pPacket->pts != AV_NOPTS_VALUE ? pPacket->pts : pPacket->dts;
+        if (!bStarted)
+        {
+            // A demuxer that lands past the keyframe gets one entry earlier;
+            // one that lands before it is read forward.
+            if (bFirst && iSeek > 0 && pts != AV_NOPTS_VALUE && pts > first.pts)
+            {
+                av_packet_unref(pPacket);
+                ret = SeekToKeyframe(pStream->pFormatContext, pStream->iVideo, index.Entry(--iSeek));
+                continue;
+            }
+            bFirst = false;
+            if (!(pPacket->flags & AV_PKT_FLAG_KEY) || pts != first.pts)
+            {
+                const bool bMissed = pPacket->dts != AV_NOPTS_VALUE && first.dts != AV_NOPTS_VALUE &&
+                                     pPacket->dts > first.dts;
+                av_packet_unref(pPacket);
+                if (bMissed)
+                    ret = AVERROR_INVALIDDATA;
+                continue;
+            }
+            bStarted = true;
+        }
+        else if (!bLast && !bPastEnd)
+            bPastEnd = (pPacket->flags & AV_PKT_FLAG_KEY) && pts == endPts;
+        else if (bPastEnd && pts != AV_NOPTS_VALUE && pts >= endPts)
+        {
+            av_packet_unref(pPacket);
+            break;
+        }
+
+        if (pnPackets)
+            (*pnPackets)++;
+        ret = DecodeFrame(pStream->pCodecCtx, pPacket, onFrame, pFramePool, pStream->pBackend.get());
+        av_packet_unref(pPacket);
+    }
+
+    if (ret >= 0 || ret == AVERROR_EOF)
+        ret = DecodeFrame(pStream->pCodecCtx, NULL, onFrame, pFramePool, pStream->pBackend.get());
+    if (ret == AVERROR_EOF)
+        ret = 0;
+    if (ret >= 0 && !bStarted)
+    {
+        fprintf(stderr, "keyframe at pts %lld not found\n", (long long)first.pts);
+        ret = AVERROR_INVALIDDATA;
+    }
+    return ret;
+}
+
+int64_t FrameBytes(const AVFrame* frame)
+{
+    int64_t nBytes = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
+        nBytes += frame->buf[i]->size;
+    for (int i = 0; i < frame->nb_extended_buf; i++)
+        nBytes += frame->extended_buf[i]->size;
+    return nBytes;
+}
+
+int SeekToPts(VideoStream* pStream, const KeyframeIndex* pIndex, int64_t targetPts,
+              const FrameCallback& onFrame, SeekStats* pStats)
+{
+    AVFormatContext* pFormatContext = pStream->pFormatContext;
+    AVCodecContext* pCodecCtx = pStream->pCodecCtx;
+    const int iVideo = pStream->iVideo;
+
+    if (pIndex && pIndex->Size() > 0 && pIndex->Header().iStream != iVideo)
+        return AVERROR(EINVAL);
+
+    ptrdiff_t iKey = pIndex ? pIndex->Find(targetPts) : -1;
+
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+        return AVERROR(ENOMEM);
+
+    SeekStats stats;
+    int ret = 0;
+    int retCallback = 0;
+    bool bLanded = false;
+
+    // Frames before the target are decoded and dropped; the first one at or
+    // past it is delivered and ends the seek.
+    FrameCallback onDecoded = [&](AVCodecContext* avctx, AVFrame* frame)
+    {
+        stats.nDecoded++;
+        const int64_t pts = frame->best_effort_timestamp;
+        if (pts == AV_NOPTS_VALUE || pts < targetPts)
+            return 0;
+        stats.landedPts = pts;
+        bLanded = true;
+        if (onFrame && (retCallback = onFrame(avctx, frame)) < 0)
+            return retCallback;
+        return AVERROR_EXIT;
+    };
+
+    BenchClock::time_point tStart = BenchClock::now();
+
+    while (true)
+    {
+        BenchClock::time_point tSeek = BenchClock::now();
+        if (iKey >= 0)
+            ret = SeekToKeyframe(pFormatContext, iVideo, pIndex->Entry(iKey));
+        else
+            ret = av_seek_frame(pFormatContext, iVideo, targetPts, AVSEEK_FLAG_BACKWARD);
+        stats.dSeekSeconds += ElapsedSeconds(tSeek, BenchClock::now());
+        if (ret < 0)
+        {
+            fprintf(stderr, "av_seek_frame: %s\n", av_err2str(ret));
+            break;
+        }
+        avcodec_flush_buffers(pCodecCtx);
+
+        bool bFirst = true;
+        bool bOvershot = false;
+        while (!bLanded)
+        {
+            if ((ret = av_read_frame(pFormatContext, pPacket)) < 0)
+                break;
+
+            if (pPacket->stream_index == iVideo)
+            {
+                // A demuxer that lands past the indexed keyframe would make
+                // the seek miss its target; step back one GOP instead.
+                const int64_t pts = pPacket->pts != AV_NOPTS_VALUE ? pPacket->pts : pPacket->dts;
+                if (bFirst && iKey > 0 && pts != AV_NOPTS_VALUE && pts > pIndex->Entry(iKey).pts)
+                {
+                    bOvershot = true;
+                    av_packet_unref(pPacket);
+                    break;
+                }
+                bFirst = false;
+                stats.nPackets++;
+                ret = DecodeFrame(pCodecCtx, pPacket, onDecoded, nullptr, pStream->pBackend.get());
+            }
+
+            av_packet_unref(pPacket);
+            if (ret < 0)
+                break;
+        }
+
+        if (bOvershot)
+        {
+            iKey--;
+            stats.nRetries++;
+            continue;
+        }
+
+        // The target is in the last GOP: drain the decoder.
+        if (!bLanded && ret == AVERROR_EOF)
+            ret = DecodeFrame(pCodecCtx, NULL, onDecoded, nullptr, pStream->pBackend.get());
+        break;
+    }
+
+    stats.dTotalSeconds = ElapsedSeconds(tStart, BenchClock::now());
+    av_packet_free(&pPacket);
+
+    if (pStats)
+        *pStats = stats;
+
+    if (bLanded)
+        return retCallback < 0 ? retCallback : 0;
+    return ret < 0 ? ret : AVERROR_EOF;
+}
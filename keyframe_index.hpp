@@ -0,0 +1,113 @@
+#pragma once
+
+#include "decoder.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// On-disk layout of a keyframe index sidecar: a header followed by nEntries
+// entries sorted by pts, in host byte order so the file can be mapped and
+// used in place.
+struct KeyframeIndexHeader
+{
+    char        magic[4];           // "KIDX"
+    uint32_t    nVersion;
+    uint32_t    nEntries;
+    int32_t     iStream;
+    int32_t     timeBaseNum;
+    int32_t     timeBaseDen;
+    // Size and modification time of the source; a sidecar that does not
+    // match is stale.
+    int64_t     nSourceSize;
+    int64_t     nSourceMtime;
+    int64_t     nFrames;            // video packets in the stream
+    int64_t     lastPts;            // largest pts seen
+};
+
+struct KeyframeEntry
+{
+    int64_t     pts;
+    int64_t     dts;
+    int64_t     pos;                // byte offset of the packet, -1 if unknown
+    int64_t     iFrame;             // packet number in decode order
+    uint32_t    nGopFrames;         // packets up to the next keyframe
+    uint32_t    nGopBytes;
+};
+
+class KeyframeIndex
+{
+public:
+    KeyframeIndex();
+    ~KeyframeIndex();
+
+    KeyframeIndex(const KeyframeIndex&) = delete;
+    KeyframeIndex& operator=(const KeyframeIndex&) = delete;
+
+    // One demux pass over strUrl's video stream; nothing is decoded.
+    int                     Build(const std::string& strUrl);
+    int                     Save(const std::string& strPath) const;
+    // Maps strPath where mmap is available and reads it otherwise. Returns
+    // AVERROR_INVALIDDATA for foreign or corrupt files and AVERROR(ESTALE)
+    // when strSource changed since the sidecar was written.
+    int                     Load(const std::string& strPath, const std::string& strSource);
+    void                    Reset();
+
+    size_t                  Size() const        { return m_nEntries; }
+    const KeyframeEntry&    Entry(size_t i) const { return m_pEntries[i]; }
+    const KeyframeIndexHeader& Header() const   { return m_header; }
+    AVRational              TimeBase() const    { return { m_header.timeBaseNum, m_header.timeBaseDen }; }
+    bool                    Mapped() const      { return m_pMap != nullptr; }
+
+    // Last keyframe at or before pts (the first one if pts precedes them
+    // all), or -1 when the index is empty.
+    ptrdiff_t               Find(int64_t pts) const;
+
+private:
+    KeyframeIndexHeader         m_header;
+    std::vector<KeyframeEntry>  m_entries;
+    const KeyframeEntry*        m_pEntries  = nullptr;
+    size_t                      m_nEntries  = 0;
+    void*                       m_pMap      = nullptr;
+    size_t                      m_nMapSize  = 0;
+};
+
+// Sidecar next to the media file.
+std::string KeyframeIndexPath(const std::string& strUrl);
+
+// Loads strUrl's sidecar, or builds the index and writes the sidecar when it
+// is missing or stale. *pbBuilt tells which happened.
+int     LoadOrBuildKeyframeIndex(const std::string& strUrl, KeyframeIndex* pIndex, bool* pbBuilt = nullptr);
+
+// Positions the demuxer so the next packet of iStream is entry's keyframe.
+int     SeekToKeyframe(AVFormatContext* pFormatContext, int iStream, const KeyframeEntry& entry);
+
+// Decodes the GOPs of index entries [iFirst, iEnd) on a flushed decoder. The
+// keyframe of entry iEnd and the packets after it are decoded too, up to the
+// first one with a pts at or past that keyframe's, for the leading pictures
+// of an open GOP. Every decoded frame reaches onFrame, so the caller keeps
+// only those with best_effort_timestamp in its range. *pnPackets counts the
+// packets sent to the decoder.
+int     DecodeGopRange(VideoStream* pStream, AVPacket* pPacket, const KeyframeIndex& index, size_t iFirst,
+                       size_t iEnd, const FrameCallback& onFrame, FramePool* pFramePool = nullptr,
+                       int64_t* pnPackets = nullptr);
+
+// Bytes of the buffers frame references.
+int64_t FrameBytes(const AVFrame* frame);
+
+struct SeekStats
+{
+    int64_t     landedPts       = AV_NOPTS_VALUE;
+    double      dSeekSeconds    = 0.0;      // inside av_seek_frame
+    double      dTotalSeconds   = 0.0;      // until the target frame was delivered
+    int         nPackets        = 0;        // video packets sent to the decoder
+    int         nDecoded        = 0;        // frames decoded, including the target
+    int         nRetries        = 0;        // index seeks that landed past the keyframe
+};
+
+// Frame-accurate seek: delivers the first frame with pts >= targetPts (in the
+// stream time base) to onFrame. With an index the demuxer is positioned on
+// the keyframe the index names and only that GOP is decoded; without one
+// this is av_seek_frame(AVSEEK_FLAG_BACKWARD) plus decoding forward.
+int     SeekToPts(VideoStream* pStream, const KeyframeIndex* pIndex, int64_t targetPts,
+                  const FrameCallback& onFrame, SeekStats* pStats = nullptr);
@@ -0,0 +1,240 @@
+#include "live_feeder.hpp"
+#include "av_err2string.hpp"
+
+#include <cstdio>
+#include <vector>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/time.h>
+}
+
+typedef std::chrono::steady_clock Clock;
+
+LiveFeeder::~LiveFeeder()
+{
+    Stop();
+}
+
+int LiveFeeder::Start(const std::string& strInput, const std::string& strOutput, double dSeconds,
+                      int nConnectTimeoutMs)
+{
+    if (m_thread.joinable())
+        return AVERROR(EINVAL);
+
+    m_strInput = strInput;
+    m_strOutput = strOutput;
+    m_dSeconds = dSeconds;
+    m_nConnectTimeoutMs = nConnectTimeoutMs;
+    m_bAbort.store(false);
+    m_bStarted.store(false);
+    m_ret.store(0);
+    m_nPackets.store(0);
+    m_sendTimes.clear();
+    m_thread = std::thread(&LiveFeeder::Run, this);
+    return 0;
+}
+
+void LiveFeeder::Stop()
+{
+    m_bAbort.store(true, std::memory_order_release);
+    Join();
+}
+
+void LiveFeeder::Join()
+{
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+Clock::time_point LiveFeeder::StartTime() const
+{
+    return Clock::time_point(std::chrono::nanoseconds(m_tStartNs.load(std::memory_order_acquire)));
+}
+
+// MPEG-TS carries 33 bits, and demuxers differ in whether they unwrap them.
+static int64_t TsKey(int64_t pts90k)
+{
+    return pts90k & ((int64_t(1) << 33) - 1);
+}
+
+bool LiveFeeder::SendTime(int64_t pts90k, Clock::time_point* pTime)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::map<int64_t, int64_t>::iterator it = m_sendTimes.find(TsKey(pts90k));
+    if (it == m_sendTimes.end())
+        return false;
+    *pTime = Clock::time_point(std::chrono::nanoseconds(it->second));
+    m_sendTimes.erase(it);
+    return true;
+}
+
+void LiveFeeder::RecordSendTime(int64_t pts90k)
+{
+    // Bounded in case the receiver stops looking.
+    const size_t nMaxEntries = 4096;
+
+    int64_t tNs = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_sendTimes[TsKey(pts90k)] = tNs;
+    if (m_sendTimes.size() > nMaxEntries)
+        m_sendTimes.erase(m_sendTimes.begin());
+}
+
+static int OpenOutput(AVIOContext** ppIO, const std::string& strOutput, int nTimeoutMs,
+                      const std::atomic<bool>& bAbort)
+{
+    int64_t tDeadline = av_gettime_relative() + int64_t(nTimeoutMs) * 1000;
+    int ret = 0;
+    do
+    {
+        if ((ret = avio_open2(ppIO, strOutput.c_str(), AVIO_FLAG_WRITE, nullptr, nullptr)) >= 0)
+            return ret;
+        av_usleep(20 * 1000);
+    } while (!bAbort.load(std::memory_order_acquire) && av_gettime_relative() < tDeadline);
+    return ret;
+}
+
+void LiveFeeder::Run()
+{
+    AVFormatContext* pInput = nullptr;
+    AVFormatContext* pOutput = nullptr;
+    AVPacket* pPacket = nullptr;
+    std::vector<int> streamMap;
+    std::vector<bool> isVideo;
+    int64_t dtsOrigin = AV_NOPTS_VALUE;
+    int64_t tOrigin = 0;
+    int ret = 0;
+
+    if ((ret = avformat_open_input(&pInput, m_strInput.c_str(), nullptr, nullptr)) < 0 ||
+        (ret = avformat_find_stream_info(pInput, nullptr)) < 0)
+    {
+        fprintf(stderr, "feeder input %s: %s\n", m_strInput.c_str(), av_err2str(ret));
+        goto end;
+    }
+
+    if ((ret = avformat_alloc_output_context2(&pOutput, nullptr, "mpegts", m_strOutput.c_str())) < 0)
+    {
+        fprintf(stderr, "avformat_alloc_output_context2: %s\n", av_err2str(ret));
+        goto end;
+    }
+    // Every packet goes to the socket as soon as it is muxed.
+    pOutput->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+    // MPEG-TS takes negative timestamps (they wrap at 33 bits), so nothing
+    // is shifted and the receiver demuxes the pts each send time was
+    // recorded under. The default would shift everything when the input
+    // starts with a negative dts, as MP4 with B-frames does.
+    pOutput->avoid_negative_ts = AVFMT_AVOID_NEG_TS_DISABLED;
+
+    streamMap.assign(pInput->nb_streams, -1);
+    isVideo.assign(pInput->nb_streams, false);
+    for (unsigned i = 0; i < pInput->nb_streams; i++)
+    {
+        const AVCodecParameters* par = pInput->streams[i]->codecpar;
+        if (par->codec_type != AVMEDIA_TYPE_VIDEO && par->codec_type != AVMEDIA_TYPE_AUDIO)
+            continue;
+
+        AVStream* pOut = avformat_new_stream(pOutput, nullptr);
+        if (!pOut)
+        {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        if ((ret = avcodec_parameters_copy(pOut->codecpar, par)) < 0)
+            goto end;
+        pOut->codecpar->codec_tag = 0;
+        pOut->time_base = pInput->streams[i]->time_base;
+        streamMap[i] = pOut->index;
+        isVideo[i] = par->codec_type == AVMEDIA_TYPE_VIDEO;
+    }
+
+    if ((ret = OpenOutput(&pOutput->pb, m_strOutput, m_nConnectTimeoutMs, m_bAbort)) < 0)
+    {
+        fprintf(stderr, "feeder output %s: %s\n", m_strOutput.c_str(), av_err2str(ret));
+        goto end;
+    }
+
+    if ((ret = avformat_write_header(pOutput, nullptr)) < 0)
+    {
+        fprintf(stderr, "avformat_write_header: %s\n", av_err2str(ret));
+        goto end;
+    }
+
+    if (!(pPacket = av_packet_alloc()))
+    {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    while (!m_bAbort.load(std::memory_order_acquire))
+    {
+        if ((ret = av_read_frame(pInput, pPacket)) < 0)
+            break;
+
+        int iOut = streamMap[pPacket->stream_index];
+        if (iOut < 0)
+        {
+            av_packet_unref(pPacket);
+            continue;
+        }
+
+        // Hold each packet until its dts is due on the wall clock, like a
+        // camera or encoder that produces them as time passes.
+        AVRational tb = pInput->streams[pPacket->stream_index]->time_base;
+        if (pPacket->dts != AV_NOPTS_VALUE)
+        {
+            int64_t dts = av_rescale_q(pPacket->dts, tb, av_make_q(1, AV_TIME_BASE));
+            if (dtsOrigin == AV_NOPTS_VALUE)
+            {
+                dtsOrigin = dts;
+                tOrigin = av_gettime_relative();
+                m_tStartNs.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     Clock::now().time_since_epoch()).count(),
+                                 std::memory_order_release);
+                m_bStarted.store(true, std::memory_order_release);
+            }
+            if (m_dSeconds > 0 && dts - dtsOrigin > int64_t(m_dSeconds * AV_TIME_BASE))
+            {
+                av_packet_unref(pPacket);
+                ret = AVERROR_EOF;
+                break;
+            }
+            int64_t nWait = tOrigin + (dts - dtsOrigin) - av_gettime_relative();
+            if (nWait > 0)
+                av_usleep(unsigned(nWait));
+        }
+
+        bool bVideo = isVideo[pPacket->stream_index];
+        pPacket->stream_index = iOut;
+        av_packet_rescale_ts(pPacket, tb, pOutput->streams[iOut]->time_base);
+        pPacket->pos = -1;
+        int64_t pts90k = pPacket->pts != AV_NOPTS_VALUE
+                       ? av_rescale_q(pPacket->pts, pOutput->streams[iOut]->time_base, av_make_q(1, 90000))
+                       : AV_NOPTS_VALUE;
+        // Packets arrive in dts order already; interleaving would buffer.
+        if ((ret = av_write_frame(pOutput, pPacket)) < 0)
+        {
+            fprintf(stderr, "feeder write: %s\n", av_err2str(ret));
+            break;
+        }
+        if (bVideo && pts90k != AV_NOPTS_VALUE)
+            RecordSendTime(pts90k);
+        av_packet_unref(pPacket);
+        m_nPackets.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (ret == AVERROR_EOF)
+        av_write_trailer(pOutput);
+
+end:
+    av_packet_free(&pPacket);
+    if (pOutput)
+    {
+        avio_closep(&pOutput->pb);
+        avformat_free_context(pOutput);
+    }
+    avformat_close_input(&pInput);
+    m_ret.store(ret, std::memory_order_release);
+}
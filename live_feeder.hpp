@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Replays a file as a live source: remuxes it to MPEG-TS and writes the
+// packets to an output URL in real time, paced by their dts. Meant for
+// tcp://127.0.0.1:PORT with a receiver listening on the same address, so
+// live ingest can be measured without a camera or a server.
+class LiveFeeder
+{
+public:
+    LiveFeeder() = default;
+    ~LiveFeeder();
+
+    LiveFeeder(const LiveFeeder&) = delete;
+    LiveFeeder& operator=(const LiveFeeder&) = delete;
+
+    // Connecting is retried for up to nConnectTimeoutMs, so the receiver
+    // may start listening after Start.
+    int         Start(const std::string& strInput, const std::string& strOutput, double dSeconds = 0.0,
+                      int nConnectTimeoutMs = 5000);
+    void        Stop();
+    void        Join();
+
+    // When the first packet went out; the origin of the input timeline.
+    std::chrono::steady_clock::time_point   StartTime() const;
+    bool        Started() const     { return m_bStarted.load(std::memory_order_acquire); }
+    // The error that ended the feed, AVERROR_EOF at end of input.
+    int         Result() const      { return m_ret.load(std::memory_order_acquire); }
+    int64_t     PacketsWritten() const  { return m_nPackets.load(std::memory_order_relaxed); }
+    // When the video packet with this pts (90 kHz, as MPEG-TS carries it)
+    // was written. Timestamps go out unshifted and are matched modulo 2^33,
+    // so the pts the receiver demuxes finds its entry. Each entry can be
+    // taken once; the oldest are dropped past a few thousand.
+    bool        SendTime(int64_t pts90k, std::chrono::steady_clock::time_point* pTime);
+
+private:
+    void        Run();
+    void        RecordSendTime(int64_t pts90k);
+
+    std::string             m_strInput;
+    std::string             m_strOutput;
+    double                  m_dSeconds          = 0.0;
+    int                     m_nConnectTimeoutMs = 0;
+    std::thread             m_thread;
+    std::atomic<bool>       m_bAbort{false};
+    std::atomic<bool>       m_bStarted{false};
+    std::atomic<int64_t>    m_tStartNs{0};
+    std::atomic<int>        m_ret{0};
+    std::atomic<int64_t>    m_nPackets{0};
+
+    std::mutex              m_lock;
+    std::map<int64_t, int64_t>  m_sendTimes;    // pts -> steady clock ns
+};
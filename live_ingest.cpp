@@ -0,0 +1,250 @@
+#include "decoder.hpp"
+#include "bench_stats.hpp"
+#include "decoder_threading.hpp"
+#include "live_feeder.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <input> [--profile low|default|both] [--port N] [--seconds S] [--warmup S]\n"
+            "                [--probesize BYTES] [--analyzeduration MS] [--threads MODE[:N]]\n"
+            "  --profile          open options to measure (default both)\n"
+            "  --port             loopback TCP port the input is replayed to (default 23000)\n"
+            "  --seconds          seconds of input to replay (default 10)\n"
+            "  --warmup           seconds after the first frame left out of the steady state (default 1)\n"
+            "  --probesize        low profile probe size (default 32768)\n"
+            "  --analyzeduration  low profile analyze duration (default 200)\n"
+            "  --threads          none, frame, slice or both, with an optional count\n",
+            argv0);
+}
+
+struct IngestResult
+{
+    double              dInputOpenedMs  = 0.0;
+    double              dStreamInfoMs   = 0.0;
+    double              dDecoderOpenedMs = 0.0;
+    double              dFirstFrameMs   = 0.0;
+    int64_t             nFrames         = 0;
+    int                 activeThreadType = 0;
+    std::vector<double> receive;        // written by the feeder -> av_read_frame
+    std::vector<double> latency;        // written by the feeder -> decoded
+};
+
+// Listens on the port, has a feeder replay the input to it in real time and
+// times everything against the feeder's first packet.
+static int RunIngest(const std::string& strInput, int nPort, double dSeconds, double dWarmup,
+                     const DecoderOptions& options, IngestResult* pResult)
+{
+    char szListen[128];
+    char szConnect[128];
+    snprintf(szListen, sizeof(szListen), "tcp://127.0.0.1:%d?listen=1&listen_timeout=5000", nPort);
+    snprintf(szConnect, sizeof(szConnect), "tcp://127.0.0.1:%d", nPort);
+
+    LiveFeeder feeder;
+    int ret = feeder.Start(strInput, szConnect, dSeconds);
+    if (ret < 0)
+        return ret;
+
+    VideoStream stream;
+    if ((ret = OpenStream(szListen, &stream, options)) < 0)
+    {
+        feeder.Stop();
+        return ret;
+    }
+
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+    {
+        CloseStream(&stream);
+        feeder.Stop();
+        return AVERROR(ENOMEM);
+    }
+
+    // The feeder is connected by now, so its start time is set.
+    BenchClock::time_point tFeed = feeder.StartTime();
+    const OpenTimings& timings = stream.timings;
+    pResult->dInputOpenedMs = ElapsedSeconds(tFeed, timings.tInputOpened) * 1e3;
+    pResult->dStreamInfoMs = ElapsedSeconds(tFeed, timings.tStreamInfo) * 1e3;
+    pResult->dDecoderOpenedMs = ElapsedSeconds(tFeed, timings.tDecoderOpened) * 1e3;
+
+    AVRational tb = stream.pFormatContext->streams[stream.iVideo]->time_base;
+    BenchClock::time_point tFirstFrame;
+    // Send times of packets read but not decoded yet, by pts.
+    std::map<int64_t, BenchClock::time_point> inFlight;
+
+    auto InSteadyState = [&](BenchClock::time_point tNow)
+    {
+        return pResult->nFrames > 0 && ElapsedSeconds(tFirstFrame, tNow) >= dWarmup;
+    };
+
+    FrameCallback onFrame = [&](AVCodecContext*, AVFrame* frame)
+    {
+        BenchClock::time_point tNow = BenchClock::now();
+        if (pResult->nFrames++ == 0)
+        {
+            tFirstFrame = tNow;
+            pResult->dFirstFrameMs = ElapsedSeconds(tFeed, tNow) * 1e3;
+        }
+        if (frame->pts == AV_NOPTS_VALUE)
+            return 0;
+
+        std::map<int64_t, BenchClock::time_point>::iterator it = inFlight.find(frame->pts);
+        if (it != inFlight.end())
+        {
+            if (InSteadyState(tNow))
+                pResult->latency.push_back(ElapsedSeconds(it->second, tNow));
+            inFlight.erase(it);
+        }
+        return 0;
+    };
+
+    while (ret >= 0)
+    {
+        if ((ret = av_read_frame(stream.pFormatContext, pPacket)) < 0)
+            break;
+
+        if (pPacket->stream_index == stream.iVideo)
+        {
+            BenchClock::time_point tNow = BenchClock::now();
+            BenchClock::time_point tSent;
+            if (pPacket->pts != AV_NOPTS_VALUE &&
+                feeder.SendTime(av_rescale_q(pPacket->pts, tb, av_make_q(1, 90000)), &tSent))
+            {
+                if (InSteadyState(tNow))
+                    pResult->receive.push_back(ElapsedSeconds(tSent, tNow));
+                // Frames keep the packet's pts, so the decoded frame finds it.
+                inFlight[pPacket->pts] = tSent;
+                if (inFlight.size() > 1024)
+                    inFlight.erase(inFlight.begin());
+            }
+            ret = DecodeFrame(stream.pCodecCtx, pPacket, onFrame);
+        }
+
+        av_packet_unref(pPacket);
+    }
+    DecodeFrame(stream.pCodecCtx, NULL, onFrame);
+
+    pResult->activeThreadType = stream.pCodecCtx->active_thread_type;
+
+    av_packet_free(&pPacket);
+    CloseStream(&stream);
+    feeder.Stop();
+
+    if (ret < 0 && ret != AVERROR_EOF)
+        return ret;
+    if (pResult->nFrames == 0)
+        return AVERROR_INVALIDDATA;
+    // Percentiles of nothing would print as 0 ms, which reads like a result.
+    if (pResult->receive.empty() || pResult->latency.empty())
+    {
+        fprintf(stderr, "no received packet matched a send time after the warm-up\n");
+        return AVERROR_INVALIDDATA;
+    }
+    return 0;
+}
+
+static void PrintResult(const char* pszProfile, IngestResult& result)
+{
+    printf("profile:      %s\n", pszProfile);
+    printf("threads:      %s\n", ActiveThreadTypeToString(result.activeThreadType).c_str());
+    printf("input open:   %.1f ms\n", result.dInputOpenedMs);
+    printf("stream info:  %.1f ms\n", result.dStreamInfoMs);
+    printf("decoder open: %.1f ms\n", result.dDecoderOpenedMs);
+    printf("first frame:  %.1f ms\n", result.dFirstFrameMs);
+    printf("frames:       %lld\n", (long long)result.nFrames);
+    printf("receive:      p50 %.2f ms, p90 %.2f ms, p99 %.2f ms\n",
+           Percentile(result.receive, 50) * 1e3, Percentile(result.receive, 90) * 1e3,
+           Percentile(result.receive, 99) * 1e3);
+    printf("latency:      p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+           Percentile(result.latency, 50) * 1e3, Percentile(result.latency, 90) * 1e3,
+           Percentile(result.latency, 99) * 1e3, Percentile(result.latency, 100) * 1e3);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strUrl;
+    std::string strProfile = "both";
+    int nPort = 23000;
+    double dSeconds = 10.0;
+    double dWarmup = 1.0;
+    LowLatencyProfile profile;
+    ThreadingConfig threading;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+            strProfile = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+            nPort = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            dSeconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            dWarmup = atof(argv[++i]);
+        else if (strcmp(argv[i], "--probesize") == 0 && i + 1 < argc)
+            profile.nProbeSize = strtoll(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--analyzeduration") == 0 && i + 1 < argc)
+            profile.nAnalyzeDurationUs = strtoll(argv[++i], nullptr, 10) * 1000;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (ParseThreadingConfig(argv[++i], &threading) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (argv[i][0] != '-' && strUrl.empty())
+            strUrl = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (strUrl.empty() || (strProfile != "low" && strProfile != "default" && strProfile != "both"))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+    avformat_network_init();
+
+    std::vector<bool> profiles;
+    if (strProfile != "low")
+        profiles.push_back(false);
+    if (strProfile != "default")
+        profiles.push_back(true);
+
+    printf("input:        %s, %.1f s replayed over tcp://127.0.0.1\n\n", strUrl.c_str(), dSeconds);
+
+    int nFailed = 0;
+    for (size_t i = 0; i < profiles.size(); i++)
+    {
+        DecoderOptions options;
+        options.threading = threading;
+        options.bLowLatency = profiles[i];
+        options.lowLatency = profile;
+
+        // A port per run, so the previous listener's TIME_WAIT is no issue.
+        IngestResult result;
+        int ret = RunIngest(strUrl, nPort + int(i), dSeconds, dWarmup, options, &result);
+        if (ret < 0)
+        {
+            fprintf(stderr, "%s profile: %s\n", profiles[i] ? "low" : "default", av_err2str(ret));
+            nFailed++;
+            continue;
+        }
+        PrintResult(profiles[i] ? "low latency" : "default", result);
+        printf("\n");
+    }
+
+    avformat_network_deinit();
+    return nFailed ? 1 : 0;
+}
@@ -0,0 +1,29 @@
+#include "live_profile.hpp"
+
+void SetLowLatencyFormatOptions(AVDictionary** ppOptions, const LowLatencyProfile& profile)
+{
+    av_dict_set_int(ppOptions, "probesize", profile.nProbeSize, 0);
+    av_dict_set_int(ppOptions, "analyzeduration", profile.nAnalyzeDurationUs, 0);
+    av_dict_set(ppOptions, "fflags", "nobuffer", 0);
+    // Frame rate probing reads ahead on its own otherwise.
+    av_dict_set_int(ppOptions, "fpsprobesize", 0, 0);
+}
+
+void ApplyLowLatencyCodecOptions(AVCodecContext* avctx)
+{
+    avctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+    // thread_type defaults to frame|slice, so this also covers an untouched
+    // ThreadMode::Default.
+    avctx->thread_type &= ~FF_THREAD_FRAME;
+    if (avctx->thread_type == 0 && avctx->thread_count != 1)
+        avctx->thread_type = FF_THREAD_SLICE;
+}
+
+bool IsLiveUrl(const std::string& strUrl)
+{
+    size_t scheme = strUrl.find("://");
+    if (scheme == std::string::npos || scheme < 2)
+        return false;
+    return strUrl.compare(0, scheme, "file") != 0;
+}
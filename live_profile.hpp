@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/dict.h>
+}
+
+// Open and decode settings for live sources, where the defaults probe and
+// buffer for seconds before the first frame comes out.
+struct LowLatencyProfile
+{
+    int64_t     nProbeSize          = 32 * 1024;
+    int64_t     nAnalyzeDurationUs  = 200 * 1000;
+};
+
+// Caps probesize/analyzeduration and sets fflags=nobuffer for
+// avformat_open_input.
+void    SetLowLatencyFormatOptions(AVDictionary** ppOptions, const LowLatencyProfile& profile = LowLatencyProfile());
+// Sets AV_CODEC_FLAG_LOW_DELAY and drops frame threading, which holds back
+// one frame per thread, keeping slice threading. Call before avcodec_open2.
+void    ApplyLowLatencyCodecOptions(AVCodecContext* avctx);
+
+// Network URLs other than file:; what hw_d3d11va applies the profile to.
+bool    IsLiveUrl(const std::string& strUrl);
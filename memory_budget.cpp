@@ -0,0 +1,197 @@
+#include "memory_budget.hpp"
+
+#include <algorithm>
+
+extern "C"
+{
+#include <libavutil/imgutils.h>
+}
+
+static const int kStages = static_cast<int>(MemoryStage::Count);
+
+static void UpdatePeak(std::atomic<int64_t>& peak, int64_t nValue)
+{
+    int64_t nPeak = peak.load(std::memory_order_relaxed);
+    while (nValue > nPeak && !peak.compare_exchange_weak(nPeak, nValue, std::memory_order_relaxed))
+        ;
+}
+
+const char* MemoryStageName(MemoryStage stage)
+{
+    switch (stage)
+    {
+        case MemoryStage::Packets:  return "packets";
+        case MemoryStage::Frames:   return "frames";
+        case MemoryStage::Surfaces: return "surfaces";
+        case MemoryStage::Count:    break;
+    }
+    return "unknown";
+}
+
+MemoryBudget::MemoryBudget(const char* pszName, int64_t nLimit, MemoryBudget* pParent)
+    : m_strName(pszName)
+    , m_pParent(pParent)
+    , m_nLimit(nLimit)
+{
+    for (int i = 0; i < kStages; i++)
+    {
+        m_nStageCurrent[i].store(0, std::memory_order_relaxed);
+        m_nStagePeak[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+MemoryBudget::~MemoryBudget()
+{
+    // Whatever is still charged leaves the parent with this budget.
+    if (m_pParent)
+    {
+        for (int i = 0; i < kStages; i++)
+        {
+            int64_t nBytes = m_nStageCurrent[i].load(std::memory_order_acquire);
+            if (nBytes)
+                m_pParent->Release(nBytes, static_cast<MemoryStage>(i));
+        }
+    }
+}
+
+bool MemoryBudget::Fits(int64_t nBytes) const
+{
+    for (const MemoryBudget* p = this; p; p = p->m_pParent)
+    {
+        const int64_t nLimit = p->Limit();
+        if (nLimit > 0 && p->Current() + nBytes > nLimit)
+            return false;
+    }
+    return true;
+}
+
+int64_t MemoryBudget::EffectiveLimit() const
+{
+    int64_t nLimit = 0;
+    for (const MemoryBudget* p = this; p; p = p->m_pParent)
+    {
+        const int64_t n = p->Limit();
+        if (n > 0 && (nLimit == 0 || n < nLimit))
+            nLimit = n;
+    }
+    return nLimit;
+}
+
+bool MemoryBudget::HasRoom() const
+{
+    for (const MemoryBudget* p = this; p; p = p->m_pParent)
+    {
+        const int64_t nLimit = p->Limit();
+        if (nLimit > 0 && p->Current() >= nLimit)
+            return false;
+    }
+    return true;
+}
+
+void MemoryBudget::Add(int64_t nBytes, MemoryStage stage)
+{
+    const int i = static_cast<int>(stage);
+    for (MemoryBudget* p = this; p; p = p->m_pParent)
+    {
+        UpdatePeak(p->m_nPeak, p->m_nCurrent.fetch_add(nBytes, std::memory_order_acq_rel) + nBytes);
+        UpdatePeak(p->m_nStagePeak[i], p->m_nStageCurrent[i].fetch_add(nBytes, std::memory_order_relaxed) + nBytes);
+    }
+}
+
+bool MemoryBudget::TryCharge(int64_t nBytes, MemoryStage stage)
+{
+    // Check and add are separate steps, so concurrent chargers can overshoot
+    // by at most one charge each; packets are small next to the limit.
+    if (!Fits(nBytes))
+    {
+        m_nRefused.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    Add(nBytes, stage);
+    return true;
+}
+
+void MemoryBudget::Charge(int64_t nBytes, MemoryStage stage)
+{
+    if (!Fits(nBytes))
+        m_nOvercommits.fetch_add(1, std::memory_order_relaxed);
+    Add(nBytes, stage);
+}
+
+void MemoryBudget::Release(int64_t nBytes, MemoryStage stage)
+{
+    const int i = static_cast<int>(stage);
+    for (MemoryBudget* p = this; p; p = p->m_pParent)
+    {
+        p->m_nCurrent.fetch_sub(nBytes, std::memory_order_acq_rel);
+        p->m_nStageCurrent[i].fetch_sub(nBytes, std::memory_order_relaxed);
+    }
+}
+
+MemoryBudgetStats MemoryBudget::Stats() const
+{
+    MemoryBudgetStats stats;
+    stats.nLimit        = Limit();
+    stats.nCurrent      = Current();
+    stats.nPeak         = m_nPeak.load(std::memory_order_relaxed);
+    for (int i = 0; i < kStages; i++)
+    {
+        stats.stages[i].nCurrent = m_nStageCurrent[i].load(std::memory_order_relaxed);
+        stats.stages[i].nPeak    = m_nStagePeak[i].load(std::memory_order_relaxed);
+    }
+    stats.nRefused      = m_nRefused.load(std::memory_order_relaxed);
+    stats.nOvercommits  = m_nOvercommits.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void MemoryBudget::Print(FILE* fp) const
+{
+    const double kMiB = 1024.0 * 1024.0;
+    MemoryBudgetStats stats = Stats();
+    if (stats.nLimit > 0)
+        fprintf(fp, "%-14s%.1f / %.1f MiB peak, limit %.1f MiB, %llu refused, %llu overcommits\n",
+                (m_strName + ":").c_str(), stats.nCurrent / kMiB, stats.nPeak / kMiB, stats.nLimit / kMiB,
+                (unsigned long long)stats.nRefused, (unsigned long long)stats.nOvercommits);
+    else
+        fprintf(fp, "%-14s%.1f / %.1f MiB peak, no limit\n", (m_strName + ":").c_str(),
+                stats.nCurrent / kMiB, stats.nPeak / kMiB);
+    for (int i = 0; i < kStages; i++)
+    {
+        fprintf(fp, "  %-12s%.1f / %.1f MiB peak\n", MemoryStageName(static_cast<MemoryStage>(i)),
+                stats.stages[i].nCurrent / kMiB, stats.stages[i].nPeak / kMiB);
+    }
+}
+
+MemoryBudget* ProcessMemoryBudget()
+{
+    static MemoryBudget s_budget("process");
+    return &s_budget;
+}
+
+int64_t EstimateFrameBytes(enum AVPixelFormat format, int nWidth, int nHeight)
+{
+    // Hardware formats have no layout of their own; NV12 is what they hold.
+    int nBytes = av_image_get_buffer_size(format, nWidth, nHeight, 64);
+    if (nBytes < 0)
+        nBytes = av_image_get_buffer_size(AV_PIX_FMT_NV12, nWidth, nHeight, 64);
+    return std::max(nBytes, 0);
+}
+
+MemoryPlan PlanMemory(int64_t nBudget, int64_t nFrameBytes, int nDecoderFrames)
+{
+    MemoryPlan plan;
+    plan.nFrameBytes = nFrameBytes;
+    if (nBudget <= 0 || nFrameBytes <= 0)
+        return plan;
+
+    const int64_t nFrameShare = nBudget / 4 * 3;
+    plan.nFrameSlots = static_cast<int>(std::min<int64_t>(nFrameShare / nFrameBytes, 1 << 16));
+    plan.nPacketBytes = std::max<int64_t>(nBudget - nFrameShare, 1 << 20);
+
+    // Whatever the budget, a decoder needs its references and one frame out.
+    const int nSpare = std::max(0, plan.nFrameSlots - nDecoderFrames - 1);
+    plan.nMaxThreads = std::max(1, nSpare / 2 + 1);
+    plan.nQueueFrames = std::max(1, nSpare - (plan.nMaxThreads - 1));
+    plan.nExtraHwFrames = plan.nQueueFrames;
+    return plan;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+extern "C"
+{
+#include <libavutil/pixfmt.h>
+}
+
+enum class MemoryStage
+{
+    Packets,        // demuxed payload waiting in packet queues
+    Frames,         // decoded frames in system memory (FramePool buffers)
+    Surfaces,       // hw decoder surfaces
+    Count
+};
+
+const char*     MemoryStageName(MemoryStage stage);
+
+struct MemoryStageStats
+{
+    int64_t     nCurrent    = 0;
+    int64_t     nPeak       = 0;
+};
+
+struct MemoryBudgetStats
+{
+    int64_t             nLimit          = 0;        // 0: unlimited
+    int64_t             nCurrent        = 0;
+    int64_t             nPeak           = 0;
+    MemoryStageStats    stages[static_cast<int>(MemoryStage::Count)];
+    uint64_t            nRefused        = 0;        // TryCharge calls that did not fit
+    uint64_t            nOvercommits    = 0;        // Charge calls past the limit
+};
+
+// Byte budget with per-stage accounting, lock-free. A budget with a parent
+// charges the parent too, so a session budget under the process budget only
+// has room when both do. Stages that cannot wait (decoded frames, surfaces)
+// use Charge and may overcommit; the packet queues use TryCharge and hold
+// the demuxer back until enough is released, which is where the backpressure
+// comes from. Every budget must outlive what it has charged.
+class MemoryBudget
+{
+public:
+    explicit MemoryBudget(const char* pszName = "", int64_t nLimit = 0, MemoryBudget* pParent = nullptr);
+    ~MemoryBudget();
+
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    void                SetLimit(int64_t nLimit)    { m_nLimit.store(nLimit, std::memory_order_relaxed); }
+    int64_t             Limit() const               { return m_nLimit.load(std::memory_order_relaxed); }
+    int64_t             Current() const             { return m_nCurrent.load(std::memory_order_acquire); }
+    const std::string&  Name() const                { return m_strName; }
+    MemoryBudget*       Parent() const              { return m_pParent; }
+    // Smallest limit of this budget and its parents, 0 if none has one.
+    int64_t             EffectiveLimit() const;
+
+    // Charges nBytes only if it fits here and in every parent.
+    bool                TryCharge(int64_t nBytes, MemoryStage stage);
+    // Charges nBytes whether it fits or not.
+    void                Charge(int64_t nBytes, MemoryStage stage);
+    void                Release(int64_t nBytes, MemoryStage stage);
+    // False once this budget or a parent is at its limit.
+    bool                HasRoom() const;
+
+    MemoryBudgetStats   Stats() const;
+    // One line per stage, "label: current / peak".
+    void                Print(FILE* fp) const;
+
+private:
+    bool                Fits(int64_t nBytes) const;
+    void                Add(int64_t nBytes, MemoryStage stage);
+
+    std::string             m_strName;
+    MemoryBudget*           m_pParent;
+    std::atomic<int64_t>    m_nLimit;
+    std::atomic<int64_t>    m_nCurrent{0};
+    std::atomic<int64_t>    m_nPeak{0};
+    std::atomic<int64_t>    m_nStageCurrent[static_cast<int>(MemoryStage::Count)];
+    std::atomic<int64_t>    m_nStagePeak[static_cast<int>(MemoryStage::Count)];
+    std::atomic<uint64_t>   m_nRefused{0};
+    std::atomic<uint64_t>   m_nOvercommits{0};
+};
+
+// Shared by every session of the process; unlimited until SetLimit.
+MemoryBudget*   ProcessMemoryBudget();
+
+// How a decoder fits a budget, worked out from the size of one frame.
+struct MemoryPlan
+{
+    int64_t     nFrameBytes     = 0;
+    int         nFrameSlots     = 0;        // frames the frame share of the budget holds
+    int         nMaxThreads     = 0;        // frame threads that fit; 0: no limit
+    int         nQueueFrames    = 0;        // decoded frames downstream may hold
+    int         nExtraHwFrames  = 0;        // hw surfaces beyond the decoder's own
+    int64_t     nPacketBytes    = 0;        // demux queue byte budget
+};
+
+// Size of one decoded frame as the pools allocate it.
+int64_t         EstimateFrameBytes(enum AVPixelFormat format, int nWidth, int nHeight);
+// Three quarters of nBudget go to frames, the rest to packets. The decoder
+// keeps a reference set of its own (nDecoderFrames) and frame threading one
+// frame per thread; what is left is for frames held downstream.
+MemoryPlan      PlanMemory(int64_t nBudget, int64_t nFrameBytes, int nDecoderFrames = 7);
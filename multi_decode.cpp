@@ -0,0 +1,180 @@
+#include "decode_session.hpp"
+#include "bench_stats.hpp"
+#include "stage_trace.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s [--workers N] [--copies K] [--step PACKETS] [--threads MODE[:N]] [--backend NAME]\n"
+            "                [--probe-cache PATH] [--session-mb N] [--process-mb N] [--stages] [--trace PATH]\n"
+            "                [--metrics PATH] input...\n"
+            "  --workers  size of the shared worker pool (default: one per hardware thread)\n"
+            "  --copies   open every input K times (default 1)\n"
+            "  --step     packets decoded per task before yielding the worker (default 8)\n"
+            "  --threads  per-session decoder threading (default none)\n"
+            "  --backend  software (default), auto, or a hw device type; one device per session\n"
+            "  --probe-cache  share stream probe results between sessions and runs through PATH\n"
+            "  --session-mb  cap each session's frames and surfaces at N MiB, which caps its decoder threads\n"
+            "  --process-mb  cap all sessions together; sessions wait to start while it is full\n"
+            "  --stages   time read, send and receive per call and print percentiles\n"
+            "  --trace    with --stages, write a Chrome trace with one track per worker\n"
+            "  --metrics  with --stages, write Prometheus text metrics\n",
+            argv0);
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> inputs;
+    unsigned nWorkers = 0;
+    int nCopies = 1;
+    int nStep = 8;
+    SessionOptions options;
+    std::string strProbeCache;
+    bool bStages = false;
+    std::string strTrace;
+    std::string strMetrics;
+    // The pool already spreads sessions over the cores; decoder threads on
+    // top of that would only oversubscribe them.
+    options.decoder.threading.mode = ThreadMode::None;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+            nWorkers = static_cast<unsigned>(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--copies") == 0 && i + 1 < argc)
+            nCopies = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--step") == 0 && i + 1 < argc)
+            nStep = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (ParseThreadingConfig(argv[++i], &options.decoder.threading) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            options.decoder.strBackend = argv[++i];
+        else if (strcmp(argv[i], "--probe-cache") == 0 && i + 1 < argc)
+            strProbeCache = argv[++i];
+        else if (strcmp(argv[i], "--session-mb") == 0 && i + 1 < argc)
+            options.nMemoryBudget = static_cast<int64_t>(atoi(argv[++i])) << 20;
+        else if (strcmp(argv[i], "--process-mb") == 0 && i + 1 < argc)
+            ProcessMemoryBudget()->SetLimit(static_cast<int64_t>(atoi(argv[++i])) << 20);
+        else if (strcmp(argv[i], "--stages") == 0)
+            bStages = true;
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            strTrace = argv[++i];
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc)
+            strMetrics = argv[++i];
+        else if (argv[i][0] != '-')
+            inputs.push_back(argv[i]);
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (inputs.empty() || nCopies < 1 || nStep < 1)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+    SetTracingEnabled(bStages || !strTrace.empty() || !strMetrics.empty());
+
+    ProbeCache probeCache;
+    if (!strProbeCache.empty())
+    {
+        int ret = probeCache.Load(strProbeCache);
+        if (ret < 0 && ret != AVERROR(ENOENT))
+            fprintf(stderr, "probe cache %s: %s, starting empty\n", strProbeCache.c_str(), av_err2str(ret));
+        options.decoder.pProbeCache = &probeCache;
+    }
+
+    std::vector<std::unique_ptr<DecodeSession>> sessions;
+    std::vector<DecodeSession*> pSessions;
+    for (int copy = 0; copy < nCopies; copy++)
+    {
+        for (const std::string& strUrl : inputs)
+        {
+            sessions.emplace_back(new DecodeSession(static_cast<int>(sessions.size()), strUrl, options));
+            pSessions.push_back(sessions.back().get());
+        }
+    }
+
+    WorkerPool pool(nWorkers);
+
+    BenchClock::time_point tStart = BenchClock::now();
+    RunSessions(&pool, pSessions, nStep);
+    double dElapsed = ElapsedSeconds(tStart, BenchClock::now());
+
+    int64_t nFrames = 0;
+    int64_t nBytes = 0;
+    double dBusy = 0.0;
+    int nFailed = 0;
+
+    printf("%4s %-9s %8s %10s %9s %9s %9s  %s\n",
+           "id", "backend", "frames", "frames/s", "busy s", "wall s", "peak MiB", "input");
+    for (const std::unique_ptr<DecodeSession>& pSession : sessions)
+    {
+        SessionStats stats = pSession->Stats();
+        printf("%4d %-9s %8lld %10.2f %9.3f %9.3f %9.1f  %s%s\n",
+               stats.nId, stats.strBackend.c_str(), (long long)stats.nFrames,
+               stats.dWallSeconds > 0 ? stats.nFrames / stats.dWallSeconds : 0.0,
+               stats.dBusySeconds, stats.dWallSeconds, stats.memory.nPeak / (1024.0 * 1024.0),
+               stats.strUrl.c_str(),
+               (stats.ret < 0 && stats.ret != AVERROR_EOF) ? " (failed)" : "");
+
+        nFrames += stats.nFrames;
+        nBytes += stats.nBytes;
+        dBusy += stats.dBusySeconds;
+        if (stats.ret < 0 && stats.ret != AVERROR_EOF)
+            nFailed++;
+    }
+
+    printf("\n");
+    printf("sessions:     %zu (%d failed)\n", sessions.size(), nFailed);
+    printf("workers:      %u, %llu steals\n", pool.Size(), (unsigned long long)pool.Steals());
+    printf("elapsed:      %.3f s\n", dElapsed);
+    printf("frames:       %lld\n", (long long)nFrames);
+    printf("frames/s:     %.2f\n", dElapsed > 0 ? nFrames / dElapsed : 0.0);
+    printf("bytes/s:      %.0f\n", dElapsed > 0 ? nBytes / dElapsed : 0.0);
+    printf("utilization:  %.1f%%\n", dElapsed > 0 ? 100.0 * dBusy / (dElapsed * pool.Size()) : 0.0);
+    printf("peak rss:     %.1f MiB\n", PeakRssBytes() / (1024.0 * 1024.0));
+    ProcessMemoryBudget()->Print(stdout);
+
+    if (!strProbeCache.empty())
+    {
+        ProbeCacheStats cs = probeCache.Stats();
+        printf("probe cache:  %llu hits, %llu misses (%llu stale, %llu rejected), %llu uncacheable, %llu evicted\n",
+               (unsigned long long)cs.nHits, (unsigned long long)cs.nMisses, (unsigned long long)cs.nStale,
+               (unsigned long long)cs.nRejected, (unsigned long long)cs.nUncacheable,
+               (unsigned long long)cs.nEvictions);
+        printf("probe time:   %.3f s probing, %.3f s saved\n", cs.dProbeSeconds, cs.dSavedSeconds);
+        int ret = probeCache.Save(strProbeCache);
+        if (ret < 0)
+            fprintf(stderr, "probe cache %s: %s\n", strProbeCache.c_str(), av_err2str(ret));
+    }
+
+    if (TracingEnabled())
+    {
+        printf("\n");
+        PrintStageSummary(stdout);
+        int ret;
+        if (!strTrace.empty() && (ret = WriteChromeTrace(strTrace)) < 0)
+            fprintf(stderr, "%s: %s\n", strTrace.c_str(), av_err2str(ret));
+        if (!strMetrics.empty() && (ret = WritePrometheusMetrics(strMetrics)) < 0)
+            fprintf(stderr, "%s: %s\n", strMetrics.c_str(), av_err2str(ret));
+    }
+
+    return nFailed ? 1 : 0;
+}
@@ -0,0 +1,249 @@
+#include "packet_fanout.hpp"
+#include "av_err2string.hpp"
+#include "stage_trace.hpp"
+
+#include <cstdio>
+
+RemuxSink::~RemuxSink()
+{
+    Close();
+}
+
+int RemuxSink::Open(AVFormatContext* pInput, const std::string& strPath, const RemuxSinkOptions& options)
+{
+    int ret = 0;
+    m_strPath = strPath;
+
+    const bool bSegments = options.dSegmentSeconds > 0;
+    const char* pszFormat = bSegments ? "segment" : (options.strFormat.empty() ? nullptr : options.strFormat.c_str());
+    if ((ret = avformat_alloc_output_context2(&m_pOutput, nullptr, pszFormat, strPath.c_str())) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", strPath.c_str(), av_err2str(ret));
+        return ret;
+    }
+
+    m_streamMap.assign(pInput->nb_streams, -1);
+    m_timeBases.resize(pInput->nb_streams);
+    for (unsigned i = 0; i < pInput->nb_streams; i++)
+    {
+        const AVStream* pIn = pInput->streams[i];
+        const AVCodecParameters* pParams = pIn->codecpar;
+        m_timeBases[i] = pIn->time_base;
+
+        // Cover art is a video stream of one picture, not something to record.
+        if ((pParams->codec_type != AVMEDIA_TYPE_VIDEO && pParams->codec_type != AVMEDIA_TYPE_AUDIO) ||
+            (pIn->disposition & AV_DISPOSITION_ATTACHED_PIC))
+            continue;
+        if (avformat_query_codec(m_pOutput->oformat, pParams->codec_id, FF_COMPLIANCE_NORMAL) == 0)
+            continue;
+
+        AVStream* pOut = avformat_new_stream(m_pOutput, nullptr);
+        if (!pOut)
+        {
+            Close();
+            return AVERROR(ENOMEM);
+        }
+        if ((ret = avcodec_parameters_copy(pOut->codecpar, pParams)) < 0)
+        {
+            Close();
+            return ret;
+        }
+        // The input container's tag may mean nothing to this muxer.
+        pOut->codecpar->codec_tag = 0;
+        pOut->time_base = pIn->time_base;
+        m_streamMap[i] = pOut->index;
+        if (m_iVideo < 0 && pParams->codec_type == AVMEDIA_TYPE_VIDEO)
+            m_iVideo = static_cast<int>(i);
+    }
+    if (m_pOutput->nb_streams == 0)
+    {
+        fprintf(stderr, "%s: no stream the muxer can hold\n", strPath.c_str());
+        Close();
+        return AVERROR_STREAM_NOT_FOUND;
+    }
+
+    if (!(m_pOutput->oformat->flags & AVFMT_NOFILE) &&
+        (ret = avio_open(&m_pOutput->pb, strPath.c_str(), AVIO_FLAG_WRITE)) < 0)
+    {
+        fprintf(stderr, "avio_open %s: %s\n", strPath.c_str(), av_err2str(ret));
+        Close();
+        return ret;
+    }
+
+    AVDictionary* pOptions = nullptr;
+    if (bSegments)
+    {
+        av_dict_set(&pOptions, "segment_time", std::to_string(options.dSegmentSeconds).c_str(), 0);
+        av_dict_set(&pOptions, "reset_timestamps", "1", 0);
+        if (!options.strFormat.empty())
+            av_dict_set(&pOptions, "segment_format", options.strFormat.c_str(), 0);
+    }
+    ret = avformat_write_header(m_pOutput, &pOptions);
+    av_dict_free(&pOptions);
+    if (ret < 0)
+    {
+        fprintf(stderr, "avformat_write_header %s: %s\n", strPath.c_str(), av_err2str(ret));
+        Close();
+        return ret;
+    }
+
+    if (!(m_pRef = av_packet_alloc()))
+    {
+        Close();
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = m_queue.Init(options.nQueueDepth, options.nQueueBytes)) < 0)
+    {
+        Close();
+        return ret;
+    }
+
+    m_thread = std::thread(&RemuxSink::WriteLoop, this);
+    return 0;
+}
+
+void RemuxSink::Drop(const AVPacket* pPacket)
+{
+    m_nDropped.fetch_add(1, std::memory_order_relaxed);
+    m_nDroppedBytes.fetch_add(pPacket->size, std::memory_order_relaxed);
+}
+
+void RemuxSink::Offer(const AVPacket* pPacket)
+{
+    const int iStream = pPacket->stream_index;
+    if (!m_thread.joinable() || iStream < 0 || iStream >= static_cast<int>(m_streamMap.size()) ||
+        m_streamMap[iStream] < 0)
+        return;
+
+    const bool bVideo = iStream == m_iVideo;
+    const bool bKey = (pPacket->flags & AV_PKT_FLAG_KEY) != 0;
+    const int64_t ts = pPacket->dts != AV_NOPTS_VALUE ? pPacket->dts : pPacket->pts;
+
+    if (!m_bStarted)
+    {
+        if ((m_iVideo >= 0 && !(bVideo && bKey)) || ts == AV_NOPTS_VALUE)
+            return;
+        m_nStartUs = av_rescale_q(ts, m_timeBases[iStream], av_make_q(1, AV_TIME_BASE));
+        m_bStarted = true;
+    }
+    else if (!bVideo && ts != AV_NOPTS_VALUE &&
+             av_rescale_q(ts, m_timeBases[iStream], av_make_q(1, AV_TIME_BASE)) < m_nStartUs)
+    {
+        // Audio from before the first keyframe.
+        return;
+    }
+
+    if (bVideo && m_bWaitKeyframe)
+    {
+        if (!bKey)
+        {
+            Drop(pPacket);
+            return;
+        }
+        m_bWaitKeyframe = false;
+    }
+
+    int ret = av_packet_ref(m_pRef, pPacket);
+    if (ret >= 0 && (ret = m_queue.TryPush(m_pRef)) >= 0)
+        return;
+
+    av_packet_unref(m_pRef);
+    Drop(pPacket);
+    if (bVideo)
+        m_bWaitKeyframe = true;
+}
+
+void RemuxSink::WriteLoop()
+{
+    SetTraceThreadName("remux");
+
+    AVPacket* pPacket = av_packet_alloc();
+    int ret = pPacket ? 0 : AVERROR(ENOMEM);
+
+    while (ret >= 0)
+    {
+        if ((ret = m_queue.Pop(pPacket)) < 0)
+            break;
+
+        const AVRational timeBase = m_timeBases[pPacket->stream_index];
+        const int64_t nOffset = av_rescale_q(m_nStartUs, av_make_q(1, AV_TIME_BASE), timeBase);
+        if (pPacket->pts != AV_NOPTS_VALUE)
+            pPacket->pts -= nOffset;
+        if (pPacket->dts != AV_NOPTS_VALUE)
+            pPacket->dts -= nOffset;
+
+        pPacket->stream_index = m_streamMap[pPacket->stream_index];
+        pPacket->pos = -1;
+        av_packet_rescale_ts(pPacket, timeBase, m_pOutput->streams[pPacket->stream_index]->time_base);
+
+        const int64_t nSize = pPacket->size;
+        if ((ret = av_interleaved_write_frame(m_pOutput, pPacket)) < 0)
+            break;
+        m_nPackets.fetch_add(1, std::memory_order_relaxed);
+        m_nBytes.fetch_add(nSize, std::memory_order_relaxed);
+    }
+
+    if (ret == AVERROR_EOF)
+        ret = av_write_trailer(m_pOutput);
+    if (ret < 0 && ret != AVERROR_EXIT)
+    {
+        fprintf(stderr, "%s: %s\n", m_strPath.c_str(), av_err2str(ret));
+        m_ret.store(ret, std::memory_order_release);
+        // Offer drops everything from here on.
+        m_queue.Abort();
+    }
+
+    av_packet_free(&pPacket);
+}
+
+int RemuxSink::Close()
+{
+    if (m_thread.joinable())
+    {
+        m_queue.Close();
+        m_thread.join();
+    }
+    av_packet_free(&m_pRef);
+
+    if (m_pOutput)
+    {
+        if (!(m_pOutput->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&m_pOutput->pb);
+        avformat_free_context(m_pOutput);
+        m_pOutput = nullptr;
+    }
+    return m_ret.load(std::memory_order_acquire);
+}
+
+RemuxSinkStats RemuxSink::Stats() const
+{
+    PacketQueueStats qs = m_queue.Stats();
+
+    RemuxSinkStats stats;
+    stats.nPackets      = m_nPackets.load(std::memory_order_relaxed);
+    stats.nBytes        = m_nBytes.load(std::memory_order_relaxed);
+    stats.nDropped      = m_nDropped.load(std::memory_order_relaxed);
+    stats.nDroppedBytes = m_nDroppedBytes.load(std::memory_order_relaxed);
+    stats.nPeakPackets  = qs.nPeakPackets;
+    stats.nPeakBytes    = qs.nPeakBytes;
+    stats.ret           = m_ret.load(std::memory_order_acquire);
+    return stats;
+}
+
+void PacketFanout::Deliver(const AVPacket* pPacket)
+{
+    for (RemuxSink* pSink : m_sinks)
+        pSink->Offer(pPacket);
+}
+
+int PacketFanout::Close()
+{
+    int ret = 0;
+    for (RemuxSink* pSink : m_sinks)
+    {
+        int err = pSink->Close();
+        if (ret == 0)
+            ret = err;
+    }
+    return ret;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "packet_queue.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+struct RemuxSinkOptions
+{
+    // Muxer name; empty guesses it from the path. With segments, the format
+    // of each segment.
+    std::string     strFormat;
+    // Write segments of about this many seconds through the segment muxer;
+    // the path then needs a pattern such as rec%03d.ts.
+    double          dSegmentSeconds = 0.0;
+    size_t          nQueueDepth     = 512;
+    int64_t         nQueueBytes     = 64LL << 20;
+};
+
+struct RemuxSinkStats
+{
+    uint64_t    nPackets        = 0;        // written
+    int64_t     nBytes          = 0;        // payload written
+    uint64_t    nDropped        = 0;        // no room in the queue, or skipped up to the next keyframe
+    int64_t     nDroppedBytes   = 0;
+    size_t      nPeakPackets    = 0;
+    int64_t     nPeakBytes      = 0;
+    int         ret             = 0;        // the error that stopped writing
+};
+
+// Stream copy of an input to a file, written on a thread of its own from a
+// bounded PacketQueue. Offer never waits: a packet the queue has no room for
+// is dropped, and video then skips to its next keyframe so the recording
+// stays decodable. Recording starts at the first video keyframe offered,
+// with timestamps shifted to start at zero.
+class RemuxSink
+{
+public:
+    RemuxSink() = default;
+    ~RemuxSink();
+
+    RemuxSink(const RemuxSink&) = delete;
+    RemuxSink& operator=(const RemuxSink&) = delete;
+
+    // Maps every audio and video stream of pInput the muxer can hold, writes
+    // the header and starts the writer.
+    int             Open(AVFormatContext* pInput, const std::string& strPath,
+                         const RemuxSinkOptions& options = RemuxSinkOptions());
+    // From one producer thread. Queues a new reference to pPacket's payload.
+    void            Offer(const AVPacket* pPacket);
+    // After the last Offer: writes what is queued and the trailer. Returns
+    // the first error the writer hit.
+    int             Close();
+
+    const std::string&  Path() const    { return m_strPath; }
+    RemuxSinkStats  Stats() const;
+
+private:
+    void            WriteLoop();
+    void            Drop(const AVPacket* pPacket);
+
+    std::string             m_strPath;
+    AVFormatContext*        m_pOutput       = nullptr;
+    // Per input stream: the output stream, or -1, and the input time base.
+    std::vector<int>        m_streamMap;
+    std::vector<AVRational> m_timeBases;
+    int                     m_iVideo        = -1;
+
+    // Owned by the producer; m_nStartUs is published to the writer by the
+    // queue along with the first packet.
+    AVPacket*               m_pRef          = nullptr;
+    bool                    m_bStarted      = false;
+    bool                    m_bWaitKeyframe = false;
+    int64_t                 m_nStartUs      = 0;
+
+    PacketQueue             m_queue;
+    std::thread             m_thread;
+    std::atomic<uint64_t>   m_nPackets{0};
+    std::atomic<int64_t>    m_nBytes{0};
+    std::atomic<uint64_t>   m_nDropped{0};
+    std::atomic<int64_t>    m_nDroppedBytes{0};
+    std::atomic<int>        m_ret{0};
+};
+
+// Hands every packet av_read_frame returns to each sink as another
+// reference to the same payload, so recording costs no second demux and no
+// copy. Attach it to a DemuxThread (SetFanout) or call Deliver from a read
+// loop.
+class PacketFanout
+{
+public:
+    void            AddSink(RemuxSink* pSink)   { m_sinks.push_back(pSink); }
+    bool            Empty() const               { return m_sinks.empty(); }
+
+    void            Deliver(const AVPacket* pPacket);
+    // Closes every sink; the first error is returned.
+    int             Close();
+
+private:
+    std::vector<RemuxSink*> m_sinks;
+};
@@ -0,0 +1,114 @@
+#include "packet_pool.hpp"
+
+#include <chrono>
+#include <cstring>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+static const int kMinClassShift = 12;      // 4 KiB
+static const int kStepsPerOctave = 4;
+
+static size_t ClassSize(int iClass)
+{
+    const size_t nOctave = size_t(1) << (kMinClassShift + iClass / kStepsPerOctave);
+    return nOctave / kStepsPerOctave * (kStepsPerOctave + iClass % kStepsPerOctave);
+}
+
+// Smallest class of at least nSize bytes, -1 when there is none.
+static int ClassIndex(size_t nSize, int nClasses)
+{
+    for (int i = 0; i < nClasses; i++)
+    {
+        if (ClassSize(i) >= nSize)
+            return i;
+    }
+    return -1;
+}
+
+PacketPool::~PacketPool()
+{
+    // Payloads still referenced downstream keep their pool alive until
+    // they are released.
+    for (AVBufferPool*& pPool : m_pools)
+        av_buffer_pool_uninit(&pPool);
+}
+
+AVBufferRef* PacketPool::AllocBuffer(void* opaque, size_t size)
+{
+    PacketPool* pPool = static_cast<PacketPool*>(opaque);
+    AVBufferRef* pBuffer = av_buffer_alloc(size);
+    if (pBuffer)
+    {
+        pPool->m_classAllocs[ClassIndex(size, kClasses)].fetch_add(1, std::memory_order_relaxed);
+        pPool->m_nPoolBytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+    }
+    return pBuffer;
+}
+
+int PacketPool::Adopt(AVPacket* pPacket)
+{
+    if (pPacket->size <= 0)
+        return 0;
+
+    const int iClass = ClassIndex(static_cast<size_t>(pPacket->size) + AV_INPUT_BUFFER_PADDING_SIZE, kClasses);
+    if (iClass < 0)
+    {
+        m_nOversize.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+    AVBufferRef* pBuffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_pools[iClass] &&
+            !(m_pools[iClass] = av_buffer_pool_init2(ClassSize(iClass), this, AllocBuffer, nullptr)))
+            return AVERROR(ENOMEM);
+        pBuffer = av_buffer_pool_get(m_pools[iClass]);
+    }
+    if (!pBuffer)
+        return AVERROR(ENOMEM);
+
+    memcpy(pBuffer->data, pPacket->data, pPacket->size);
+    memset(pBuffer->data + pPacket->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    av_buffer_unref(&pPacket->buf);
+    pPacket->buf = pBuffer;
+    pPacket->data = pBuffer->data;
+
+    m_nPackets.fetch_add(1, std::memory_order_relaxed);
+    m_nAdoptNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - tStart).count(), std::memory_order_relaxed);
+    return 0;
+}
+
+PacketPoolStats PacketPool::Stats() const
+{
+    PacketPoolStats stats;
+    stats.nPackets      = m_nPackets.load(std::memory_order_relaxed);
+    stats.nOversize     = m_nOversize.load(std::memory_order_relaxed);
+    stats.nPoolBytes    = m_nPoolBytes.load(std::memory_order_relaxed);
+    stats.dAdoptSeconds = m_nAdoptNs.load(std::memory_order_relaxed) * 1e-9;
+    for (int i = 0; i < kClasses; i++)
+    {
+        const uint64_t nAllocs = m_classAllocs[i].load(std::memory_order_relaxed);
+        stats.nBufferAllocs += nAllocs;
+        if (nAllocs > 0)
+            stats.nClasses++;
+    }
+    return stats;
+}
+
+void PacketPool::Print(FILE* fp) const
+{
+    for (int i = 0; i < kClasses; i++)
+    {
+        const uint64_t nAllocs = m_classAllocs[i].load(std::memory_order_relaxed);
+        if (nAllocs == 0)
+            continue;
+        fprintf(fp, "  %9zu bytes  %6llu buffers  %8.1f MiB\n", ClassSize(i), (unsigned long long)nAllocs,
+                ClassSize(i) * nAllocs / (1024.0 * 1024.0));
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+extern "C"
+{
+#include <libavcodec/packet.h>
+#include <libavutil/buffer.h>
+}
+
+struct PacketPoolStats
+{
+    uint64_t    nPackets        = 0;    // payloads moved into pooled buffers
+    uint64_t    nBufferAllocs   = 0;    // buffers the AVBufferPools allocated
+    uint64_t    nOversize       = 0;    // payloads above the largest class, left on the heap
+    int         nClasses        = 0;    // size classes in use
+    // Allocated by the pools, free or in use. AVBufferPool keeps every
+    // buffer until the pool goes away, so this is also the peak.
+    int64_t     nPoolBytes      = 0;
+    double      dAdoptSeconds   = 0.0;  // copying payloads in, pool gets included
+};
+
+// Size-classed AVBufferPools for demuxed packet payloads. libavformat has
+// no hook for its payload allocation, so Adopt copies the payload into a
+// pooled buffer of the smallest class that fits and drops the demuxer's
+// buffer straight away. That buffer is freed right after it was allocated,
+// on the same thread, which the heap handles well; the pooled copy is the
+// one that lives on in queues and fan-out sinks, and it goes back to its
+// pool instead of the heap when the last reference drops.
+//
+// Classes run from 4 KiB to 64 MiB in quarter-octave steps, so at most a
+// fifth of a buffer is slack. Adopt is thread-safe.
+class PacketPool
+{
+public:
+    PacketPool() = default;
+    ~PacketPool();
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    int             Adopt(AVPacket* pPacket);
+
+    PacketPoolStats Stats() const;
+    // One line per class in use: buffer size and buffers allocated.
+    void            Print(FILE* fp) const;
+
+private:
+    static const int    kClasses = 57;
+
+    static AVBufferRef* AllocBuffer(void* opaque, size_t size);
+
+    std::mutex              m_lock;
+    AVBufferPool*           m_pools[kClasses]   = {};
+
+    std::atomic<uint64_t>   m_classAllocs[kClasses] = {};
+    std::atomic<uint64_t>   m_nPackets{0};
+    std::atomic<uint64_t>   m_nOversize{0};
+    std::atomic<int64_t>    m_nPoolBytes{0};
+    std::atomic<int64_t>    m_nAdoptNs{0};
+};
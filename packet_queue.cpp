@@ -0,0 +1,190 @@
+#include "packet_queue.hpp"
+#include "queue_wait.hpp"
+
+#include <chrono>
+
+extern "C"
+{
+#include <libavutil/avutil.h>
+}
+
+typedef std::chrono::steady_clock Clock;
+
+PacketQueue::~PacketQueue()
+{
+    if (m_pBudget && m_nBytes.load(std::memory_order_acquire) > 0)
+        m_pBudget->Release(m_nBytes.load(std::memory_order_acquire), MemoryStage::Packets);
+    for (AVPacket*& pSlot : m_slots)
+        av_packet_free(&pSlot);
+}
+
+int PacketQueue::Init(size_t nDepth, int64_t nMaxBytes)
+{
+    if (nDepth == 0 || !m_slots.empty())
+        return AVERROR(EINVAL);
+
+    m_slots.resize(nDepth, nullptr);
+    for (AVPacket*& pSlot : m_slots)
+    {
+        if (!(pSlot = av_packet_alloc()))
+            return AVERROR(ENOMEM);
+    }
+
+    m_nMaxBytes = nMaxBytes;
+    return 0;
+}
+
+int PacketQueue::Push(AVPacket* pPacket)
+{
+    return Enqueue(pPacket, true);
+}
+
+int PacketQueue::TryPush(AVPacket* pPacket)
+{
+    return Enqueue(pPacket, false);
+}
+
+int PacketQueue::Enqueue(AVPacket* pPacket, bool bWait)
+{
+    int ret = av_packet_make_refcounted(pPacket);
+    if (ret < 0)
+        return ret;
+
+    const size_t tail = m_tail.load(std::memory_order_relaxed);
+    const size_t nDepth = m_slots.size();
+
+    // The byte budget never blocks an empty queue, otherwise a single packet
+    // larger than the budget would wait forever. The same goes for the
+    // memory budget, which is charged as the last step so a refused packet
+    // holds no charge.
+    auto HasRoom = [&]()
+    {
+        size_t nQueued = tail - m_head.load(std::memory_order_acquire);
+        if (nQueued >= nDepth)
+            return false;
+        if (m_nMaxBytes > 0 && nQueued > 0 &&
+            m_nBytes.load(std::memory_order_acquire) + pPacket->size > m_nMaxBytes)
+            return false;
+        if (!m_pBudget)
+            return true;
+        if (nQueued == 0)
+        {
+            m_pBudget->Charge(pPacket->size, MemoryStage::Packets);
+            return true;
+        }
+        return m_pBudget->TryCharge(pPacket->size, MemoryStage::Packets);
+    };
+
+    if (!HasRoom())
+    {
+        if (!bWait)
+            return m_bAborted.load(std::memory_order_acquire) ? AVERROR_EXIT : AVERROR(EAGAIN);
+
+        Clock::time_point tStart = Clock::now();
+        unsigned nSpins = 0;
+        m_nProducerStalls.fetch_add(1, std::memory_order_relaxed);
+        while (!HasRoom())
+        {
+            if (m_bAborted.load(std::memory_order_acquire))
+                return AVERROR_EXIT;
+            QueueBackoff(nSpins);
+        }
+        m_nProducerStallNs.fetch_add(NanosecondsSince(tStart), std::memory_order_relaxed);
+    }
+
+    if (m_bAborted.load(std::memory_order_acquire))
+    {
+        if (m_pBudget)
+            m_pBudget->Release(pPacket->size, MemoryStage::Packets);
+        return AVERROR_EXIT;
+    }
+
+    const int64_t nSize = pPacket->size;
+    av_packet_move_ref(m_slots[tail % nDepth], pPacket);
+
+    int64_t nBytes = m_nBytes.fetch_add(nSize, std::memory_order_release) + nSize;
+    m_tail.store(tail + 1, std::memory_order_release);
+
+    size_t nQueued = tail + 1 - m_head.load(std::memory_order_acquire);
+    if (nQueued > m_nPeakPackets.load(std::memory_order_relaxed))
+        m_nPeakPackets.store(nQueued, std::memory_order_relaxed);
+    if (nBytes > m_nPeakBytes.load(std::memory_order_relaxed))
+        m_nPeakBytes.store(nBytes, std::memory_order_relaxed);
+
+    return 0;
+}
+
+int PacketQueue::Pop(AVPacket* pPacket)
+{
+    const size_t head = m_head.load(std::memory_order_relaxed);
+
+    if (m_tail.load(std::memory_order_acquire) == head)
+    {
+        Clock::time_point tStart = Clock::now();
+        unsigned nSpins = 0;
+        m_nConsumerStalls.fetch_add(1, std::memory_order_relaxed);
+        while (m_tail.load(std::memory_order_acquire) == head)
+        {
+            if (m_bAborted.load(std::memory_order_acquire))
+                return AVERROR_EXIT;
+            // Re-check the tail after seeing the flag: Close is only called
+            // after the last Push, so this cannot miss a packet.
+            if (m_bClosed.load(std::memory_order_acquire) &&
+                m_tail.load(std::memory_order_acquire) == head)
+                return AVERROR_EOF;
+            QueueBackoff(nSpins);
+        }
+        m_nConsumerStallNs.fetch_add(NanosecondsSince(tStart), std::memory_order_relaxed);
+    }
+
+    if (m_bAborted.load(std::memory_order_acquire))
+        return AVERROR_EXIT;
+
+    m_nOccupancySum.fetch_add(m_tail.load(std::memory_order_acquire) - head, std::memory_order_relaxed);
+
+    AVPacket* pSlot = m_slots[head % m_slots.size()];
+    const int64_t nSize = pSlot->size;
+    av_packet_move_ref(pPacket, pSlot);
+
+    m_nBytes.fetch_sub(nSize, std::memory_order_release);
+    m_head.store(head + 1, std::memory_order_release);
+    if (m_pBudget)
+        m_pBudget->Release(nSize, MemoryStage::Packets);
+
+    return 0;
+}
+
+void PacketQueue::Close()
+{
+    m_bClosed.store(true, std::memory_order_release);
+}
+
+void PacketQueue::Abort()
+{
+    m_bAborted.store(true, std::memory_order_release);
+}
+
+size_t PacketQueue::Size() const
+{
+    return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+}
+
+int64_t PacketQueue::Bytes() const
+{
+    return m_nBytes.load(std::memory_order_acquire);
+}
+
+PacketQueueStats PacketQueue::Stats() const
+{
+    PacketQueueStats stats;
+    stats.nPopped               = m_head.load(std::memory_order_acquire);
+    stats.nPushed               = m_tail.load(std::memory_order_acquire);
+    stats.nProducerStalls       = m_nProducerStalls.load(std::memory_order_relaxed);
+    stats.nConsumerStalls       = m_nConsumerStalls.load(std::memory_order_relaxed);
+    stats.dProducerStallSeconds = m_nProducerStallNs.load(std::memory_order_relaxed) * 1e-9;
+    stats.dConsumerStallSeconds = m_nConsumerStallNs.load(std::memory_order_relaxed) * 1e-9;
+    stats.nPeakPackets          = m_nPeakPackets.load(std::memory_order_relaxed);
+    stats.nPeakBytes            = m_nPeakBytes.load(std::memory_order_relaxed);
+    stats.dMeanOccupancy        = stats.nPopped ? double(m_nOccupancySum.load(std::memory_order_relaxed)) / stats.nPopped : 0.0;
+    return stats;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "memory_budget.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+extern "C"
+{
+#include <libavcodec/packet.h>
+}
+
+struct PacketQueueStats
+{
+    uint64_t    nPushed                 = 0;
+    uint64_t    nPopped                 = 0;
+    uint64_t    nProducerStalls         = 0;    // Push calls that had to wait for room
+    uint64_t    nConsumerStalls         = 0;    // Pop calls that had to wait for a packet
+    double      dProducerStallSeconds   = 0.0;
+    double      dConsumerStallSeconds   = 0.0;
+    size_t      nPeakPackets            = 0;
+    int64_t     nPeakBytes              = 0;
+    double      dMeanOccupancy          = 0.0;  // packets queued, sampled at every Pop
+};
+
+// Bounded single-producer/single-consumer ring of refcounted AVPackets.
+// Slots are allocated once in Init and packets are moved in and out by
+// reference, so the payload is never copied. Push blocks while the ring is
+// full or while the queued payload would exceed the byte budget or the
+// memory budget; Pop blocks
+// while it is empty. Neither side takes a lock.
+class PacketQueue
+{
+public:
+    PacketQueue() = default;
+    ~PacketQueue();
+
+    PacketQueue(const PacketQueue&) = delete;
+    PacketQueue& operator=(const PacketQueue&) = delete;
+
+    // nMaxBytes <= 0 disables the byte budget.
+    int                 Init(size_t nDepth, int64_t nMaxBytes);
+    // Before the first Push: queued payload is charged to pBudget as
+    // MemoryStage::Packets, and Push waits while the budget (or a parent)
+    // has no room, except into an empty queue.
+    void                SetMemoryBudget(MemoryBudget* pBudget)  { m_pBudget = pBudget; }
+
+    // Takes over the reference held by pPacket. Returns AVERROR_EXIT once aborted.
+    int                 Push(AVPacket* pPacket);
+    // Push that returns AVERROR(EAGAIN) instead of waiting for room; the
+    // reference then stays with pPacket.
+    int                 TryPush(AVPacket* pPacket);
+    // Returns AVERROR_EOF once closed and drained, AVERROR_EXIT once aborted.
+    int                 Pop(AVPacket* pPacket);
+
+    void                Close();
+    void                Abort();
+
+    size_t              Size() const;
+    int64_t             Bytes() const;
+    PacketQueueStats    Stats() const;
+
+private:
+    int                 Enqueue(AVPacket* pPacket, bool bWait);
+
+    std::vector<AVPacket*>  m_slots;
+    int64_t                 m_nMaxBytes = 0;
+    MemoryBudget*           m_pBudget   = nullptr;
+
+    alignas(64) std::atomic<size_t>     m_head{0};      // next slot to pop, owned by the consumer
+    alignas(64) std::atomic<size_t>     m_tail{0};      // next slot to push, owned by the producer
+    alignas(64) std::atomic<int64_t>    m_nBytes{0};
+    std::atomic<bool>                   m_bClosed{false};
+    std::atomic<bool>                   m_bAborted{false};
+
+    std::atomic<uint64_t>   m_nProducerStalls{0};
+    std::atomic<uint64_t>   m_nConsumerStalls{0};
+    std::atomic<int64_t>    m_nProducerStallNs{0};
+    std::atomic<int64_t>    m_nConsumerStallNs{0};
+    std::atomic<size_t>     m_nPeakPackets{0};
+    std::atomic<int64_t>    m_nPeakBytes{0};
+    std::atomic<uint64_t>   m_nOccupancySum{0};
+};
@@ -0,0 +1,179 @@
+#include "decoder.hpp"
+#include "bench_stats.hpp"
+#include "frame_scheduler.hpp"
+#include "stage_trace.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <input> [--frames N] [--realtime] [--decode-ms MS] [--decode-scale X] [--render-ms MS]\n"
+            "                [--rate X] [--drop-late-ms MS] [--skip-nonref-ms MS] [--skip-nonkey-ms MS]\n"
+            "                [--threads MODE[:N]] [--backend NAME]\n"
+            "  --realtime        pace against the wall clock instead of a simulated one\n"
+            "  --decode-ms       simulated decode cost per decoded frame (default: measured)\n"
+            "  --decode-scale    multiply the measured decode cost, to emulate a slower machine\n"
+            "  --render-ms       simulated render cost per presented frame (default 2)\n"
+            "  --rate            playback speed (default 1)\n"
+            "  --drop-late-ms    drop frames later than this before render (default 25)\n"
+            "  --skip-nonref-ms  skip non-reference frames in the decoder past this lateness (default 100)\n"
+            "  --skip-nonkey-ms  decode keyframes only past this lateness (default 500)\n",
+            argv0);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strUrl;
+    int64_t nMaxFrames = 0;
+    bool bRealtime = false;
+    double dDecodeMs = -1.0;
+    double dDecodeScale = 1.0;
+    double dRenderMs = 2.0;
+    SchedulerOptions scheduling;
+    DecoderOptions options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            nMaxFrames = strtoll(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--realtime") == 0)
+            bRealtime = true;
+        else if (strcmp(argv[i], "--decode-ms") == 0 && i + 1 < argc)
+            dDecodeMs = atof(argv[++i]);
+        else if (strcmp(argv[i], "--decode-scale") == 0 && i + 1 < argc)
+            dDecodeScale = atof(argv[++i]);
+        else if (strcmp(argv[i], "--render-ms") == 0 && i + 1 < argc)
+            dRenderMs = atof(argv[++i]);
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+            scheduling.dRate = atof(argv[++i]);
+        else if (strcmp(argv[i], "--drop-late-ms") == 0 && i + 1 < argc)
+            scheduling.dDropLateSeconds = atof(argv[++i]) * 1e-3;
+        else if (strcmp(argv[i], "--skip-nonref-ms") == 0 && i + 1 < argc)
+            scheduling.dSkipNonRefSeconds = atof(argv[++i]) * 1e-3;
+        else if (strcmp(argv[i], "--skip-nonkey-ms") == 0 && i + 1 < argc)
+            scheduling.dSkipNonKeySeconds = atof(argv[++i]) * 1e-3;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (ParseThreadingConfig(argv[++i], &options.threading) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            options.strBackend = argv[++i];
+        else if (argv[i][0] != '-' && strUrl.empty())
+            strUrl = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (strUrl.empty() || scheduling.dRate <= 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    VideoStream stream;
+    if (OpenStream(strUrl, &stream, options) < 0)
+        return 1;
+
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+    {
+        fprintf(stderr, "av_packet_alloc failed\n");
+        CloseStream(&stream);
+        return 1;
+    }
+
+    SystemClock systemClock;
+    SimulatedClock simulatedClock;
+    PresentationClock* pClock = bRealtime ? static_cast<PresentationClock*>(&systemClock) : &simulatedClock;
+    FrameScheduler scheduler(pClock, scheduling);
+    const AVRational timeBase = stream.pFormatContext->streams[stream.iVideo]->time_base;
+
+    // On the simulated clock decode costs what it measured (or what it was
+    // told to) and rendering costs --render-ms; waiting for a frame to be due
+    // costs nothing, so the run takes as long as decoding does.
+    int64_t nDecoded = 0;
+    int64_t nPackets = 0;
+    BenchClock::time_point tSegment;
+    FrameCallback onFrame = [&](AVCodecContext*, AVFrame* frame)
+    {
+        if (!bRealtime)
+        {
+            if (dDecodeMs >= 0)
+                simulatedClock.Advance(dDecodeMs * 1e-3);
+            else
+                simulatedClock.Advance(ElapsedSeconds(tSegment, BenchClock::now()) * dDecodeScale);
+        }
+        nDecoded++;
+
+        const double dDecodedAt = pClock->Now();
+        if (scheduler.Schedule(frame->best_effort_timestamp, timeBase, dDecodedAt) == ScheduleAction::Present)
+        {
+            ScopedStage stage(TraceStage::Present);
+            if (bRealtime)
+                systemClock.SleepUntil(systemClock.Now() + dRenderMs * 1e-3);
+            else
+                simulatedClock.Advance(dRenderMs * 1e-3);
+            scheduler.Presented();
+        }
+
+        tSegment = BenchClock::now();
+        return 0;
+    };
+
+    int ret = 0;
+    while (ret >= 0 && (nMaxFrames <= 0 || nDecoded < nMaxFrames))
+    {
+        if ((ret = TracedReadFrame(stream.pFormatContext, pPacket)) < 0)
+            break;
+
+        if (pPacket->stream_index == stream.iVideo)
+        {
+            nPackets++;
+            scheduler.UpdateDiscard(stream.pCodecCtx);
+            tSegment = BenchClock::now();
+            ret = DecodeFrame(stream.pCodecCtx, pPacket, onFrame, nullptr, stream.pBackend.get());
+        }
+
+        av_packet_unref(pPacket);
+    }
+    tSegment = BenchClock::now();
+    DecodeFrame(stream.pCodecCtx, NULL, onFrame, nullptr, stream.pBackend.get());
+
+    if (ret < 0 && ret != AVERROR_EOF)
+        fprintf(stderr, "decode stopped early: %s\n", av_err2str(ret));
+
+    const SchedulerStats& stats = scheduler.Stats();
+    printf("input:        %s\n", strUrl.c_str());
+    printf("clock:        %s, %.3f s elapsed, rate %.2f\n", bRealtime ? "system" : "simulated",
+           pClock->Now(), scheduling.dRate);
+    printf("packets:      %lld, %llu with skip nonref, %llu with skip nonkey\n", (long long)nPackets,
+           (unsigned long long)stats.nPacketsSkipNonRef, (unsigned long long)stats.nPacketsSkipNonKey);
+    printf("frames:       %lld decoded, %llu presented, %llu dropped late\n", (long long)nDecoded,
+           (unsigned long long)stats.nPresented, (unsigned long long)stats.nDroppedLate);
+    printf("resyncs:      %llu, max lateness %.3f ms\n", (unsigned long long)stats.nResyncs,
+           stats.dMaxLateness * 1e3);
+    printf("latency:      mean %.3f ms, max %.3f ms (decoded -> presented)\n",
+           stats.latency.MeanMs(), stats.latency.MaxMs());
+    stats.latency.Print(stdout, "              ");
+    printf("jitter:       mean %.3f ms, max %.3f ms (|presented - due|)\n",
+           stats.jitter.MeanMs(), stats.jitter.MaxMs());
+    stats.jitter.Print(stdout, "              ");
+
+    av_packet_free(&pPacket);
+    CloseStream(&stream);
+
+    return 0;
+}
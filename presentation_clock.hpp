@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+
+// Time source the FrameScheduler paces against, in seconds. Tests and
+// headless runs swap in SimulatedClock to make pacing deterministic.
+class PresentationClock
+{
+public:
+    virtual ~PresentationClock() = default;
+
+    virtual double  Now() const = 0;
+    virtual void    SleepUntil(double dTime) = 0;
+};
+
+class SystemClock : public PresentationClock
+{
+public:
+    SystemClock() : m_tEpoch(std::chrono::steady_clock::now()) {}
+
+    double Now() const override
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_tEpoch).count();
+    }
+
+    void SleepUntil(double dTime) override
+    {
+        std::this_thread::sleep_until(m_tEpoch + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                     std::chrono::duration<double>(dTime)));
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_tEpoch;
+};
+
+// Only moves when told to: SleepUntil jumps ahead, Advance charges work.
+class SimulatedClock : public PresentationClock
+{
+public:
+    double  Now() const override                { return m_dNow; }
+    void    SleepUntil(double dTime) override   { if (dTime > m_dNow) m_dNow = dTime; }
+    void    Advance(double dSeconds)            { m_dNow += dSeconds; }
+
+private:
+    double  m_dNow = 0.0;
+};
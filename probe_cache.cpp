@@ -0,0 +1,427 @@
+#include "probe_cache.hpp"
+#include "av_err2string.hpp"
+#include "bench_stats.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+extern "C"
+{
+#include <libavutil/channel_layout.h>
+#include <libavutil/mem.h>
+}
+
+static const char       kMagic[4]   = { 'P', 'R', 'B', 'C' };
+static const uint32_t   kVersion    = 1;
+
+struct ProbeCacheFileHeader
+{
+    char        magic[4];           // "PRBC"
+    uint32_t    nVersion;
+    uint64_t    nEntries;
+    uint64_t    nClock;
+};
+
+struct ProbeCacheEntryHeader
+{
+    uint32_t    nPath;
+    uint32_t    nStreams;
+    uint64_t    nExtradata;
+    int64_t     nSize;
+    int64_t     nMtime;
+    uint64_t    nLastUsed;
+    double      dProbeSeconds;
+    int64_t     startTime;
+    int64_t     duration;
+    int64_t     bitRate;
+};
+
+static int StatSource(const std::string& strPath, int64_t* pnSize, int64_t* pnMtime)
+{
+    struct stat st;
+    if (stat(strPath.c_str(), &st) != 0)
+        return AVERROR(errno);
+    *pnSize = static_cast<int64_t>(st.st_size);
+    *pnMtime = static_cast<int64_t>(st.st_mtime);
+    return 0;
+}
+
+int64_t ProbeCache::Entry::Bytes() const
+{
+    return static_cast<int64_t>(sizeof(Entry) + strPath.size() + streams.size() * sizeof(StreamRecord) +
+                                extradata.size());
+}
+
+ProbeCache::ProbeCache(size_t nMaxEntries, int64_t nMaxBytes)
+    : m_nMaxEntries(nMaxEntries)
+    , m_nMaxBytes(nMaxBytes)
+{
+}
+
+ProbeCache::Entry* ProbeCache::Find(const std::string& strPath)
+{
+    for (Entry& entry : m_entries)
+    {
+        if (entry.strPath == strPath)
+            return &entry;
+    }
+    return nullptr;
+}
+
+void ProbeCache::Evict()
+{
+    while (!m_entries.empty() && (m_entries.size() > m_nMaxEntries || m_nBytes > m_nMaxBytes))
+    {
+        std::vector<Entry>::iterator oldest = std::min_element(m_entries.begin(), m_entries.end(),
+            [](const Entry& a, const Entry& b) { return a.nLastUsed < b.nLastUsed; });
+        m_nBytes -= oldest->Bytes();
+        std::swap(*oldest, m_entries.back());
+        m_entries.pop_back();
+        m_stats.nEvictions++;
+    }
+}
+
+int ProbeCache::Apply(const std::string& strUrl, AVFormatContext* pFormatContext)
+{
+    BenchClock::time_point tStart = BenchClock::now();
+
+    int64_t nSize = 0, nMtime = 0;
+    if ((pFormatContext->ctx_flags & AVFMTCTX_NOHEADER) || StatSource(strUrl, &nSize, &nMtime) < 0)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stats.nUncacheable++;
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    Entry* pEntry = Find(strUrl);
+    if (!pEntry)
+    {
+        m_stats.nMisses++;
+        return 0;
+    }
+    if (pEntry->nSize != nSize || pEntry->nMtime != nMtime)
+    {
+        m_stats.nMisses++;
+        m_stats.nStale++;
+        return 0;
+    }
+
+    // The header already names every stream; a cached layout that disagrees
+    // with it belongs to some other file.
+    bool bMatches = pEntry->streams.size() == pFormatContext->nb_streams;
+    for (size_t i = 0; bMatches && i < pEntry->streams.size(); i++)
+    {
+        const AVCodecParameters* par = pFormatContext->streams[i]->codecpar;
+        const StreamRecord& rec = pEntry->streams[i];
+        bMatches = rec.codecType == par->codec_type &&
+                   (par->codec_id == AV_CODEC_ID_NONE || rec.codecId == par->codec_id);
+    }
+    if (!bMatches)
+    {
+        m_stats.nMisses++;
+        m_stats.nRejected++;
+        return 0;
+    }
+
+    const uint8_t* pExtradata = pEntry->extradata.data();
+    for (size_t i = 0; i < pEntry->streams.size(); i++)
+    {
+        AVStream* st = pFormatContext->streams[i];
+        AVCodecParameters* par = st->codecpar;
+        const StreamRecord& rec = pEntry->streams[i];
+
+        if (rec.nExtradata > 0)
+        {
+            uint8_t* pData = static_cast<uint8_t*>(av_mallocz(rec.nExtradata + AV_INPUT_BUFFER_PADDING_SIZE));
+            if (!pData)
+                return AVERROR(ENOMEM);
+            memcpy(pData, pExtradata, rec.nExtradata);
+            av_freep(&par->extradata);
+            par->extradata = pData;
+            par->extradata_size = static_cast<int>(rec.nExtradata);
+            pExtradata += rec.nExtradata;
+        }
+
+        par->codec_id               = static_cast<enum AVCodecID>(rec.codecId);
+        par->codec_tag              = rec.codecTag;
+        par->format                 = rec.format;
+        par->bit_rate               = rec.bitRate;
+        par->bits_per_coded_sample  = rec.bitsPerCodedSample;
+        par->bits_per_raw_sample    = rec.bitsPerRawSample;
+        par->profile                = rec.profile;
+        par->level                  = rec.level;
+        par->width                  = rec.width;
+        par->height                 = rec.height;
+        par->sample_aspect_ratio    = av_make_q(rec.sarNum, rec.sarDen);
+        par->field_order            = static_cast<enum AVFieldOrder>(rec.fieldOrder);
+        par->color_range            = static_cast<enum AVColorRange>(rec.colorRange);
+        par->color_primaries        = static_cast<enum AVColorPrimaries>(rec.colorPrimaries);
+        par->color_trc              = static_cast<enum AVColorTransferCharacteristic>(rec.colorTrc);
+        par->color_space            = static_cast<enum AVColorSpace>(rec.colorSpace);
+        par->chroma_location        = static_cast<enum AVChromaLocation>(rec.chromaLocation);
+        par->video_delay            = rec.videoDelay;
+        par->sample_rate            = rec.sampleRate;
+        par->frame_size             = rec.frameSize;
+        par->initial_padding        = rec.initialPadding;
+        par->block_align            = rec.blockAlign;
+
+        av_channel_layout_uninit(&par->ch_layout);
+        if (rec.channelOrder == AV_CHANNEL_ORDER_NATIVE)
+            av_channel_layout_from_mask(&par->ch_layout, rec.channelMask);
+        else if (rec.nbChannels > 0)
+        {
+            par->ch_layout.order = AV_CHANNEL_ORDER_UNSPEC;
+            par->ch_layout.nb_channels = rec.nbChannels;
+        }
+
+        st->time_base       = av_make_q(rec.timeBaseNum, rec.timeBaseDen);
+        st->avg_frame_rate  = av_make_q(rec.avgRateNum, rec.avgRateDen);
+        st->r_frame_rate    = av_make_q(rec.realRateNum, rec.realRateDen);
+        st->start_time      = rec.startTime;
+        st->duration        = rec.duration;
+        st->nb_frames       = rec.nbFrames;
+        st->disposition     = rec.disposition;
+    }
+    pFormatContext->start_time  = pEntry->startTime;
+    pFormatContext->duration    = pEntry->duration;
+    pFormatContext->bit_rate    = pEntry->bitRate;
+
+    pEntry->nLastUsed = ++m_nClock;
+    m_stats.nHits++;
+    m_stats.dSavedSeconds += std::max(0.0, pEntry->dProbeSeconds - ElapsedSeconds(tStart, BenchClock::now()));
+    return 1;
+}
+
+void ProbeCache::Store(const std::string& strUrl, const AVFormatContext* pFormatContext, double dProbeSeconds)
+{
+    Entry entry;
+    if ((pFormatContext->ctx_flags & AVFMTCTX_NOHEADER) || StatSource(strUrl, &entry.nSize, &entry.nMtime) < 0)
+        return;
+
+    entry.strPath       = strUrl;
+    entry.dProbeSeconds = dProbeSeconds;
+    entry.startTime     = pFormatContext->start_time;
+    entry.duration      = pFormatContext->duration;
+    entry.bitRate       = pFormatContext->bit_rate;
+
+    for (unsigned int i = 0; i < pFormatContext->nb_streams; i++)
+    {
+        const AVStream* st = pFormatContext->streams[i];
+        const AVCodecParameters* par = st->codecpar;
+
+        // Custom channel maps do not fit the record; probe those files.
+        if (par->ch_layout.order == AV_CHANNEL_ORDER_CUSTOM || par->ch_layout.order == AV_CHANNEL_ORDER_AMBISONIC)
+            return;
+
+        StreamRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.codecType           = par->codec_type;
+        rec.codecId             = par->codec_id;
+        rec.codecTag            = par->codec_tag;
+        rec.format              = par->format;
+        rec.bitRate             = par->bit_rate;
+        rec.bitsPerCodedSample  = par->bits_per_coded_sample;
+        rec.bitsPerRawSample    = par->bits_per_raw_sample;
+        rec.profile             = par->profile;
+        rec.level               = par->level;
+        rec.width               = par->width;
+        rec.height              = par->height;
+        rec.sarNum              = par->sample_aspect_ratio.num;
+        rec.sarDen              = par->sample_aspect_ratio.den;
+        rec.fieldOrder          = par->field_order;
+        rec.colorRange          = par->color_range;
+        rec.colorPrimaries      = par->color_primaries;
+        rec.colorTrc            = par->color_trc;
+        rec.colorSpace          = par->color_space;
+        rec.chromaLocation      = par->chroma_location;
+        rec.videoDelay          = par->video_delay;
+        rec.sampleRate          = par->sample_rate;
+        rec.channelOrder        = par->ch_layout.order;
+        rec.nbChannels          = par->ch_layout.nb_channels;
+        rec.channelMask         = par->ch_layout.order == AV_CHANNEL_ORDER_NATIVE ? par->ch_layout.u.mask : 0;
+        rec.frameSize           = par->frame_size;
+        rec.initialPadding      = par->initial_padding;
+        rec.blockAlign          = par->block_align;
+        rec.timeBaseNum         = st->time_base.num;
+        rec.timeBaseDen         = st->time_base.den;
+        rec.avgRateNum          = st->avg_frame_rate.num;
+        rec.avgRateDen          = st->avg_frame_rate.den;
+        rec.realRateNum         = st->r_frame_rate.num;
+        rec.realRateDen         = st->r_frame_rate.den;
+        rec.startTime           = st->start_time;
+        rec.duration            = st->duration;
+        rec.nbFrames            = st->nb_frames;
+        rec.disposition         = st->disposition;
+        rec.nExtradata          = par->extradata_size > 0 ? static_cast<uint32_t>(par->extradata_size) : 0;
+        entry.streams.push_back(rec);
+        entry.extradata.insert(entry.extradata.end(), par->extradata, par->extradata + rec.nExtradata);
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_stats.dProbeSeconds += dProbeSeconds;
+
+    entry.nLastUsed = ++m_nClock;
+    if (Entry* pOld = Find(strUrl))
+    {
+        m_nBytes -= pOld->Bytes();
+        *pOld = std::move(entry);
+        m_nBytes += pOld->Bytes();
+    }
+    else
+    {
+        m_nBytes += entry.Bytes();
+        m_entries.push_back(std::move(entry));
+    }
+    Evict();
+}
+
+int ProbeCache::Save(const std::string& strPath) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    const std::string strTemp = strPath + ".tmp";
+    FILE* fp = fopen(strTemp.c_str(), "wb");
+    if (!fp)
+        return AVERROR(errno);
+
+    ProbeCacheFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.nVersion = kVersion;
+    header.nEntries = m_entries.size();
+    header.nClock = m_nClock;
+
+    bool bOk = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (size_t i = 0; bOk && i < m_entries.size(); i++)
+    {
+        const Entry& entry = m_entries[i];
+        ProbeCacheEntryHeader eh;
+        memset(&eh, 0, sizeof(eh));
+        eh.nPath            = static_cast<uint32_t>(entry.strPath.size());
+        eh.nStreams         = static_cast<uint32_t>(entry.streams.size());
+        eh.nExtradata       = entry.extradata.size();
+        eh.nSize            = entry.nSize;
+        eh.nMtime           = entry.nMtime;
+        eh.nLastUsed        = entry.nLastUsed;
+        eh.dProbeSeconds    = entry.dProbeSeconds;
+        eh.startTime        = entry.startTime;
+        eh.duration         = entry.duration;
+        eh.bitRate          = entry.bitRate;
+
+        bOk = fwrite(&eh, sizeof(eh), 1, fp) == 1 &&
+              fwrite(entry.strPath.data(), 1, eh.nPath, fp) == eh.nPath &&
+              (eh.nStreams == 0 || fwrite(entry.streams.data(), sizeof(StreamRecord), eh.nStreams, fp) == eh.nStreams) &&
+              (eh.nExtradata == 0 || fwrite(entry.extradata.data(), 1, eh.nExtradata, fp) == eh.nExtradata);
+    }
+    bOk = fclose(fp) == 0 && bOk;
+    if (!bOk)
+    {
+        remove(strTemp.c_str());
+        return AVERROR(EIO);
+    }
+
+#ifdef _WIN32
+    remove(strPath.c_str());
+#endif
+    if (rename(strTemp.c_str(), strPath.c_str()) != 0)
+    {
+        int ret = AVERROR(errno);
+        remove(strTemp.c_str());
+        return ret;
+    }
+    return 0;
+}
+
+int ProbeCache::Load(const std::string& strPath)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_entries.clear();
+    m_nBytes = 0;
+    m_nClock = 0;
+
+    FILE* fp = fopen(strPath.c_str(), "rb");
+    if (!fp)
+        return AVERROR(errno);
+
+    // Sanity limits against corrupt counts.
+    const uint32_t nMaxPath = 1 << 16;
+    const uint32_t nMaxStreams = 1 << 12;
+    const uint64_t nMaxExtradata = 1 << 26;
+
+    ProbeCacheFileHeader header;
+    bool bOk = fread(&header, sizeof(header), 1, fp) == 1 &&
+               memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 && header.nVersion == kVersion;
+    for (uint64_t i = 0; bOk && i < header.nEntries; i++)
+    {
+        ProbeCacheEntryHeader eh;
+        if (fread(&eh, sizeof(eh), 1, fp) != 1 ||
+            eh.nPath > nMaxPath || eh.nStreams > nMaxStreams || eh.nExtradata > nMaxExtradata)
+        {
+            bOk = false;
+            break;
+        }
+
+        Entry entry;
+        entry.strPath.resize(eh.nPath);
+        entry.streams.resize(eh.nStreams);
+        entry.extradata.resize(eh.nExtradata);
+        bOk = fread(&entry.strPath[0], 1, eh.nPath, fp) == eh.nPath &&
+              (eh.nStreams == 0 || fread(entry.streams.data(), sizeof(StreamRecord), eh.nStreams, fp) == eh.nStreams) &&
+              (eh.nExtradata == 0 || fread(entry.extradata.data(), 1, eh.nExtradata, fp) == eh.nExtradata);
+
+        uint64_t nExtradata = 0;
+        for (const StreamRecord& rec : entry.streams)
+            nExtradata += rec.nExtradata;
+        bOk = bOk && nExtradata == eh.nExtradata;
+        if (!bOk)
+            break;
+
+        entry.nSize         = eh.nSize;
+        entry.nMtime        = eh.nMtime;
+        entry.nLastUsed     = eh.nLastUsed;
+        entry.dProbeSeconds = eh.dProbeSeconds;
+        entry.startTime     = eh.startTime;
+        entry.duration      = eh.duration;
+        entry.bitRate       = eh.bitRate;
+        m_nBytes += entry.Bytes();
+        m_entries.push_back(std::move(entry));
+    }
+    fclose(fp);
+
+    if (!bOk)
+    {
+        m_entries.clear();
+        m_nBytes = 0;
+        return AVERROR_INVALIDDATA;
+    }
+
+    m_nClock = header.nClock;
+    // The limits may be smaller than when the file was written.
+    Evict();
+    return 0;
+}
+
+size_t ProbeCache::Size() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_entries.size();
+}
+
+int64_t ProbeCache::Bytes() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_nBytes;
+}
+
+ProbeCacheStats ProbeCache::Stats() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_stats;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+struct ProbeCacheStats
+{
+    uint64_t    nHits           = 0;
+    uint64_t    nMisses         = 0;
+    uint64_t    nStale          = 0;    // misses because size or mtime changed
+    uint64_t    nRejected       = 0;    // entries that disagreed with the header
+    uint64_t    nUncacheable    = 0;    // not a local file, or streams come later
+    uint64_t    nEvictions      = 0;
+    double      dProbeSeconds   = 0.0;  // in avformat_find_stream_info on misses
+    double      dSavedSeconds   = 0.0;  // recorded probe time of hits, less applying them
+};
+
+// What avformat_find_stream_info found out about a file: codec parameters
+// including extradata, timing and layout of every stream. Keyed by path,
+// size and mtime, bounded by entry count and bytes with least recently used
+// eviction, and persisted to one file. Thread-safe.
+//
+// Only containers that declare all their streams in the header are cached;
+// for those a hit fills in the streams and the probe is skipped.
+class ProbeCache
+{
+public:
+    explicit ProbeCache(size_t nMaxEntries = 1024, int64_t nMaxBytes = 16LL << 20);
+
+    ProbeCache(const ProbeCache&) = delete;
+    ProbeCache& operator=(const ProbeCache&) = delete;
+
+    // Returns AVERROR(ENOENT) when there is no cache file yet and
+    // AVERROR_INVALIDDATA for foreign or corrupt ones, leaving it empty.
+    int         Load(const std::string& strPath);
+    int         Save(const std::string& strPath) const;
+
+    // After avformat_open_input: on a hit, fills pFormatContext's streams and
+    // returns 1, so avformat_find_stream_info can be skipped. 0 on a miss.
+    int         Apply(const std::string& strUrl, AVFormatContext* pFormatContext);
+    // After avformat_find_stream_info took dProbeSeconds on a miss.
+    void        Store(const std::string& strUrl, const AVFormatContext* pFormatContext, double dProbeSeconds);
+
+    size_t          Size() const;
+    int64_t         Bytes() const;
+    ProbeCacheStats Stats() const;
+
+private:
+    // Host byte order, like the keyframe index sidecar.
+    struct StreamRecord
+    {
+        int32_t     codecType;
+        int32_t     codecId;
+        uint32_t    codecTag;
+        int32_t     format;
+        int64_t     bitRate;
+        int32_t     bitsPerCodedSample;
+        int32_t     bitsPerRawSample;
+        int32_t     profile;
+        int32_t     level;
+        int32_t     width;
+        int32_t     height;
+        int32_t     sarNum;
+        int32_t     sarDen;
+        int32_t     fieldOrder;
+        int32_t     colorRange;
+        int32_t     colorPrimaries;
+        int32_t     colorTrc;
+        int32_t     colorSpace;
+        int32_t     chromaLocation;
+        int32_t     videoDelay;
+        int32_t     sampleRate;
+        int32_t     channelOrder;
+        int32_t     nbChannels;
+        int32_t     frameSize;
+        uint64_t    channelMask;
+        int32_t     initialPadding;
+        int32_t     blockAlign;
+        int32_t     timeBaseNum;
+        int32_t     timeBaseDen;
+        int32_t     avgRateNum;
+        int32_t     avgRateDen;
+        int32_t     realRateNum;
+        int32_t     realRateDen;
+        int64_t     startTime;
+        int64_t     duration;
+        int64_t     nbFrames;
+        int32_t     disposition;
+        uint32_t    nExtradata;
+    };
+
+    struct Entry
+    {
+        std::string                 strPath;
+        int64_t                     nSize           = 0;
+        int64_t                     nMtime          = 0;
+        uint64_t                    nLastUsed       = 0;
+        double                      dProbeSeconds   = 0.0;
+        int64_t                     startTime       = 0;
+        int64_t                     duration        = 0;
+        int64_t                     bitRate         = 0;
+        std::vector<StreamRecord>   streams;
+        std::vector<uint8_t>        extradata;      // every stream's, back to back
+
+        int64_t     Bytes() const;
+    };
+
+    Entry*      Find(const std::string& strPath);
+    void        Evict();
+
+    const size_t            m_nMaxEntries;
+    const int64_t           m_nMaxBytes;
+    mutable std::mutex      m_lock;
+    std::vector<Entry>      m_entries;
+    int64_t                 m_nBytes    = 0;
+    uint64_t                m_nClock    = 0;
+    ProbeCacheStats         m_stats;
+};
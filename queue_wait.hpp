@@ -0,0 +1,22 @@
+#pragma once
+
+// Shared by the lock-free queues (PacketQueue, FrameQueue): how a full or
+// empty side waits, and how long it waited.
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+// Yields for the first spins, then sleeps so a long stall does not burn a core.
+inline void QueueBackoff(unsigned& nSpins)
+{
+    if (nSpins++ < 64)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+inline int64_t NanosecondsSince(std::chrono::steady_clock::time_point tStart)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tStart).count();
+}
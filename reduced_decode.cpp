@@ -0,0 +1,133 @@
+#include "reduced_decode.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+ReducedDecode ChooseReducedDecode(const AVCodec* pCodec, int nWidth, int nHeight, AVRational sar,
+                                  int nViewWidth, int nViewHeight, bool bHardware)
+{
+    ReducedDecode reduced;
+    if (nWidth <= 0 || nHeight <= 0 || nViewWidth <= 0 || nViewHeight <= 0)
+        return reduced;
+
+    // Fit the display size, not the coded one, into the viewport.
+    double dDisplayWidth = nWidth;
+    if (sar.num > 0 && sar.den > 0)
+        dDisplayWidth = nWidth * av_q2d(sar);
+    const double dScale = std::min(1.0, std::min(nViewWidth / dDisplayWidth, nViewHeight / double(nHeight)));
+    reduced.nOutputWidth = std::max(2, static_cast<int>(dDisplayWidth * dScale) & ~1);
+    reduced.nOutputHeight = std::max(2, static_cast<int>(nHeight * dScale) & ~1);
+
+    reduced.bActive = reduced.nOutputWidth * 2 <= nWidth && reduced.nOutputHeight * 2 <= nHeight;
+    if (!reduced.bActive)
+        return reduced;
+
+    if (!bHardware)
+    {
+        const int nMaxLowres = pCodec ? pCodec->max_lowres : 0;
+        while (reduced.nLowres < nMaxLowres &&
+               AV_CEIL_RSHIFT(nWidth, reduced.nLowres + 1) >= reduced.nOutputWidth &&
+               AV_CEIL_RSHIFT(nHeight, reduced.nLowres + 1) >= reduced.nOutputHeight)
+            reduced.nLowres++;
+        // Non-reference frames are not predicted from, so skipping their
+        // deblocking does not spread, and the downscale hides most of it.
+        reduced.bSkipLoopFilter = true;
+    }
+
+    reduced.bEarlyDownscale = AV_CEIL_RSHIFT(nWidth, reduced.nLowres) > reduced.nOutputWidth ||
+                              AV_CEIL_RSHIFT(nHeight, reduced.nLowres) > reduced.nOutputHeight;
+    return reduced;
+}
+
+void ApplyReducedDecode(AVCodecContext* avctx, const ReducedDecode& reduced)
+{
+    if (!reduced.bActive)
+        return;
+    avctx->lowres = reduced.nLowres;
+    if (reduced.bSkipLoopFilter)
+        avctx->skip_loop_filter = AVDISCARD_NONREF;
+}
+
+std::string ReducedDecodeToString(const ReducedDecode& reduced)
+{
+    char szText[128];
+    if (!reduced.bActive)
+    {
+        snprintf(szText, sizeof(szText), "off (output %dx%d)", reduced.nOutputWidth, reduced.nOutputHeight);
+        return szText;
+    }
+    snprintf(szText, sizeof(szText), "lowres %d, loop filter %s, %s downscale to %dx%d", reduced.nLowres,
+             reduced.bSkipLoopFilter ? "skipped on non-ref" : "on", reduced.bEarlyDownscale ? "early" : "no",
+             reduced.nOutputWidth, reduced.nOutputHeight);
+    return szText;
+}
+
+FrameDownscaler::~FrameDownscaler()
+{
+    sws_freeContext(m_pContext);
+    av_frame_free(&m_pOut);
+}
+
+int FrameDownscaler::Init(int nWidth, int nHeight, int nFlags)
+{
+    av_frame_free(&m_pOut);
+    if (!(m_pOut = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    m_pOut->width = nWidth;
+    m_pOut->height = nHeight;
+    m_pOut->format = AV_PIX_FMT_YUV420P;
+    m_nFlags = nFlags;
+    return av_frame_get_buffer(m_pOut, 0);
+}
+
+int FrameDownscaler::Scale(const AVFrame* frame, const AVFrame** ppOut)
+{
+    if (!m_pOut)
+        return AVERROR(EINVAL);
+
+    int ret = av_frame_make_writable(m_pOut);
+    if (ret < 0)
+        return ret;
+
+    m_pContext = sws_getCachedContext(m_pContext, frame->width, frame->height,
+                                      static_cast<AVPixelFormat>(frame->format), m_pOut->width, m_pOut->height,
+                                      AV_PIX_FMT_YUV420P, m_nFlags, nullptr, nullptr, nullptr);
+    if (!m_pContext)
+        return AVERROR(EINVAL);
+
+    sws_scale(m_pContext, frame->data, frame->linesize, 0, frame->height, m_pOut->data, m_pOut->linesize);
+    m_pOut->pts = frame->pts;
+    m_pOut->best_effort_timestamp = frame->best_effort_timestamp;
+    *ppOut = m_pOut;
+    return 0;
+}
+
+int ComputePsnr(const AVFrame* a, const AVFrame* b, double* pdPsnr)
+{
+    if (a->format != AV_PIX_FMT_YUV420P || b->format != AV_PIX_FMT_YUV420P ||
+        a->width != b->width || a->height != b->height)
+        return AVERROR(EINVAL);
+
+    uint64_t nSquares = 0;
+    uint64_t nSamples = 0;
+    for (int iPlane = 0; iPlane < 3; iPlane++)
+    {
+        const int w = iPlane ? AV_CEIL_RSHIFT(a->width, 1) : a->width;
+        const int h = iPlane ? AV_CEIL_RSHIFT(a->height, 1) : a->height;
+        for (int y = 0; y < h; y++)
+        {
+            const uint8_t* pA = a->data[iPlane] + y * a->linesize[iPlane];
+            const uint8_t* pB = b->data[iPlane] + y * b->linesize[iPlane];
+            for (int x = 0; x < w; x++)
+            {
+                const int d = pA[x] - pB[x];
+                nSquares += d * d;
+            }
+        }
+        nSamples += static_cast<uint64_t>(w) * h;
+    }
+
+    *pdPsnr = nSquares ? std::min(100.0, 10.0 * std::log10(255.0 * 255.0 * nSamples / nSquares)) : 100.0;
+    return 0;
+}
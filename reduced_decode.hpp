@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+// Cheaper decode paths for a viewport well below the source size.
+struct ReducedDecode
+{
+    bool        bActive         = false;    // viewport at most a quarter of the source area
+    int         nLowres         = 0;        // decoder outputs 1/2^n of the coded size
+    bool        bSkipLoopFilter = false;    // no deblocking on non-reference frames
+    bool        bEarlyDownscale = false;    // scale to the output size straight after decode
+    int         nOutputWidth    = 0;        // source fitted in the viewport, aspect kept
+    int         nOutputHeight   = 0;
+};
+
+// Picks the paths for showing a nWidth x nHeight stream (sample aspect sar)
+// in a nViewWidth x nViewHeight viewport. lowres is limited to what pCodec
+// supports and to levels that still cover the output size; hardware decoders
+// take neither lowres nor skip_loop_filter, so bHardware leaves only the
+// early downscale.
+ReducedDecode   ChooseReducedDecode(const AVCodec* pCodec, int nWidth, int nHeight, AVRational sar,
+                                    int nViewWidth, int nViewHeight, bool bHardware);
+// Before avcodec_open2.
+void            ApplyReducedDecode(AVCodecContext* avctx, const ReducedDecode& reduced);
+std::string     ReducedDecodeToString(const ReducedDecode& reduced);
+
+// sws_scale into a YUV420P frame of a fixed size, reused across calls.
+class FrameDownscaler
+{
+public:
+    FrameDownscaler() = default;
+    ~FrameDownscaler();
+
+    FrameDownscaler(const FrameDownscaler&) = delete;
+    FrameDownscaler& operator=(const FrameDownscaler&) = delete;
+
+    int             Init(int nWidth, int nHeight, int nFlags = SWS_AREA);
+    // *ppOut stays valid until the next call; frames cloned from it are
+    // left alone, the next call writes to fresh planes.
+    int             Scale(const AVFrame* frame, const AVFrame** ppOut);
+
+private:
+    SwsContext*     m_pContext  = nullptr;
+    AVFrame*        m_pOut      = nullptr;
+    int             m_nFlags    = 0;
+};
+
+// PSNR in dB over all three planes of two YUV420P frames of the same size,
+// 100 for identical frames.
+int             ComputePsnr(const AVFrame* a, const AVFrame* b, double* pdPsnr);
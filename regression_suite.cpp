@@ -0,0 +1,535 @@
+#include "synthetic_clip.hpp"
+#include "bench_stats.hpp"
+#include "decoder.hpp"
+#include "frame_sink.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+extern "C"
+{
+#include <libavutil/adler32.h>
+}
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s --dir DIR [--golden PATH] [--regenerate] [--update-golden] [--allow-missing-golden]\n"
+            "                [--baseline-out PATH] [--compare PATH] [--max-fps-drop PCT] [--max-p99-rise PCT]\n"
+            "                [--runs N] [--only NAME] [--lossless] [--max-height N] [--threads MODE[:N]]\n"
+            "  --dir            where the clips live; clips missing from it are generated\n"
+            "  --golden         golden hashes to check against (default DIR/golden.txt)\n"
+            "  --regenerate     encode every clip again, even those already there\n"
+            "  --update-golden  record the frame hashes of this run as the golden ones\n"
+            "  --allow-missing-golden\n"
+            "                   report a clip without golden hashes, or with stale ones, but do not fail\n"
+            "  --baseline-out   write frames/s and latency of this run to PATH\n"
+            "  --compare        fail when a clip is slower than the baseline in PATH\n"
+            "  --max-fps-drop   frames/s drop that counts as a regression (default 10)\n"
+            "  --max-p99-rise   p99 latency rise that counts as a regression (default 20)\n"
+            "  --runs           decodes per clip; best frames/s and lowest p99 are kept (default 3)\n"
+            "  --only           run just this clip (repeatable)\n"
+            "  --lossless       run just the losslessly encoded clips, whose hashes hold for any encoder build\n"
+            "  --max-height     skip clips taller than N lines\n"
+            "  --threads        decoder threading (default: the decoder's default)\n",
+            argv0);
+}
+
+struct GoldenEntry
+{
+    uint32_t                nFileSum    = 0;
+    std::vector<uint32_t>   frameSums;
+};
+
+struct BaselineEntry
+{
+    int64_t     nFrames     = 0;
+    double      dFps        = 0.0;
+    double      dP50Ms      = 0.0;
+    double      dP99Ms      = 0.0;
+};
+
+struct ClipRun
+{
+    std::vector<uint32_t>   frameSums;
+    std::vector<double>     latencies;
+    double                  dElapsed    = 0.0;
+};
+
+static void SkipLine(FILE* fp)
+{
+    int c;
+    while ((c = fgetc(fp)) != EOF && c != '\n')
+        ;
+}
+
+// Lines of "clip file_adler32 frames frame_adler32...", all in hex but the
+// frame count; '#' starts a comment line. The file checksum is 0 for
+// lossless clips.
+static int LoadGolden(const std::string& strPath, std::map<std::string, GoldenEntry>* pGolden)
+{
+    FILE* fp = fopen(strPath.c_str(), "r");
+    if (!fp)
+        return AVERROR(errno);
+
+    char szName[256];
+    int ret = 0;
+    while (ret >= 0 && fscanf(fp, " %255s", szName) == 1)
+    {
+        if (szName[0] == '#')
+        {
+            SkipLine(fp);
+            continue;
+        }
+        GoldenEntry entry;
+        long long nFrames = 0;
+        if (fscanf(fp, "%x %lld", &entry.nFileSum, &nFrames) != 2 || nFrames < 0)
+            ret = AVERROR_INVALIDDATA;
+        for (long long i = 0; ret >= 0 && i < nFrames; i++)
+        {
+            uint32_t sum = 0;
+            if (fscanf(fp, "%x", &sum) != 1)
+                ret = AVERROR_INVALIDDATA;
+            entry.frameSums.push_back(sum);
+        }
+        (*pGolden)[szName] = std::move(entry);
+    }
+    fclose(fp);
+    return ret;
+}
+
+static int SaveGolden(const std::string& strPath, const std::map<std::string, GoldenEntry>& golden)
+{
+    const std::string strTemp = strPath + ".tmp";
+    FILE* fp = fopen(strTemp.c_str(), "w");
+    if (!fp)
+        return AVERROR(errno);
+
+    const unsigned nVersion = avcodec_version();
+    fprintf(fp, "# regression_suite golden hashes, libavcodec %u.%u.%u\n", nVersion >> 16, (nVersion >> 8) & 0xff,
+            nVersion & 0xff);
+    fprintf(fp, "# clip file_adler32 frames frame_adler32...\n");
+    for (const auto& it : golden)
+    {
+        fprintf(fp, "%s %08x %zu", it.first.c_str(), it.second.nFileSum, it.second.frameSums.size());
+        for (uint32_t sum : it.second.frameSums)
+            fprintf(fp, " %08x", sum);
+        fprintf(fp, "\n");
+    }
+
+    bool bOk = !ferror(fp);
+    if (fclose(fp) != 0)
+        bOk = false;
+    if (!bOk || rename(strTemp.c_str(), strPath.c_str()) != 0)
+    {
+        remove(strTemp.c_str());
+        return AVERROR(EIO);
+    }
+    return 0;
+}
+
+static int LoadBaseline(const std::string& strPath, std::map<std::string, BaselineEntry>* pBaseline)
+{
+    FILE* fp = fopen(strPath.c_str(), "r");
+    if (!fp)
+        return AVERROR(errno);
+
+    char szName[256];
+    int ret = 0;
+    while (ret >= 0 && fscanf(fp, " %255s", szName) == 1)
+    {
+        if (szName[0] == '#')
+        {
+            SkipLine(fp);
+            continue;
+        }
+        BaselineEntry entry;
+        long long nFrames = 0;
+        if (fscanf(fp, "%lld %lf %lf %lf", &nFrames, &entry.dFps, &entry.dP50Ms, &entry.dP99Ms) != 4)
+            ret = AVERROR_INVALIDDATA;
+        entry.nFrames = nFrames;
+        (*pBaseline)[szName] = entry;
+    }
+    fclose(fp);
+    return ret;
+}
+
+static int SaveBaseline(const std::string& strPath, const std::string& strThreads,
+                        const std::map<std::string, BaselineEntry>& baseline)
+{
+    FILE* fp = fopen(strPath.c_str(), "w");
+    if (!fp)
+        return AVERROR(errno);
+
+    fprintf(fp, "# regression_suite baseline, threads %s\n", strThreads.c_str());
+    fprintf(fp, "# clip frames fps p50_ms p99_ms\n");
+    for (const auto& it : baseline)
+    {
+        fprintf(fp, "%s %lld %.2f %.4f %.4f\n", it.first.c_str(), (long long)it.second.nFrames, it.second.dFps,
+                it.second.dP50Ms, it.second.dP99Ms);
+    }
+
+    bool bOk = !ferror(fp);
+    if (fclose(fp) != 0)
+        bOk = false;
+    return bOk ? 0 : AVERROR(EIO);
+}
+
+// Identifies the clip the golden hashes were taken from: a clip encoded
+// again by a different encoder build decodes to different frames.
+static int FileSum(const std::string& strPath, uint32_t* pnSum)
+{
+    FILE* fp = fopen(strPath.c_str(), "rb");
+    if (!fp)
+        return AVERROR(errno);
+
+    AVAdler sum = 1;
+    uint8_t buffer[1 << 16];
+    size_t nRead;
+    while ((nRead = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+        sum = av_adler32_update(sum, buffer, nRead);
+    int ret = ferror(fp) ? AVERROR(EIO) : 0;
+    fclose(fp);
+    *pnSum = sum;
+    return ret;
+}
+
+static int DecodeClip(const std::string& strPath, const DecoderOptions& options, ClipRun* pRun)
+{
+    VideoStream stream;
+    int ret = OpenStream(strPath, &stream, options);
+    if (ret < 0)
+        return ret;
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+    {
+        CloseStream(&stream);
+        return AVERROR(ENOMEM);
+    }
+
+    // Latency is measured as in decode_bench: decode time is charged to the
+    // next frame out. Hashing is excluded from it but not from frames/s.
+    ChecksumSink sink;
+    double dPending = 0.0;
+    BenchClock::time_point tSegment;
+    FrameCallback onFrame = [&](AVCodecContext* avctx, AVFrame* frame)
+    {
+        pRun->latencies.push_back(dPending + ElapsedSeconds(tSegment, BenchClock::now()));
+        dPending = 0.0;
+        int err = sink.Write(avctx, frame);
+        tSegment = BenchClock::now();
+        return err;
+    };
+
+    BenchClock::time_point tStart = BenchClock::now();
+    while ((ret = av_read_frame(stream.pFormatContext, pPacket)) >= 0)
+    {
+        if (pPacket->stream_index == stream.iVideo)
+        {
+            tSegment = BenchClock::now();
+            ret = DecodeFrame(stream.pCodecCtx, pPacket, onFrame, nullptr, stream.pBackend.get());
+            dPending += ElapsedSeconds(tSegment, BenchClock::now());
+        }
+        av_packet_unref(pPacket);
+        if (ret < 0)
+            break;
+    }
+    if (ret == AVERROR_EOF)
+    {
+        tSegment = BenchClock::now();
+        ret = DecodeFrame(stream.pCodecCtx, NULL, onFrame, nullptr, stream.pBackend.get());
+    }
+    pRun->dElapsed = ElapsedSeconds(tStart, BenchClock::now());
+    pRun->frameSums = sink.FrameSums();
+
+    av_packet_free(&pPacket);
+    CloseStream(&stream);
+    return (ret < 0 && ret != AVERROR_EOF) ? ret : 0;
+}
+
+static bool FileExists(const std::string& strPath)
+{
+    struct stat st;
+    return stat(strPath.c_str(), &st) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strDir;
+    std::string strGoldenPath;
+    bool bRegenerate = false;
+    bool bUpdateGolden = false;
+    bool bAllowMissingGolden = false;
+    std::string strBaselineOut;
+    std::string strCompare;
+    double dMaxFpsDrop = 10.0;
+    double dMaxP99Rise = 20.0;
+    int nRuns = 3;
+    std::vector<std::string> only;
+    bool bLosslessOnly = false;
+    int nMaxHeight = 0;
+    std::string strThreads = "default";
+    DecoderOptions options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+            strDir = argv[++i];
+        else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc)
+            strGoldenPath = argv[++i];
+        else if (strcmp(argv[i], "--regenerate") == 0)
+            bRegenerate = true;
+        else if (strcmp(argv[i], "--update-golden") == 0)
+            bUpdateGolden = true;
+        else if (strcmp(argv[i], "--allow-missing-golden") == 0)
+            bAllowMissingGolden = true;
+        else if (strcmp(argv[i], "--baseline-out") == 0 && i + 1 < argc)
+            strBaselineOut = argv[++i];
+        else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+            strCompare = argv[++i];
+        else if (strcmp(argv[i], "--max-fps-drop") == 0 && i + 1 < argc)
+            dMaxFpsDrop = atof(argv[++i]);
+        else if (strcmp(argv[i], "--max-p99-rise") == 0 && i + 1 < argc)
+            dMaxP99Rise = atof(argv[++i]);
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+            nRuns = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc)
+            only.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--lossless") == 0)
+            bLosslessOnly = true;
+        else if (strcmp(argv[i], "--max-height") == 0 && i + 1 < argc)
+            nMaxHeight = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            strThreads = argv[++i];
+            if (ParseThreadingConfig(strThreads, &options.threading) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (strDir.empty() || nRuns < 1)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    if (!FileExists(strDir))
+    {
+        fprintf(stderr, "%s does not exist\n", strDir.c_str());
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    if (strGoldenPath.empty())
+        strGoldenPath = strDir + "/golden.txt";
+    std::map<std::string, GoldenEntry> golden;
+    int ret = LoadGolden(strGoldenPath, &golden);
+    if (ret < 0 && ret != AVERROR(ENOENT))
+    {
+        fprintf(stderr, "%s: %s\n", strGoldenPath.c_str(), av_err2str(ret));
+        return 1;
+    }
+
+    std::map<std::string, BaselineEntry> reference;
+    if (!strCompare.empty() && (ret = LoadBaseline(strCompare, &reference)) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", strCompare.c_str(), av_err2str(ret));
+        return 1;
+    }
+
+    std::map<std::string, BaselineEntry> results;
+    int nFailures = 0;
+    int nSkipped = 0;
+
+    printf("%-22s %9s %6s %9s %8s %8s  %s\n", "clip", "size", "frames", "frames/s", "p50 ms", "p99 ms", "hashes");
+    for (const SyntheticClipSpec& spec : DefaultRegressionClips())
+    {
+        if (!only.empty() && std::find(only.begin(), only.end(), spec.strName) == only.end())
+            continue;
+        if (nMaxHeight > 0 && spec.nHeight > nMaxHeight)
+            continue;
+        if (bLosslessOnly && !spec.bLossless)
+            continue;
+
+        const std::string strPath = strDir + "/" + spec.strName + "." + spec.strExtension;
+        if (bRegenerate || !FileExists(strPath))
+        {
+            if ((ret = GenerateSyntheticClip(spec, strPath)) < 0)
+            {
+                // A build without the encoder can't make the clip; that
+                // is not a regression in the decoder.
+                if (ret == AVERROR_ENCODER_NOT_FOUND)
+                {
+                    printf("%-22s skipped, no %s encoder\n", spec.strName.c_str(), spec.strEncoder.c_str());
+                    nSkipped++;
+                    continue;
+                }
+                printf("%-22s FAILED to generate: %s\n", spec.strName.c_str(), av_err2str(ret));
+                nFailures++;
+                continue;
+            }
+        }
+
+        // Lossless clips decode to the test source whatever encoded them,
+        // so their golden hashes are not tied to the file.
+        GoldenEntry current;
+        if (!spec.bLossless && (ret = FileSum(strPath, &current.nFileSum)) < 0)
+        {
+            printf("%-22s FAILED to read: %s\n", spec.strName.c_str(), av_err2str(ret));
+            nFailures++;
+            continue;
+        }
+
+        // Best frames/s and lowest p99 over the runs: both only get worse
+        // from interference, never better.
+        BaselineEntry best;
+        bool bDeterministic = true;
+        for (int iRun = 0; iRun < nRuns && ret >= 0; iRun++)
+        {
+            ClipRun run;
+            if ((ret = DecodeClip(strPath, options, &run)) < 0)
+                break;
+            const double dFps = run.dElapsed > 0 ? run.frameSums.size() / run.dElapsed : 0.0;
+            const double dP99Ms = Percentile(run.latencies, 99) * 1e3;
+            if (iRun == 0)
+            {
+                current.frameSums = run.frameSums;
+                best.nFrames = static_cast<int64_t>(run.frameSums.size());
+                best.dP99Ms = dP99Ms;
+            }
+            else if (run.frameSums != current.frameSums)
+                bDeterministic = false;
+            if (dFps > best.dFps)
+            {
+                best.dFps = dFps;
+                best.dP50Ms = Percentile(run.latencies, 50) * 1e3;
+            }
+            best.dP99Ms = std::min(best.dP99Ms, dP99Ms);
+        }
+        if (ret < 0)
+        {
+            printf("%-22s FAILED to decode: %s\n", spec.strName.c_str(), av_err2str(ret));
+            nFailures++;
+            continue;
+        }
+
+        std::string strHashes;
+        auto itGolden = golden.find(spec.strName);
+        if (!bDeterministic)
+        {
+            strHashes = "MISMATCH between runs";
+            nFailures++;
+        }
+        else if (bUpdateGolden)
+        {
+            golden[spec.strName] = current;
+            strHashes = "updated";
+        }
+        else if (itGolden == golden.end() || itGolden->second.nFileSum != current.nFileSum)
+        {
+            // Nothing to compare with is not a pass: record the hashes
+            // with --update-golden, or say the run doesn't need them.
+            strHashes = itGolden == golden.end() ? "no golden" : "stale, clip was encoded again";
+            if (!bAllowMissingGolden)
+            {
+                strHashes = "FAILED, " + strHashes;
+                nFailures++;
+            }
+        }
+        else if (itGolden->second.frameSums.size() != current.frameSums.size())
+        {
+            char szMsg[96];
+            snprintf(szMsg, sizeof(szMsg), "MISMATCH, %zu frames, golden has %zu", current.frameSums.size(),
+                     itGolden->second.frameSums.size());
+            strHashes = szMsg;
+            nFailures++;
+        }
+        else
+        {
+            const std::vector<uint32_t>& expected = itGolden->second.frameSums;
+            size_t iFirst = 0;
+            size_t nBad = 0;
+            for (size_t i = 0; i < expected.size(); i++)
+            {
+                if (expected[i] != current.frameSums[i] && nBad++ == 0)
+                    iFirst = i;
+            }
+            if (nBad == 0)
+                strHashes = "ok";
+            else
+            {
+                char szMsg[96];
+                snprintf(szMsg, sizeof(szMsg), "MISMATCH, %zu frames from frame %zu", nBad, iFirst);
+                strHashes = szMsg;
+                nFailures++;
+            }
+        }
+
+        char szSize[32];
+        snprintf(szSize, sizeof(szSize), "%dx%d", spec.nWidth, spec.nHeight);
+        printf("%-22s %9s %6lld %9.1f %8.3f %8.3f  %s\n", spec.strName.c_str(), szSize, (long long)best.nFrames,
+               best.dFps, best.dP50Ms, best.dP99Ms, strHashes.c_str());
+        results[spec.strName] = best;
+    }
+
+    if (bUpdateGolden && (ret = SaveGolden(strGoldenPath, golden)) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", strGoldenPath.c_str(), av_err2str(ret));
+        nFailures++;
+    }
+    if (!strBaselineOut.empty() && (ret = SaveBaseline(strBaselineOut, strThreads, results)) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", strBaselineOut.c_str(), av_err2str(ret));
+        nFailures++;
+    }
+
+    if (!strCompare.empty())
+    {
+        printf("\n");
+        printf("%-22s %9s %9s %7s %8s %8s %7s  %s\n", "clip", "frames/s", "baseline", "change", "p99 ms",
+               "baseline", "change", "result");
+        for (const auto& it : results)
+        {
+            auto itRef = reference.find(it.first);
+            if (itRef == reference.end())
+            {
+                printf("%-22s not in the baseline\n", it.first.c_str());
+                continue;
+            }
+            const BaselineEntry& cur = it.second;
+            const BaselineEntry& ref = itRef->second;
+            const double dFpsChange = ref.dFps > 0 ? 100.0 * (cur.dFps - ref.dFps) / ref.dFps : 0.0;
+            const double dP99Change = ref.dP99Ms > 0 ? 100.0 * (cur.dP99Ms - ref.dP99Ms) / ref.dP99Ms : 0.0;
+            const char* pszResult = "ok";
+            if (-dFpsChange > dMaxFpsDrop && dP99Change > dMaxP99Rise)
+                pszResult = "REGRESSED, frames/s and p99";
+            else if (-dFpsChange > dMaxFpsDrop)
+                pszResult = "REGRESSED, frames/s";
+            else if (dP99Change > dMaxP99Rise)
+                pszResult = "REGRESSED, p99";
+            if (strcmp(pszResult, "ok") != 0)
+                nFailures++;
+            printf("%-22s %9.1f %9.1f %+6.1f%% %8.3f %8.3f %+6.1f%%  %s\n", it.first.c_str(), cur.dFps, ref.dFps,
+                   dFpsChange, cur.dP99Ms, ref.dP99Ms, dP99Change, pszResult);
+        }
+    }
+
+    printf("\n");
+    printf("clips:        %zu run, %d skipped, %d failures\n", results.size(), nSkipped, nFailures);
+    return nFailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,61 @@
+#include "sample_ring.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+extern "C"
+{
+#include <libavutil/avutil.h>
+}
+
+int SampleRing::Init(size_t nCapacityFrames, int nBytesPerFrame)
+{
+    if (nCapacityFrames == 0 || nBytesPerFrame <= 0)
+        return AVERROR(EINVAL);
+
+    m_buffer.assign(nCapacityFrames * nBytesPerFrame, 0);
+    m_nCapacity = nCapacityFrames;
+    m_nBytesPerFrame = nBytesPerFrame;
+    m_nWrite.store(0, std::memory_order_relaxed);
+    m_nRead.store(0, std::memory_order_relaxed);
+    m_bClosed.store(false, std::memory_order_relaxed);
+    return 0;
+}
+
+size_t SampleRing::Available() const
+{
+    return static_cast<size_t>(m_nWrite.load(std::memory_order_acquire) - m_nRead.load(std::memory_order_acquire));
+}
+
+size_t SampleRing::Write(const uint8_t* pData, size_t nFrames)
+{
+    const uint64_t nWrite = m_nWrite.load(std::memory_order_relaxed);
+    const uint64_t nRead = m_nRead.load(std::memory_order_acquire);
+    nFrames = std::min<size_t>(nFrames, m_nCapacity - static_cast<size_t>(nWrite - nRead));
+
+    // At most two copies: up to the end of the buffer, then from its start.
+    const size_t iStart = static_cast<size_t>(nWrite % m_nCapacity);
+    const size_t nFirst = std::min(nFrames, m_nCapacity - iStart);
+    memcpy(&m_buffer[iStart * m_nBytesPerFrame], pData, nFirst * m_nBytesPerFrame);
+    if (nFrames > nFirst)
+        memcpy(&m_buffer[0], pData + nFirst * m_nBytesPerFrame, (nFrames - nFirst) * m_nBytesPerFrame);
+
+    m_nWrite.store(nWrite + nFrames, std::memory_order_release);
+    return nFrames;
+}
+
+size_t SampleRing::Read(uint8_t* pData, size_t nFrames)
+{
+    const uint64_t nRead = m_nRead.load(std::memory_order_relaxed);
+    const uint64_t nWrite = m_nWrite.load(std::memory_order_acquire);
+    nFrames = std::min<size_t>(nFrames, static_cast<size_t>(nWrite - nRead));
+
+    const size_t iStart = static_cast<size_t>(nRead % m_nCapacity);
+    const size_t nFirst = std::min(nFrames, m_nCapacity - iStart);
+    memcpy(pData, &m_buffer[iStart * m_nBytesPerFrame], nFirst * m_nBytesPerFrame);
+    if (nFrames > nFirst)
+        memcpy(pData + nFirst * m_nBytesPerFrame, &m_buffer[0], (nFrames - nFirst) * m_nBytesPerFrame);
+
+    m_nRead.store(nRead + nFrames, std::memory_order_release);
+    return nFrames;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounded single-producer/single-consumer ring of interleaved audio frames.
+// Write and Read never block or lock: they move as many whole frames as fit
+// and return how many that was, leaving waiting policy to the caller.
+class SampleRing
+{
+public:
+    SampleRing() = default;
+
+    SampleRing(const SampleRing&) = delete;
+    SampleRing& operator=(const SampleRing&) = delete;
+
+    int         Init(size_t nCapacityFrames, int nBytesPerFrame);
+
+    size_t      Write(const uint8_t* pData, size_t nFrames);
+    size_t      Read(uint8_t* pData, size_t nFrames);
+
+    // The producer is done; Read drains what is left.
+    void        Close()             { m_bClosed.store(true, std::memory_order_release); }
+    bool        Closed() const      { return m_bClosed.load(std::memory_order_acquire); }
+
+    size_t      Capacity() const    { return m_nCapacity; }
+    size_t      Available() const;
+    size_t      Space() const       { return m_nCapacity - Available(); }
+    // Frames ever written and read; the difference is the fill level.
+    uint64_t    TotalWritten() const { return m_nWrite.load(std::memory_order_acquire); }
+    uint64_t    TotalRead() const   { return m_nRead.load(std::memory_order_acquire); }
+
+private:
+    std::vector<uint8_t>    m_buffer;
+    size_t                  m_nCapacity         = 0;
+    int                     m_nBytesPerFrame    = 0;
+
+    alignas(64) std::atomic<uint64_t>   m_nWrite{0};    // owned by the producer
+    alignas(64) std::atomic<uint64_t>   m_nRead{0};     // owned by the consumer
+    std::atomic<bool>                   m_bClosed{false};
+};
@@ -0,0 +1,234 @@
+#include "gop_cache.hpp"
+#include "bench_stats.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <input> [--rounds N] [--steps N] [--window S] [--cache-mb MB] [--prefetch GOPS]\n"
+            "                [--workers N] [--step-ms MS] [--seed S] [--threads MODE[:N]] [--backend NAME]\n"
+            "                [--no-baseline]\n"
+            "  --rounds       seeks into the window, each followed by reverse and forward steps (default 50)\n"
+            "  --steps        frame steps each way per round (default 30)\n"
+            "  --window       seconds of the input the rounds stay in (default 4)\n"
+            "  --cache-mb     GopCache budget (default 512)\n"
+            "  --prefetch     GOPs on each side decoded ahead on the pool, 0 for none (default 1)\n"
+            "  --workers      prefetch pool size (default: one per hardware thread)\n"
+            "  --step-ms      pause between steps, the time an editor looks at a frame (default 0)\n"
+            "  --seed         seed for the window and the seek targets (default 1)\n"
+            "  --threads      decoder threading (default none; frame threads add step latency)\n"
+            "  --backend      software (default), auto, or a hw device type\n"
+            "  --no-baseline  skip the pass without a cache\n",
+            argv0);
+}
+
+struct ScrubRun
+{
+    std::vector<double>     seeks;
+    std::vector<double>     reverse;
+    std::vector<double>     forward;
+    int                     nFailed     = 0;
+    ScrubStats              scrub;
+    GopCacheStats           cache;
+};
+
+static int RunScrub(const std::string& strUrl, const ScrubOptions& options, int64_t nCacheBytes,
+                    WorkerPool* pPool, const std::vector<int64_t>& targets, int nSteps, int nStepMs,
+                    ScrubRun* pRun)
+{
+    GopCache cache(nCacheBytes);
+    ScrubSource source(&cache, pPool);
+    int ret = source.Open(strUrl, options);
+    if (ret < 0)
+        return ret;
+
+    AVFrame* pFrame = av_frame_alloc();
+    if (!pFrame)
+        return AVERROR(ENOMEM);
+
+    auto Timed = [&](std::vector<double>* pLatencies, const std::function<int()>& move)
+    {
+        if (nStepMs > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(nStepMs));
+        BenchClock::time_point tStart = BenchClock::now();
+        int err = move();
+        if (err >= 0)
+            pLatencies->push_back(ElapsedSeconds(tStart, BenchClock::now()));
+        else if (err != AVERROR_EOF)
+            pRun->nFailed++;
+        av_frame_unref(pFrame);
+        return err;
+    };
+
+    for (int64_t target : targets)
+    {
+        if (Timed(&pRun->seeks, [&]() { return source.Seek(target, pFrame); }) < 0)
+            continue;
+        for (int i = 0; i < nSteps; i++)
+        {
+            if (Timed(&pRun->reverse, [&]() { return source.Step(-1, pFrame); }) < 0)
+                break;
+        }
+        for (int i = 0; i < nSteps; i++)
+        {
+            if (Timed(&pRun->forward, [&]() { return source.Step(1, pFrame); }) < 0)
+                break;
+        }
+    }
+
+    av_frame_free(&pFrame);
+    source.Close();
+    pRun->scrub = source.Stats();
+    pRun->cache = cache.Stats();
+    return 0;
+}
+
+static void PrintRun(const char* szName, ScrubRun& run)
+{
+    printf("%-9s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8llu %7d\n", szName,
+           Percentile(run.seeks, 50) * 1e3, Percentile(run.reverse, 50) * 1e3,
+           Percentile(run.reverse, 99) * 1e3, Percentile(run.reverse, 100) * 1e3,
+           Percentile(run.forward, 50) * 1e3, Percentile(run.forward, 99) * 1e3,
+           (unsigned long long)run.scrub.nGopsDecoded, run.nFailed);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strUrl;
+    int nRounds = 50;
+    int nSteps = 30;
+    double dWindow = 4.0;
+    int64_t nCacheBytes = 512LL << 20;
+    unsigned nWorkers = 0;
+    int nStepMs = 0;
+    unsigned nSeed = 1;
+    bool bBaseline = true;
+    ScrubOptions options;
+    options.decoder.threading.mode = ThreadMode::None;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc)
+            nRounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc)
+            nSteps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+            dWindow = atof(argv[++i]);
+        else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc)
+            nCacheBytes = static_cast<int64_t>(atoi(argv[++i])) << 20;
+        else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc)
+            options.nPrefetchGops = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+            nWorkers = static_cast<unsigned>(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--step-ms") == 0 && i + 1 < argc)
+            nStepMs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            nSeed = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (ParseThreadingConfig(argv[++i], &options.decoder.threading) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            options.decoder.strBackend = argv[++i];
+        else if (strcmp(argv[i], "--no-baseline") == 0)
+            bBaseline = false;
+        else if (argv[i][0] != '-' && strUrl.empty())
+            strUrl = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (strUrl.empty() || nRounds < 1 || nSteps < 0 || dWindow <= 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    KeyframeIndex index;
+    int ret = LoadOrBuildKeyframeIndex(strUrl, &index);
+    if (ret < 0)
+    {
+        fprintf(stderr, "keyframe index: %s\n", av_err2str(ret));
+        return 1;
+    }
+    if (index.Size() == 0 || index.Header().lastPts == AV_NOPTS_VALUE)
+    {
+        fprintf(stderr, "no seekable keyframes in %s\n", strUrl.c_str());
+        return 1;
+    }
+
+    // Editors go back and forth over the same few seconds: every round
+    // seeks somewhere inside one window.
+    const int64_t firstPts = index.Entry(0).pts;
+    const int64_t lastPts = index.Header().lastPts;
+    const int64_t nWindow = std::min<int64_t>(av_rescale_q(static_cast<int64_t>(dWindow * AV_TIME_BASE),
+                                                           av_make_q(1, AV_TIME_BASE), index.TimeBase()),
+                                              lastPts - firstPts);
+    std::mt19937_64 rng(nSeed);
+    const int64_t windowStart = std::uniform_int_distribution<int64_t>(firstPts, lastPts - nWindow)(rng);
+    std::uniform_int_distribution<int64_t> pick(windowStart, windowStart + nWindow);
+    std::vector<int64_t> targets;
+    for (int i = 0; i < nRounds; i++)
+        targets.push_back(pick(rng));
+
+    WorkerPool pool(nWorkers);
+
+    ScrubRun baseline, cached;
+    if (bBaseline)
+    {
+        ScrubOptions noPrefetch = options;
+        noPrefetch.nPrefetchGops = 0;
+        if (RunScrub(strUrl, noPrefetch, 0, nullptr, targets, nSteps, nStepMs, &baseline) < 0)
+            return 1;
+    }
+    if (RunScrub(strUrl, options, nCacheBytes, &pool, targets, nSteps, nStepMs, &cached) < 0)
+        return 1;
+
+    const double dTimeBase = av_q2d(index.TimeBase());
+    printf("input:        %s\n", strUrl.c_str());
+    printf("window:       %.3f s to %.3f s, %d rounds of %d steps each way\n",
+           windowStart * dTimeBase, (windowStart + nWindow) * dTimeBase, nRounds, nSteps);
+    printf("cache:        %lld MiB, prefetch %d GOPs each side on %u workers\n",
+           (long long)(nCacheBytes >> 20), options.nPrefetchGops, pool.Size());
+    printf("%-9s %8s %8s %8s %8s %8s %8s %8s %7s\n", "mode", "seek p50", "back p50", "back p99", "back max",
+           "fwd p50", "fwd p99", "GOPs", "failed");
+    if (bBaseline)
+        PrintRun("decode", baseline);
+    PrintRun("cache", cached);
+
+    const GopCacheStats& cs = cached.cache;
+    const uint64_t nLookups = cs.nHits + cs.nMisses;
+    printf("\n");
+    printf("hit rate:     %.1f%% (%llu hits, %llu misses, %llu on prefetched GOPs)\n",
+           nLookups ? 100.0 * cs.nHits / nLookups : 0.0, (unsigned long long)cs.nHits,
+           (unsigned long long)cs.nMisses, (unsigned long long)cs.nPrefetchHits);
+    printf("evictions:    %llu (%.1f MiB), peak %.1f MiB, %zu GOPs held at the end\n",
+           (unsigned long long)cs.nEvictions, cs.nEvictedBytes / (1024.0 * 1024.0),
+           cs.nPeakBytes / (1024.0 * 1024.0), cs.nGops);
+    printf("prefetch:     %llu GOPs decoded ahead, %llu lookups waited for one in flight\n",
+           (unsigned long long)cached.scrub.nGopsPrefetched, (unsigned long long)cached.scrub.nPrefetchWaits);
+    printf("decode time:  %.3f s on the caller", cached.scrub.dDecodeSeconds);
+    if (bBaseline)
+        printf(", %.3f s without the cache", baseline.scrub.dDecodeSeconds);
+    printf("\n");
+
+    return 0;
+}
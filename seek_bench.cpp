@@ -0,0 +1,162 @@
+#include "keyframe_index.hpp"
+#include "bench_stats.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <input> [--seeks N] [--seed S] [--rebuild] [--threads MODE[:N]] [--backend NAME]\n"
+            "  --seeks    random frame-accurate seeks per mode (default 100)\n"
+            "  --seed     seed for the seek targets (default 1)\n"
+            "  --rebuild  ignore an existing sidecar and index the input again\n"
+            "  --threads  decoder threading (default none; frame threads add seek latency)\n"
+            "  --backend  software (default), auto, or a hw device type\n",
+            argv0);
+}
+
+struct SeekRun
+{
+    std::vector<double>     latencies;
+    std::vector<int64_t>    landed;
+    int64_t                 nDecoded    = 0;
+    int64_t                 nPackets    = 0;
+    int64_t                 nRetries    = 0;
+    int                     nFailed     = 0;
+};
+
+static void RunSeeks(VideoStream* pStream, const KeyframeIndex* pIndex,
+                     const std::vector<int64_t>& targets, SeekRun* pRun)
+{
+    for (int64_t target : targets)
+    {
+        SeekStats stats;
+        int ret = SeekToPts(pStream, pIndex, target, nullptr, &stats);
+        if (ret < 0)
+            pRun->nFailed++;
+        pRun->latencies.push_back(stats.dTotalSeconds);
+        pRun->landed.push_back(ret < 0 ? AV_NOPTS_VALUE : stats.landedPts);
+        pRun->nDecoded += stats.nDecoded;
+        pRun->nPackets += stats.nPackets;
+        pRun->nRetries += stats.nRetries;
+    }
+}
+
+static void PrintRun(const char* szName, SeekRun& run)
+{
+    const double n = run.latencies.empty() ? 1.0 : static_cast<double>(run.latencies.size());
+    printf("%-10s %8.2f %8.2f %8.2f %8.2f %10.1f %10.1f %8lld %7d\n", szName,
+           Percentile(run.latencies, 50) * 1e3, Percentile(run.latencies, 90) * 1e3,
+           Percentile(run.latencies, 99) * 1e3, Percentile(run.latencies, 100) * 1e3,
+           run.nDecoded / n, run.nPackets / n, (long long)run.nRetries, run.nFailed);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strUrl;
+    int nSeeks = 100;
+    unsigned nSeed = 1;
+    bool bRebuild = false;
+    DecoderOptions options;
+    options.threading.mode = ThreadMode::None;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--seeks") == 0 && i + 1 < argc)
+            nSeeks = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            nSeed = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        else if (strcmp(argv[i], "--rebuild") == 0)
+            bRebuild = true;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (ParseThreadingConfig(argv[++i], &options.threading) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            options.strBackend = argv[++i];
+        else if (argv[i][0] != '-' && strUrl.empty())
+            strUrl = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (strUrl.empty() || nSeeks < 1)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    if (bRebuild)
+        remove(KeyframeIndexPath(strUrl).c_str());
+
+    KeyframeIndex index;
+    bool bBuilt = false;
+    BenchClock::time_point tIndex = BenchClock::now();
+    int ret = LoadOrBuildKeyframeIndex(strUrl, &index, &bBuilt);
+    double dIndexSeconds = ElapsedSeconds(tIndex, BenchClock::now());
+    if (ret < 0)
+    {
+        fprintf(stderr, "keyframe index: %s\n", av_err2str(ret));
+        return 1;
+    }
+    if (index.Size() == 0 || index.Header().lastPts == AV_NOPTS_VALUE)
+    {
+        fprintf(stderr, "no seekable keyframes in %s\n", strUrl.c_str());
+        return 1;
+    }
+
+    VideoStream stream;
+    if (OpenStream(strUrl, &stream, options) < 0)
+        return 1;
+
+    // Uniform over the stream; the same targets for both modes.
+    std::mt19937_64 rng(nSeed);
+    std::uniform_int_distribution<int64_t> pick(index.Entry(0).pts, index.Header().lastPts);
+    std::vector<int64_t> targets;
+    for (int i = 0; i < nSeeks; i++)
+        targets.push_back(pick(rng));
+
+    SeekRun indexed, container;
+    RunSeeks(&stream, &index, targets, &indexed);
+    RunSeeks(&stream, nullptr, targets, &container);
+
+    // Both modes promise the first frame at or after the target.
+    int nMismatches = 0;
+    for (size_t i = 0; i < targets.size(); i++)
+    {
+        if (indexed.landed[i] != container.landed[i])
+            nMismatches++;
+    }
+
+    const KeyframeIndexHeader& header = index.Header();
+    printf("input:        %s\n", strUrl.c_str());
+    printf("index:        %s in %.2f ms, %zu keyframes, %lld frames, mean GOP %.1f, %zu bytes%s\n",
+           bBuilt ? "built" : "loaded", dIndexSeconds * 1e3, index.Size(), (long long)header.nFrames,
+           double(header.nFrames) / index.Size(),
+           sizeof(KeyframeIndexHeader) + index.Size() * sizeof(KeyframeEntry),
+           index.Mapped() ? " (mapped)" : "");
+    printf("seeks:        %d, %s, backend %s\n", nSeeks,
+           ThreadingConfigToString(options.threading).c_str(), stream.pBackend->Name());
+    printf("%-10s %8s %8s %8s %8s %10s %10s %8s %7s\n", "mode", "p50 ms", "p90 ms", "p99 ms", "max ms",
+           "frames/sk", "pkts/sk", "retries", "failed");
+    PrintRun("index", indexed);
+    PrintRun("container", container);
+    printf("mismatches:   %d landed on a different frame\n", nMismatches);
+
+    CloseStream(&stream);
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include "shm_ring.hpp"
+#include "bench_stats.hpp"
+#include "av_err2string.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+extern "C"
+{
+#include <libavutil/adler32.h>
+}
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <name> [--frames N] [--delay-ms MS]\n"
+            "  reads frames in place from the shared-memory ring a decode_bench --sink shm:<name>\n"
+            "  publishes, checksums them and reports frames lost to falling behind\n"
+            "  --delay-ms  extra time spent per frame, to simulate a slow consumer\n",
+            argv0);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strName;
+    int64_t nMaxFrames = 0;
+    int nDelayMs = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            nMaxFrames = strtoll(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--delay-ms") == 0 && i + 1 < argc)
+            nDelayMs = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && strName.empty())
+            strName = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (strName.empty())
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // The producer creates the ring when its first frame is decoded.
+    ShmRingReader reader;
+    int ret;
+    BenchClock::time_point tGiveUp = BenchClock::now() + std::chrono::seconds(10);
+    while ((ret = reader.Open(strName)) < 0)
+    {
+        if (BenchClock::now() >= tGiveUp)
+        {
+            fprintf(stderr, "can't attach to %s: %s\n", strName.c_str(), av_err2str(ret));
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    int64_t nFrames = 0;
+    int64_t nTorn = 0;
+    int64_t nBytes = 0;
+    AVAdler sum = 1;
+    BenchClock::time_point tStart = BenchClock::now();
+    BenchClock::time_point tReport = tStart;
+
+    while (nMaxFrames <= 0 || nFrames < nMaxFrames)
+    {
+        ShmFrameView view;
+        if ((ret = reader.Acquire(&view, 2000)) < 0)
+            break;
+
+        // Same visible-pixel Adler-32 as ChecksumSink, computed in place.
+        int bytewidth[4];
+        int rows[4];
+        int nPlanes = GetPlaneGeometry(view.format, view.width, view.height, bytewidth, rows);
+        AVAdler frameSum = 1;
+        for (int i = 0; i < nPlanes && i < view.nPlanes; i++)
+        {
+            const uint8_t* pRow = view.data[i];
+            for (int y = 0; y < rows[i]; y++, pRow += view.linesize[i])
+                frameSum = av_adler32_update(frameSum, pRow, bytewidth[i]);
+            nBytes += static_cast<int64_t>(bytewidth[i]) * rows[i];
+        }
+
+        if (nDelayMs > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(nDelayMs));
+
+        if (reader.Release(view) < 0)
+        {
+            nTorn++;
+            continue;
+        }
+
+        uint8_t bytes[4] = { uint8_t(frameSum >> 24), uint8_t(frameSum >> 16), uint8_t(frameSum >> 8), uint8_t(frameSum) };
+        sum = av_adler32_update(sum, bytes, sizeof(bytes));
+        nFrames++;
+
+        BenchClock::time_point tNow = BenchClock::now();
+        if (ElapsedSeconds(tReport, tNow) >= 1.0)
+        {
+            printf("frames %lld, dropped %llu, torn %lld, lag %llu\n",
+                   (long long)nFrames, (unsigned long long)reader.Dropped(),
+                   (long long)nTorn, (unsigned long long)reader.Lag());
+            fflush(stdout);
+            tReport = tNow;
+        }
+    }
+
+    double dElapsed = ElapsedSeconds(tStart, BenchClock::now());
+    printf("frames:       %lld\n", (long long)nFrames);
+    printf("dropped:      %llu (fell behind the producer)\n", (unsigned long long)reader.Dropped());
+    printf("torn:         %lld (overwritten while being read)\n", (long long)nTorn);
+    printf("frames/s:     %.2f\n", dElapsed > 0 ? nFrames / dElapsed : 0.0);
+    printf("bytes/s:      %.0f\n", dElapsed > 0 ? nBytes / dElapsed : 0.0);
+    printf("checksum:     %08x\n", sum);
+
+    return 0;
+}
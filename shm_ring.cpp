@@ -0,0 +1,381 @@
+#include "shm_ring.hpp"
+#include "av_err2string.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_POSIX_SHM 1
+#endif
+
+extern "C"
+{
+#include <libavutil/imgutils.h>
+}
+
+static const size_t kSlotAlign = 64;
+
+static size_t SlotHeaderBytes()
+{
+    return FFALIGN(sizeof(ShmRingSlot), kSlotAlign);
+}
+
+#ifdef HAVE_POSIX_SHM
+
+class ShmRingSink : public FrameSink
+{
+public:
+    ShmRingSink(const std::string& strName, int nSlots);
+    ~ShmRingSink() override;
+
+    const char*         Name() const override   { return "shm"; }
+    int                 Write(AVCodecContext* avctx, const AVFrame* frame) override;
+    int64_t             Frames() const override { return m_stats.nFrames; }
+    std::string         Summary() const override;
+
+    ShmRingSinkStats    Stats() const           { return m_stats; }
+
+private:
+    int                 Create(uint64_t nCapacity);
+
+    std::string         m_strName;
+    int                 m_nSlots;
+    uint8_t*            m_pBase     = nullptr;
+    size_t              m_nSize     = 0;
+    ShmRingHeader*      m_pHeader   = nullptr;
+    ShmRingSinkStats    m_stats;
+};
+
+ShmRingSink::ShmRingSink(const std::string& strName, int nSlots)
+    : m_strName(strName[0] == '/' ? strName : "/" + strName)
+    , m_nSlots(nSlots)
+{
+}
+
+ShmRingSink::~ShmRingSink()
+{
+    if (m_pBase)
+    {
+        munmap(m_pBase, m_nSize);
+        shm_unlink(m_strName.c_str());
+    }
+}
+
+int ShmRingSink::Create(uint64_t nCapacity)
+{
+    const uint64_t nSlotOffset = FFALIGN(sizeof(ShmRingHeader), kSlotAlign);
+    const uint64_t nSlotStride = SlotHeaderBytes() + FFALIGN(nCapacity, kSlotAlign);
+    m_nSize = nSlotOffset + nSlotStride * m_nSlots;
+
+    // Replace a ring left behind by a producer that didn't exit cleanly.
+    shm_unlink(m_strName.c_str());
+
+    int fd = shm_open(m_strName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        int ret = AVERROR(errno);
+        fprintf(stderr, "shm_open %s: %s\n", m_strName.c_str(), av_err2str(ret));
+        return ret;
+    }
+
+    if (ftruncate(fd, static_cast<off_t>(m_nSize)) < 0)
+    {
+        int ret = AVERROR(errno);
+        fprintf(stderr, "ftruncate %s: %s\n", m_strName.c_str(), av_err2str(ret));
+        close(fd);
+        shm_unlink(m_strName.c_str());
+        return ret;
+    }
+
+    void* p = mmap(nullptr, m_nSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        int ret = AVERROR(errno);
+        fprintf(stderr, "mmap %s: %s\n", m_strName.c_str(), av_err2str(ret));
+        shm_unlink(m_strName.c_str());
+        return ret;
+    }
+
+    // ftruncate zero-fills, which is a valid initial state for every atomic.
+    m_pBase = static_cast<uint8_t*>(p);
+    m_pHeader = reinterpret_cast<ShmRingHeader*>(m_pBase);
+    m_pHeader->version = kShmRingVersion;
+    m_pHeader->nSlots = static_cast<uint32_t>(m_nSlots);
+    m_pHeader->nSlotOffset = nSlotOffset;
+    m_pHeader->nSlotStride = nSlotStride;
+    m_pHeader->nSlotCapacity = nCapacity;
+
+    // Readers wait for the magic before trusting the rest of the header.
+    std::atomic_thread_fence(std::memory_order_release);
+    m_pHeader->magic = kShmRingMagic;
+
+    return 0;
+}
+
+int ShmRingSink::Write(AVCodecContext*, const AVFrame* frame)
+{
+    int bytewidth[4];
+    int rows[4];
+    int nPlanes = GetPlaneGeometry(frame->format, frame->width, frame->height, bytewidth, rows);
+    if (nPlanes < 0)
+        return nPlanes;
+
+    int linesize[4] = {};
+    uint64_t planeOffset[4] = {};
+    uint64_t nPayload = 0;
+    for (int i = 0; i < nPlanes; i++)
+    {
+        linesize[i] = FFALIGN(bytewidth[i], static_cast<int>(kSlotAlign));
+        planeOffset[i] = nPayload;
+        nPayload += static_cast<uint64_t>(linesize[i]) * rows[i];
+    }
+
+    int ret;
+    if (!m_pBase && (ret = Create(nPayload)) < 0)
+        return ret;
+    if (nPayload > m_pHeader->nSlotCapacity)
+        return AVERROR(ENOSPC);
+
+    const uint64_t n = m_pHeader->nWriteSeq.load(std::memory_order_relaxed);
+
+    for (int i = 0; i < kShmRingMaxReaders; i++)
+    {
+        ShmRingCursor& cursor = m_pHeader->readers[i];
+        if (!cursor.bActive.load(std::memory_order_acquire))
+            continue;
+        uint64_t nRead = cursor.nReadSeq.load(std::memory_order_acquire);
+        uint64_t nLag = n > nRead ? n - nRead : 0;
+        if (nLag > m_stats.nMaxLag)
+            m_stats.nMaxLag = nLag;
+        if (nLag >= static_cast<uint64_t>(m_nSlots))
+            m_stats.nOverruns++;
+    }
+
+    ShmRingSlot* pSlot = reinterpret_cast<ShmRingSlot*>(
+        m_pBase + m_pHeader->nSlotOffset + (n % m_nSlots) * m_pHeader->nSlotStride);
+    uint8_t* pPayload = reinterpret_cast<uint8_t*>(pSlot) + SlotHeaderBytes();
+
+    pSlot->seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    pSlot->width = frame->width;
+    pSlot->height = frame->height;
+    pSlot->format = frame->format;
+    pSlot->nPlanes = nPlanes;
+    pSlot->pts = frame->pts;
+    pSlot->nPayloadBytes = nPayload;
+    for (int i = 0; i < 4; i++)
+    {
+        pSlot->linesize[i] = linesize[i];
+        pSlot->planeOffset[i] = planeOffset[i];
+    }
+    for (int i = 0; i < nPlanes; i++)
+    {
+        av_image_copy_plane(pPayload + planeOffset[i], linesize[i],
+                            frame->data[i], frame->linesize[i], bytewidth[i], rows[i]);
+    }
+
+    pSlot->seq.store(2 * n + 2, std::memory_order_release);
+    m_pHeader->nWriteSeq.store(n + 1, std::memory_order_release);
+
+    m_stats.nFrames++;
+    m_stats.nBytes += static_cast<int64_t>(nPayload);
+    return 0;
+}
+
+std::string ShmRingSink::Summary() const
+{
+    char str[160];
+    snprintf(str, sizeof(str), "%s: %d slots, %lld MiB written, %lld overruns, max reader lag %llu",
+             m_strName.c_str(), m_nSlots, (long long)(m_stats.nBytes >> 20),
+             (long long)m_stats.nOverruns, (unsigned long long)m_stats.nMaxLag);
+    return str;
+}
+
+int CreateShmRingSink(const std::string& strName, int nSlots, std::unique_ptr<FrameSink>* ppSink)
+{
+    ppSink->reset(new ShmRingSink(strName, nSlots));
+    return 0;
+}
+
+ShmRingReader::~ShmRingReader()
+{
+    Close();
+}
+
+int ShmRingReader::Open(const std::string& strName)
+{
+    std::string strPath = strName[0] == '/' ? strName : "/" + strName;
+
+    int fd = shm_open(strPath.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        return AVERROR(errno);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(ShmRingHeader)))
+    {
+        close(fd);
+        return AVERROR(EAGAIN);
+    }
+
+    void* p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return AVERROR(errno);
+
+    m_pBase = static_cast<uint8_t*>(p);
+    m_nSize = static_cast<size_t>(st.st_size);
+    m_pHeader = reinterpret_cast<ShmRingHeader*>(m_pBase);
+
+    if (m_pHeader->magic != kShmRingMagic || m_pHeader->version != kShmRingVersion)
+    {
+        Close();
+        return AVERROR(EAGAIN);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    for (int i = 0; i < kShmRingMaxReaders && !m_pCursor; i++)
+    {
+        uint32_t expected = 0;
+        if (m_pHeader->readers[i].bActive.compare_exchange_strong(expected, 1, std::memory_order_acq_rel))
+            m_pCursor = &m_pHeader->readers[i];
+    }
+    if (!m_pCursor)
+    {
+        Close();
+        return AVERROR(EBUSY);
+    }
+
+    m_nNext = m_pHeader->nWriteSeq.load(std::memory_order_acquire);
+    m_pCursor->nDropped.store(0, std::memory_order_relaxed);
+    m_pCursor->nReadSeq.store(m_nNext, std::memory_order_release);
+
+    return 0;
+}
+
+void ShmRingReader::Close()
+{
+    if (m_pCursor)
+    {
+        m_pCursor->bActive.store(0, std::memory_order_release);
+        m_pCursor = nullptr;
+    }
+    if (m_pBase)
+        munmap(m_pBase, m_nSize);
+    m_pBase = nullptr;
+    m_pHeader = nullptr;
+    m_nSize = 0;
+}
+
+ShmRingSlot* ShmRingReader::Slot(uint64_t nSeq) const
+{
+    return reinterpret_cast<ShmRingSlot*>(
+        m_pBase + m_pHeader->nSlotOffset + (nSeq % m_pHeader->nSlots) * m_pHeader->nSlotStride);
+}
+
+int ShmRingReader::Acquire(ShmFrameView* pView, int nTimeoutMs)
+{
+    if (!m_pHeader)
+        return AVERROR(EINVAL);
+
+    std::chrono::steady_clock::time_point tDeadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeoutMs);
+
+    while (true)
+    {
+        uint64_t nWritten = m_pHeader->nWriteSeq.load(std::memory_order_acquire);
+        if (nWritten <= m_nNext)
+        {
+            if (std::chrono::steady_clock::now() >= tDeadline)
+                return AVERROR(EAGAIN);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            continue;
+        }
+
+        // Everything older than the last nSlots frames is gone already.
+        uint64_t nOldest = nWritten > m_pHeader->nSlots ? nWritten - m_pHeader->nSlots : 0;
+        if (m_nNext < nOldest)
+        {
+            m_pCursor->nDropped.fetch_add(nOldest - m_nNext, std::memory_order_relaxed);
+            m_nNext = nOldest;
+        }
+
+        ShmRingSlot* pSlot = Slot(m_nNext);
+        uint64_t seq = pSlot->seq.load(std::memory_order_acquire);
+        if (seq != 2 * m_nNext + 2)
+        {
+            // Overwritten (or being overwritten) since nWriteSeq was read.
+            m_pCursor->nDropped.fetch_add(1, std::memory_order_relaxed);
+            m_nNext++;
+            continue;
+        }
+
+        const uint8_t* pPayload = reinterpret_cast<const uint8_t*>(pSlot) + SlotHeaderBytes();
+        pView->nSeq = m_nNext;
+        pView->width = pSlot->width;
+        pView->height = pSlot->height;
+        pView->format = pSlot->format;
+        pView->nPlanes = pSlot->nPlanes;
+        pView->pts = pSlot->pts;
+        for (int i = 0; i < 4; i++)
+        {
+            pView->data[i] = i < pSlot->nPlanes ? pPayload + pSlot->planeOffset[i] : nullptr;
+            pView->linesize[i] = pSlot->linesize[i];
+        }
+        return 0;
+    }
+}
+
+int ShmRingReader::Release(const ShmFrameView& view)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t seq = Slot(view.nSeq)->seq.load(std::memory_order_relaxed);
+
+    m_nNext = view.nSeq + 1;
+    m_pCursor->nReadSeq.store(m_nNext, std::memory_order_release);
+
+    if (seq != 2 * view.nSeq + 2)
+    {
+        m_pCursor->nDropped.fetch_add(1, std::memory_order_relaxed);
+        return AVERROR(ESTALE);
+    }
+    return 0;
+}
+
+uint64_t ShmRingReader::Dropped() const
+{
+    return m_pCursor ? m_pCursor->nDropped.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t ShmRingReader::Lag() const
+{
+    if (!m_pHeader)
+        return 0;
+    uint64_t nWritten = m_pHeader->nWriteSeq.load(std::memory_order_acquire);
+    return nWritten > m_nNext ? nWritten - m_nNext : 0;
+}
+
+#else
+
+int CreateShmRingSink(const std::string& strName, int nSlots, std::unique_ptr<FrameSink>* ppSink)
+{
+    fprintf(stderr, "shm sink: POSIX shared memory is not available on this platform\n");
+    return AVERROR(ENOSYS);
+}
+
+ShmRingReader::~ShmRingReader()                                 {}
+int ShmRingReader::Open(const std::string& strName)             { return AVERROR(ENOSYS); }
+void ShmRingReader::Close()                                     {}
+int ShmRingReader::Acquire(ShmFrameView* pView, int nTimeoutMs) { return AVERROR(ENOSYS); }
+int ShmRingReader::Release(const ShmFrameView& view)            { return AVERROR(ENOSYS); }
+uint64_t ShmRingReader::Dropped() const                         { return 0; }
+uint64_t ShmRingReader::Lag() const                             { return 0; }
+
+#endif
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "frame_sink.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Layout of the POSIX shared-memory frame ring. The producer (ShmRingSink)
+// owns the object and writes frame n into slot n % nSlots, overwriting the
+// oldest frame without waiting for readers. Readers map the same object and
+// read the planes in place.
+//
+// Every slot carries a sequence number used as a seqlock: 2n+1 while frame n
+// is being written, 2n+2 once it is published. A reader that sees a different
+// number before or after reading a slot has fallen behind and lost the frame.
+
+static const uint32_t   kShmRingMagic       = 0x474e5246;     // "FRNG"
+static const uint32_t   kShmRingVersion     = 1;
+static const int        kShmRingMaxReaders  = 8;
+
+struct ShmRingCursor
+{
+    std::atomic<uint32_t>   bActive;
+    std::atomic<uint64_t>   nReadSeq;       // next frame this reader will read
+    std::atomic<uint64_t>   nDropped;       // frames it lost by falling behind
+};
+
+struct ShmRingHeader
+{
+    uint32_t                magic;
+    uint32_t                version;
+    uint32_t                nSlots;
+    uint32_t                reserved;
+    uint64_t                nSlotOffset;    // first slot, from the start of the object
+    uint64_t                nSlotStride;
+    uint64_t                nSlotCapacity;  // payload bytes per slot
+    std::atomic<uint64_t>   nWriteSeq;      // frames published so far
+    ShmRingCursor           readers[kShmRingMaxReaders];
+};
+
+struct ShmRingSlot
+{
+    std::atomic<uint64_t>   seq;
+    int32_t                 width;
+    int32_t                 height;
+    int32_t                 format;         // AVPixelFormat
+    int32_t                 nPlanes;
+    int32_t                 linesize[4];
+    uint64_t                planeOffset[4]; // from the start of the slot payload
+    int64_t                 pts;
+    uint64_t                nPayloadBytes;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring needs address-free 64-bit atomics");
+
+struct ShmRingSinkStats
+{
+    int64_t     nFrames     = 0;
+    int64_t     nBytes      = 0;
+    int64_t     nOverruns   = 0;    // frames overwritten before an attached reader got to them
+    uint64_t    nMaxLag     = 0;    // largest reader lag seen, in frames
+};
+
+// Creates the ring when the first frame arrives, sized for that frame's
+// geometry. Frames that no longer fit after a resolution change fail with
+// AVERROR(ENOSPC).
+int     CreateShmRingSink(const std::string& strName, int nSlots, std::unique_ptr<FrameSink>* ppSink);
+
+struct ShmFrameView
+{
+    uint64_t        nSeq;
+    int             width;
+    int             height;
+    int             format;
+    int             nPlanes;
+    const uint8_t*  data[4];
+    int             linesize[4];
+    int64_t         pts;
+};
+
+// Consumer side of the ring.
+class ShmRingReader
+{
+public:
+    ShmRingReader() = default;
+    ~ShmRingReader();
+
+    ShmRingReader(const ShmRingReader&) = delete;
+    ShmRingReader& operator=(const ShmRingReader&) = delete;
+
+    // Attaches to an existing ring and starts at its newest frame.
+    int             Open(const std::string& strName);
+    void            Close();
+
+    // Maps the next frame in place. Returns AVERROR(EAGAIN) if nothing new
+    // was published within nTimeoutMs. Skipped frames are counted as dropped.
+    int             Acquire(ShmFrameView* pView, int nTimeoutMs);
+    // Ends the read of pView. Returns AVERROR(ESTALE) if the producer
+    // overwrote the slot while it was being read; the data must be discarded.
+    int             Release(const ShmFrameView& view);
+
+    uint64_t        Dropped() const;
+    uint64_t        Lag() const;
+
+private:
+    ShmRingSlot*    Slot(uint64_t nSeq) const;
+
+    uint8_t*        m_pBase     = nullptr;
+    size_t          m_nSize     = 0;
+    ShmRingHeader*  m_pHeader   = nullptr;
+    ShmRingCursor*  m_pCursor   = nullptr;
+    uint64_t        m_nNext     = 0;
+};
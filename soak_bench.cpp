@@ -0,0 +1,252 @@
+#include "decoder.hpp"
+#include "bench_stats.hpp"
+#include "demux_thread.hpp"
+#include "frame_pool.hpp"
+#include "packet_pool.hpp"
+#include "packet_queue.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <input> [--hours H] [--minutes M] [--allocator heap|pool] [--report-s S]\n"
+            "                [--demux-queue DEPTH] [--threads MODE[:N]] [--no-decode]\n"
+            "  --hours        how long to run, looping over the input (default 24)\n"
+            "  --minutes      the same in minutes, for a short check\n"
+            "  --allocator    where queued payloads live: the heap buffers libavformat returns,\n"
+            "                 or a PacketPool (default pool)\n"
+            "  --report-s     seconds between progress lines (default 60)\n"
+            "  --demux-queue  packets queued between the demux thread and the decoder (default 64)\n"
+            "  --threads      decoder threading (default: libavcodec's)\n"
+            "  --no-decode    drop packets instead of decoding them, to drive the allocator at demux speed\n"
+            "Run once per allocator: each run is a process of its own, so RSS is not shared.\n",
+            argv0);
+}
+
+struct SoakCounters
+{
+    uint64_t    nPackets        = 0;
+    double      dFreeSeconds    = 0.0;
+    double      dAdoptSeconds   = 0.0;
+};
+
+int main(int argc, char* argv[])
+{
+    std::string strUrl;
+    double dSeconds = 24 * 3600.0;
+    bool bPool = true;
+    double dReportSeconds = 60.0;
+    size_t nQueueDepth = 64;
+    bool bDecode = true;
+    DecoderOptions options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--hours") == 0 && i + 1 < argc)
+            dSeconds = atof(argv[++i]) * 3600.0;
+        else if (strcmp(argv[i], "--minutes") == 0 && i + 1 < argc)
+            dSeconds = atof(argv[++i]) * 60.0;
+        else if (strcmp(argv[i], "--allocator") == 0 && i + 1 < argc)
+        {
+            const char* pszAllocator = argv[++i];
+            if (strcmp(pszAllocator, "heap") != 0 && strcmp(pszAllocator, "pool") != 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            bPool = strcmp(pszAllocator, "pool") == 0;
+        }
+        else if (strcmp(argv[i], "--report-s") == 0 && i + 1 < argc)
+            dReportSeconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--demux-queue") == 0 && i + 1 < argc)
+            nQueueDepth = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (ParseThreadingConfig(argv[++i], &options.threading) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--no-decode") == 0)
+            bDecode = false;
+        else if (argv[i][0] != '-' && strUrl.empty())
+            strUrl = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (strUrl.empty() || dSeconds <= 0 || dReportSeconds <= 0 || nQueueDepth < 1)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    // Frames are pooled in both runs, so the packet payloads are the only
+    // allocations that differ.
+    FramePool framePool;
+    options.pFramePool = &framePool;
+
+    VideoStream stream;
+    int ret = OpenStream(strUrl, &stream, options);
+    if (ret < 0)
+        return 1;
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+    {
+        fprintf(stderr, "av_packet_alloc failed\n");
+        CloseStream(&stream);
+        return 1;
+    }
+
+    const AVStream* pVideo = stream.pFormatContext->streams[stream.iVideo];
+    const int64_t startPts = pVideo->start_time != AV_NOPTS_VALUE ? pVideo->start_time : 0;
+
+    PacketPool packetPool;
+    SoakCounters total;
+    SoakCounters reported;
+    int64_t nFrames = 0;
+    int nPasses = 0;
+    uint64_t nRssBaseline = 0;
+    double dBaselineSeconds = 0.0;
+
+    FrameCallback onFrame = [&](AVCodecContext*, AVFrame*)
+    {
+        nFrames++;
+        return 0;
+    };
+
+    // The allocator's share per packet: copying into the pool on the demux
+    // thread, plus dropping the queue's reference after decode. The
+    // demuxer's own allocation inside av_read_frame is the same in both runs.
+    auto Report = [&](double dElapsed)
+    {
+        if (bPool)
+            total.dAdoptSeconds = packetPool.Stats().dAdoptSeconds;
+        const uint64_t nPackets = total.nPackets - reported.nPackets;
+        const double dAllocSeconds = (total.dAdoptSeconds - reported.dAdoptSeconds) +
+                                     (total.dFreeSeconds - reported.dFreeSeconds);
+        const uint64_t nRss = CurrentRssBytes();
+        // The first interval is warm-up: growth is measured from its end.
+        if (nRssBaseline == 0)
+        {
+            nRssBaseline = nRss;
+            dBaselineSeconds = dElapsed;
+        }
+        printf("%9.0f %12llu %7d %10.3f %9.1f %+10.1f %9.1f\n", dElapsed, (unsigned long long)total.nPackets,
+               nPasses, nPackets ? dAllocSeconds * 1e6 / nPackets : 0.0, nRss / (1024.0 * 1024.0),
+               (double(nRss) - double(nRssBaseline)) / (1024.0 * 1024.0),
+               packetPool.Stats().nPoolBytes / (1024.0 * 1024.0));
+        fflush(stdout);
+        reported = total;
+    };
+
+    printf("%9s %12s %7s %10s %9s %10s %9s\n", "elapsed s", "packets", "passes", "alloc us", "rss MiB",
+           "growth MiB", "pool MiB");
+
+    BenchClock::time_point tStart = BenchClock::now();
+    double dNextReport = dReportSeconds;
+    bool bDone = false;
+
+    while (!bDone && ret >= 0)
+    {
+        PacketQueue packetQueue;
+        DemuxThread demuxThread;
+        if (bPool)
+            demuxThread.SetPacketPool(&packetPool);
+        if ((ret = packetQueue.Init(nQueueDepth, 256LL << 20)) < 0 ||
+            (ret = demuxThread.Start(stream.pFormatContext, stream.iVideo, &packetQueue)) < 0)
+        {
+            fprintf(stderr, "demux thread: %s\n", av_err2str(ret));
+            break;
+        }
+
+        while ((ret = packetQueue.Pop(pPacket)) >= 0)
+        {
+            total.nPackets++;
+            if (bDecode)
+                ret = DecodeFrame(stream.pCodecCtx, pPacket, onFrame, &framePool, stream.pBackend.get());
+
+            BenchClock::time_point tFree = BenchClock::now();
+            av_packet_unref(pPacket);
+            BenchClock::time_point tNow = BenchClock::now();
+            total.dFreeSeconds += ElapsedSeconds(tFree, tNow);
+            if (ret < 0)
+                break;
+
+            const double dElapsed = ElapsedSeconds(tStart, tNow);
+            if (dElapsed >= dNextReport)
+            {
+                Report(dElapsed);
+                dNextReport += dReportSeconds;
+            }
+            if (dElapsed >= dSeconds)
+            {
+                bDone = true;
+                break;
+            }
+        }
+
+        demuxThread.Stop();
+        if (ret == AVERROR_EOF)
+            ret = 0;
+        if (ret >= 0 && demuxThread.Result() < 0 && demuxThread.Result() != AVERROR_EOF &&
+            demuxThread.Result() != AVERROR_EXIT)
+            ret = demuxThread.Result();
+        if (bDone || ret < 0)
+            break;
+
+        // Loop over the input; frames still held for reordering are dropped.
+        if ((ret = av_seek_frame(stream.pFormatContext, stream.iVideo, startPts, AVSEEK_FLAG_BACKWARD)) < 0)
+        {
+            fprintf(stderr, "av_seek_frame: %s\n", av_err2str(ret));
+            break;
+        }
+        avcodec_flush_buffers(stream.pCodecCtx);
+        nPasses++;
+    }
+
+    const double dElapsed = ElapsedSeconds(tStart, BenchClock::now());
+    if (ret < 0)
+        fprintf(stderr, "soak stopped after %.0f s: %s\n", dElapsed, av_err2str(ret));
+
+    PacketPoolStats pp = packetPool.Stats();
+    const uint64_t nRss = CurrentRssBytes();
+    const double dAllocSeconds = pp.dAdoptSeconds + total.dFreeSeconds;
+    const double dGrowthHours = (dElapsed - dBaselineSeconds) / 3600.0;
+
+    printf("\n");
+    printf("input:        %s\n", strUrl.c_str());
+    printf("allocator:    %s%s\n", bPool ? "pool" : "heap", bDecode ? "" : ", no decode");
+    printf("elapsed:      %.0f s, %d passes, %llu packets, %lld frames\n", dElapsed, nPasses,
+           (unsigned long long)total.nPackets, (long long)nFrames);
+    printf("alloc time:   %.3f s, %.3f us/packet (%.3f s copying in, %.3f s unref)\n", dAllocSeconds,
+           total.nPackets ? dAllocSeconds * 1e6 / total.nPackets : 0.0, pp.dAdoptSeconds, total.dFreeSeconds);
+    if (nRssBaseline > 0)
+    {
+        const double dGrowthMiB = (double(nRss) - double(nRssBaseline)) / (1024.0 * 1024.0);
+        printf("rss:          %.1f MiB after warm-up, %.1f MiB at the end, %+.1f MiB (%+.2f MiB/h)\n",
+               nRssBaseline / (1024.0 * 1024.0), nRss / (1024.0 * 1024.0), dGrowthMiB,
+               dGrowthHours > 0 ? dGrowthMiB / dGrowthHours : 0.0);
+    }
+    printf("peak rss:     %.1f MiB\n", PeakRssBytes() / (1024.0 * 1024.0));
+    if (bPool)
+    {
+        printf("packet pool:  %llu buffers in %d classes, %.1f MiB, %llu oversize packets left on the heap\n",
+               (unsigned long long)pp.nBufferAllocs, pp.nClasses, pp.nPoolBytes / (1024.0 * 1024.0),
+               (unsigned long long)pp.nOversize);
+        packetPool.Print(stdout);
+    }
+
+    av_packet_free(&pPacket);
+    CloseStream(&stream);
+    return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,368 @@
+#include "stage_trace.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+extern "C"
+{
+#include <libavutil/avutil.h>
+}
+
+std::atomic<bool> g_bTracing{false};
+
+// Log-linear buckets with 16 steps per power of two, about 6% resolution
+// over the whole int64 nanosecond range, like an HDR histogram with one
+// significant digit.
+static const int    kSubBucketBits  = 4;
+static const int    kSubBuckets     = 1 << kSubBucketBits;
+static const int    kBuckets        = (64 - kSubBucketBits + 1) * kSubBuckets;
+static const size_t kEventsPerThread = 1 << 16;
+
+static int BucketOf(uint64_t nValue)
+{
+    if (nValue < uint64_t(kSubBuckets))
+        return static_cast<int>(nValue);
+    int nMagnitude = 63;
+    while (!(nValue >> nMagnitude))
+        nMagnitude--;
+    int nShift = nMagnitude - kSubBucketBits;
+    return (nShift + 1) * kSubBuckets + static_cast<int>((nValue >> nShift) & (kSubBuckets - 1));
+}
+
+// Largest value that lands in the bucket.
+static uint64_t BucketUpper(int iBucket)
+{
+    if (iBucket < kSubBuckets)
+        return static_cast<uint64_t>(iBucket);
+    int nShift = iBucket / kSubBuckets - 1;
+    uint64_t nLower = (uint64_t(kSubBuckets) | uint64_t(iBucket % kSubBuckets)) << nShift;
+    return nLower + ((uint64_t(1) << nShift) - 1);
+}
+
+struct TraceEvent
+{
+    int64_t     tStartNs;
+    int64_t     nDurationNs;
+    int32_t     stage;
+};
+
+// Written by its own thread only. Counters are atomics updated with plain
+// relaxed load/store pairs rather than read-modify-writes, which keeps them
+// as cheap as ordinary adds while exports read them from other threads.
+// When the thread exits, its counters move to g_retired and the trace waits
+// in g_free for the next thread that records; its events stay exported
+// until then.
+struct ThreadTrace
+{
+    int                     nTid;
+    std::string             strName;
+    std::atomic<uint64_t>   counts[int(TraceStage::Count)][kBuckets];
+    std::atomic<uint64_t>   totals[int(TraceStage::Count)];
+    std::atomic<uint64_t>   maxima[int(TraceStage::Count)];
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t>   nEvents{0};
+
+    explicit ThreadTrace(int tid)
+        : nTid(tid)
+        , events(kEventsPerThread)
+    {
+        for (int s = 0; s < int(TraceStage::Count); s++)
+        {
+            for (int b = 0; b < kBuckets; b++)
+                counts[s][b].store(0, std::memory_order_relaxed);
+            totals[s].store(0, std::memory_order_relaxed);
+            maxima[s].store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Counters of the threads that have exited, under g_traceLock.
+struct RetiredCounts
+{
+    uint64_t    counts[int(TraceStage::Count)][kBuckets]    = {};
+    uint64_t    totals[int(TraceStage::Count)]              = {};
+    uint64_t    maxima[int(TraceStage::Count)]              = {};
+};
+
+// Gives the calling thread's trace back when the thread exits.
+struct TraceOwner
+{
+    ~TraceOwner();
+
+    ThreadTrace*    pTrace  = nullptr;
+};
+
+static std::mutex                                   g_traceLock;
+static std::vector<std::shared_ptr<ThreadTrace>>    g_traces;
+static std::vector<ThreadTrace*>                    g_free;
+static RetiredCounts                                g_retired;
+static int                                          g_nLastTid = 0;
+static thread_local TraceOwner                      t_owner;
+static thread_local std::string                     t_strName;
+
+TraceOwner::~TraceOwner()
+{
+    if (!pTrace)
+        return;
+
+    std::lock_guard<std::mutex> lock(g_traceLock);
+    for (int s = 0; s < int(TraceStage::Count); s++)
+    {
+        for (int b = 0; b < kBuckets; b++)
+        {
+            g_retired.counts[s][b] += pTrace->counts[s][b].load(std::memory_order_relaxed);
+            pTrace->counts[s][b].store(0, std::memory_order_relaxed);
+        }
+        g_retired.totals[s] += pTrace->totals[s].load(std::memory_order_relaxed);
+        g_retired.maxima[s] = std::max(g_retired.maxima[s], pTrace->maxima[s].load(std::memory_order_relaxed));
+        pTrace->totals[s].store(0, std::memory_order_relaxed);
+        pTrace->maxima[s].store(0, std::memory_order_relaxed);
+    }
+    g_free.push_back(pTrace);
+    pTrace = nullptr;
+}
+
+static ThreadTrace* ThisThreadTrace()
+{
+    if (t_owner.pTrace)
+        return t_owner.pTrace;
+
+    // Reusing an exited thread's trace keeps the memory bounded by the most
+    // threads recording at once, however many come and go.
+    std::lock_guard<std::mutex> lock(g_traceLock);
+    ThreadTrace* pTrace = nullptr;
+    if (!g_free.empty())
+    {
+        pTrace = g_free.back();
+        g_free.pop_back();
+        pTrace->nTid = ++g_nLastTid;
+        pTrace->nEvents.store(0, std::memory_order_relaxed);
+    }
+    else
+    {
+        g_traces.push_back(std::make_shared<ThreadTrace>(++g_nLastTid));
+        pTrace = g_traces.back().get();
+    }
+    pTrace->strName = t_strName;
+    t_owner.pTrace = pTrace;
+    return pTrace;
+}
+
+static std::vector<std::shared_ptr<ThreadTrace>> Snapshot()
+{
+    std::lock_guard<std::mutex> lock(g_traceLock);
+    return g_traces;
+}
+
+const char* TraceStageName(TraceStage stage)
+{
+    switch (stage)
+    {
+        case TraceStage::Read:          return "read";
+        case TraceStage::SendPacket:    return "send_packet";
+        case TraceStage::ReceiveFrame:  return "receive_frame";
+        case TraceStage::Convert:       return "convert";
+        case TraceStage::Present:       return "present";
+        case TraceStage::Count:         break;
+    }
+    return "?";
+}
+
+void SetTracingEnabled(bool bEnabled)
+{
+    g_bTracing.store(bEnabled, std::memory_order_relaxed);
+}
+
+void SetTraceThreadName(const std::string& strName)
+{
+    // Threads that never record allocate nothing.
+    t_strName = strName;
+    if (t_owner.pTrace)
+    {
+        std::lock_guard<std::mutex> lock(g_traceLock);
+        t_owner.pTrace->strName = strName;
+    }
+}
+
+void RecordStage(TraceStage stage, int64_t tStartNs, int64_t tEndNs)
+{
+    ThreadTrace* pTrace = ThisThreadTrace();
+    const int s = static_cast<int>(stage);
+    const uint64_t nDuration = tEndNs > tStartNs ? uint64_t(tEndNs - tStartNs) : 0;
+
+    std::atomic<uint64_t>& count = pTrace->counts[s][BucketOf(nDuration)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    pTrace->totals[s].store(pTrace->totals[s].load(std::memory_order_relaxed) + nDuration,
+                            std::memory_order_relaxed);
+    if (nDuration > pTrace->maxima[s].load(std::memory_order_relaxed))
+        pTrace->maxima[s].store(nDuration, std::memory_order_relaxed);
+
+    uint64_t n = pTrace->nEvents.load(std::memory_order_relaxed);
+    pTrace->events[n & (kEventsPerThread - 1)] = { tStartNs, int64_t(nDuration), s };
+    pTrace->nEvents.store(n + 1, std::memory_order_release);
+}
+
+// Every thread's buckets of one stage, added up. Under the lock, so a
+// thread exiting meanwhile is counted once.
+static void MergeCounts(int s, std::vector<uint64_t>* pCounts, uint64_t* pnTotal, uint64_t* pnMax)
+{
+    std::lock_guard<std::mutex> lock(g_traceLock);
+    pCounts->assign(g_retired.counts[s], g_retired.counts[s] + kBuckets);
+    *pnTotal = g_retired.totals[s];
+    *pnMax = g_retired.maxima[s];
+    for (const std::shared_ptr<ThreadTrace>& pTrace : g_traces)
+    {
+        for (int b = 0; b < kBuckets; b++)
+            (*pCounts)[b] += pTrace->counts[s][b].load(std::memory_order_relaxed);
+        *pnTotal += pTrace->totals[s].load(std::memory_order_relaxed);
+        *pnMax = std::max(*pnMax, pTrace->maxima[s].load(std::memory_order_relaxed));
+    }
+}
+
+static double PercentileMs(const std::vector<uint64_t>& counts, uint64_t nCount, double p)
+{
+    if (nCount == 0)
+        return 0.0;
+    uint64_t nRank = static_cast<uint64_t>(p / 100.0 * (nCount - 1)) + 1;
+    uint64_t nSeen = 0;
+    for (int b = 0; b < kBuckets; b++)
+    {
+        nSeen += counts[b];
+        if (nSeen >= nRank)
+            return BucketUpper(b) * 1e-6;
+    }
+    return BucketUpper(kBuckets - 1) * 1e-6;
+}
+
+StageSummary GetStageSummary(TraceStage stage)
+{
+    std::vector<uint64_t> counts;
+    uint64_t nTotal = 0, nMax = 0;
+    MergeCounts(static_cast<int>(stage), &counts, &nTotal, &nMax);
+
+    StageSummary summary;
+    for (uint64_t n : counts)
+        summary.nCount += n;
+    summary.dTotalMs    = nTotal * 1e-6;
+    summary.dP50Ms      = PercentileMs(counts, summary.nCount, 50);
+    summary.dP90Ms      = PercentileMs(counts, summary.nCount, 90);
+    summary.dP99Ms      = PercentileMs(counts, summary.nCount, 99);
+    summary.dP999Ms     = PercentileMs(counts, summary.nCount, 99.9);
+    summary.dMaxMs      = nMax * 1e-6;
+    return summary;
+}
+
+void PrintStageSummary(FILE* fp)
+{
+    fprintf(fp, "%-14s %10s %10s %9s %9s %9s %9s %9s\n",
+            "stage", "count", "total ms", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+    for (int s = 0; s < int(TraceStage::Count); s++)
+    {
+        StageSummary summary = GetStageSummary(static_cast<TraceStage>(s));
+        if (summary.nCount == 0)
+            continue;
+        fprintf(fp, "%-14s %10llu %10.1f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+                TraceStageName(static_cast<TraceStage>(s)), (unsigned long long)summary.nCount,
+                summary.dTotalMs, summary.dP50Ms, summary.dP90Ms, summary.dP99Ms, summary.dP999Ms,
+                summary.dMaxMs);
+    }
+}
+
+int WriteChromeTrace(const std::string& strPath)
+{
+    std::vector<std::shared_ptr<ThreadTrace>> traces = Snapshot();
+
+    FILE* fp = fopen(strPath.c_str(), "w");
+    if (!fp)
+        return AVERROR(errno);
+
+    // Timestamps are relative to the earliest event kept.
+    int64_t tOrigin = INT64_MAX;
+    for (const std::shared_ptr<ThreadTrace>& pTrace : traces)
+    {
+        uint64_t n = pTrace->nEvents.load(std::memory_order_acquire);
+        uint64_t nFirst = n > kEventsPerThread ? n - kEventsPerThread : 0;
+        if (n > nFirst)
+            tOrigin = std::min(tOrigin, pTrace->events[nFirst & (kEventsPerThread - 1)].tStartNs);
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool bFirst = true;
+    for (const std::shared_ptr<ThreadTrace>& pTrace : traces)
+    {
+        std::string strName;
+        {
+            std::lock_guard<std::mutex> lock(g_traceLock);
+            strName = pTrace->strName.empty() ? "thread " + std::to_string(pTrace->nTid) : pTrace->strName;
+        }
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                bFirst ? "" : ",\n", pTrace->nTid, strName.c_str());
+        bFirst = false;
+
+        uint64_t n = pTrace->nEvents.load(std::memory_order_acquire);
+        for (uint64_t i = n > kEventsPerThread ? n - kEventsPerThread : 0; i < n; i++)
+        {
+            const TraceEvent& e = pTrace->events[i & (kEventsPerThread - 1)];
+            fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"decode\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                        "\"ts\":%.3f,\"dur\":%.3f}",
+                    TraceStageName(static_cast<TraceStage>(e.stage)), pTrace->nTid,
+                    (e.tStartNs - tOrigin) * 1e-3, e.nDurationNs * 1e-3);
+        }
+    }
+    fprintf(fp, "\n]}\n");
+
+    return fclose(fp) == 0 ? 0 : AVERROR(EIO);
+}
+
+int WritePrometheusMetrics(const std::string& strPath)
+{
+    FILE* fp = fopen(strPath.c_str(), "w");
+    if (!fp)
+        return AVERROR(errno);
+
+    // Powers of two from 1 us to about 1 s.
+    const int nBounds = 21;
+
+    fprintf(fp, "# HELP decode_stage_seconds Time spent in each decode pipeline stage.\n");
+    fprintf(fp, "# TYPE decode_stage_seconds histogram\n");
+    for (int s = 0; s < int(TraceStage::Count); s++)
+    {
+        std::vector<uint64_t> counts;
+        uint64_t nTotal = 0, nMax = 0;
+        MergeCounts(s, &counts, &nTotal, &nMax);
+        const char* pszStage = TraceStageName(static_cast<TraceStage>(s));
+
+        uint64_t nCumulative = 0;
+        int b = 0;
+        for (int i = 0; i < nBounds; i++)
+        {
+            const uint64_t nBoundNs = uint64_t(1000) << i;
+            for (; b < kBuckets && BucketUpper(b) <= nBoundNs; b++)
+                nCumulative += counts[b];
+            fprintf(fp, "decode_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+                    pszStage, nBoundNs * 1e-9, (unsigned long long)nCumulative);
+        }
+        for (; b < kBuckets; b++)
+            nCumulative += counts[b];
+        fprintf(fp, "decode_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+                pszStage, (unsigned long long)nCumulative);
+        fprintf(fp, "decode_stage_seconds_sum{stage=\"%s\"} %.9f\n", pszStage, nTotal * 1e-9);
+        fprintf(fp, "decode_stage_seconds_count{stage=\"%s\"} %llu\n", pszStage, (unsigned long long)nCumulative);
+    }
+
+    fprintf(fp, "# HELP decode_stage_max_seconds Longest single call of each stage.\n");
+    fprintf(fp, "# TYPE decode_stage_max_seconds gauge\n");
+    for (int s = 0; s < int(TraceStage::Count); s++)
+    {
+        std::vector<uint64_t> counts;
+        uint64_t nTotal = 0, nMax = 0;
+        MergeCounts(s, &counts, &nTotal, &nMax);
+        fprintf(fp, "decode_stage_max_seconds{stage=\"%s\"} %.9f\n",
+                TraceStageName(static_cast<TraceStage>(s)), nMax * 1e-9);
+    }
+
+    return fclose(fp) == 0 ? 0 : AVERROR(EIO);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Pipeline stages that are timed when tracing is on.
+enum class TraceStage
+{
+    Read,           // av_read_frame
+    SendPacket,     // avcodec_send_packet
+    ReceiveFrame,   // avcodec_receive_frame, including EAGAIN/EOF polls
+    Convert,        // colour conversion and scaling
+    Present,        // handing a frame to the screen or a sink
+    Count
+};
+
+const char* TraceStageName(TraceStage stage);
+
+// Off by default. Every thread records into buffers of its own: a ring of
+// the last events for the trace and a log-linear histogram per stage, so the
+// hot path takes no locks. When off, a ScopedStage costs one relaxed load.
+extern std::atomic<bool> g_bTracing;
+
+inline bool     TracingEnabled()    { return g_bTracing.load(std::memory_order_relaxed); }
+void            SetTracingEnabled(bool bEnabled);
+
+inline int64_t  TraceNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void    RecordStage(TraceStage stage, int64_t tStartNs, int64_t tEndNs);
+// Name shown for the calling thread in the Chrome trace.
+void    SetTraceThreadName(const std::string& strName);
+
+class ScopedStage
+{
+public:
+    explicit ScopedStage(TraceStage stage)
+        : m_stage(stage)
+        , m_tStartNs(TracingEnabled() ? TraceNowNs() : -1)
+    {
+    }
+    ~ScopedStage()
+    {
+        if (m_tStartNs >= 0)
+            RecordStage(m_stage, m_tStartNs, TraceNowNs());
+    }
+
+    ScopedStage(const ScopedStage&) = delete;
+    ScopedStage& operator=(const ScopedStage&) = delete;
+
+private:
+    TraceStage  m_stage;
+    int64_t     m_tStartNs;
+};
+
+struct StageSummary
+{
+    uint64_t    nCount      = 0;
+    double      dTotalMs    = 0.0;
+    double      dP50Ms      = 0.0;
+    double      dP90Ms      = 0.0;
+    double      dP99Ms      = 0.0;
+    double      dP999Ms     = 0.0;
+    double      dMaxMs      = 0.0;
+};
+
+// Exports merge every thread's histograms, including those of threads that
+// have exited, and may run while threads record.
+StageSummary    GetStageSummary(TraceStage stage);
+void            PrintStageSummary(FILE* fp);
+// Complete ("X") events, one track per thread, for chrome://tracing or
+// Perfetto. Only the last 64Ki events of each thread are kept, and an exited
+// thread's events only until another thread starts recording. Events are
+// copied without synchronisation: call this once tracing is off and the
+// recording threads are idle or joined.
+int             WriteChromeTrace(const std::string& strPath);
+// Prometheus text exposition: one histogram per stage in seconds.
+int             WritePrometheusMetrics(const std::string& strPath);
@@ -0,0 +1,241 @@
+#include "synthetic_clip.hpp"
+#include "av_err2string.hpp"
+
+#include <cerrno>
+#include <cstdio>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavformat/avformat.h>
+#include <libavutil/dict.h>
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+}
+
+namespace
+{
+
+struct ClipWriter
+{
+    ~ClipWriter()
+    {
+        av_frame_free(&pFrame);
+        av_packet_free(&pPacket);
+        avcodec_free_context(&pEncoder);
+        if (pOutput && !(pOutput->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&pOutput->pb);
+        avformat_free_context(pOutput);
+        avfilter_graph_free(&pGraph);
+    }
+
+    AVFilterGraph*      pGraph      = nullptr;
+    AVFilterContext*    pSink       = nullptr;
+    AVCodecContext*     pEncoder    = nullptr;
+    AVFormatContext*    pOutput     = nullptr;
+    AVStream*           pStream     = nullptr;
+    AVFrame*            pFrame      = nullptr;
+    AVPacket*           pPacket     = nullptr;
+};
+
+int OpenSource(const SyntheticClipSpec& spec, ClipWriter* pWriter)
+{
+    if (!(pWriter->pGraph = avfilter_graph_alloc()))
+        return AVERROR(ENOMEM);
+    int ret = avfilter_graph_create_filter(&pWriter->pSink, avfilter_get_by_name("buffersink"), "out", nullptr,
+                                           nullptr, pWriter->pGraph);
+    if (ret < 0)
+        return ret;
+
+    char szGraph[256];
+    snprintf(szGraph, sizeof(szGraph), "testsrc2=size=%dx%d:rate=%d/%d,format=pix_fmts=yuv420p",
+             spec.nWidth, spec.nHeight, spec.frameRate.num, spec.frameRate.den);
+
+    AVFilterInOut* pInputs = avfilter_inout_alloc();
+    AVFilterInOut* pOutputs = nullptr;
+    if (!pInputs)
+        return AVERROR(ENOMEM);
+    pInputs->name       = av_strdup("out");
+    pInputs->filter_ctx = pWriter->pSink;
+    pInputs->pad_idx    = 0;
+    pInputs->next       = nullptr;
+
+    ret = avfilter_graph_parse_ptr(pWriter->pGraph, szGraph, &pInputs, &pOutputs, nullptr);
+    avfilter_inout_free(&pInputs);
+    avfilter_inout_free(&pOutputs);
+    if (ret < 0)
+    {
+        fprintf(stderr, "filter graph \"%s\": %s\n", szGraph, av_err2str(ret));
+        return ret;
+    }
+    return avfilter_graph_config(pWriter->pGraph, nullptr);
+}
+
+int OpenOutput(const SyntheticClipSpec& spec, const std::string& strPath, const std::string& strTemp,
+               ClipWriter* pWriter)
+{
+    const AVCodec* pCodec = avcodec_find_encoder_by_name(spec.strEncoder.c_str());
+    if (!pCodec)
+        return AVERROR_ENCODER_NOT_FOUND;
+
+    // The temporary name has no usable extension; guess from the real one.
+    const AVOutputFormat* pFormat = av_guess_format(nullptr, strPath.c_str(), nullptr);
+    if (!pFormat)
+        return AVERROR_MUXER_NOT_FOUND;
+    int ret = avformat_alloc_output_context2(&pWriter->pOutput, pFormat, nullptr, strTemp.c_str());
+    if (ret < 0)
+        return ret;
+    // No library version strings in the file: the same encoder output
+    // gives the same bytes.
+    pWriter->pOutput->flags |= AVFMT_FLAG_BITEXACT;
+    if (!(pWriter->pStream = avformat_new_stream(pWriter->pOutput, nullptr)))
+        return AVERROR(ENOMEM);
+    if (!(pWriter->pEncoder = avcodec_alloc_context3(pCodec)))
+        return AVERROR(ENOMEM);
+
+    AVCodecContext* pEncoder = pWriter->pEncoder;
+    pEncoder->width         = spec.nWidth;
+    pEncoder->height        = spec.nHeight;
+    pEncoder->pix_fmt       = AV_PIX_FMT_YUV420P;
+    pEncoder->time_base     = av_inv_q(spec.frameRate);
+    pEncoder->framerate     = spec.frameRate;
+    pEncoder->gop_size      = spec.nGopSize;
+    pEncoder->max_b_frames  = spec.nBFrames;
+    // One thread: encoder output must not depend on the machine's core count.
+    pEncoder->thread_count  = 1;
+    pEncoder->flags        |= AV_CODEC_FLAG_BITEXACT;
+    if (pWriter->pOutput->oformat->flags & AVFMT_GLOBALHEADER)
+        pEncoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    AVDictionary* pOptions = nullptr;
+    if (!spec.strEncoderOptions.empty() &&
+        (ret = av_dict_parse_string(&pOptions, spec.strEncoderOptions.c_str(), "=", ":", 0)) < 0)
+    {
+        av_dict_free(&pOptions);
+        return ret;
+    }
+    ret = avcodec_open2(pEncoder, pCodec, &pOptions);
+    if (const AVDictionaryEntry* pUnused = av_dict_get(pOptions, "", nullptr, AV_DICT_IGNORE_SUFFIX))
+        fprintf(stderr, "%s: encoder option %s not recognised\n", spec.strName.c_str(), pUnused->key);
+    av_dict_free(&pOptions);
+    if (ret < 0)
+    {
+        fprintf(stderr, "avcodec_open2 %s: %s\n", pCodec->name, av_err2str(ret));
+        return ret;
+    }
+
+    if ((ret = avcodec_parameters_from_context(pWriter->pStream->codecpar, pEncoder)) < 0)
+        return ret;
+    pWriter->pStream->time_base = pEncoder->time_base;
+    pWriter->pStream->avg_frame_rate = pEncoder->framerate;
+
+    if (!(pWriter->pOutput->oformat->flags & AVFMT_NOFILE) &&
+        (ret = avio_open(&pWriter->pOutput->pb, strTemp.c_str(), AVIO_FLAG_WRITE)) < 0)
+    {
+        fprintf(stderr, "avio_open %s: %s\n", strTemp.c_str(), av_err2str(ret));
+        return ret;
+    }
+    return avformat_write_header(pWriter->pOutput, nullptr);
+}
+
+int WritePackets(ClipWriter* pWriter)
+{
+    int ret = 0;
+    while ((ret = avcodec_receive_packet(pWriter->pEncoder, pWriter->pPacket)) >= 0)
+    {
+        av_packet_rescale_ts(pWriter->pPacket, pWriter->pEncoder->time_base, pWriter->pStream->time_base);
+        pWriter->pPacket->stream_index = pWriter->pStream->index;
+        if ((ret = av_interleaved_write_frame(pWriter->pOutput, pWriter->pPacket)) < 0)
+            return ret;
+    }
+    return ret == AVERROR(EAGAIN) ? 0 : ret;
+}
+
+int Encode(const SyntheticClipSpec& spec, ClipWriter* pWriter)
+{
+    int ret = 0;
+    for (int i = 0; i < spec.nFrames; i++)
+    {
+        if ((ret = av_buffersink_get_frame(pWriter->pSink, pWriter->pFrame)) < 0)
+            return ret;
+        pWriter->pFrame->pts = i;
+        pWriter->pFrame->pict_type = AV_PICTURE_TYPE_NONE;
+        ret = avcodec_send_frame(pWriter->pEncoder, pWriter->pFrame);
+        av_frame_unref(pWriter->pFrame);
+        if (ret < 0 || (ret = WritePackets(pWriter)) < 0)
+            return ret;
+    }
+
+    if ((ret = avcodec_send_frame(pWriter->pEncoder, nullptr)) < 0)
+        return ret;
+    if ((ret = WritePackets(pWriter)) < 0 && ret != AVERROR_EOF)
+        return ret;
+    return av_write_trailer(pWriter->pOutput);
+}
+
+} // namespace
+
+int GenerateSyntheticClip(const SyntheticClipSpec& spec, const std::string& strPath)
+{
+    const std::string strTemp = strPath + ".part";
+    int ret = 0;
+    {
+        ClipWriter writer;
+        if (!(writer.pFrame = av_frame_alloc()) || !(writer.pPacket = av_packet_alloc()))
+            ret = AVERROR(ENOMEM);
+        if (ret >= 0)
+            ret = OpenSource(spec, &writer);
+        if (ret >= 0)
+            ret = OpenOutput(spec, strPath, strTemp, &writer);
+        if (ret >= 0)
+            ret = Encode(spec, &writer);
+        // The writer closes the file here, before the rename.
+    }
+
+    if (ret >= 0 && rename(strTemp.c_str(), strPath.c_str()) != 0)
+        ret = AVERROR(errno);
+    if (ret < 0)
+        remove(strTemp.c_str());
+    return ret;
+}
+
+std::vector<SyntheticClipSpec> DefaultRegressionClips()
+{
+    std::vector<SyntheticClipSpec> clips;
+    auto Add = [&](const char* pszName, const char* pszEncoder, const char* pszExtension, int nWidth, int nHeight,
+                   int nFrames, AVRational frameRate, int nGopSize, int nBFrames, const char* pszOptions,
+                   bool bLossless = false)
+    {
+        SyntheticClipSpec spec;
+        spec.strName            = pszName;
+        spec.strEncoder         = pszEncoder;
+        spec.strExtension       = pszExtension;
+        spec.nWidth             = nWidth;
+        spec.nHeight            = nHeight;
+        spec.nFrames            = nFrames;
+        spec.frameRate          = frameRate;
+        spec.nGopSize           = nGopSize;
+        spec.nBFrames           = nBFrames;
+        spec.strEncoderOptions  = pszOptions;
+        spec.bLossless          = bLossless;
+        clips.push_back(spec);
+    };
+
+    Add("h264_360p_gop30_b2",   "libx264",     "mp4",  640,  360,  120, { 30, 1 },   30, 2, "preset=veryfast");
+    Add("h264_1080p_gop60_b3",  "libx264",     "mp4",  1920, 1080, 120, { 30, 1 },   60, 3, "preset=veryfast");
+    Add("h264_1080p_intra",     "libx264",     "mp4",  1920, 1080, 60,  { 30, 1 },   1,  0, "preset=veryfast");
+    Add("h264_720p_opengop",    "libx264",     "mkv",  1280, 720,  120, { 60, 1 },   48, 3,
+        "preset=veryfast:x264-params=open-gop=1");
+    Add("hevc_2160p_gop48_b4",  "libx265",     "mp4",  3840, 2160, 48,  { 24, 1 },   48, 4,
+        "preset=ultrafast:x265-params=log-level=error");
+    Add("vp9_720p_gop60",       "libvpx-vp9",  "webm", 1280, 720,  90,  { 30, 1 },   60, 0,
+        "deadline=realtime:cpu-used=8");
+    Add("mpeg4_360p_gop12",     "mpeg4",       "avi",  640,  360,  100, { 25, 1 },   12, 2, "");
+    Add("h264_4320p_gop30",     "libx264",     "mp4",  7680, 4320, 30,  { 30, 1 },   30, 2, "preset=ultrafast");
+    Add("ffv1_360p_lossless",   "ffv1",        "mkv",  640,  360,  60,  { 30, 1 },   30, 0, "", true);
+    Add("h264_360p_lossless_b2", "libx264",    "mp4",  640,  360,  60,  { 30, 1 },   30, 2, "preset=veryfast:qp=0",
+        true);
+    return clips;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <libavutil/rational.h>
+}
+
+// A short clip rendered from a lavfi test source and encoded locally, so
+// regression inputs need not be checked in or downloaded.
+struct SyntheticClipSpec
+{
+    std::string     strName;
+    std::string     strEncoder;                 // avcodec_find_encoder_by_name
+    std::string     strExtension;               // picks the muxer
+    int             nWidth          = 1280;
+    int             nHeight         = 720;
+    int             nFrames         = 120;
+    AVRational      frameRate       = { 30, 1 };
+    int             nGopSize        = 60;       // 1 for intra only
+    int             nBFrames        = 0;
+    std::string     strEncoderOptions;          // "key=value:key=value"
+    // Decodes to exactly the testsrc2 frames, so the frame hashes hold for
+    // any build of the encoder.
+    bool            bLossless       = false;
+};
+
+// Encodes testsrc2 into strPath. Written to a temporary name and renamed,
+// so an interrupted run never leaves a truncated clip behind. Returns
+// AVERROR_ENCODER_NOT_FOUND when this FFmpeg build lacks the encoder.
+int     GenerateSyntheticClip(const SyntheticClipSpec& spec, const std::string& strPath);
+
+// Several codecs, 360p to 8K, long and short GOPs, B-frames, intra only and
+// open GOP, plus two lossless clips (FFV1, and H.264 at qp 0 with B-frames).
+std::vector<SyntheticClipSpec>  DefaultRegressionClips();
@@ -0,0 +1,340 @@
+#include "thumbnailer.hpp"
+#include "bench_stats.hpp"
+#include "decoder.hpp"
+#include "keyframe_index.hpp"
+#include "stage_trace.hpp"
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+extern "C"
+{
+#include <libswscale/swscale.h>
+}
+
+static bool IsKeyFrame(const AVFrame* frame)
+{
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(58, 7, 100)
+    return (frame->flags & AV_FRAME_FLAG_KEY) != 0;
+#else
+    return frame->key_frame != 0;
+#endif
+}
+
+// Collects decoded keyframes and scales them into the sheet a batch at a
+// time. Each pool lane keeps its own SwsContext across batches.
+class ThumbnailBatcher
+{
+public:
+    ThumbnailBatcher(const ThumbnailOptions& options, WorkerPool* pPool, ThumbnailSheet* pSheet,
+                     ThumbnailStats* pStats);
+    ~ThumbnailBatcher();
+
+    int     Add(const AVFrame* frame);
+    int     Flush();
+    bool    Full() const;
+    void    Reserve(int nTiles);
+
+private:
+    void    ScaleTile(int iLane, const AVFrame* frame, int iTile);
+
+    ThumbnailOptions            m_options;
+    WorkerPool*                 m_pPool;
+    ThumbnailSheet*             m_pSheet;
+    ThumbnailStats*             m_pStats;
+    int                         m_nBatch;
+    std::vector<AVFrame*>       m_pending;
+    std::vector<SwsContext*>    m_contexts;
+};
+
+ThumbnailBatcher::ThumbnailBatcher(const ThumbnailOptions& options, WorkerPool* pPool, ThumbnailSheet* pSheet,
+                                   ThumbnailStats* pStats)
+    : m_options(options)
+    , m_pPool(pPool)
+    , m_pSheet(pSheet)
+    , m_pStats(pStats)
+{
+    const int nLanes = pPool ? static_cast<int>(pPool->Size()) + 1 : 1;
+    m_nBatch = options.nBatch > 0 ? options.nBatch : 2 * nLanes;
+    m_contexts.resize(nLanes, nullptr);
+
+    pSheet->nWidth = options.nColumns * options.nTileWidth;
+    pSheet->nStride = pSheet->nWidth * 4;
+    pSheet->nHeight = 0;
+    pSheet->nTiles = 0;
+    pSheet->pixels.clear();
+}
+
+ThumbnailBatcher::~ThumbnailBatcher()
+{
+    for (AVFrame*& frame : m_pending)
+        av_frame_free(&frame);
+    for (SwsContext* pContext : m_contexts)
+        sws_freeContext(pContext);
+}
+
+bool ThumbnailBatcher::Full() const
+{
+    return m_options.nMaxThumbnails > 0 &&
+           m_pSheet->nTiles + static_cast<int>(m_pending.size()) >= m_options.nMaxThumbnails;
+}
+
+void ThumbnailBatcher::Reserve(int nTiles)
+{
+    const int nRows = (nTiles + m_options.nColumns - 1) / m_options.nColumns;
+    const int nHeight = nRows * m_options.nTileHeight;
+    if (nHeight <= m_pSheet->nHeight)
+        return;
+
+    // Opaque black, so letterbox bars and unused tiles stay visible as such.
+    const size_t nOld = m_pSheet->pixels.size();
+    m_pSheet->pixels.resize(static_cast<size_t>(nHeight) * m_pSheet->nStride);
+    for (size_t i = nOld; i < m_pSheet->pixels.size(); i += 4)
+    {
+        m_pSheet->pixels[i + 0] = 0;
+        m_pSheet->pixels[i + 1] = 0;
+        m_pSheet->pixels[i + 2] = 0;
+        m_pSheet->pixels[i + 3] = 255;
+    }
+    m_pSheet->nHeight = nHeight;
+}
+
+int ThumbnailBatcher::Add(const AVFrame* frame)
+{
+    if (Full())
+        return 0;
+
+    AVFrame* pClone = av_frame_clone(frame);
+    if (!pClone)
+        return AVERROR(ENOMEM);
+    m_pending.push_back(pClone);
+
+    if (static_cast<int>(m_pending.size()) >= m_nBatch)
+        return Flush();
+    return 0;
+}
+
+void ThumbnailBatcher::ScaleTile(int iLane, const AVFrame* frame, int iTile)
+{
+    // Fit the display aspect ratio into the tile.
+    double dDisplayWidth = frame->width;
+    if (frame->sample_aspect_ratio.num > 0 && frame->sample_aspect_ratio.den > 0)
+        dDisplayWidth *= av_q2d(frame->sample_aspect_ratio);
+
+    const int nTileWidth = m_options.nTileWidth;
+    const int nTileHeight = m_options.nTileHeight;
+    int w = nTileWidth;
+    int h = static_cast<int>(nTileWidth * frame->height / dDisplayWidth + 0.5);
+    if (h > nTileHeight)
+    {
+        h = nTileHeight;
+        w = static_cast<int>(nTileHeight * dDisplayWidth / frame->height + 0.5);
+    }
+    w = std::max(1, std::min(w, nTileWidth));
+    h = std::max(1, std::min(h, nTileHeight));
+
+    SwsContext*& pContext = m_contexts[iLane];
+    pContext = sws_getCachedContext(pContext, frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+                                    w, h, AV_PIX_FMT_BGRA, SWS_AREA, nullptr, nullptr, nullptr);
+    if (!pContext)
+        return;
+
+    const int x = (iTile % m_options.nColumns) * nTileWidth + (nTileWidth - w) / 2;
+    const int y = (iTile / m_options.nColumns) * nTileHeight + (nTileHeight - h) / 2;
+    uint8_t* dst[4] = { m_pSheet->pixels.data() + static_cast<size_t>(y) * m_pSheet->nStride + x * 4,
+                        nullptr, nullptr, nullptr };
+    int dstStride[4] = { m_pSheet->nStride, 0, 0, 0 };
+    ScopedStage stage(TraceStage::Convert);
+    sws_scale(pContext, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+}
+
+int ThumbnailBatcher::Flush()
+{
+    if (m_pending.empty())
+        return 0;
+
+    const int iFirstTile = m_pSheet->nTiles;
+    const int nFrames = static_cast<int>(m_pending.size());
+    Reserve(iFirstTile + nFrames);
+
+    BenchClock::time_point tStart = BenchClock::now();
+
+    const int nLanes = static_cast<int>(m_contexts.size());
+    auto ScaleLane = [&](int iLane)
+    {
+        for (int i = iLane; i < nFrames; i += nLanes)
+            ScaleTile(iLane, m_pending[i], iFirstTile + i);
+    };
+    if (m_pPool)
+        m_pPool->ParallelFor(std::min(nLanes, nFrames), ScaleLane);
+    else
+        ScaleLane(0);
+
+    m_pStats->dScaleSeconds += ElapsedSeconds(tStart, BenchClock::now());
+
+    for (AVFrame*& frame : m_pending)
+        av_frame_free(&frame);
+    m_pending.clear();
+    m_pSheet->nTiles += nFrames;
+    return 0;
+}
+
+static int DecodeSequential(VideoStream* pStream, const ThumbnailOptions& options, ThumbnailBatcher* pBatcher,
+                            ThumbnailStats* pStats)
+{
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+        return AVERROR(ENOMEM);
+
+    FrameCallback onFrame = [&](AVCodecContext*, AVFrame* frame)
+    {
+        pStats->nFrames++;
+        if (options.mode == ThumbnailMode::Full && !IsKeyFrame(frame))
+            return 0;
+        return pBatcher->Add(frame);
+    };
+
+    int ret = 0;
+    while (ret >= 0 && !pBatcher->Full())
+    {
+        if ((ret = av_read_frame(pStream->pFormatContext, pPacket)) < 0)
+            break;
+        if (pPacket->stream_index == pStream->iVideo)
+        {
+            pStats->nPackets++;
+            ret = DecodeFrame(pStream->pCodecCtx, pPacket, onFrame, nullptr, pStream->pBackend.get());
+        }
+        av_packet_unref(pPacket);
+    }
+    if (ret == AVERROR_EOF)
+        ret = DecodeFrame(pStream->pCodecCtx, NULL, onFrame, nullptr, pStream->pBackend.get());
+
+    av_packet_free(&pPacket);
+    return ret == AVERROR_EOF ? 0 : ret;
+}
+
+static int DecodeIndexed(VideoStream* pStream, const KeyframeIndex& index, const ThumbnailOptions& options,
+                         ThumbnailBatcher* pBatcher, ThumbnailStats* pStats)
+{
+    // Evenly spaced keyframes when fewer than all are wanted.
+    const size_t nKeyframes = index.Size();
+    const size_t nWanted = options.nMaxThumbnails > 0 ? std::min<size_t>(options.nMaxThumbnails, nKeyframes)
+                                                      : nKeyframes;
+    pBatcher->Reserve(static_cast<int>(nWanted));
+
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+        return AVERROR(ENOMEM);
+
+    FrameCallback onFrame = [&](AVCodecContext*, AVFrame* frame)
+    {
+        pStats->nFrames++;
+        return pBatcher->Add(frame);
+    };
+
+    int ret = 0;
+    for (size_t i = 0; i < nWanted && ret >= 0; i++)
+    {
+        const KeyframeEntry& entry = index.Entry(i * nKeyframes / nWanted);
+        if ((ret = SeekToKeyframe(pStream->pFormatContext, pStream->iVideo, entry)) < 0)
+        {
+            fprintf(stderr, "av_seek_frame: %s\n", av_err2str(ret));
+            break;
+        }
+        avcodec_flush_buffers(pStream->pCodecCtx);
+
+        while ((ret = av_read_frame(pStream->pFormatContext, pPacket)) >= 0 &&
+               pPacket->stream_index != pStream->iVideo)
+            av_packet_unref(pPacket);
+        if (ret < 0)
+            break;
+
+        // One packet, then drain so a decoder with reorder delay gives the
+        // frame up; the flush above resets it for the next seek.
+        pStats->nPackets++;
+        ret = DecodeFrame(pStream->pCodecCtx, pPacket, onFrame, nullptr, pStream->pBackend.get());
+        av_packet_unref(pPacket);
+        if (ret >= 0)
+            ret = DecodeFrame(pStream->pCodecCtx, NULL, onFrame, nullptr, pStream->pBackend.get());
+    }
+
+    av_packet_free(&pPacket);
+    return ret == AVERROR_EOF ? 0 : ret;
+}
+
+int ExtractThumbnails(const std::string& strUrl, const ThumbnailOptions& options, WorkerPool* pPool,
+                      ThumbnailSheet* pSheet, ThumbnailStats* pStats)
+{
+    if (options.nTileWidth < 1 || options.nTileHeight < 1 || options.nColumns < 1)
+        return AVERROR(EINVAL);
+
+    ThumbnailStats stats;
+    BenchClock::time_point tStart = BenchClock::now();
+
+    int ret = 0;
+    KeyframeIndex index;
+    if (options.mode == ThumbnailMode::Index && (ret = LoadOrBuildKeyframeIndex(strUrl, &index)) < 0)
+        return ret;
+
+    DecoderOptions decoder;
+    decoder.threading = options.threading;
+    decoder.bKeyframesOnly = options.mode != ThumbnailMode::Full;
+
+    VideoStream stream;
+    if ((ret = OpenStream(strUrl, &stream, decoder)) < 0)
+        return ret;
+
+    {
+        ThumbnailBatcher batcher(options, pPool, pSheet, &stats);
+        if (options.mode == ThumbnailMode::Index)
+            ret = DecodeIndexed(&stream, index, options, &batcher, &stats);
+        else
+            ret = DecodeSequential(&stream, options, &batcher, &stats);
+        if (ret >= 0)
+            ret = batcher.Flush();
+    }
+
+    if (stream.pFormatContext->pb)
+        stats.nBytesRead = stream.pFormatContext->pb->bytes_read;
+    CloseStream(&stream);
+
+    stats.dWallSeconds = ElapsedSeconds(tStart, BenchClock::now());
+    if (pStats)
+        *pStats = stats;
+
+    return ret;
+}
+
+int WriteThumbnailSheet(const std::string& strPath, const ThumbnailSheet& sheet)
+{
+    FILE* fp = fopen(strPath.c_str(), "wb");
+    if (!fp)
+        return AVERROR(errno);
+
+    bool bOk = true;
+    const bool bPpm = strPath.size() > 4 && strPath.compare(strPath.size() - 4, 4, ".ppm") == 0;
+    if (bPpm)
+    {
+        fprintf(fp, "P6\n%d %d\n255\n", sheet.nWidth, sheet.nHeight);
+        std::vector<uint8_t> row(static_cast<size_t>(sheet.nWidth) * 3);
+        for (int y = 0; y < sheet.nHeight && bOk; y++)
+        {
+            const uint8_t* pSrc = sheet.pixels.data() + static_cast<size_t>(y) * sheet.nStride;
+            for (int x = 0; x < sheet.nWidth; x++)
+            {
+                row[3 * x + 0] = pSrc[4 * x + 2];
+                row[3 * x + 1] = pSrc[4 * x + 1];
+                row[3 * x + 2] = pSrc[4 * x + 0];
+            }
+            bOk = fwrite(row.data(), 1, row.size(), fp) == row.size();
+        }
+    }
+    else
+        bOk = sheet.pixels.empty() || fwrite(sheet.pixels.data(), 1, sheet.pixels.size(), fp) == sheet.pixels.size();
+
+    bOk = fclose(fp) == 0 && bOk;
+    return bOk ? 0 : AVERROR(EIO);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "decoder_threading.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class WorkerPool;
+
+enum class ThumbnailMode
+{
+    Full,           // decode every frame, keep the keyframes (the baseline)
+    Discard,        // drop non-key packets in the demuxer and decoder
+    Index,          // seek from keyframe to keyframe with the sidecar index
+};
+
+struct ThumbnailOptions
+{
+    ThumbnailMode   mode            = ThumbnailMode::Index;
+    int             nTileWidth      = 160;
+    int             nTileHeight     = 90;
+    int             nColumns        = 8;
+    // 0 takes every keyframe. With the index the thumbnails are spread
+    // evenly over the stream, otherwise they are the first ones.
+    int             nMaxThumbnails  = 0;
+    // Frames downscaled together on the pool; 0 is two per thread.
+    int             nBatch          = 0;
+    ThreadingConfig threading;
+};
+
+// BGRA contact sheet, nColumns tiles wide, letterboxed tiles in stream order.
+struct ThumbnailSheet
+{
+    int                     nWidth      = 0;
+    int                     nHeight     = 0;
+    int                     nStride     = 0;
+    int                     nTiles      = 0;
+    std::vector<uint8_t>    pixels;
+};
+
+struct ThumbnailStats
+{
+    int64_t     nPackets        = 0;    // video packets sent to the decoder
+    int64_t     nFrames         = 0;    // frames the decoder returned
+    int64_t     nBytesRead      = 0;    // from the input, all streams
+    double      dScaleSeconds   = 0.0;  // waiting for batches to scale
+    double      dWallSeconds    = 0.0;
+};
+
+// Decodes keyframes of strUrl and downscales them into a sheet, in batches
+// on pPool (or the calling thread when it is null).
+int     ExtractThumbnails(const std::string& strUrl, const ThumbnailOptions& options, WorkerPool* pPool,
+                          ThumbnailSheet* pSheet, ThumbnailStats* pStats = nullptr);
+
+// A .ppm path gets a binary PPM, anything else the raw BGRA rows.
+int     WriteThumbnailSheet(const std::string& strPath, const ThumbnailSheet& sheet);
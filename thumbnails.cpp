@@ -0,0 +1,155 @@
+#include "thumbnailer.hpp"
+#include "keyframe_index.hpp"
+#include "worker_pool.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <input> [--mode index|discard|full|all] [--size WxH] [--columns N] [--count N]\n"
+            "                [--workers N] [--batch N] [--threads MODE[:N]] [--out FILE]\n"
+            "  --mode     how keyframes are found (default all: every mode, timed against full)\n"
+            "  --size     tile size (default 160x90)\n"
+            "  --columns  tiles per row of the sheet (default 8)\n"
+            "  --count    thumbnails to take, 0 for every keyframe (default 0)\n"
+            "  --workers  pool threads that downscale (default: one per core)\n"
+            "  --batch    frames downscaled per batch (default: two per thread)\n"
+            "  --out      write the sheet of the last mode run; .ppm or raw BGRA\n",
+            argv0);
+}
+
+static const char* ModeName(ThumbnailMode mode)
+{
+    switch (mode)
+    {
+        case ThumbnailMode::Full:       return "full";
+        case ThumbnailMode::Discard:    return "discard";
+        case ThumbnailMode::Index:      return "index";
+    }
+    return "unknown";
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strUrl;
+    std::string strMode = "all";
+    std::string strOut;
+    unsigned nWorkers = 0;
+    ThumbnailOptions options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+            strMode = argv[++i];
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &options.nTileWidth, &options.nTileHeight) != 2)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--columns") == 0 && i + 1 < argc)
+            options.nColumns = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+            options.nMaxThumbnails = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+            nWorkers = static_cast<unsigned>(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            options.nBatch = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (ParseThreadingConfig(argv[++i], &options.threading) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            strOut = argv[++i];
+        else if (argv[i][0] != '-' && strUrl.empty())
+            strUrl = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<ThumbnailMode> modes;
+    if (strMode == "all")
+        modes = { ThumbnailMode::Full, ThumbnailMode::Discard, ThumbnailMode::Index };
+    else if (strMode == "full")
+        modes = { ThumbnailMode::Full };
+    else if (strMode == "discard")
+        modes = { ThumbnailMode::Discard };
+    else if (strMode == "index")
+        modes = { ThumbnailMode::Index };
+    if (strUrl.empty() || modes.empty() || options.nTileWidth < 1 || options.nTileHeight < 1 || options.nColumns < 1)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    // Build the sidecar up front so the index mode is timed as a later
+    // session would see it.
+    for (ThumbnailMode mode : modes)
+    {
+        if (mode != ThumbnailMode::Index)
+            continue;
+        KeyframeIndex index;
+        bool bBuilt = false;
+        if (LoadOrBuildKeyframeIndex(strUrl, &index, &bBuilt) < 0)
+            return 1;
+        printf("index:        %s, %zu keyframes\n", bBuilt ? "built" : "loaded", index.Size());
+    }
+
+    WorkerPool pool(nWorkers);
+    ThumbnailSheet sheet;
+    double dFullSeconds = 0.0;
+
+    printf("%-8s %7s %9s %9s %10s %9s %9s %8s\n",
+           "mode", "tiles", "packets", "frames", "MiB read", "scale s", "wall s", "speedup");
+    for (ThumbnailMode mode : modes)
+    {
+        options.mode = mode;
+        ThumbnailStats stats;
+        int ret = ExtractThumbnails(strUrl, options, &pool, &sheet, &stats);
+        if (ret < 0)
+        {
+            fprintf(stderr, "%s: %s\n", ModeName(mode), av_err2str(ret));
+            return 1;
+        }
+        if (mode == ThumbnailMode::Full)
+            dFullSeconds = stats.dWallSeconds;
+
+        printf("%-8s %7d %9lld %9lld %10.1f %9.3f %9.3f", ModeName(mode), sheet.nTiles,
+               (long long)stats.nPackets, (long long)stats.nFrames, stats.nBytesRead / (1024.0 * 1024.0),
+               stats.dScaleSeconds, stats.dWallSeconds);
+        if (dFullSeconds > 0 && stats.dWallSeconds > 0)
+            printf(" %7.2fx\n", dFullSeconds / stats.dWallSeconds);
+        else
+            printf(" %8s\n", "-");
+    }
+    printf("sheet:        %dx%d, %d tiles of %dx%d\n", sheet.nWidth, sheet.nHeight, sheet.nTiles,
+           options.nTileWidth, options.nTileHeight);
+
+    if (!strOut.empty())
+    {
+        int ret = WriteThumbnailSheet(strOut, sheet);
+        if (ret < 0)
+        {
+            fprintf(stderr, "%s: %s\n", strOut.c_str(), av_err2str(ret));
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include "transcoder.hpp"
+#include "bench_stats.hpp"
+#include "decoder_threading.hpp"
+#include "frame_pool.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <input> <output> [--vf GRAPH] [--filter-threads N] [--encoder NAME] [--encoder-opts K=V:...]\n"
+            "                [--bitrate KBPS] [--gop N] [--encoder-threads N] [--format NAME] [--threads MODE[:N]]\n"
+            "                [--backend NAME] [--packet-queue N] [--frame-queue N] [--no-frame-pool]\n"
+            "  --vf              libavfilter graph between decoder and encoder (default null)\n"
+            "  --filter-threads  threads for the filter graph (default: libavfilter's)\n"
+            "  --encoder         encoder name (default libx264)\n"
+            "  --encoder-opts    private encoder options, e.g. preset=veryfast:crf=23\n"
+            "  --bitrate         target bit rate in kbit/s\n"
+            "  --gop             keyframe interval in frames\n"
+            "  --encoder-threads threads for the encoder (default auto)\n"
+            "  --format          muxer name (default: guessed from the output name)\n"
+            "  --threads         decoder threading: none, frame, slice or both, with an optional count\n"
+            "  --backend         software (default), auto, a hw device type, or a comma separated list\n"
+            "  --packet-queue    depth of the demux->decode and encode->mux queues (default 64)\n"
+            "  --frame-queue     depth of the decode->filter and filter->encode queues (default 8)\n"
+            "  --no-frame-pool   allocate decoded frames with the default allocator instead of FramePool\n",
+            argv0);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strInput;
+    std::string strOutput;
+    TranscodeOptions options;
+    bool bFramePool = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--vf") == 0 && i + 1 < argc)
+            options.strFilter = argv[++i];
+        else if (strcmp(argv[i], "--filter-threads") == 0 && i + 1 < argc)
+            options.nFilterThreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--encoder") == 0 && i + 1 < argc)
+            options.strEncoder = argv[++i];
+        else if (strcmp(argv[i], "--encoder-opts") == 0 && i + 1 < argc)
+            options.strEncoderOptions = argv[++i];
+        else if (strcmp(argv[i], "--bitrate") == 0 && i + 1 < argc)
+            options.nBitRate = strtoll(argv[++i], nullptr, 10) * 1000;
+        else if (strcmp(argv[i], "--gop") == 0 && i + 1 < argc)
+            options.nGopSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--encoder-threads") == 0 && i + 1 < argc)
+            options.nEncoderThreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+            options.strFormat = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (ParseThreadingConfig(argv[++i], &options.decoder.threading) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            options.decoder.strBackend = argv[++i];
+        else if (strcmp(argv[i], "--packet-queue") == 0 && i + 1 < argc)
+            options.nPacketQueue = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--frame-queue") == 0 && i + 1 < argc)
+            options.nFrameQueue = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--no-frame-pool") == 0)
+            bFramePool = false;
+        else if (argv[i][0] != '-' && strInput.empty())
+            strInput = argv[i];
+        else if (argv[i][0] != '-' && strOutput.empty())
+            strOutput = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (strInput.empty() || strOutput.empty() || options.nPacketQueue == 0 || options.nFrameQueue == 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    FramePool framePool;
+    if (bFramePool)
+        options.decoder.pFramePool = &framePool;
+
+    Transcoder transcoder;
+    int ret = transcoder.Open(strInput, strOutput, options);
+    if (ret < 0)
+        return 1;
+
+    ret = transcoder.Run();
+    if (ret < 0)
+        fprintf(stderr, "transcode stopped early: %s\n", av_err2str(ret));
+
+    TranscodeStats stats = transcoder.Stats();
+    const AVCodecContext* pDecoder = transcoder.Input().pCodecCtx;
+    const AVCodecContext* pEncoder = transcoder.Encoder();
+    const uint64_t nFrames = stats.stages[kStageFilter].nItems;
+
+    printf("input:        %s (%s %dx%d)\n", strInput.c_str(), pDecoder->codec->name, pDecoder->width, pDecoder->height);
+    if (pEncoder)
+        printf("output:       %s (%s %dx%d)\n", strOutput.c_str(), pEncoder->codec->name, pEncoder->width, pEncoder->height);
+    printf("filter:       %s\n", options.strFilter.c_str());
+    printf("frames:       %llu\n", (unsigned long long)nFrames);
+    printf("bytes out:    %lld\n", (long long)stats.nBytesWritten);
+    printf("elapsed:      %.3f s\n", stats.dWallSeconds);
+    printf("frames/s:     %.2f\n", stats.dWallSeconds > 0 ? nFrames / stats.dWallSeconds : 0.0);
+    printf("\n");
+
+    printf("%-8s %10s %10s %10s %10s %8s\n", "stage", "items", "busy s", "starved s", "blocked s", "util");
+    for (const TranscodeStageStats& stage : stats.stages)
+    {
+        printf("%-8s %10llu %10.3f %10.3f %10.3f %7.1f%%\n", stage.pszName, (unsigned long long)stage.nItems,
+               stage.dBusySeconds, stage.dStarvedSeconds, stage.dBlockedSeconds, stage.dUtilization * 100.0);
+    }
+    printf("\n");
+
+    printf("queue peaks:  demux %zu/%zu, decode %zu/%zu, filter %zu/%zu, encode %zu/%zu\n",
+           stats.demuxQueue.nPeakPackets, options.nPacketQueue,
+           stats.decodeQueue.nPeakFrames, options.nFrameQueue,
+           stats.filterQueue.nPeakFrames, options.nFrameQueue,
+           stats.encodeQueue.nPeakPackets, options.nPacketQueue);
+    if (stats.iBottleneck >= 0)
+        printf("bottleneck:   %s (%.1f%% busy)\n", stats.stages[stats.iBottleneck].pszName,
+               stats.stages[stats.iBottleneck].dUtilization * 100.0);
+    printf("peak rss:     %.1f MiB\n", PeakRssBytes() / (1024.0 * 1024.0));
+
+    transcoder.Close();
+    return ret < 0 ? 1 : 0;
+}
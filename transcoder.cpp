@@ -0,0 +1,570 @@
+#include "transcoder.hpp"
+#include "stage_trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+extern "C"
+{
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/pixdesc.h>
+}
+
+static int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Transcoder::~Transcoder()
+{
+    Close();
+}
+
+int Transcoder::Open(const std::string& strInput, const std::string& strOutput, const TranscodeOptions& options)
+{
+    Close();
+
+    m_options = options;
+    m_strOutput = strOutput;
+    m_ret.store(0);
+    for (int i = 0; i < kStageCount; i++)
+    {
+        m_nItems[i].store(0);
+        m_nStartNs[i].store(0);
+        m_nEndNs[i].store(0);
+    }
+    m_nBytesWritten = 0;
+    m_dWallSeconds = 0.0;
+    m_bHeaderWritten = false;
+
+    if (!avcodec_find_encoder_by_name(options.strEncoder.c_str()))
+    {
+        fprintf(stderr, "encoder %s not found\n", options.strEncoder.c_str());
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+
+    int ret = OpenStream(strInput, &m_input, options.decoder);
+    if (ret < 0)
+        return ret;
+    for (unsigned int i = 0; i < m_input.pFormatContext->nb_streams; i++)
+    {
+        if (static_cast<int>(i) != m_input.iVideo)
+            m_input.pFormatContext->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    m_pDemuxQueue.reset(new PacketQueue());
+    m_pDecodeQueue.reset(new FrameQueue());
+    m_pFilterQueue.reset(new FrameQueue());
+    m_pEncodeQueue.reset(new PacketQueue());
+    m_pDemuxThread.reset(new DemuxThread());
+    if ((ret = m_pDemuxQueue->Init(options.nPacketQueue, 0)) < 0 ||
+        (ret = m_pDecodeQueue->Init(options.nFrameQueue)) < 0 ||
+        (ret = m_pFilterQueue->Init(options.nFrameQueue)) < 0 ||
+        (ret = m_pEncodeQueue->Init(options.nPacketQueue, 0)) < 0)
+    {
+        Close();
+        return ret;
+    }
+
+    ret = avformat_alloc_output_context2(&m_pOutput, nullptr,
+                                         options.strFormat.empty() ? nullptr : options.strFormat.c_str(),
+                                         strOutput.c_str());
+    if (ret < 0)
+    {
+        fprintf(stderr, "avformat_alloc_output_context2: %s\n", av_err2str(ret));
+        Close();
+        return ret;
+    }
+    if (!(m_pOutStream = avformat_new_stream(m_pOutput, nullptr)))
+    {
+        Close();
+        return AVERROR(ENOMEM);
+    }
+    if (!(m_pOutput->oformat->flags & AVFMT_NOFILE) &&
+        (ret = avio_open(&m_pOutput->pb, strOutput.c_str(), AVIO_FLAG_WRITE)) < 0)
+    {
+        fprintf(stderr, "avio_open %s: %s\n", strOutput.c_str(), av_err2str(ret));
+        Close();
+        return ret;
+    }
+
+    return 0;
+}
+
+void Transcoder::Close()
+{
+    Stop();
+    for (std::thread& thread : m_threads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+    if (m_pDemuxThread)
+        m_pDemuxThread->Join();
+
+    avfilter_graph_free(&m_pGraph);
+    m_pBufferSrc = nullptr;
+    m_pBufferSink = nullptr;
+    avcodec_free_context(&m_pEncoder);
+    if (m_pOutput)
+    {
+        if (!(m_pOutput->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&m_pOutput->pb);
+        avformat_free_context(m_pOutput);
+        m_pOutput = nullptr;
+    }
+    m_pOutStream = nullptr;
+    CloseStream(&m_input);
+
+    m_pDemuxThread.reset();
+    m_pDemuxQueue.reset();
+    m_pDecodeQueue.reset();
+    m_pFilterQueue.reset();
+    m_pEncodeQueue.reset();
+}
+
+int Transcoder::Run()
+{
+    if (!m_pOutput)
+        return AVERROR(EINVAL);
+
+    const int64_t tStart = NowNs();
+
+    int ret = m_pDemuxThread->Start(m_input.pFormatContext, m_input.iVideo, m_pDemuxQueue.get());
+    if (ret < 0)
+        return ret;
+
+    m_threads[kStageDecode] = std::thread(&Transcoder::DecodeLoop, this);
+    m_threads[kStageFilter] = std::thread(&Transcoder::FilterLoop, this);
+    m_threads[kStageEncode] = std::thread(&Transcoder::EncodeLoop, this);
+    m_threads[kStageMux]    = std::thread(&Transcoder::MuxLoop, this);
+
+    for (std::thread& thread : m_threads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+    m_pDemuxThread->Join();
+
+    m_dWallSeconds = (NowNs() - tStart) * 1e-9;
+
+    ret = m_ret.load(std::memory_order_acquire);
+    if (ret == 0)
+    {
+        ret = m_pDemuxThread->Result();
+        if (ret == AVERROR_EOF)
+            ret = 0;
+    }
+    return ret;
+}
+
+void Transcoder::Stop()
+{
+    if (m_pDemuxQueue)
+        Fail(AVERROR_EXIT);
+}
+
+void Transcoder::Fail(int ret)
+{
+    int expected = 0;
+    if (m_ret.compare_exchange_strong(expected, ret, std::memory_order_acq_rel))
+    {
+        if (ret != AVERROR_EXIT)
+            fprintf(stderr, "transcode: %s\n", av_err2str(ret));
+    }
+    // Wake every other stage; they return AVERROR_EXIT from their queues.
+    m_pDemuxQueue->Abort();
+    m_pDecodeQueue->Abort();
+    m_pFilterQueue->Abort();
+    m_pEncodeQueue->Abort();
+}
+
+void Transcoder::DecodeLoop()
+{
+    SetTraceThreadName("decode");
+    m_nStartNs[kStageDecode].store(NowNs(), std::memory_order_relaxed);
+
+    AVPacket* pPacket = av_packet_alloc();
+    AVFrame* pRef = av_frame_alloc();
+    int ret = (pPacket && pRef) ? 0 : AVERROR(ENOMEM);
+
+    // The decoder reuses its output frame, so the queue gets a new reference.
+    FrameCallback onFrame = [this, pRef](AVCodecContext*, AVFrame* frame)
+    {
+        int ret = av_frame_ref(pRef, frame);
+        if (ret < 0)
+            return ret;
+        pRef->pts = frame->best_effort_timestamp;
+        m_nItems[kStageDecode].fetch_add(1, std::memory_order_relaxed);
+        return m_pDecodeQueue->Push(pRef);
+    };
+
+    while (ret >= 0)
+    {
+        if ((ret = m_pDemuxQueue->Pop(pPacket)) < 0)
+            break;
+        ret = DecodeFrame(m_input.pCodecCtx, pPacket, onFrame, m_options.decoder.pFramePool, m_input.pBackend.get());
+        av_packet_unref(pPacket);
+    }
+    if (ret == AVERROR_EOF)
+        ret = DecodeFrame(m_input.pCodecCtx, NULL, onFrame, m_options.decoder.pFramePool, m_input.pBackend.get());
+
+    if (ret < 0 && ret != AVERROR_EOF)
+        Fail(ret);
+    m_pDecodeQueue->Close();
+
+    av_frame_free(&pRef);
+    av_packet_free(&pPacket);
+    m_nEndNs[kStageDecode].store(NowNs(), std::memory_order_relaxed);
+}
+
+int Transcoder::ConfigureFilter(const AVFrame* frame)
+{
+    const AVStream* pStream = m_input.pFormatContext->streams[m_input.iVideo];
+    AVRational frameRate = av_guess_frame_rate(m_input.pFormatContext, const_cast<AVStream*>(pStream), nullptr);
+
+    if (!(m_pGraph = avfilter_graph_alloc()))
+        return AVERROR(ENOMEM);
+    if (m_options.nFilterThreads > 0)
+        m_pGraph->nb_threads = m_options.nFilterThreads;
+
+    char szArgs[256];
+    snprintf(szArgs, sizeof(szArgs),
+             "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+             frame->width, frame->height, frame->format, pStream->time_base.num, pStream->time_base.den,
+             frame->sample_aspect_ratio.num, FFMAX(frame->sample_aspect_ratio.den, 1));
+    if (frameRate.num > 0 && frameRate.den > 0)
+    {
+        size_t nLen = strlen(szArgs);
+        snprintf(szArgs + nLen, sizeof(szArgs) - nLen, ":frame_rate=%d/%d", frameRate.num, frameRate.den);
+    }
+
+    int ret = avfilter_graph_create_filter(&m_pBufferSrc, avfilter_get_by_name("buffer"), "in", szArgs,
+                                           nullptr, m_pGraph);
+    if (ret < 0)
+        return ret;
+    if ((ret = avfilter_graph_create_filter(&m_pBufferSink, avfilter_get_by_name("buffersink"), "out", nullptr,
+                                            nullptr, m_pGraph)) < 0)
+        return ret;
+
+    // Hand the encoder a format it takes; scale converts where needed.
+    std::string strGraph = m_options.strFilter.empty() ? std::string("null") : m_options.strFilter;
+    const AVCodec* pEncoder = avcodec_find_encoder_by_name(m_options.strEncoder.c_str());
+    if (pEncoder && pEncoder->pix_fmts)
+    {
+        std::string strFormats;
+        for (const enum AVPixelFormat* p = pEncoder->pix_fmts; *p != AV_PIX_FMT_NONE; p++)
+        {
+            if (const char* pszName = av_get_pix_fmt_name(*p))
+                strFormats += (strFormats.empty() ? "" : "|") + std::string(pszName);
+        }
+        if (!strFormats.empty())
+            strGraph += ",format=pix_fmts=" + strFormats;
+    }
+
+    AVFilterInOut* pOutputs = avfilter_inout_alloc();
+    AVFilterInOut* pInputs = avfilter_inout_alloc();
+    if (!pOutputs || !pInputs)
+    {
+        avfilter_inout_free(&pOutputs);
+        avfilter_inout_free(&pInputs);
+        return AVERROR(ENOMEM);
+    }
+    pOutputs->name       = av_strdup("in");
+    pOutputs->filter_ctx = m_pBufferSrc;
+    pOutputs->pad_idx    = 0;
+    pOutputs->next       = nullptr;
+    pInputs->name        = av_strdup("out");
+    pInputs->filter_ctx  = m_pBufferSink;
+    pInputs->pad_idx     = 0;
+    pInputs->next        = nullptr;
+
+    ret = avfilter_graph_parse_ptr(m_pGraph, strGraph.c_str(), &pInputs, &pOutputs, nullptr);
+    avfilter_inout_free(&pOutputs);
+    avfilter_inout_free(&pInputs);
+    if (ret < 0)
+    {
+        fprintf(stderr, "filter graph \"%s\": %s\n", strGraph.c_str(), av_err2str(ret));
+        return ret;
+    }
+    if ((ret = avfilter_graph_config(m_pGraph, nullptr)) < 0)
+        return ret;
+
+    m_filterTimeBase = av_buffersink_get_time_base(m_pBufferSink);
+    m_filterFrameRate = av_buffersink_get_frame_rate(m_pBufferSink);
+    if (m_filterFrameRate.num <= 0 || m_filterFrameRate.den <= 0)
+        m_filterFrameRate = frameRate;
+    return 0;
+}
+
+int Transcoder::FilterFrames(AVFrame* pFiltered)
+{
+    while (true)
+    {
+        int ret;
+        {
+            ScopedStage stage(TraceStage::Convert);
+            ret = av_buffersink_get_frame(m_pBufferSink, pFiltered);
+        }
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return 0;
+        if (ret < 0)
+            return ret;
+
+        m_nItems[kStageFilter].fetch_add(1, std::memory_order_relaxed);
+        if ((ret = m_pFilterQueue->Push(pFiltered)) < 0)
+            return ret;
+    }
+}
+
+void Transcoder::FilterLoop()
+{
+    SetTraceThreadName("filter");
+    m_nStartNs[kStageFilter].store(NowNs(), std::memory_order_relaxed);
+
+    AVFrame* pFrame = av_frame_alloc();
+    AVFrame* pFiltered = av_frame_alloc();
+    int ret = (pFrame && pFiltered) ? 0 : AVERROR(ENOMEM);
+
+    while (ret >= 0)
+    {
+        if ((ret = m_pDecodeQueue->Pop(pFrame)) < 0)
+            break;
+
+        if (!m_pGraph && (ret = ConfigureFilter(pFrame)) < 0)
+            break;
+
+        {
+            ScopedStage stage(TraceStage::Convert);
+            ret = av_buffersrc_add_frame_flags(m_pBufferSrc, pFrame, 0);
+        }
+        av_frame_unref(pFrame);
+        if (ret >= 0)
+            ret = FilterFrames(pFiltered);
+    }
+    if (ret == AVERROR_EOF)
+    {
+        ret = 0;
+        // Flush frames filters like fps still hold.
+        if (m_pGraph && (ret = av_buffersrc_add_frame_flags(m_pBufferSrc, nullptr, 0)) >= 0)
+            ret = FilterFrames(pFiltered);
+    }
+
+    if (ret < 0)
+        Fail(ret);
+    m_pFilterQueue->Close();
+
+    av_frame_free(&pFiltered);
+    av_frame_free(&pFrame);
+    m_nEndNs[kStageFilter].store(NowNs(), std::memory_order_relaxed);
+}
+
+int Transcoder::OpenEncoder(const AVFrame* frame)
+{
+    const AVCodec* pCodec = avcodec_find_encoder_by_name(m_options.strEncoder.c_str());
+    if (!pCodec)
+        return AVERROR_ENCODER_NOT_FOUND;
+    if (!(m_pEncoder = avcodec_alloc_context3(pCodec)))
+        return AVERROR(ENOMEM);
+
+    m_pEncoder->width               = frame->width;
+    m_pEncoder->height              = frame->height;
+    m_pEncoder->pix_fmt             = static_cast<enum AVPixelFormat>(frame->format);
+    m_pEncoder->sample_aspect_ratio = frame->sample_aspect_ratio;
+    m_pEncoder->color_range         = frame->color_range;
+    m_pEncoder->colorspace          = frame->colorspace;
+    m_pEncoder->color_primaries     = frame->color_primaries;
+    m_pEncoder->color_trc           = frame->color_trc;
+    m_pEncoder->time_base           = m_filterTimeBase;
+    m_pEncoder->framerate           = m_filterFrameRate;
+    if (m_options.nBitRate > 0)
+        m_pEncoder->bit_rate = m_options.nBitRate;
+    if (m_options.nGopSize >= 0)
+        m_pEncoder->gop_size = m_options.nGopSize;
+    m_pEncoder->thread_count = m_options.nEncoderThreads;
+    if (m_pOutput->oformat->flags & AVFMT_GLOBALHEADER)
+        m_pEncoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    AVDictionary* pOptions = nullptr;
+    int ret = 0;
+    if (!m_options.strEncoderOptions.empty() &&
+        (ret = av_dict_parse_string(&pOptions, m_options.strEncoderOptions.c_str(), "=", ":", 0)) < 0)
+    {
+        av_dict_free(&pOptions);
+        return ret;
+    }
+    ret = avcodec_open2(m_pEncoder, pCodec, &pOptions);
+    if (const AVDictionaryEntry* pUnused = av_dict_get(pOptions, "", nullptr, AV_DICT_IGNORE_SUFFIX))
+        fprintf(stderr, "encoder option %s not recognised\n", pUnused->key);
+    av_dict_free(&pOptions);
+    if (ret < 0)
+    {
+        fprintf(stderr, "avcodec_open2 %s: %s\n", pCodec->name, av_err2str(ret));
+        return ret;
+    }
+
+    if ((ret = avcodec_parameters_from_context(m_pOutStream->codecpar, m_pEncoder)) < 0)
+        return ret;
+    m_pOutStream->time_base = m_pEncoder->time_base;
+    m_pOutStream->avg_frame_rate = m_pEncoder->framerate;
+    return 0;
+}
+
+int Transcoder::EncodeFrames(AVFrame* frame, AVPacket* pPacket)
+{
+    int ret = avcodec_send_frame(m_pEncoder, frame);
+    if (ret < 0)
+        return ret;
+
+    while ((ret = avcodec_receive_packet(m_pEncoder, pPacket)) >= 0)
+    {
+        pPacket->stream_index = 0;
+        m_nItems[kStageEncode].fetch_add(1, std::memory_order_relaxed);
+        if ((ret = m_pEncodeQueue->Push(pPacket)) < 0)
+            return ret;
+    }
+    return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+
+void Transcoder::EncodeLoop()
+{
+    SetTraceThreadName("encode");
+    m_nStartNs[kStageEncode].store(NowNs(), std::memory_order_relaxed);
+
+    AVFrame* pFrame = av_frame_alloc();
+    AVPacket* pPacket = av_packet_alloc();
+    int ret = (pFrame && pPacket) ? 0 : AVERROR(ENOMEM);
+
+    while (ret >= 0)
+    {
+        if ((ret = m_pFilterQueue->Pop(pFrame)) < 0)
+            break;
+
+        if (!m_pEncoder && (ret = OpenEncoder(pFrame)) < 0)
+            break;
+
+        // Let the encoder place keyframes itself.
+        pFrame->pict_type = AV_PICTURE_TYPE_NONE;
+        ret = EncodeFrames(pFrame, pPacket);
+        av_frame_unref(pFrame);
+    }
+    if (ret == AVERROR_EOF)
+        ret = m_pEncoder ? EncodeFrames(nullptr, pPacket) : 0;
+
+    if (ret < 0)
+        Fail(ret);
+    m_pEncodeQueue->Close();
+
+    av_packet_free(&pPacket);
+    av_frame_free(&pFrame);
+    m_nEndNs[kStageEncode].store(NowNs(), std::memory_order_relaxed);
+}
+
+void Transcoder::MuxLoop()
+{
+    SetTraceThreadName("mux");
+    m_nStartNs[kStageMux].store(NowNs(), std::memory_order_relaxed);
+
+    AVPacket* pPacket = av_packet_alloc();
+    int ret = pPacket ? 0 : AVERROR(ENOMEM);
+
+    while (ret >= 0)
+    {
+        if ((ret = m_pEncodeQueue->Pop(pPacket)) < 0)
+            break;
+
+        // The encoder filled in the stream before its first packet.
+        if (!m_bHeaderWritten)
+        {
+            if ((ret = avformat_write_header(m_pOutput, nullptr)) < 0)
+            {
+                av_packet_unref(pPacket);
+                break;
+            }
+            m_bHeaderWritten = true;
+        }
+
+        av_packet_rescale_ts(pPacket, m_pEncoder->time_base, m_pOutStream->time_base);
+        m_nBytesWritten += pPacket->size;
+        m_nItems[kStageMux].fetch_add(1, std::memory_order_relaxed);
+        ret = av_interleaved_write_frame(m_pOutput, pPacket);
+    }
+    if (ret == AVERROR_EOF)
+    {
+        ret = 0;
+        if (!m_bHeaderWritten)
+        {
+            // Nothing to mux unless the pipeline was stopped.
+            if (m_ret.load(std::memory_order_acquire) == 0)
+                ret = AVERROR_INVALIDDATA;
+        }
+        else
+            ret = av_write_trailer(m_pOutput);
+    }
+
+    if (ret < 0)
+        Fail(ret);
+
+    av_packet_free(&pPacket);
+    m_nEndNs[kStageMux].store(NowNs(), std::memory_order_relaxed);
+}
+
+double Transcoder::StageSeconds(int iStage) const
+{
+    if (iStage == kStageDemux)
+        return m_pDemuxThread ? m_pDemuxThread->RunSeconds() : 0.0;
+    int64_t nStart = m_nStartNs[iStage].load(std::memory_order_relaxed);
+    int64_t nEnd = m_nEndNs[iStage].load(std::memory_order_relaxed);
+    return nEnd > nStart ? (nEnd - nStart) * 1e-9 : 0.0;
+}
+
+TranscodeStats Transcoder::Stats() const
+{
+    static const char* const kNames[kStageCount] = { "demux", "decode", "filter", "encode", "mux" };
+
+    TranscodeStats stats;
+    if (!m_pDemuxQueue)
+        return stats;
+
+    stats.demuxQueue    = m_pDemuxQueue->Stats();
+    stats.decodeQueue   = m_pDecodeQueue->Stats();
+    stats.filterQueue   = m_pFilterQueue->Stats();
+    stats.encodeQueue   = m_pEncodeQueue->Stats();
+    stats.nBytesWritten = m_nBytesWritten;
+    stats.dWallSeconds  = m_dWallSeconds;
+
+    // Each stage waits on the queue before it and the queue after it.
+    const double dStarved[kStageCount] = {
+        0.0,
+        stats.demuxQueue.dConsumerStallSeconds,
+        stats.decodeQueue.dConsumerStallSeconds,
+        stats.filterQueue.dConsumerStallSeconds,
+        stats.encodeQueue.dConsumerStallSeconds,
+    };
+    const double dBlocked[kStageCount] = {
+        stats.demuxQueue.dProducerStallSeconds,
+        stats.decodeQueue.dProducerStallSeconds,
+        stats.filterQueue.dProducerStallSeconds,
+        stats.encodeQueue.dProducerStallSeconds,
+        0.0,
+    };
+
+    for (int i = 0; i < kStageCount; i++)
+    {
+        TranscodeStageStats& stage = stats.stages[i];
+        stage.pszName           = kNames[i];
+        stage.nItems            = i == kStageDemux ? stats.demuxQueue.nPushed
+                                                   : m_nItems[i].load(std::memory_order_relaxed);
+        stage.dStarvedSeconds   = dStarved[i];
+        stage.dBlockedSeconds   = dBlocked[i];
+        stage.dBusySeconds      = std::max(0.0, StageSeconds(i) - dStarved[i] - dBlocked[i]);
+        stage.dUtilization      = m_dWallSeconds > 0 ? stage.dBusySeconds / m_dWallSeconds : 0.0;
+        if (stats.iBottleneck < 0 || stage.dUtilization > stats.stages[stats.iBottleneck].dUtilization)
+            stats.iBottleneck = i;
+    }
+    return stats;
+}
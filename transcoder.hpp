@@ -0,0 +1,142 @@
+#pragma once
+
+#include "decoder.hpp"
+#include "demux_thread.hpp"
+#include "frame_queue.hpp"
+#include "packet_queue.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+extern "C"
+{
+#include <libavfilter/avfilter.h>
+}
+
+struct TranscodeOptions
+{
+    DecoderOptions  decoder;
+    // Filter chain between the decoder and the encoder, e.g.
+    // "scale=1280:-2,fps=30". A format filter for the encoder's pixel
+    // formats is appended.
+    std::string     strFilter           = "null";
+    int             nFilterThreads      = 0;        // 0: libavfilter's default
+    std::string     strEncoder          = "libx264";
+    // key=value pairs separated by ':', passed to avcodec_open2.
+    std::string     strEncoderOptions;
+    int64_t         nBitRate            = 0;
+    int             nGopSize            = -1;       // -1: the encoder's default
+    int             nEncoderThreads     = 0;        // 0: auto
+    // Muxer name; guessed from the output file name when empty.
+    std::string     strFormat;
+    size_t          nPacketQueue        = 64;       // demux -> decode and encode -> mux
+    size_t          nFrameQueue         = 8;        // decode -> filter -> encode
+};
+
+// Busy time is the stage thread's lifetime less the time it spent waiting on
+// its input queue (starved) or its output queue (blocked downstream).
+struct TranscodeStageStats
+{
+    const char*     pszName             = "";
+    uint64_t        nItems              = 0;        // packets or frames the stage produced
+    double          dBusySeconds        = 0.0;
+    double          dStarvedSeconds     = 0.0;
+    double          dBlockedSeconds     = 0.0;
+    double          dUtilization        = 0.0;      // busy / wall
+};
+
+enum TranscodeStage
+{
+    kStageDemux,
+    kStageDecode,
+    kStageFilter,
+    kStageEncode,
+    kStageMux,
+    kStageCount
+};
+
+struct TranscodeStats
+{
+    TranscodeStageStats stages[kStageCount];
+    PacketQueueStats    demuxQueue;
+    FrameQueueStats     decodeQueue;
+    FrameQueueStats     filterQueue;
+    PacketQueueStats    encodeQueue;
+    int64_t             nBytesWritten   = 0;
+    double              dWallSeconds    = 0.0;
+    int                 iBottleneck     = -1;       // stage with the highest utilization
+};
+
+// Video transcode as five stages on five threads: demux (DemuxThread),
+// decode, filter (an avfilter graph), encode and mux, connected by bounded
+// PacketQueues and FrameQueues of refcounted data. The filter graph and the
+// encoder are configured from the first frame that reaches them, so they see
+// the real decoded format. Other streams are not carried over.
+class Transcoder
+{
+public:
+    Transcoder() = default;
+    ~Transcoder();
+
+    Transcoder(const Transcoder&) = delete;
+    Transcoder& operator=(const Transcoder&) = delete;
+
+    int             Open(const std::string& strInput, const std::string& strOutput,
+                         const TranscodeOptions& options = TranscodeOptions());
+    // Starts every stage and waits for the output to be finished. Returns
+    // the first stage error, or 0.
+    int             Run();
+    // From another thread: aborts every queue so Run returns.
+    void            Stop();
+    void            Close();
+
+    // Complete once Run returned.
+    TranscodeStats  Stats() const;
+    const VideoStream& Input() const    { return m_input; }
+    const AVCodecContext* Encoder() const { return m_pEncoder; }
+
+private:
+    void            DecodeLoop();
+    void            FilterLoop();
+    void            EncodeLoop();
+    void            MuxLoop();
+    int             ConfigureFilter(const AVFrame* frame);
+    int             FilterFrames(AVFrame* pFiltered);
+    int             OpenEncoder(const AVFrame* frame);
+    int             EncodeFrames(AVFrame* frame, AVPacket* pPacket);
+    void            Fail(int ret);
+    double          StageSeconds(int iStage) const;
+
+    TranscodeOptions        m_options;
+    std::string             m_strOutput;
+    VideoStream             m_input;
+    AVFormatContext*        m_pOutput           = nullptr;
+    AVStream*               m_pOutStream        = nullptr;
+    AVCodecContext*         m_pEncoder          = nullptr;
+    AVFilterGraph*          m_pGraph            = nullptr;
+    AVFilterContext*        m_pBufferSrc        = nullptr;
+    AVFilterContext*        m_pBufferSink       = nullptr;
+    // Written by the filter thread before its first Push, read by the
+    // encoder after its first Pop.
+    AVRational              m_filterTimeBase    = { 0, 1 };
+    AVRational              m_filterFrameRate   = { 0, 1 };
+    bool                    m_bHeaderWritten    = false;
+
+    // Queues take one Init each, so every Open makes new ones.
+    std::unique_ptr<PacketQueue>    m_pDemuxQueue;
+    std::unique_ptr<FrameQueue>     m_pDecodeQueue;
+    std::unique_ptr<FrameQueue>     m_pFilterQueue;
+    std::unique_ptr<PacketQueue>    m_pEncodeQueue;
+    std::unique_ptr<DemuxThread>    m_pDemuxThread;
+    std::thread             m_threads[kStageCount];     // decode to mux; demux has its own
+
+    std::atomic<int>        m_ret{0};
+    std::atomic<uint64_t>   m_nItems[kStageCount];
+    std::atomic<int64_t>    m_nStartNs[kStageCount];
+    std::atomic<int64_t>    m_nEndNs[kStageCount];
+    int64_t                 m_nBytesWritten     = 0;
+    double                  m_dWallSeconds      = 0.0;
+};
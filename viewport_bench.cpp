@@ -0,0 +1,299 @@
+#include "decoder.hpp"
+#include "bench_stats.hpp"
+#include "reduced_decode.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+static void PrintUsage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s <input> --viewport WxH [--frames N] [--threads MODE[:N]] [--no-psnr]\n"
+            "                [--psnr-threshold DB]\n"
+            "  --viewport        size the frames are shown at\n"
+            "  --frames          stop after N frames (default: whole input)\n"
+            "  --threads         none, frame, slice or both, with an optional count (default: libavcodec's)\n"
+            "  --no-psnr         skip the pass comparing reduced and full decode\n"
+            "  --psnr-threshold  count frames below this PSNR (default 35 dB)\n",
+            argv0);
+}
+
+struct PassResult
+{
+    int64_t     nFrames     = 0;
+    double      dWall       = 0.0;
+    double      dCpu        = 0.0;
+};
+
+// Decode plus the downscale to the output size, which a full decode needs
+// before display too.
+static int RunPass(const std::string& strUrl, const DecoderOptions& options, int nOutWidth, int nOutHeight,
+                   int64_t nMaxFrames, PassResult* pResult)
+{
+    VideoStream stream;
+    int ret = OpenStream(strUrl, &stream, options);
+    if (ret < 0)
+        return ret;
+
+    FrameDownscaler downscaler;
+    AVPacket* pPacket = av_packet_alloc();
+    if (!pPacket)
+        ret = AVERROR(ENOMEM);
+    else
+        ret = downscaler.Init(nOutWidth, nOutHeight);
+
+    PassResult result;
+    FrameCallback onFrame = [&](AVCodecContext*, AVFrame* frame)
+    {
+        const AVFrame* pScaled = nullptr;
+        int ret = downscaler.Scale(frame, &pScaled);
+        if (ret < 0)
+            return ret;
+        result.nFrames++;
+        return (nMaxFrames > 0 && result.nFrames >= nMaxFrames) ? AVERROR_EOF : 0;
+    };
+
+    BenchClock::time_point tStart = BenchClock::now();
+    const double dCpuStart = ProcessCpuSeconds();
+    while (ret >= 0)
+    {
+        if ((ret = av_read_frame(stream.pFormatContext, pPacket)) < 0)
+            break;
+        if (pPacket->stream_index == stream.iVideo)
+            ret = DecodeFrame(stream.pCodecCtx, pPacket, onFrame, nullptr, stream.pBackend.get());
+        av_packet_unref(pPacket);
+    }
+    if (ret == AVERROR_EOF && (nMaxFrames <= 0 || result.nFrames < nMaxFrames))
+        ret = DecodeFrame(stream.pCodecCtx, NULL, onFrame, nullptr, stream.pBackend.get());
+    result.dCpu = ProcessCpuSeconds() - dCpuStart;
+    result.dWall = ElapsedSeconds(tStart, BenchClock::now());
+
+    av_packet_free(&pPacket);
+    CloseStream(&stream);
+    *pResult = result;
+    return (ret < 0 && ret != AVERROR_EOF) ? ret : 0;
+}
+
+// Decodes both ways in lockstep and compares frames with the same pts at
+// the output size.
+static int ComparePasses(const std::string& strUrl, const DecoderOptions& fullOptions,
+                         const DecoderOptions& reducedOptions, int nOutWidth, int nOutHeight,
+                         int64_t nMaxFrames, std::vector<double>* pPsnr)
+{
+    VideoStream streams[2];
+    FrameDownscaler downscalers[2];
+    std::deque<AVFrame*> pending[2];
+    AVPacket* pPacket = av_packet_alloc();
+    bool bEof[2] = { false, false };
+
+    int ret = pPacket ? 0 : AVERROR(ENOMEM);
+    for (int i = 0; i < 2 && ret >= 0; i++)
+    {
+        if ((ret = OpenStream(strUrl, &streams[i], i ? reducedOptions : fullOptions)) >= 0)
+            ret = downscalers[i].Init(nOutWidth, nOutHeight);
+    }
+
+    auto Match = [&]()
+    {
+        while (!pending[0].empty() && !pending[1].empty())
+        {
+            AVFrame* a = pending[0].front();
+            AVFrame* b = pending[1].front();
+            // A frame only one side produced has nothing to compare against.
+            int iDrop = a->pts < b->pts ? 0 : (b->pts < a->pts ? 1 : -1);
+            if (iDrop >= 0)
+            {
+                av_frame_free(&pending[iDrop].front());
+                pending[iDrop].pop_front();
+                continue;
+            }
+            double dPsnr = 0.0;
+            if (ComputePsnr(a, b, &dPsnr) >= 0)
+                pPsnr->push_back(dPsnr);
+            for (int i = 0; i < 2; i++)
+            {
+                av_frame_free(&pending[i].front());
+                pending[i].pop_front();
+            }
+        }
+    };
+
+    auto Collect = [&](int i)
+    {
+        return FrameCallback([&, i](AVCodecContext*, AVFrame* frame)
+        {
+            const AVFrame* pScaled = nullptr;
+            frame->pts = frame->best_effort_timestamp;
+            int ret = downscalers[i].Scale(frame, &pScaled);
+            if (ret < 0)
+                return ret;
+            AVFrame* pCopy = av_frame_clone(pScaled);
+            if (!pCopy)
+                return AVERROR(ENOMEM);
+            pending[i].push_back(pCopy);
+            return 0;
+        });
+    };
+    FrameCallback onFrame[2] = { Collect(0), Collect(1) };
+
+    while (ret >= 0 && !(bEof[0] && bEof[1]) && (nMaxFrames <= 0 || int64_t(pPsnr->size()) < nMaxFrames))
+    {
+        // One video packet from each side per round.
+        for (int i = 0; i < 2 && ret >= 0; i++)
+        {
+            while (!bEof[i])
+            {
+                if ((ret = av_read_frame(streams[i].pFormatContext, pPacket)) < 0)
+                {
+                    if (ret != AVERROR_EOF)
+                        break;
+                    bEof[i] = true;
+                    ret = DecodeFrame(streams[i].pCodecCtx, NULL, onFrame[i], nullptr, streams[i].pBackend.get());
+                    break;
+                }
+                const bool bVideo = pPacket->stream_index == streams[i].iVideo;
+                if (bVideo)
+                    ret = DecodeFrame(streams[i].pCodecCtx, pPacket, onFrame[i], nullptr, streams[i].pBackend.get());
+                av_packet_unref(pPacket);
+                if (bVideo || ret < 0)
+                    break;
+            }
+        }
+        Match();
+    }
+
+    for (std::deque<AVFrame*>& frames : pending)
+    {
+        for (AVFrame* frame : frames)
+            av_frame_free(&frame);
+    }
+    av_packet_free(&pPacket);
+    CloseStream(&streams[0]);
+    CloseStream(&streams[1]);
+    return (ret < 0 && ret != AVERROR_EOF) ? ret : 0;
+}
+
+static void PrintPass(const char* pszLabel, const PassResult& result)
+{
+    printf("%-14s%lld frames, %.3f s wall, %.3f s cpu, %.3f ms cpu/frame, %.2f frames/s\n", pszLabel,
+           (long long)result.nFrames, result.dWall, result.dCpu,
+           result.nFrames ? result.dCpu * 1e3 / result.nFrames : 0.0,
+           result.dWall > 0 ? result.nFrames / result.dWall : 0.0);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strUrl;
+    int nViewWidth = 0;
+    int nViewHeight = 0;
+    int64_t nMaxFrames = 0;
+    bool bPsnr = true;
+    double dThreshold = 35.0;
+    DecoderOptions options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--viewport") == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &nViewWidth, &nViewHeight) != 2)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            nMaxFrames = strtoll(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (ParseThreadingConfig(argv[++i], &options.threading) < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--no-psnr") == 0)
+            bPsnr = false;
+        else if (strcmp(argv[i], "--psnr-threshold") == 0 && i + 1 < argc)
+            dThreshold = atof(argv[++i]);
+        else if (argv[i][0] != '-' && strUrl.empty())
+            strUrl = argv[i];
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (strUrl.empty() || nViewWidth <= 0 || nViewHeight <= 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    DecoderOptions reducedOptions = options;
+    reducedOptions.nViewportWidth = nViewWidth;
+    reducedOptions.nViewportHeight = nViewHeight;
+
+    // Opened only to learn the size and what the reduced path will do.
+    VideoStream probe;
+    if (OpenStream(strUrl, &probe, reducedOptions) < 0)
+        return 1;
+    const ReducedDecode reduced = probe.reduced;
+    const AVCodecParameters* pParams = probe.pFormatContext->streams[probe.iVideo]->codecpar;
+    printf("input:        %s (%s %dx%d)\n", strUrl.c_str(), probe.pCodecCtx->codec->name,
+           pParams->width, pParams->height);
+    CloseStream(&probe);
+
+    printf("viewport:     %dx%d, output %dx%d\n", nViewWidth, nViewHeight, reduced.nOutputWidth, reduced.nOutputHeight);
+    printf("reduced:      %s\n", ReducedDecodeToString(reduced).c_str());
+
+    PassResult full;
+    PassResult cheap;
+    int ret = RunPass(strUrl, options, reduced.nOutputWidth, reduced.nOutputHeight, nMaxFrames, &full);
+    if (ret >= 0)
+        ret = RunPass(strUrl, reducedOptions, reduced.nOutputWidth, reduced.nOutputHeight, nMaxFrames, &cheap);
+    if (ret < 0)
+    {
+        fprintf(stderr, "decode: %s\n", av_err2str(ret));
+        return 1;
+    }
+
+    PrintPass("full:", full);
+    PrintPass("reduced:", cheap);
+    const double dFullPerFrame = full.nFrames ? full.dCpu / full.nFrames : 0.0;
+    const double dCheapPerFrame = cheap.nFrames ? cheap.dCpu / cheap.nFrames : 0.0;
+    printf("cpu saved:    %.1f%% (%.3f ms/frame)\n",
+           dFullPerFrame > 0 ? (1.0 - dCheapPerFrame / dFullPerFrame) * 100.0 : 0.0,
+           (dFullPerFrame - dCheapPerFrame) * 1e3);
+    printf("wall saved:   %.1f%%\n", full.dWall > 0 ? (1.0 - cheap.dWall / full.dWall) * 100.0 : 0.0);
+
+    if (bPsnr)
+    {
+        std::vector<double> psnr;
+        if ((ret = ComparePasses(strUrl, options, reducedOptions, reduced.nOutputWidth, reduced.nOutputHeight,
+                                 nMaxFrames, &psnr)) < 0)
+        {
+            fprintf(stderr, "compare: %s\n", av_err2str(ret));
+            return 1;
+        }
+        double dSum = 0.0;
+        size_t nBelow = 0;
+        for (double d : psnr)
+        {
+            dSum += d;
+            nBelow += d < dThreshold;
+        }
+        const double dMean = psnr.empty() ? 0.0 : dSum / psnr.size();
+        const double dP5 = Percentile(psnr, 5);
+        printf("psnr:         mean %.2f dB, p5 %.2f dB, min %.2f dB over %zu frames\n",
+               dMean, dP5, Percentile(psnr, 0), psnr.size());
+        printf("below %.0f dB: %zu frames\n", dThreshold, nBelow);
+    }
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include "worker_pool.hpp"
+#include "stage_trace.hpp"
+
+#include <algorithm>
+
+static thread_local WorkerPool* t_pPool = nullptr;
+static thread_local unsigned    t_index = 0;
+
+WorkerPool::WorkerPool(unsigned nWorkers)
+{
+    if (nWorkers == 0)
+        nWorkers = std::thread::hardware_concurrency();
+    if (nWorkers == 0)
+        nWorkers = 1;
+
+    for (unsigned i = 0; i < nWorkers; i++)
+        m_workers.emplace_back(new Worker);
+    for (unsigned i = 0; i < nWorkers; i++)
+        m_threads.emplace_back(&WorkerPool::Run, this, i);
+}
+
+WorkerPool::~WorkerPool()
+{
+    Wait();
+    {
+        std::lock_guard<std::mutex> lock(m_sleepLock);
+        m_bStop.store(true, std::memory_order_release);
+    }
+    m_wake.notify_all();
+    for (std::thread& thread : m_threads)
+        thread.join();
+}
+
+void WorkerPool::Submit(Task task)
+{
+    unsigned index = (t_pPool == this)
+        ? t_index
+        : m_nNext.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+
+    m_nPending.fetch_add(1, std::memory_order_acq_rel);
+    {
+        std::lock_guard<std::mutex> lock(m_workers[index]->lock);
+        m_workers[index]->tasks.push_back(std::move(task));
+    }
+
+    // Publishing the count under the sleep lock pairs with the predicate
+    // check in Run, so a worker about to sleep cannot miss this task.
+    {
+        std::lock_guard<std::mutex> lock(m_sleepLock);
+        m_nQueued.fetch_add(1, std::memory_order_acq_rel);
+    }
+    m_wake.notify_one();
+}
+
+void WorkerPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_sleepLock);
+    m_idle.wait(lock, [this]() { return m_nPending.load(std::memory_order_acquire) == 0; });
+}
+
+void WorkerPool::ParallelFor(int nCount, const std::function<void(int)>& fn)
+{
+    struct Shared
+    {
+        std::atomic<int>        nNext{0};
+        std::atomic<int>        nDone{0};
+        std::mutex              lock;
+        std::condition_variable done;
+    };
+    std::shared_ptr<Shared> pShared = std::make_shared<Shared>();
+
+    // Helpers that start after every item has been claimed return at once,
+    // so fn and its captures are never touched after this call returns.
+    auto RunItems = [pShared, nCount, &fn]()
+    {
+        int i;
+        while ((i = pShared->nNext.fetch_add(1, std::memory_order_relaxed)) < nCount)
+        {
+            fn(i);
+            if (pShared->nDone.fetch_add(1, std::memory_order_acq_rel) + 1 == nCount)
+            {
+                std::lock_guard<std::mutex> lock(pShared->lock);
+                pShared->done.notify_all();
+            }
+        }
+    };
+
+    const int nHelpers = std::min(nCount - 1, static_cast<int>(m_threads.size()));
+    for (int i = 0; i < nHelpers; i++)
+        Submit(RunItems);
+
+    RunItems();
+
+    std::unique_lock<std::mutex> lock(pShared->lock);
+    pShared->done.wait(lock, [&]() { return pShared->nDone.load(std::memory_order_acquire) == nCount; });
+}
+
+bool WorkerPool::TryPop(unsigned index, Task& task)
+{
+    {
+        Worker& self = *m_workers[index];
+        std::lock_guard<std::mutex> lock(self.lock);
+        if (!self.tasks.empty())
+        {
+            task = std::move(self.tasks.front());
+            self.tasks.pop_front();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < m_workers.size(); i++)
+    {
+        Worker& victim = *m_workers[(index + i) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(victim.lock);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            m_nSteals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkerPool::Run(unsigned index)
+{
+    t_pPool = this;
+    t_index = index;
+    SetTraceThreadName("worker " + std::to_string(index));
+
+    while (true)
+    {
+        Task task;
+        if (TryPop(index, task))
+        {
+            m_nQueued.fetch_sub(1, std::memory_order_acq_rel);
+            task();
+
+            if (m_nPending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                std::lock_guard<std::mutex> lock(m_sleepLock);
+                m_idle.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleepLock);
+        m_wake.wait(lock, [this]()
+        {
+            return m_nQueued.load(std::memory_order_acquire) > 0 || m_bStop.load(std::memory_order_acquire);
+        });
+        if (m_bStop.load(std::memory_order_acquire) && m_nQueued.load(std::memory_order_acquire) == 0)
+            return;
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own task deque. A worker runs
+// its own tasks in submission order and, when it runs dry, steals from the
+// back of the other workers' deques. Tasks submitted from inside a task land
+// on the submitting worker's deque, so a task that re-submits itself keeps
+// its cache-warm thread unless another worker is idle.
+class WorkerPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    // nWorkers == 0 sizes the pool to the number of hardware threads.
+    explicit WorkerPool(unsigned nWorkers = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void        Submit(Task task);
+    // Blocks until every submitted task, including ones submitted by other
+    // tasks, has finished.
+    void        Wait();
+
+    // Runs fn(0) .. fn(nCount - 1) on the workers and the calling thread and
+    // returns when all have finished. Safe to call from inside a task: the
+    // caller keeps claiming items itself and only waits for ones already
+    // running elsewhere.
+    void        ParallelFor(int nCount, const std::function<void(int)>& fn);
+
+    unsigned    Size() const    { return static_cast<unsigned>(m_threads.size()); }
+    uint64_t    Steals() const  { return m_nSteals.load(std::memory_order_relaxed); }
+
+private:
+    struct Worker
+    {
+        std::mutex          lock;
+        std::deque<Task>    tasks;
+    };
+
+    void        Run(unsigned index);
+    bool        TryPop(unsigned index, Task& task);
+
+    std::vector<std::unique_ptr<Worker>>    m_workers;
+    std::vector<std::thread>                m_threads;
+
+    std::mutex                  m_sleepLock;
+    std::condition_variable     m_wake;
+    std::condition_variable     m_idle;
+    std::atomic<int64_t>        m_nQueued{0};
+    std::atomic<int64_t>        m_nPending{0};     // queued plus running
+    std::atomic<bool>           m_bStop{false};
+    std::atomic<unsigned>       m_nNext{0};
+    std::atomic<uint64_t>       m_nSteals{0};
+};
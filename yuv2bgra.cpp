@@ -0,0 +1,172 @@
+#include "yuv2bgra.hpp"
+#include "yuv2bgra_kernels.hpp"
+#include "stage_trace.hpp"
+#include "worker_pool.hpp"
+
+#include <algorithm>
+
+extern "C"
+{
+#include <libavutil/cpu.h>
+#include <libavutil/pixfmt.h>
+}
+
+template <YuvLayout kLayout, YuvMatrix kMatrix, bool kFullRange>
+static void ConvertRowsC(const uint8_t* const src[3], const int srcStride[3],
+                         uint8_t* dst, int dstStride, int width, int yBegin, int yEnd)
+{
+    ConvertRowsScalar<kLayout, kMatrix, kFullRange>(src, srcStride, dst, dstStride, width, 0, yBegin, yEnd);
+}
+
+#define KERNELS(layout)                                                             \
+    {                                                                               \
+        { ConvertRowsC<layout, YuvMatrix::BT601, false>,                            \
+          ConvertRowsC<layout, YuvMatrix::BT601, true> },                           \
+        { ConvertRowsC<layout, YuvMatrix::BT709, false>,                            \
+          ConvertRowsC<layout, YuvMatrix::BT709, true> },                           \
+    }
+
+static const ConvertRowsFn g_convertRowsC[2][2][2] =
+{
+    KERNELS(YuvLayout::NV12),
+    KERNELS(YuvLayout::YUV420P),
+};
+
+#undef KERNELS
+
+int GetYuvToBgraFormat(const AVFrame* frame, YuvToBgraFormat* pFormat)
+{
+    YuvToBgraFormat format;
+
+    switch (frame->format)
+    {
+        case AV_PIX_FMT_NV12:
+            format.layout = YuvLayout::NV12;
+            break;
+        case AV_PIX_FMT_YUVJ420P:
+            format.bFullRange = true;
+            // fall through
+        case AV_PIX_FMT_YUV420P:
+            format.layout = YuvLayout::YUV420P;
+            break;
+        default:
+            return AVERROR(ENOSYS);
+    }
+
+    if (frame->color_range == AVCOL_RANGE_JPEG)
+        format.bFullRange = true;
+
+    switch (frame->colorspace)
+    {
+        case AVCOL_SPC_BT709:
+            format.matrix = YuvMatrix::BT709;
+            break;
+        case AVCOL_SPC_BT470BG:
+        case AVCOL_SPC_SMPTE170M:
+            format.matrix = YuvMatrix::BT601;
+            break;
+        default:
+            format.matrix = frame->height >= 720 ? YuvMatrix::BT709 : YuvMatrix::BT601;
+            break;
+    }
+
+    *pFormat = format;
+    return 0;
+}
+
+ConvertPath ResolveConvertPath(ConvertPath path)
+{
+#if HAVE_X86_SIMD
+    const int flags = av_get_cpu_flags();
+    if (path == ConvertPath::Auto)
+    {
+        if (flags & AV_CPU_FLAG_AVX2)
+            return ConvertPath::AVX2;
+        if (flags & AV_CPU_FLAG_SSE4)
+            return ConvertPath::SSE41;
+        return ConvertPath::Scalar;
+    }
+    if (path == ConvertPath::AVX2 && !(flags & AV_CPU_FLAG_AVX2))
+        return ResolveConvertPath(ConvertPath::SSE41);
+    if (path == ConvertPath::SSE41 && !(flags & AV_CPU_FLAG_SSE4))
+        return ConvertPath::Scalar;
+    return path;
+#else
+    (void)path;
+    return ConvertPath::Scalar;
+#endif
+}
+
+const char* ConvertPathName(ConvertPath path)
+{
+    switch (path)
+    {
+        case ConvertPath::Auto:     return "auto";
+        case ConvertPath::Scalar:   return "scalar";
+        case ConvertPath::SSE41:    return "sse4.1";
+        case ConvertPath::AVX2:     return "avx2";
+    }
+    return "unknown";
+}
+
+void ConvertYuvToBgraRows(const YuvToBgraFormat& format, ConvertPath path,
+                          const uint8_t* const src[3], const int srcStride[3],
+                          uint8_t* dst, int dstStride, int width, int yBegin, int yEnd)
+{
+    const int l = static_cast<int>(format.layout);
+    const int m = static_cast<int>(format.matrix);
+    const int r = format.bFullRange ? 1 : 0;
+
+    ConvertRowsFn fn = g_convertRowsC[l][m][r];
+#if HAVE_X86_SIMD
+    switch (ResolveConvertPath(path))
+    {
+        case ConvertPath::AVX2:     fn = g_convertRowsAVX2[l][m][r]; break;
+        case ConvertPath::SSE41:    fn = g_convertRowsSSE41[l][m][r]; break;
+        default:                    break;
+    }
+#else
+    (void)path;
+#endif
+
+    fn(src, srcStride, dst, dstStride, width, yBegin, yEnd);
+}
+
+int ConvertFrameToBgra(const AVFrame* frame, uint8_t* dst, int dstStride,
+                       ConvertPath path, WorkerPool* pPool, int nBands)
+{
+    ScopedStage stage(TraceStage::Convert);
+    YuvToBgraFormat format;
+    int ret = GetYuvToBgraFormat(frame, &format);
+    if (ret < 0)
+        return ret;
+
+    // Resolve once rather than per band.
+    path = ResolveConvertPath(path);
+
+    const uint8_t* src[3] = { frame->data[0], frame->data[1], frame->data[2] };
+    const int srcStride[3] = { frame->linesize[0], frame->linesize[1], frame->linesize[2] };
+
+    if (!pPool)
+    {
+        ConvertYuvToBgraRows(format, path, src, srcStride, dst, dstStride, frame->width, 0, frame->height);
+        return 0;
+    }
+
+    if (nBands <= 0)
+        nBands = static_cast<int>(pPool->Size()) + 1;
+
+    // Bands start on even rows so each one owns whole chroma rows.
+    int nBandRows = (frame->height + nBands - 1) / nBands;
+    nBandRows = std::max(2, (nBandRows + 1) & ~1);
+    nBands = (frame->height + nBandRows - 1) / nBandRows;
+
+    pPool->ParallelFor(nBands, [&](int i)
+    {
+        int yBegin = i * nBandRows;
+        int yEnd = std::min(frame->height, yBegin + nBandRows);
+        ConvertYuvToBgraRows(format, path, src, srcStride, dst, dstStride, frame->width, yBegin, yEnd);
+    });
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+
+extern "C"
+{
+#include <libavutil/frame.h>
+}
+
+class WorkerPool;
+
+enum class YuvLayout
+{
+    NV12,           // Y plane plus interleaved UV plane
+    YUV420P,        // Y, U and V planes
+};
+
+enum class YuvMatrix
+{
+    BT601,
+    BT709,
+};
+
+enum class ConvertPath
+{
+    Auto,           // best the CPU supports
+    Scalar,
+    SSE41,
+    AVX2,
+};
+
+struct YuvToBgraFormat
+{
+    YuvLayout   layout      = YuvLayout::YUV420P;
+    YuvMatrix   matrix      = YuvMatrix::BT709;
+    bool        bFullRange  = false;
+};
+
+// Layout, matrix and range of a decoded frame. Unspecified colorspaces are
+// treated as BT.709 from 720 lines up and BT.601 below, as players do.
+int             GetYuvToBgraFormat(const AVFrame* frame, YuvToBgraFormat* pFormat);
+
+// Best path this CPU can run, and its name.
+ConvertPath     ResolveConvertPath(ConvertPath path);
+const char*     ConvertPathName(ConvertPath path);
+
+// Converts rows [yBegin, yEnd) of a 4:2:0 image; yBegin must be even.
+void            ConvertYuvToBgraRows(const YuvToBgraFormat& format, ConvertPath path,
+                                     const uint8_t* const src[3], const int srcStride[3],
+                                     uint8_t* dst, int dstStride, int width, int yBegin, int yEnd);
+
+// Converts a whole NV12/YUV420P frame into a BGRA image. With a pool the
+// rows are split into nBands bands (0: one per worker) converted in parallel;
+// the calling thread converts bands too.
+int             ConvertFrameToBgra(const AVFrame* frame, uint8_t* dst, int dstStride,
+                                   ConvertPath path = ConvertPath::Auto,
+                                   WorkerPool* pPool = nullptr, int nBands = 0);
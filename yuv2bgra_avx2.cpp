@@ -0,0 +1,121 @@
+// Built with AVX2 enabled; only called after a runtime CPU check.
+
+#include "yuv2bgra_kernels.hpp"
+
+#include <immintrin.h>
+
+// Converts 32 pixels of one row: yLo/yHi hold luma of pixels 0-15 and 16-31
+// as 16-bit lanes, u/v the 16 chroma samples that cover them.
+template <YuvMatrix kMatrix, bool kFullRange>
+static inline void ConvertBlock32(__m256i yLo, __m256i yHi, __m256i u, __m256i v, uint8_t* pOut)
+{
+    typedef YuvCoefficients<kMatrix, kFullRange> C;
+
+    const __m256i yOffset = _mm256_set1_epi16(C::kYOffset);
+    const __m256i bias = _mm256_set1_epi16(128);
+    const __m256i round = _mm256_set1_epi16(8);
+
+    yLo = _mm256_mulhrs_epi16(_mm256_slli_epi16(_mm256_sub_epi16(yLo, yOffset), 6), _mm256_set1_epi16(C::kY));
+    yHi = _mm256_mulhrs_epi16(_mm256_slli_epi16(_mm256_sub_epi16(yHi, yOffset), 6), _mm256_set1_epi16(C::kY));
+    u = _mm256_slli_epi16(_mm256_sub_epi16(u, bias), 6);
+    v = _mm256_slli_epi16(_mm256_sub_epi16(v, bias), 6);
+
+    const __m256i rv = _mm256_mulhrs_epi16(v, _mm256_set1_epi16(C::kRV));
+    const __m256i gu = _mm256_mulhrs_epi16(u, _mm256_set1_epi16(C::kGU));
+    const __m256i gv = _mm256_mulhrs_epi16(v, _mm256_set1_epi16(C::kGV));
+    const __m256i bu = _mm256_mulhrs_epi16(u, _mm256_set1_epi16(C::kBU));
+
+    // Duplicate every chroma term for its two pixels. The unpacks work per
+    // 128-bit lane, so the halves are put back in order with a permute.
+    auto Lo = [](__m256i t)
+    {
+        return _mm256_permute2x128_si256(_mm256_unpacklo_epi16(t, t), _mm256_unpackhi_epi16(t, t), 0x20);
+    };
+    auto Hi = [](__m256i t)
+    {
+        return _mm256_permute2x128_si256(_mm256_unpacklo_epi16(t, t), _mm256_unpackhi_epi16(t, t), 0x31);
+    };
+
+    __m256i r0 = _mm256_srai_epi16(_mm256_adds_epi16(_mm256_adds_epi16(yLo, Lo(rv)), round), 4);
+    __m256i r1 = _mm256_srai_epi16(_mm256_adds_epi16(_mm256_adds_epi16(yHi, Hi(rv)), round), 4);
+    __m256i g0 = _mm256_srai_epi16(_mm256_adds_epi16(_mm256_subs_epi16(_mm256_subs_epi16(yLo, Lo(gu)), Lo(gv)), round), 4);
+    __m256i g1 = _mm256_srai_epi16(_mm256_adds_epi16(_mm256_subs_epi16(_mm256_subs_epi16(yHi, Hi(gu)), Hi(gv)), round), 4);
+    __m256i b0 = _mm256_srai_epi16(_mm256_adds_epi16(_mm256_adds_epi16(yLo, Lo(bu)), round), 4);
+    __m256i b1 = _mm256_srai_epi16(_mm256_adds_epi16(_mm256_adds_epi16(yHi, Hi(bu)), round), 4);
+
+    // After the in-lane pack, lane 0 holds pixels 0-7 and 16-23, lane 1
+    // pixels 8-15 and 24-31.
+    const __m256i b8 = _mm256_packus_epi16(b0, b1);
+    const __m256i g8 = _mm256_packus_epi16(g0, g1);
+    const __m256i r8 = _mm256_packus_epi16(r0, r1);
+    const __m256i a8 = _mm256_set1_epi8(static_cast<char>(0xff));
+
+    const __m256i bgLo = _mm256_unpacklo_epi8(b8, g8), bgHi = _mm256_unpackhi_epi8(b8, g8);
+    const __m256i raLo = _mm256_unpacklo_epi8(r8, a8), raHi = _mm256_unpackhi_epi8(r8, a8);
+
+    const __m256i p0 = _mm256_unpacklo_epi16(bgLo, raLo);     // 0-3   | 8-11
+    const __m256i p1 = _mm256_unpackhi_epi16(bgLo, raLo);     // 4-7   | 12-15
+    const __m256i p2 = _mm256_unpacklo_epi16(bgHi, raHi);     // 16-19 | 24-27
+    const __m256i p3 = _mm256_unpackhi_epi16(bgHi, raHi);     // 20-23 | 28-31
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOut +  0), _mm256_permute2x128_si256(p0, p1, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOut + 32), _mm256_permute2x128_si256(p0, p1, 0x31));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOut + 64), _mm256_permute2x128_si256(p2, p3, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOut + 96), _mm256_permute2x128_si256(p2, p3, 0x31));
+}
+
+template <YuvLayout kLayout, YuvMatrix kMatrix, bool kFullRange>
+static void ConvertRowsAVX2(const uint8_t* const src[3], const int srcStride[3],
+                            uint8_t* dst, int dstStride, int width, int yBegin, int yEnd)
+{
+    const int nBlockWidth = width & ~31;
+    const __m256i lowBytes = _mm256_set1_epi16(0x00ff);
+
+    for (int y = yBegin; y < yEnd; y++)
+    {
+        const uint8_t* pY = src[0] + static_cast<ptrdiff_t>(y) * srcStride[0];
+        const uint8_t* pU = src[1] + static_cast<ptrdiff_t>(y / 2) * srcStride[1];
+        const uint8_t* pV = kLayout == YuvLayout::NV12 ? nullptr : src[2] + static_cast<ptrdiff_t>(y / 2) * srcStride[2];
+        uint8_t* pOut = dst + static_cast<ptrdiff_t>(y) * dstStride;
+
+        for (int x = 0; x < nBlockWidth; x += 32)
+        {
+            const __m256i yLo = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pY + x)));
+            const __m256i yHi = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pY + x + 16)));
+
+            __m256i u, v;
+            if (kLayout == YuvLayout::NV12)
+            {
+                const __m256i uv = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pU + x));
+                u = _mm256_and_si256(uv, lowBytes);
+                v = _mm256_srli_epi16(uv, 8);
+            }
+            else
+            {
+                u = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pU + x / 2)));
+                v = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pV + x / 2)));
+            }
+
+            ConvertBlock32<kMatrix, kFullRange>(yLo, yHi, u, v, pOut + 4 * x);
+        }
+
+        if (nBlockWidth < width)
+            ConvertRowsScalar<kLayout, kMatrix, kFullRange>(src, srcStride, dst, dstStride, width, nBlockWidth, y, y + 1);
+    }
+}
+
+#define KERNELS(layout)                                                             \
+    {                                                                               \
+        { ConvertRowsAVX2<layout, YuvMatrix::BT601, false>,                         \
+          ConvertRowsAVX2<layout, YuvMatrix::BT601, true> },                        \
+        { ConvertRowsAVX2<layout, YuvMatrix::BT709, false>,                         \
+          ConvertRowsAVX2<layout, YuvMatrix::BT709, true> },                        \
+    }
+
+const ConvertRowsFn g_convertRowsAVX2[2][2][2] =
+{
+    KERNELS(YuvLayout::NV12),
+    KERNELS(YuvLayout::YUV420P),
+};
+
+#undef KERNELS
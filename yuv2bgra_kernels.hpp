@@ -0,0 +1,83 @@
+#pragma once
+
+// Shared between the scalar and SIMD translation units of yuv2bgra: the
+// fixed-point model every kernel implements, so all paths produce identical
+// output, and the scalar row converter the SIMD kernels use for row tails.
+
+#include "yuv2bgra.hpp"
+
+#include <cstdint>
+
+// Luma and chroma are scaled by 64 and multiplied by coefficient/4 in Q15
+// with rounding (the pmulhrsw operation). Results are in 1/16 pixel units and
+// are rounded back with (x + 8) >> 4.
+template <YuvMatrix kMatrix, bool kFullRange>
+struct YuvCoefficients;
+
+#define YUV_COEFFICIENTS(matrix, full, yoff, y, rv, gu, gv, bu)                     \
+    template <> struct YuvCoefficients<matrix, full>                                \
+    {                                                                               \
+        static constexpr int16_t kYOffset   = yoff;                                     \
+        static constexpr int16_t kY         = static_cast<int16_t>(y  / 4 * 32768 + 0.5);  \
+        static constexpr int16_t kRV        = static_cast<int16_t>(rv / 4 * 32768 + 0.5);  \
+        static constexpr int16_t kGU        = static_cast<int16_t>(gu / 4 * 32768 + 0.5);  \
+        static constexpr int16_t kGV        = static_cast<int16_t>(gv / 4 * 32768 + 0.5);  \
+        static constexpr int16_t kBU        = static_cast<int16_t>(bu / 4 * 32768 + 0.5);  \
+    };
+
+YUV_COEFFICIENTS(YuvMatrix::BT601, false, 16, 1.164383, 1.596027, 0.391762, 0.812968, 2.017232)
+YUV_COEFFICIENTS(YuvMatrix::BT709, false, 16, 1.164383, 1.792741, 0.213249, 0.532909, 2.112402)
+YUV_COEFFICIENTS(YuvMatrix::BT601, true,   0, 1.0,      1.402000, 0.344136, 0.714136, 1.772000)
+YUV_COEFFICIENTS(YuvMatrix::BT709, true,   0, 1.0,      1.574800, 0.187324, 0.468124, 1.855600)
+
+#undef YUV_COEFFICIENTS
+
+// The pmulhrsw operation: (a * b + 2^14) >> 15.
+static inline int16_t MulHRS(int16_t a, int16_t b)
+{
+    return static_cast<int16_t>((static_cast<int32_t>(a) * b + (1 << 14)) >> 15);
+}
+
+static inline uint8_t ClampToByte(int v)
+{
+    return static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+template <YuvLayout kLayout, YuvMatrix kMatrix, bool kFullRange>
+static void ConvertRowsScalar(const uint8_t* const src[3], const int srcStride[3],
+                             uint8_t* dst, int dstStride, int width, int xBegin, int yBegin, int yEnd)
+{
+    typedef YuvCoefficients<kMatrix, kFullRange> C;
+
+    for (int y = yBegin; y < yEnd; y++)
+    {
+        const uint8_t* pY = src[0] + static_cast<ptrdiff_t>(y) * srcStride[0];
+        const uint8_t* pU = src[1] + static_cast<ptrdiff_t>(y / 2) * srcStride[1];
+        const uint8_t* pV = kLayout == YuvLayout::NV12 ? pU + 1 : src[2] + static_cast<ptrdiff_t>(y / 2) * srcStride[2];
+        uint8_t* pOut = dst + static_cast<ptrdiff_t>(y) * dstStride;
+
+        for (int x = xBegin; x < width; x++)
+        {
+            const int c = kLayout == YuvLayout::NV12 ? (x / 2) * 2 : x / 2;
+            const int16_t yy = MulHRS(static_cast<int16_t>((pY[x] - C::kYOffset) << 6), C::kY);
+            const int16_t u = static_cast<int16_t>((pU[c] - 128) << 6);
+            const int16_t v = static_cast<int16_t>((pV[c] - 128) << 6);
+
+            const int r = yy + MulHRS(v, C::kRV);
+            const int g = yy - MulHRS(u, C::kGU) - MulHRS(v, C::kGV);
+            const int b = yy + MulHRS(u, C::kBU);
+
+            pOut[4 * x + 0] = ClampToByte((b + 8) >> 4);
+            pOut[4 * x + 1] = ClampToByte((g + 8) >> 4);
+            pOut[4 * x + 2] = ClampToByte((r + 8) >> 4);
+            pOut[4 * x + 3] = 255;
+        }
+    }
+}
+
+typedef void (*ConvertRowsFn)(const uint8_t* const src[3], const int srcStride[3],
+                              uint8_t* dst, int dstStride, int width, int yBegin, int yEnd);
+
+// Kernel tables indexed [layout][matrix][full range], one per instruction set.
+extern const ConvertRowsFn g_convertRowsSSE41[2][2][2];
+extern const ConvertRowsFn g_convertRowsAVX2[2][2][2];
@@ -0,0 +1,110 @@
+// Built with SSE4.1 enabled; only called after a runtime CPU check.
+
+#include "yuv2bgra_kernels.hpp"
+
+#include <smmintrin.h>
+
+// Converts 16 pixels of one row: yLo/yHi are luma as 16-bit lanes, u/v the
+// 8 chroma samples that cover them.
+template <YuvMatrix kMatrix, bool kFullRange>
+static inline void ConvertBlock16(__m128i yLo, __m128i yHi, __m128i u, __m128i v, uint8_t* pOut)
+{
+    typedef YuvCoefficients<kMatrix, kFullRange> C;
+
+    const __m128i yOffset = _mm_set1_epi16(C::kYOffset);
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i round = _mm_set1_epi16(8);
+
+    yLo = _mm_mulhrs_epi16(_mm_slli_epi16(_mm_sub_epi16(yLo, yOffset), 6), _mm_set1_epi16(C::kY));
+    yHi = _mm_mulhrs_epi16(_mm_slli_epi16(_mm_sub_epi16(yHi, yOffset), 6), _mm_set1_epi16(C::kY));
+    u = _mm_slli_epi16(_mm_sub_epi16(u, bias), 6);
+    v = _mm_slli_epi16(_mm_sub_epi16(v, bias), 6);
+
+    const __m128i rv = _mm_mulhrs_epi16(v, _mm_set1_epi16(C::kRV));
+    const __m128i gu = _mm_mulhrs_epi16(u, _mm_set1_epi16(C::kGU));
+    const __m128i gv = _mm_mulhrs_epi16(v, _mm_set1_epi16(C::kGV));
+    const __m128i bu = _mm_mulhrs_epi16(u, _mm_set1_epi16(C::kBU));
+
+    // Every chroma term covers two horizontally adjacent pixels.
+    const __m128i rLo = _mm_unpacklo_epi16(rv, rv), rHi = _mm_unpackhi_epi16(rv, rv);
+    const __m128i guLo = _mm_unpacklo_epi16(gu, gu), guHi = _mm_unpackhi_epi16(gu, gu);
+    const __m128i gvLo = _mm_unpacklo_epi16(gv, gv), gvHi = _mm_unpackhi_epi16(gv, gv);
+    const __m128i bLo = _mm_unpacklo_epi16(bu, bu), bHi = _mm_unpackhi_epi16(bu, bu);
+
+    __m128i r0 = _mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(yLo, rLo), round), 4);
+    __m128i r1 = _mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(yHi, rHi), round), 4);
+    __m128i g0 = _mm_srai_epi16(_mm_adds_epi16(_mm_subs_epi16(_mm_subs_epi16(yLo, guLo), gvLo), round), 4);
+    __m128i g1 = _mm_srai_epi16(_mm_adds_epi16(_mm_subs_epi16(_mm_subs_epi16(yHi, guHi), gvHi), round), 4);
+    __m128i b0 = _mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(yLo, bLo), round), 4);
+    __m128i b1 = _mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(yHi, bHi), round), 4);
+
+    const __m128i b8 = _mm_packus_epi16(b0, b1);
+    const __m128i g8 = _mm_packus_epi16(g0, g1);
+    const __m128i r8 = _mm_packus_epi16(r0, r1);
+    const __m128i a8 = _mm_set1_epi8(static_cast<char>(0xff));
+
+    const __m128i bgLo = _mm_unpacklo_epi8(b8, g8), bgHi = _mm_unpackhi_epi8(b8, g8);
+    const __m128i raLo = _mm_unpacklo_epi8(r8, a8), raHi = _mm_unpackhi_epi8(r8, a8);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut +  0), _mm_unpacklo_epi16(bgLo, raLo));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + 16), _mm_unpackhi_epi16(bgLo, raLo));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + 32), _mm_unpacklo_epi16(bgHi, raHi));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + 48), _mm_unpackhi_epi16(bgHi, raHi));
+}
+
+template <YuvLayout kLayout, YuvMatrix kMatrix, bool kFullRange>
+static void ConvertRowsSSE41(const uint8_t* const src[3], const int srcStride[3],
+                             uint8_t* dst, int dstStride, int width, int yBegin, int yEnd)
+{
+    const int nBlockWidth = width & ~15;
+    const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+
+    for (int y = yBegin; y < yEnd; y++)
+    {
+        const uint8_t* pY = src[0] + static_cast<ptrdiff_t>(y) * srcStride[0];
+        const uint8_t* pU = src[1] + static_cast<ptrdiff_t>(y / 2) * srcStride[1];
+        const uint8_t* pV = kLayout == YuvLayout::NV12 ? nullptr : src[2] + static_cast<ptrdiff_t>(y / 2) * srcStride[2];
+        uint8_t* pOut = dst + static_cast<ptrdiff_t>(y) * dstStride;
+
+        for (int x = 0; x < nBlockWidth; x += 16)
+        {
+            const __m128i y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pY + x));
+            const __m128i yLo = _mm_cvtepu8_epi16(y8);
+            const __m128i yHi = _mm_cvtepu8_epi16(_mm_srli_si128(y8, 8));
+
+            __m128i u, v;
+            if (kLayout == YuvLayout::NV12)
+            {
+                const __m128i uv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pU + x));
+                u = _mm_and_si128(uv, lowBytes);
+                v = _mm_srli_epi16(uv, 8);
+            }
+            else
+            {
+                u = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pU + x / 2)));
+                v = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pV + x / 2)));
+            }
+
+            ConvertBlock16<kMatrix, kFullRange>(yLo, yHi, u, v, pOut + 4 * x);
+        }
+
+        if (nBlockWidth < width)
+            ConvertRowsScalar<kLayout, kMatrix, kFullRange>(src, srcStride, dst, dstStride, width, nBlockWidth, y, y + 1);
+    }
+}
+
+#define KERNELS(layout)                                                             \
+    {                                                                               \
+        { ConvertRowsSSE41<layout, YuvMatrix::BT601, false>,                        \
+          ConvertRowsSSE41<layout, YuvMatrix::BT601, true> },                       \
+        { ConvertRowsSSE41<layout, YuvMatrix::BT709, false>,                        \
+          ConvertRowsSSE41<layout, YuvMatrix::BT709, true> },                       \
+    }
+
+const ConvertRowsFn g_convertRowsSSE41[2][2][2] =
+{
+    KERNELS(YuvLayout::NV12),
+    KERNELS(YuvLayout::YUV420P),
+};
+
+#undef KERNELS